@@ -63,11 +63,33 @@ pivacy_rv pivacy_ui_lib_uninit(void);
 pivacy_rv pivacy_ui_connect(void);
 
 /**
- * Disconnect from the Pivacy UI
+ * Disconnect from the Pivacy UI; also stops reconnecting in the background
  * @return PRV_OK if successful
  */
 pivacy_rv pivacy_ui_disconnect(void);
 
+/* Connection state callback; connected is 1 if connected, 0 if disconnected */
+typedef void (*pivacy_ui_state_callback)(int connected, void* cb_data);
+
+/**
+ * Keep connected to the Pivacy UI in the background; the library connects
+ * as soon as the UI is available and reconnects with increasing delays
+ * (up to a few seconds) when the connection is lost. The callback is
+ * invoked on the library's background thread whenever the connection
+ * state changes and must not call pivacy_ui_disconnect
+ * @param callback the state callback (may be NULL)
+ * @param cb_data passed to the callback
+ * @return PRV_OK if successful
+ */
+pivacy_rv pivacy_ui_auto_connect(pivacy_ui_state_callback callback, void* cb_data);
+
+/**
+ * Check if there is a connection to the Pivacy UI; this does not
+ * take a lock or make a system call
+ * @return 1 if connected, 0 otherwise
+ */
+int pivacy_ui_is_connected(void);
+
 #define PIVACY_STATE_WAIT		1			/* Pivacy is waiting for a card terminal to connect */
 #define PIVACY_STATE_PRESENT	2			/* Pivacy has detected a card terminal */
 #define PIVACY_STATE_OK			3			/* The Pivacy interaction was successful */
@@ -113,6 +135,98 @@ pivacy_rv pivacy_ui_consent(const char* rp_name, const char** attributes, size_t
  */
 pivacy_rv pivacy_ui_message(const char* msg);
 
+/*
+ * Asynchronous interface
+ *
+ * Requests are sent to the UI by a background thread in the library; the
+ * UI handles them one at a time and in order, but any number of requests
+ * may be in flight. Status and message updates are fire-and-forget. PIN
+ * and consent requests return a ticket and complete either through a
+ * callback (invoked on the library's background thread) or, if no
+ * callback is given, through pivacy_ui_get_result / pivacy_ui_wait; the
+ * descriptor returned by pivacy_ui_completion_fd is readable while such
+ * results are waiting to be collected. The synchronous functions above
+ * are implemented on top of this interface and may be mixed with it.
+ */
+
+/* Request ticket; 0 is never a valid ticket */
+typedef unsigned long pivacy_ui_ticket;
+
+/* Result of a request */
+typedef struct pivacy_ui_result
+{
+	pivacy_rv	rv;							/* PRV_OK if the request succeeded */
+	int			consent_result;				/* Consent decision (consent requests only) */
+	char		pin[MAX_PIN_LEN];			/* The PIN entered (PIN requests only) */
+	size_t		pin_len;					/* Length of the PIN entered (PIN requests only) */
+}
+pivacy_ui_result;
+
+/* Completion callback; the result is only valid during the call */
+typedef void (*pivacy_ui_callback)(pivacy_ui_ticket ticket, const pivacy_ui_result* result, void* cb_data);
+
+/**
+ * Switch to the status display for the specified state without waiting
+ * for the UI; an update that has not been sent yet is replaced by a
+ * newer one
+ * @param status the status to report
+ * @return PRV_OK if the update was queued
+ */
+pivacy_rv pivacy_ui_show_status_async(unsigned char status);
+
+/**
+ * Show a message to the user without waiting for the UI
+ * @param msg the message to display
+ * @return PRV_OK if the message was queued
+ */
+pivacy_rv pivacy_ui_message_async(const char* msg);
+
+/**
+ * Request the user to enter their PIN without waiting for the answer
+ * @param callback the completion callback (may be NULL)
+ * @param cb_data passed to the callback
+ * @param ticket receives the ticket for the request (may be NULL if a callback is given)
+ * @return PRV_OK if the request was queued
+ */
+pivacy_rv pivacy_ui_request_pin_async(pivacy_ui_callback callback, void* cb_data, pivacy_ui_ticket* ticket);
+
+/**
+ * Request user consent without waiting for the answer
+ * @param rp_name the name of the relying party (NULL-terminated string)
+ * @param attributes the names of the attributes that are to be revealed (array of NULL-terminated strings)
+ * @param num_attrs the number of attributes
+ * @param show_always set to a value other than 0 if the ALWAYS button should be displayed
+ * @param callback the completion callback (may be NULL)
+ * @param cb_data passed to the callback
+ * @param ticket receives the ticket for the request (may be NULL if a callback is given)
+ * @return PRV_OK if the request was queued
+ */
+pivacy_rv pivacy_ui_consent_async(const char* rp_name, const char** attributes, size_t num_attrs, int show_always, pivacy_ui_callback callback, void* cb_data, pivacy_ui_ticket* ticket);
+
+/**
+ * Get a descriptor that is readable while results of requests without a
+ * callback are waiting to be collected
+ * @return the descriptor, or -1 if the library is not initialised
+ */
+int pivacy_ui_completion_fd(void);
+
+/**
+ * Collect the result of a request without a callback, if it has completed
+ * @param ticket the ticket of the request
+ * @param result receives the result
+ * @return PRV_OK if the result was collected, PRV_PENDING if the request
+ * has not completed yet, PRV_PARAM_INVALID for an unknown ticket
+ */
+pivacy_rv pivacy_ui_get_result(pivacy_ui_ticket ticket, pivacy_ui_result* result);
+
+/**
+ * Wait for a request without a callback to complete and collect its result
+ * @param ticket the ticket of the request
+ * @param result receives the result
+ * @return PRV_OK if the result was collected, PRV_PARAM_INVALID for an unknown ticket
+ */
+pivacy_rv pivacy_ui_wait(pivacy_ui_ticket ticket, pivacy_ui_result* result);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -123,6 +237,7 @@ pivacy_rv pivacy_ui_message(const char* msg);
 
 /* Warning messages */
 #define PRV_ALREADY_INITIALISED	0x40000000	/* The client library was already initialised */
+#define PRV_PENDING				0x40000001	/* The request has not completed yet */
 
 /* Error messages */
 
@@ -141,5 +256,6 @@ pivacy_rv pivacy_ui_message(const char* msg);
 #define PRV_CONNECTION_DENIED	0x80002005	/* The connection was denied because another client is already using the UI */
 #define PRV_PROTO_ERROR			0x80002006	/* Protocol error */
 #define PRV_BUFFER_TOO_SMALL	0x80002007	/* The provided buffer is too small */
+#define PRV_QUEUE_FULL			0x80002008	/* Too many requests are waiting for the UI */
 
 #endif // !_PIVACY_UI_LIB_H
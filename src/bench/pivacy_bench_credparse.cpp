@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SPRVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_bench_credparse.cpp
+
+ Benchmark for reading credentials: generates a directory of synthetic
+ credentials and times the streaming XML reader, with and without the
+ credential bodies, against the binary credential store
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cred_xml_rw.h"
+#include "pivacy_cred_bin_store.h"
+#include "pivacy_credential.h"
+#include <gmpxx.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* IRMA system parameters (see pivacy_cardemu_params.cpp) */
+#define L_N		1024
+#define L_M		256
+#define L_E		597
+#define L_V		1700
+
+void version(void)
+{
+	printf("Pivacy credential parsing benchmark version %s\n", VERSION);
+	printf("\n");
+	printf("Copyright (c) 2013 Roland van Rijswijk-Deij\n\n");
+	printf("Use, modification and redistribution of this software is subject to the terms\n");
+	printf("of the license agreement. This software is licensed under a 2-clause BSD-style\n");
+	printf("license a copy of which is included as the file LICENSE in the distribution.\n");
+}
+
+void usage(void)
+{
+	printf("Pivacy credential parsing benchmark version %s\n\n", VERSION);
+	printf("Usage:\n");
+	printf("\tpivacy_bench_credparse [-n <credentials>] [-a <attributes>] [-d <dir>] [-k]\n");
+	printf("\tpivacy_bench_credparse -h\n");
+	printf("\tpivacy_bench_credparse -v\n");
+	printf("\n");
+	printf("\t-n <credentials> Number of credentials to generate (defaults to 10000)\n");
+	printf("\t-a <attributes>  Number of attributes per credential (defaults to 5)\n");
+	printf("\t-d <dir>         Generate the credentials in <dir> (defaults to a new\n");
+	printf("\t                 temporary directory)\n");
+	printf("\t-k               Keep the generated credentials\n");
+	printf("\n");
+	printf("\t-h               Print this help message\n");
+	printf("\n");
+	printf("\t-v               Print the version number\n");
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0);
+}
+
+std::string cred_file_name(const std::string& dir, size_t i)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "/cred%06zu.xml", i);
+
+	return dir + name;
+}
+
+bool generate(gmp_randclass& rng, const std::string& dir, size_t num_creds, size_t num_attributes)
+{
+	for (size_t i = 0; i < num_creds; i++)
+	{
+		char name[32];
+
+		snprintf(name, sizeof(name), "Credential %zu", i);
+
+		pivacy_credential cred(name, "Benchmark issuer", "ipk.xml");
+		std::vector<silvia_attribute*> attributes;
+
+		for (size_t j = 0; j < num_attributes; j++)
+		{
+			char attr_name[32];
+
+			snprintf(attr_name, sizeof(attr_name), "attribute%zu", j);
+
+			cred.add_attribute_name(attr_name);
+
+			attributes.push_back(new silvia_integer_attribute(mpz_class(rng.get_z_bits(L_M))));
+		}
+
+		cred.set_credential_id((unsigned short) (i & 0xffff));
+		cred.set_silvia_credential(new silvia_credential(silvia_integer_attribute(mpz_class(rng.get_z_bits(L_M))), attributes, rng.get_z_bits(L_N), rng.get_z_bits(L_E), rng.get_z_bits(L_V)));
+
+		bool rv = pivacy_credential_xml_rw::i()->write_pivacy_credential(cred_file_name(dir, i), &cred);
+
+		for (std::vector<silvia_attribute*>::iterator j = attributes.begin(); j != attributes.end(); j++)
+		{
+			delete *j;
+		}
+
+		if (!rv)
+		{
+			fprintf(stderr, "Failed to write %s\n", cred_file_name(dir, i).c_str());
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void report(const char* what, size_t num_creds, size_t read, double time)
+{
+	printf("\t%-29s %8.3f s, %8.1f us/credential, %9.0f credentials/s%s\n", what, time, (time * 1000000.0) / num_creds, num_creds / time, (read == num_creds) ? "" : " (READ ERRORS!)");
+}
+
+void bench_xml(const std::string& dir, size_t num_creds, bool header_only)
+{
+	size_t read = 0;
+	double start = now();
+
+	for (size_t i = 0; i < num_creds; i++)
+	{
+		std::string error;
+		pivacy_credential* cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(cred_file_name(dir, i), header_only, &error);
+
+		if (cred == NULL)
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+
+			continue;
+		}
+
+		read++;
+
+		delete cred;
+	}
+
+	report(header_only ? "XML (headers only):" : "XML:", num_creds, read, now() - start);
+}
+
+void bench_store(const std::string& store_file, size_t num_creds, bool header_only)
+{
+	size_t read = 0;
+	double start = now();
+
+	pivacy_cred_bin_store store;
+
+	if (store.open(store_file))
+	{
+		for (size_t i = 0; i < store.size(); i++)
+		{
+			pivacy_credential* cred = store.read_credential(i, header_only);
+
+			if (cred != NULL)
+			{
+				read++;
+
+				delete cred;
+			}
+		}
+	}
+
+	report(header_only ? "Binary store (headers only):" : "Binary store:", num_creds, read, now() - start);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t num_creds = 10000;
+	size_t num_attributes = 5;
+	std::string dir;
+	bool keep = false;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "n:a:d:khv")) != -1)
+	{
+		switch (c)
+		{
+		case 'n':
+			num_creds = atoi(optarg);
+			break;
+		case 'a':
+			num_attributes = atoi(optarg);
+			break;
+		case 'd':
+			dir = std::string(optarg);
+			break;
+		case 'k':
+			keep = true;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case 'v':
+			version();
+			return 0;
+		}
+	}
+
+	if ((num_creds == 0) || (num_attributes == 0))
+	{
+		fprintf(stderr, "Invalid number of credentials or attributes\n");
+
+		return -1;
+	}
+
+	if (dir.empty())
+	{
+		char dir_template[] = "/tmp/pivacy_bench_credparse.XXXXXX";
+
+		if (mkdtemp(dir_template) == NULL)
+		{
+			fprintf(stderr, "Failed to create a temporary directory\n");
+
+			return -1;
+		}
+
+		dir = std::string(dir_template);
+	}
+	else if ((mkdir(dir.c_str(), 0700) != 0) && (errno != EEXIST))
+	{
+		fprintf(stderr, "Failed to create %s\n", dir.c_str());
+
+		return -1;
+	}
+
+	gmp_randclass rng(gmp_randinit_default);
+
+	rng.seed(time(NULL));
+
+	printf("Generating %zu credentials with %zu attributes in %s... ", num_creds, num_attributes, dir.c_str()); fflush(stdout);
+
+	double start = now();
+
+	if (!generate(rng, dir, num_creds, num_attributes))
+	{
+		return -1;
+	}
+
+	printf("%.3f s\n", now() - start);
+
+	/* The store only holds credentials with distinct IDs */
+	size_t store_creds = (num_creds < 0x10000) ? num_creds : 0x10000;
+	std::string store_file = dir + "/credentials.pcs";
+	std::vector<pivacy_credential*> creds;
+
+	for (size_t i = 0; i < store_creds; i++)
+	{
+		pivacy_credential* cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(cred_file_name(dir, i));
+
+		if (cred != NULL)
+		{
+			creds.push_back(cred);
+		}
+	}
+
+	bool have_store = pivacy_cred_bin_store::write(store_file, creds);
+
+	for (std::vector<pivacy_credential*>::iterator i = creds.begin(); i != creds.end(); i++)
+	{
+		delete *i;
+	}
+
+	printf("Reading %zu credentials:\n", num_creds);
+
+	bench_xml(dir, num_creds, false);
+	bench_xml(dir, num_creds, true);
+
+	if (have_store)
+	{
+		bench_store(store_file, store_creds, false);
+		bench_store(store_file, store_creds, true);
+	}
+	else
+	{
+		fprintf(stderr, "Failed to write the binary credential store\n");
+	}
+
+	if (!keep)
+	{
+		for (size_t i = 0; i < num_creds; i++)
+		{
+			unlink(cred_file_name(dir, i).c_str());
+		}
+
+		unlink(store_file.c_str());
+		rmdir(dir.c_str());
+	}
+
+	return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SPRVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_bench_loadgen.cpp
+
+ Load generator that runs full IRMA sessions against the card emulator
+ over its loopback transport and reports throughput and latency
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_loopback_proto.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* IRMA system parameters (see pivacy_cardemu_params.cpp) */
+#define L_STATZK	80
+#define L_H		256
+
+/* Session steps that are timed separately */
+enum loadgen_step
+{
+	LS_SELECT = 0,
+	LS_PROVE_CREDENTIAL,
+	LS_PROVE_COMMITMENT,
+	LS_RETRIEVE,
+	LS_SESSION,
+	LS_COUNT
+};
+
+static const char* loadgen_step_names[LS_COUNT] =
+{
+	"SELECT",
+	"PROVE CREDENTIAL",
+	"PROVE COMMITMENT",
+	"proof retrieval",
+	"full session"
+};
+
+static int loopback_socket = -1;
+
+void version(void)
+{
+	printf("Pivacy card emulator load generator version %s\n", VERSION);
+	printf("\n");
+	printf("Copyright (c) 2013 Roland van Rijswijk-Deij\n\n");
+	printf("Use, modification and redistribution of this software is subject to the terms\n");
+	printf("of the license agreement. This software is licensed under a 2-clause BSD-style\n");
+	printf("license a copy of which is included as the file LICENSE in the distribution.\n");
+}
+
+void usage(void)
+{
+	printf("Pivacy card emulator load generator version %s\n\n", VERSION);
+	printf("Usage:\n");
+	printf("\tpivacy_bench_loadgen -i <id> [-s <socket>] [-n <sessions>] [-D <mask>]\n");
+	printf("\t                     [-a <attributes>] [-F]\n");
+	printf("\tpivacy_bench_loadgen -h\n");
+	printf("\tpivacy_bench_loadgen -v\n");
+	printf("\n");
+	printf("\t-i <id>          Credential ID to prove\n");
+	printf("\t-s <socket>      Loopback socket of the emulator (defaults to\n");
+	printf("\t                 %s)\n", PIVACY_LOOPBACK_SOCKET);
+	printf("\t-n <sessions>    Number of sessions to run (defaults to 1000)\n");
+	printf("\t-D <mask>        Disclosure mask (defaults to 0x0002, the expiry)\n");
+	printf("\t-a <attributes>  Number of attributes of the credential (defaults to 5)\n");
+	printf("\t-F               Retrieve the proof with a single extended-length\n");
+	printf("\t                 APDU instead of one APDU per component\n");
+	printf("\n");
+	printf("\t-h               Print this help message\n");
+	printf("\n");
+	printf("\t-v               Print the version number\n");
+	printf("\n");
+	printf("The emulator must use the loopback transport and should not require\n");
+	printf("the UI (ui.optional = true)\n");
+}
+
+unsigned long long now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((unsigned long long) tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+bool write_full(const unsigned char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t sent = write(loopback_socket, buf, len);
+
+		if (sent < 0)
+		{
+			if (errno == EINTR) continue;
+
+			return false;
+		}
+
+		buf += sent;
+		len -= sent;
+	}
+
+	return true;
+}
+
+bool read_full(unsigned char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t received = read(loopback_socket, buf, len);
+
+		if (received < 0)
+		{
+			if (errno == EINTR) continue;
+
+			return false;
+		}
+
+		if (received == 0)
+		{
+			return false;
+		}
+
+		buf += received;
+		len -= received;
+	}
+
+	return true;
+}
+
+bool send_msg(unsigned char type, const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> msg(3 + data.size());
+
+	msg[0] = ((data.size() + 1) >> 8) & 0xff;
+	msg[1] = (data.size() + 1) & 0xff;
+	msg[2] = type;
+
+	if (!data.empty())
+	{
+		memcpy(&msg[3], &data[0], data.size());
+	}
+
+	return write_full(&msg[0], msg.size());
+}
+
+/* Exchange an APDU; returns false on transport errors or if the status word is not 9000 */
+bool exchange(const std::vector<unsigned char>& c_apdu, std::vector<unsigned char>& r_apdu)
+{
+	unsigned char len_buf[2];
+
+	if (!send_msg(LOOPBACK_APDU, c_apdu) || !read_full(len_buf, 2))
+	{
+		fprintf(stderr, "Lost the connection to the emulator\n");
+
+		exit(-1);
+	}
+
+	r_apdu.resize((len_buf[0] << 8) + len_buf[1]);
+
+	if (!r_apdu.empty() && !read_full(&r_apdu[0], r_apdu.size()))
+	{
+		fprintf(stderr, "Lost the connection to the emulator\n");
+
+		exit(-1);
+	}
+
+	return (r_apdu.size() >= 2) && (r_apdu[r_apdu.size() - 2] == 0x90) && (r_apdu[r_apdu.size() - 1] == 0x00);
+}
+
+std::vector<unsigned char> make_apdu(unsigned char cla, unsigned char ins, unsigned char p1, unsigned char p2)
+{
+	std::vector<unsigned char> apdu(4);
+
+	apdu[0] = cla;
+	apdu[1] = ins;
+	apdu[2] = p1;
+	apdu[3] = p2;
+
+	return apdu;
+}
+
+void add_random(std::vector<unsigned char>& apdu, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		apdu.push_back(rand() & 0xff);
+	}
+}
+
+bool run_session(unsigned short cred_id, unsigned short D, size_t num_attributes, bool full_proof, std::vector<unsigned long>* latencies)
+{
+	std::vector<unsigned char> c_apdu;
+	std::vector<unsigned char> r_apdu;
+	std::vector<unsigned char> none;
+	unsigned long long session_start = now_usec();
+	unsigned long long start;
+	bool ok = false;
+
+	send_msg(LOOPBACK_POWER_UP, none);
+
+	do
+	{
+		/* SELECT */
+		static const unsigned char aid[] = { 0xF8, 0x49, 0x52, 0x4D, 0x41, 0x63, 0x61, 0x72, 0x64 };
+
+		c_apdu = make_apdu(0x00, 0xa4, 0x04, 0x00);
+		c_apdu.push_back(sizeof(aid));
+		c_apdu.insert(c_apdu.end(), aid, aid + sizeof(aid));
+
+		start = now_usec();
+
+		if (!exchange(c_apdu, r_apdu)) break;
+
+		latencies[LS_SELECT].push_back(now_usec() - start);
+
+		/* PROVE CREDENTIAL: ID, D, context and timestamp */
+		c_apdu = make_apdu(0x80, 0x20, 0x00, 0x00);
+		c_apdu.push_back(2 + 2 + (L_H / 8) + 4);
+		c_apdu.push_back(cred_id >> 8);
+		c_apdu.push_back(cred_id & 0xff);
+		c_apdu.push_back(D >> 8);
+		c_apdu.push_back(D & 0xff);
+		add_random(c_apdu, L_H / 8);
+		add_random(c_apdu, 4);
+
+		start = now_usec();
+
+		if (!exchange(c_apdu, r_apdu)) break;
+
+		latencies[LS_PROVE_CREDENTIAL].push_back(now_usec() - start);
+
+		/* PROVE COMMITMENT with the verifier nonce */
+		c_apdu = make_apdu(0x80, 0x2a, full_proof ? 0x01 : 0x00, 0x00);
+
+		if (full_proof)
+		{
+			/* Extended lengths, Le = 0x0000 (65536) */
+			c_apdu.push_back(0x00);
+			c_apdu.push_back(0x00);
+			c_apdu.push_back(L_STATZK / 8);
+			add_random(c_apdu, L_STATZK / 8);
+			c_apdu.push_back(0x00);
+			c_apdu.push_back(0x00);
+		}
+		else
+		{
+			c_apdu.push_back(L_STATZK / 8);
+			add_random(c_apdu, L_STATZK / 8);
+		}
+
+		start = now_usec();
+
+		if (!exchange(c_apdu, r_apdu)) break;
+
+		latencies[LS_PROVE_COMMITMENT].push_back(now_usec() - start);
+
+		/* Retrieve the rest of the proof */
+		start = now_usec();
+
+		if (!full_proof)
+		{
+			bool retrieved = true;
+
+			for (unsigned char p1 = 1; retrieved && (p1 <= 3); p1++)
+			{
+				retrieved = exchange(make_apdu(0x80, 0x2b, p1, 0x00), r_apdu);
+			}
+
+			for (size_t i = 0; retrieved && (i <= num_attributes); i++)
+			{
+				retrieved = exchange(make_apdu(0x80, 0x2c, (unsigned char) i, 0x00), r_apdu);
+			}
+
+			if (!retrieved) break;
+		}
+
+		latencies[LS_RETRIEVE].push_back(now_usec() - start);
+
+		ok = true;
+	}
+	while (0);
+
+	send_msg(LOOPBACK_POWER_DOWN, none);
+
+	if (ok)
+	{
+		latencies[LS_SESSION].push_back(now_usec() - session_start);
+	}
+
+	return ok;
+}
+
+unsigned long percentile(const std::vector<unsigned long>& sorted, size_t per_mille)
+{
+	return sorted[((sorted.size() - 1) * per_mille) / 1000];
+}
+
+int main(int argc, char* argv[])
+{
+	std::string socket_path = PIVACY_LOOPBACK_SOCKET;
+	size_t sessions = 1000;
+	long cred_id = -1;
+	unsigned short D = 0x0002;
+	size_t num_attributes = 5;
+	bool full_proof = false;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "i:s:n:D:a:Fhv")) != -1)
+	{
+		switch (c)
+		{
+		case 'i':
+			cred_id = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			socket_path = std::string(optarg);
+			break;
+		case 'n':
+			sessions = atoi(optarg);
+			break;
+		case 'D':
+			D = (unsigned short) strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			num_attributes = atoi(optarg);
+			break;
+		case 'F':
+			full_proof = true;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case 'v':
+			version();
+			return 0;
+		}
+	}
+
+	if ((cred_id < 0) || (cred_id > 0xffff) || (sessions == 0))
+	{
+		usage();
+
+		return -1;
+	}
+
+	/* Connect to the emulator */
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+	loopback_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if ((loopback_socket < 0) || (connect(loopback_socket, (struct sockaddr*) &addr, sizeof(addr)) != 0))
+	{
+		fprintf(stderr, "Failed to connect to %s (%s)\n", socket_path.c_str(), strerror(errno));
+
+		return -1;
+	}
+
+	srand(time(NULL));
+
+	std::vector<unsigned long> latencies[LS_COUNT];
+	size_t failures = 0;
+
+	unsigned long long start = now_usec();
+
+	for (size_t i = 0; i < sessions; i++)
+	{
+		if (!run_session((unsigned short) cred_id, D, num_attributes, full_proof, latencies))
+		{
+			failures++;
+		}
+	}
+
+	double elapsed = (now_usec() - start) / 1000000.0;
+
+	close(loopback_socket);
+
+	printf("%zu sessions (%zu failed) in %.3f s: %.1f sessions/s\n", sessions, failures, elapsed, sessions / elapsed);
+	printf("\n");
+	printf("%-18s %10s %10s %10s %10s %10s %10s\n", "latency (ms)", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+	for (size_t i = 0; i < LS_COUNT; i++)
+	{
+		std::vector<unsigned long>& l = latencies[i];
+
+		if (l.empty()) continue;
+
+		std::sort(l.begin(), l.end());
+
+		unsigned long long sum = 0;
+
+		for (size_t j = 0; j < l.size(); j++) sum += l[j];
+
+		printf("%-18s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+			loadgen_step_names[i],
+			(double) sum / l.size() / 1000.0,
+			percentile(l, 500) / 1000.0,
+			percentile(l, 900) / 1000.0,
+			percentile(l, 990) / 1000.0,
+			percentile(l, 999) / 1000.0,
+			l.back() / 1000.0);
+	}
+
+	return (failures == 0) ? 0 : 1;
+}
+
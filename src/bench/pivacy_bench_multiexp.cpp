@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SPRVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_bench_multiexp.cpp
+
+ Microbenchmark comparing separate modular exponentiations against the
+ simultaneous multi-exponentiation engine, with and without fixed-base
+ tables and in constant time, for IRMA-sized proof commitments, and the
+ backends of the batch exponentiation engine
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_multiexp.h"
+#include "pivacy_fixed_base.h"
+#include "pivacy_batch_exp.h"
+#include <gmpxx.h>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* IRMA system parameters (see pivacy_cardemu_params.cpp) */
+#define L_M		256
+#define L_STATZK	80
+#define L_H		256
+#define L_V		1700
+#define L_E_PRIME	120
+
+void version(void)
+{
+	printf("Pivacy multi-exponentiation benchmark version %s\n", VERSION);
+	printf("\n");
+	printf("Copyright (c) 2013 Roland van Rijswijk-Deij\n\n");
+	printf("Use, modification and redistribution of this software is subject to the terms\n");
+	printf("of the license agreement. This software is licensed under a 2-clause BSD-style\n");
+	printf("license a copy of which is included as the file LICENSE in the distribution.\n");
+}
+
+void usage(void)
+{
+	printf("Pivacy multi-exponentiation benchmark version %s\n\n", VERSION);
+	printf("Usage:\n");
+	printf("\tpivacy_bench_multiexp [-a <attributes>] [-i <iterations>]\n");
+	printf("\tpivacy_bench_multiexp -h\n");
+	printf("\tpivacy_bench_multiexp -v\n");
+	printf("\n");
+	printf("\t-a <attributes>  Number of hidden attributes (excluding the master\n");
+	printf("\t                 secret; defaults to 5)\n");
+	printf("\t-i <iterations>  Number of commitments to compute (defaults to 50)\n");
+	printf("\n");
+	printf("\t-h               Print this help message\n");
+	printf("\n");
+	printf("\t-v               Print the version number\n");
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0);
+}
+
+void bench(gmp_randclass& rng, size_t l_n, size_t num_attributes, size_t iterations)
+{
+	/* A random odd modulus is good enough for timing purposes */
+	mpz_class n = rng.get_z_bits(l_n);
+
+	mpz_setbit(n.get_mpz_t(), l_n - 1);
+	mpz_setbit(n.get_mpz_t(), 0);
+
+	/* Z~ = A'^e~ * S^v'~ * R_0^a~_0 * ... * R_k^a~_k */
+	std::vector<mpz_class> bases;
+	std::vector<mpz_class> exps;
+
+	bases.push_back(rng.get_z_range(n));
+	exps.push_back(rng.get_z_bits(L_E_PRIME + L_STATZK + L_H));
+	bases.push_back(rng.get_z_range(n));
+	exps.push_back(rng.get_z_bits(L_V + L_STATZK + L_H));
+
+	for (size_t i = 0; i <= num_attributes; i++)
+	{
+		bases.push_back(rng.get_z_range(n));
+		exps.push_back(rng.get_z_bits(L_M + L_STATZK + L_H + 1));
+	}
+
+	/* Separate exponentiations; each needs about one squaring per exponent bit */
+	size_t separate_squarings = 0;
+
+	for (size_t i = 0; i < exps.size(); i++)
+	{
+		separate_squarings += mpz_sizeinbase(exps[i].get_mpz_t(), 2) - 1;
+	}
+
+	mpz_class separate_result;
+
+	double start = now();
+
+	for (size_t it = 0; it < iterations; it++)
+	{
+		separate_result = 1;
+
+		for (size_t i = 0; i < bases.size(); i++)
+		{
+			mpz_class r;
+
+			mpz_powm(r.get_mpz_t(), bases[i].get_mpz_t(), exps[i].get_mpz_t(), n.get_mpz_t());
+
+			separate_result = (separate_result * r) % n;
+		}
+	}
+
+	double separate_time = (now() - start) / iterations;
+
+	/* Simultaneous multi-exponentiation */
+	mpz_class multiexp_result;
+	size_t multiexp_squarings = 0;
+	size_t multiexp_multiplications = 0;
+
+	start = now();
+
+	for (size_t it = 0; it < iterations; it++)
+	{
+		pivacy_multiexp me(n);
+
+		for (size_t i = 0; i < bases.size(); i++)
+		{
+			me.add(bases[i], exps[i]);
+		}
+
+		me.compute(multiexp_result);
+
+		multiexp_squarings = me.get_squarings();
+		multiexp_multiplications = me.get_multiplications();
+	}
+
+	double multiexp_time = (now() - start) / iterations;
+
+	/* Multi-exponentiation with fixed-base tables for all but A' */
+	pivacy_fixed_base fixed_base(n);
+	size_t budget = (size_t) -1;
+
+	for (size_t i = 1; i < bases.size(); i++)
+	{
+		fixed_base.build_table(fixed_base.add_base(bases[i]), mpz_sizeinbase(exps[i].get_mpz_t(), 2), budget);
+	}
+
+	mpz_class fixed_result;
+	size_t fixed_squarings = 0;
+	size_t fixed_multiplications = 0;
+
+	start = now();
+
+	for (size_t it = 0; it < iterations; it++)
+	{
+		pivacy_multiexp me(n, &fixed_base);
+
+		me.add(bases[0], exps[0]);
+
+		for (size_t i = 1; i < bases.size(); i++)
+		{
+			me.add_fixed(i - 1, exps[i]);
+		}
+
+		me.compute(fixed_result);
+
+		fixed_squarings = me.get_squarings();
+		fixed_multiplications = me.get_multiplications();
+	}
+
+	double fixed_time = (now() - start) / iterations;
+
+	/* Constant-time multi-exponentiation */
+	mpz_class sec_result;
+
+	start = now();
+
+	for (size_t it = 0; it < iterations; it++)
+	{
+		pivacy_multiexp me(n);
+
+		me.set_constant_time(true);
+
+		for (size_t i = 0; i < bases.size(); i++)
+		{
+			me.add(bases[i], exps[i]);
+		}
+
+		me.compute(sec_result);
+	}
+
+	double sec_time = (now() - start) / iterations;
+
+	printf("l_n = %4zu, %zu bases:\n", l_n, bases.size());
+	printf("\tseparate:  %8.3f ms, ~%zu squarings\n", separate_time * 1000.0, separate_squarings);
+	printf("\tmultiexp:  %8.3f ms, %zu squarings, %zu multiplications\n", multiexp_time * 1000.0, multiexp_squarings, multiexp_multiplications);
+	printf("\tfixed-base:%8.3f ms, %zu squarings, %zu multiplications, %zu bytes of tables\n", fixed_time * 1000.0, fixed_squarings, fixed_multiplications, fixed_base.get_memory_usage());
+	printf("\tconst-time:%8.3f ms\n", sec_time * 1000.0);
+	printf("\tspeed-up:  %8.2fx (multiexp), %.2fx (fixed-base)%s\n", separate_time / multiexp_time, separate_time / fixed_time, ((separate_result == multiexp_result) && (separate_result == fixed_result) && (separate_result == sec_result)) ? "" : " (RESULTS DIFFER!)");
+}
+
+void bench_batch(gmp_randclass& rng, size_t l_n, size_t iterations)
+{
+	mpz_class n = rng.get_z_bits(l_n);
+
+	mpz_setbit(n.get_mpz_t(), l_n - 1);
+	mpz_setbit(n.get_mpz_t(), 0);
+
+	/* A batch of A'^e~ as computed when refilling the precomputation pool */
+	size_t batch_size = 8;
+	std::vector<mpz_class> bases;
+	std::vector<mpz_class> exps;
+
+	for (size_t i = 0; i < batch_size; i++)
+	{
+		bases.push_back(rng.get_z_range(n));
+		exps.push_back(rng.get_z_bits(L_E_PRIME + L_STATZK + L_H));
+	}
+
+	pivacy_batch_exp::backend backends[] = { pivacy_batch_exp::BACKEND_SCALAR, pivacy_batch_exp::BACKEND_AVX2, pivacy_batch_exp::BACKEND_AVX512 };
+	std::vector<mpz_class> scalar_results;
+	double scalar_time = 0.0;
+
+	printf("l_n = %4zu, batch of %zu:\n", l_n, batch_size);
+
+	for (size_t b = 0; b < (sizeof(backends) / sizeof(backends[0])); b++)
+	{
+		if (!pivacy_batch_exp::set_backend(backends[b]))
+		{
+			printf("\t%-10s not supported\n", pivacy_batch_exp::get_backend_name(backends[b]));
+
+			continue;
+		}
+
+		std::vector<mpz_class> results;
+
+		double start = now();
+
+		for (size_t it = 0; it < iterations; it++)
+		{
+			pivacy_batch_exp batch(n);
+
+			for (size_t i = 0; i < batch_size; i++)
+			{
+				batch.add(bases[i], exps[i]);
+			}
+
+			batch.compute(results);
+		}
+
+		double batch_time = (now() - start) / (iterations * batch_size);
+
+		if (backends[b] == pivacy_batch_exp::BACKEND_SCALAR)
+		{
+			scalar_results = results;
+			scalar_time = batch_time;
+		}
+
+		printf("\t%-10s%8.3f ms per exponentiation, speed-up %5.2fx%s\n", pivacy_batch_exp::get_backend_name(backends[b]), batch_time * 1000.0, scalar_time / batch_time, (results == scalar_results) ? "" : " (RESULTS DIFFER!)");
+	}
+
+	pivacy_batch_exp::set_backend(pivacy_batch_exp::BACKEND_AUTO);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t num_attributes = 5;
+	size_t iterations = 50;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "a:i:hv")) != -1)
+	{
+		switch (c)
+		{
+		case 'a':
+			num_attributes = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+
+			if (iterations == 0)
+			{
+				fprintf(stderr, "Invalid number of iterations\n");
+
+				return -1;
+			}
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case 'v':
+			version();
+			return 0;
+		}
+	}
+
+	gmp_randclass rng(gmp_randinit_default);
+
+	rng.seed(time(NULL));
+
+	bench(rng, 1024, num_attributes, iterations);
+	bench(rng, 2048, num_attributes, iterations);
+	bench_batch(rng, 1024, iterations);
+	bench_batch(rng, 2048, iterations);
+
+	return 0;
+}
+
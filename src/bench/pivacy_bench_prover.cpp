@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SPRVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_bench_prover.cpp
+
+ Benchmark comparing proofs computed on a single thread against proofs
+ whose exponentiations are split over a task pool, for a growing number
+ of hidden attributes
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_prover.h"
+#include "pivacy_cardemu_task_pool.h"
+#include "pivacy_fixed_base.h"
+#include "silvia_types.h"
+#include "silvia_parameters.h"
+#include <gmpxx.h>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* IRMA system parameters (see pivacy_cardemu_params.cpp) */
+#define L_M		256
+#define L_V		1700
+#define L_E		597
+
+void version(void)
+{
+	printf("Pivacy prover benchmark version %s\n", VERSION);
+	printf("\n");
+	printf("Copyright (c) 2013 Roland van Rijswijk-Deij\n\n");
+	printf("Use, modification and redistribution of this software is subject to the terms\n");
+	printf("of the license agreement. This software is licensed under a 2-clause BSD-style\n");
+	printf("license a copy of which is included as the file LICENSE in the distribution.\n");
+}
+
+void usage(void)
+{
+	printf("Pivacy prover benchmark version %s\n\n", VERSION);
+	printf("Usage:\n");
+	printf("\tpivacy_bench_prover [-a <attributes>] [-i <iterations>] [-t <threads>]\n");
+	printf("\tpivacy_bench_prover -h\n");
+	printf("\tpivacy_bench_prover -v\n");
+	printf("\n");
+	printf("\t-a <attributes>  Largest number of attributes to benchmark (excluding\n");
+	printf("\t                 the master secret; defaults to 5)\n");
+	printf("\t-i <iterations>  Number of proofs to compute (defaults to 20)\n");
+	printf("\t-t <threads>     Number of threads to split proofs over (defaults to\n");
+	printf("\t                 one per CPU)\n");
+	printf("\n");
+	printf("\t-h               Print this help message\n");
+	printf("\n");
+	printf("\t-v               Print the version number\n");
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0);
+}
+
+/* Time proofs for a known disclosure selection that hides all attributes */
+double time_proofs(pivacy_cardemu_prover& prover, size_t num_attributes, size_t iterations)
+{
+	std::vector<bool> D(num_attributes, false);
+	mpz_class n1 = 1;
+	mpz_class context = 1;
+
+	double start = now();
+
+	for (size_t it = 0; it < iterations; it++)
+	{
+		mpz_class c, A_prime, e_hat, v_prime_hat;
+		std::vector<mpz_class> a_i_hat;
+		std::vector<silvia_attribute*> a_i;
+
+		pivacy_proof_randomness* rnd = prover.precompute(D);
+
+		prover.prove(rnd, D, n1, context, c, A_prime, e_hat, v_prime_hat, a_i_hat, a_i);
+
+		delete rnd;
+	}
+
+	return (now() - start) / iterations;
+}
+
+void bench(gmp_randclass& rng, size_t l_n, size_t max_attributes, size_t iterations, pivacy_cardemu_task_pool& pool)
+{
+	silvia_system_parameters::i()->set_l_n(l_n);
+
+	/* Random values are good enough for timing purposes; the proofs are not verified */
+	mpz_class n = rng.get_z_bits(l_n);
+
+	mpz_setbit(n.get_mpz_t(), l_n - 1);
+	mpz_setbit(n.get_mpz_t(), 0);
+
+	std::vector<mpz_class> R;
+
+	for (size_t i = 0; i <= max_attributes; i++)
+	{
+		R.push_back(rng.get_z_range(n));
+	}
+
+	silvia_pub_key pubkey(n, rng.get_z_range(n), rng.get_z_range(n), R);
+
+	const pivacy_fixed_base* fixed_base = pivacy_fixed_base_cache::i()->get_tables(&pubkey);
+
+	printf("l_n = %4zu, %zu thread(s):\n", l_n, pool.get_threads() + 1);
+
+	for (size_t num_attributes = 1; num_attributes <= max_attributes; num_attributes++)
+	{
+		std::vector<silvia_attribute*> attributes;
+
+		for (size_t i = 0; i < num_attributes; i++)
+		{
+			attributes.push_back(new silvia_integer_attribute(rng.get_z_bits(L_M)));
+		}
+
+		silvia_credential cred(silvia_integer_attribute(rng.get_z_bits(L_M)), attributes, rng.get_z_range(n), rng.get_z_bits(L_E), rng.get_z_bits(L_V));
+
+		pivacy_cardemu_prover prover(&pubkey, &cred, fixed_base);
+
+		pivacy_cardemu_prover::set_task_pool(NULL);
+
+		double serial_time = time_proofs(prover, num_attributes, iterations);
+
+		pivacy_cardemu_prover::set_task_pool(&pool);
+
+		double parallel_time = time_proofs(prover, num_attributes, iterations);
+
+		pivacy_cardemu_prover::set_task_pool(NULL);
+
+		printf("\t%2zu attribute(s): serial %8.3f ms, parallel %8.3f ms, speed-up %5.2fx\n", num_attributes, serial_time * 1000.0, parallel_time * 1000.0, serial_time / parallel_time);
+	}
+
+	/* The key is not owned by the registry, so its tables are released here */
+	pivacy_fixed_base_cache::i()->release_tables(&pubkey);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t max_attributes = 5;
+	size_t iterations = 20;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "a:i:t:hv")) != -1)
+	{
+		switch (c)
+		{
+		case 'a':
+			max_attributes = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+
+			if (iterations == 0)
+			{
+				fprintf(stderr, "Invalid number of iterations\n");
+
+				return -1;
+			}
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case 'v':
+			version();
+			return 0;
+		}
+	}
+
+	/* The thread computing a proof takes part, so the pool has one worker less */
+	pivacy_cardemu_task_pool pool;
+
+	if ((threads > 1) && !pool.start(threads - 1))
+	{
+		fprintf(stderr, "Failed to start %ld threads\n", threads);
+
+		return -1;
+	}
+
+	if (threads <= 1)
+	{
+		printf("Only one thread; parallel proofs are computed serially\n");
+	}
+
+	gmp_randclass rng(gmp_randinit_default);
+
+	rng.seed(time(NULL));
+
+	bench(rng, 1024, max_attributes, iterations, pool);
+	bench(rng, 2048, max_attributes, iterations, pool);
+
+	pool.stop();
+
+	return 0;
+}
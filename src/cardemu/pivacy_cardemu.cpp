@@ -35,9 +35,15 @@
 #include "pivacy_log.h"
 #include "pivacy_errors.h"
 #include "pivacy_cardemu_emulator.h"
+#include "pivacy_cardemu_params.h"
+#include "pivacy_cardemu_trace.h"
+#include "pivacy_cardemu_metrics.h"
+#include "pivacy_cardemu_control.h"
 #include "silvia_parameters.h"
 #include "silvia_bytestring.h"
-#include "edna.h"
+#include "pivacy_cardemu_transport_edna.h"
+#include "pivacy_cardemu_transport_loopback.h"
+#include "pivacy_loopback_proto.h"
 #include <string>
 #include <unistd.h>
 #include <stdio.h>
@@ -48,57 +54,21 @@
 const static unsigned char AID[] = { 0xF8, 0x49, 0x52, 0x4D, 0x41, 0x63, 0x61, 0x72, 0x64 }; // 0xF8 + "IRMAcard"
 
 /* Global state */
-static bool must_run = true;
-static bool edna_connected = false;
+static volatile bool must_run = true;
+
+/* The transport that delivers APDUs to the emulator */
+static pivacy_cardemu_transport* transport = NULL;
 
 static pivacy_cardemu_emulator* emulator = NULL;
 
-void set_parameters()
-{
-	#define DEFAULT_L_N			1024
-	#define DEFAULT_L_M			256
-	#define DEFAULT_L_STATZK	80
-	#define DEFAULT_L_H			256
-	#define DEFAULT_L_V			1700
-	#define DEFAULT_L_E			597
-	#define DEFAULT_L_E_PRIME	120
-	#define DEFAULT_HASH_TYPE	"sha256"
-	
-	////////////////////////////////////////////////////////////////////
-	// Set the system parameters in the silvia library
-	////////////////////////////////////////////////////////////////////
-	
-	int l_n, l_m, l_statzk, l_H, l_v, l_e, l_e_prime;
-	std::string hash_type;
-	
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_n", l_n, DEFAULT_L_N);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_m", l_m, DEFAULT_L_M);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_statzk", l_statzk, DEFAULT_L_STATZK);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_H", l_H, DEFAULT_L_H);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_v", l_v, DEFAULT_L_V);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_e", l_e, DEFAULT_L_E);
-	pivacy_conf_get_int("emulation.idemix_parameters", "l_e_prime", l_e_prime, DEFAULT_L_E_PRIME);
-	pivacy_conf_get_string("emulation.idemix_parameters", "hash_type", hash_type, DEFAULT_HASH_TYPE);
-	
-	INFO_MSG("The following Idemix system parameters will be used:");
-	INFO_MSG("l(n)      = %d", l_n);
-	INFO_MSG("l(m)      = %d", l_m);
-	INFO_MSG("l(statzk) = %d", l_statzk);
-	INFO_MSG("l(H)      = %d", l_H);
-	INFO_MSG("l(v)      = %d", l_v);
-	INFO_MSG("l(e)      = %d", l_e);
-	INFO_MSG("l(e')     = %d", l_e_prime);
-	INFO_MSG("hash type = %s", hash_type.c_str());
-	
-	silvia_system_parameters::i()->set_l_n(l_n);
-	silvia_system_parameters::i()->set_l_m(l_m);
-	silvia_system_parameters::i()->set_l_statzk(l_statzk);
-	silvia_system_parameters::i()->set_l_H(l_H);
-	silvia_system_parameters::i()->set_l_v(l_v);
-	silvia_system_parameters::i()->set_l_e(l_e);
-	silvia_system_parameters::i()->set_l_e_prime(l_e_prime);
-	silvia_system_parameters::i()->set_hash_type(hash_type);
-}
+/* APDU trace (only if enabled in the configuration) */
+static pivacy_cardemu_trace_writer trace;
+
+/* Metrics endpoint (only if enabled in the configuration) */
+static pivacy_cardemu_metrics_server metrics_server;
+
+/* Control endpoint (only if enabled in the configuration) */
+static pivacy_cardemu_control_server control_server;
 
 void write_pid(const char* pid_path, pid_t pid)
 {
@@ -115,61 +85,87 @@ void write_pid(const char* pid_path, pid_t pid)
 	fclose(pid_file);
 }
 
+/* Signals are only recorded by the handlers and logged from normal context */
+static volatile sig_atomic_t unexpected_signal = 0;
+static volatile sig_atomic_t term_signal = 0;
+
 /* Signal handler for unexpected exit codes */
 void signal_unexpected(int signum)
 {
-	switch(signum)
+	/* Logging takes a lock the interrupted thread may hold, so it cannot be done here */
+	if (signum == SIGSEGV)
 	{
-	case SIGABRT:
-		ERROR_MSG("Caught SIGABRT");
-		break;
-	case SIGBUS:
-		ERROR_MSG("Caught SIGBUS");
-		break;
-	case SIGFPE:
-		ERROR_MSG("Caught SIGFPE");
-		break;
-	case SIGILL:
-		ERROR_MSG("Caught SIGILL");
-		break;
-	case SIGPIPE:
-		ERROR_MSG("Caught SIGPIPE");
-		break;
-	case SIGQUIT:
-		ERROR_MSG("Caught SIGQUIT");
-		break;
-	case SIGSEGV:
-		ERROR_MSG("Caught SIGSEGV");
-		exit(-1);
-		break;
-	case SIGSYS:
-		ERROR_MSG("Caught SIGSYS");
-		break;
-	case SIGXCPU:
-		ERROR_MSG("Caught SIGXCPU");
-		break;
-	case SIGXFSZ:
-		ERROR_MSG("Caught SIGXFSZ");
-		break;
-	default:
-		ERROR_MSG("Caught unknown signal 0x%X", signum);
-		break;
+		_exit(-1);
 	}
+
+	unexpected_signal = signum;
 }
 
 /* Signal handler for normal termination */
 void signal_term(int signum)
 {
-	INFO_MSG("Received SIGINT or SIGTERM, exiting");
-	
-	if (edna_connected)
+	term_signal = signum;
+
+	if (transport != NULL)
 	{
-		edna_lib_cancel();
+		transport->cancel();
 	}
 	
 	must_run = false;
 }
 
+/* Log the signals the handlers have recorded since the last call */
+void log_signals(void)
+{
+	int signum = unexpected_signal;
+
+	if (signum != 0)
+	{
+		unexpected_signal = 0;
+
+		switch(signum)
+		{
+		case SIGABRT:
+			ERROR_MSG("Caught SIGABRT");
+			break;
+		case SIGBUS:
+			ERROR_MSG("Caught SIGBUS");
+			break;
+		case SIGFPE:
+			ERROR_MSG("Caught SIGFPE");
+			break;
+		case SIGILL:
+			ERROR_MSG("Caught SIGILL");
+			break;
+		case SIGPIPE:
+			ERROR_MSG("Caught SIGPIPE");
+			break;
+		case SIGQUIT:
+			ERROR_MSG("Caught SIGQUIT");
+			break;
+		case SIGSYS:
+			ERROR_MSG("Caught SIGSYS");
+			break;
+		case SIGXCPU:
+			ERROR_MSG("Caught SIGXCPU");
+			break;
+		case SIGXFSZ:
+			ERROR_MSG("Caught SIGXFSZ");
+			break;
+		default:
+			ERROR_MSG("Caught unknown signal 0x%X", signum);
+			break;
+		}
+	}
+
+	if (term_signal != 0)
+	{
+		term_signal = 0;
+
+		INFO_MSG("Received SIGINT or SIGTERM, exiting");
+	}
+}
+
 void version(void)
 {
 	printf("Pivacy IRMA card emulator version %s\n", VERSION);
@@ -202,16 +198,16 @@ void usage(void)
 
 int process_apdu(const unsigned char* apdu_data, size_t apdu_len, unsigned char* rdata, size_t* rdata_len)
 {
-	bytestring c_apdu(apdu_data, apdu_len);
-	bytestring r_apdu = "6f00";
+	/* The response is written straight into the transport's buffer */
+	pivacy_cardemu_response r_apdu(rdata, *rdata_len);
 	
 	if (emulator != NULL)
 	{
-		emulator->process_apdu(c_apdu, r_apdu);
+		unsigned long long start = pivacy_trace_now();
 		
-		if (r_apdu.size() > *rdata_len) r_apdu = "6f00";
+		emulator->process_apdu(apdu_data, apdu_len, r_apdu);
 		
-		memcpy(rdata, &r_apdu[0], r_apdu.size());
+		trace.record_apdu(start, apdu_data, apdu_len, r_apdu.data(), r_apdu.size());
 		
 		*rdata_len = r_apdu.size();
 	}
@@ -221,6 +217,8 @@ int process_apdu(const unsigned char* apdu_data, size_t apdu_len, unsigned char*
 
 void handle_power_up(void)
 {
+	trace.record_event(PIVACY_TRACE_POWER_UP);
+	
 	if (emulator != NULL)
 	{
 		emulator->power_up();
@@ -229,6 +227,8 @@ void handle_power_up(void)
 
 void handle_power_down(void)
 {
+	trace.record_event(PIVACY_TRACE_POWER_DOWN);
+	
 	if (emulator != NULL)
 	{
 		emulator->power_down();
@@ -358,62 +358,133 @@ int main(int argc, char* argv[])
 	signal(SIGINT, signal_term);
 	
 	/* Set silvia system parameters */
-	set_parameters();
+	pivacy_cardemu_set_parameters();
 	
 	/* Set up emulator */
 	emulator = new pivacy_cardemu_emulator();
 	
-	/* Initialise edna library */
-	edna_rv rv = ERV_OK;
+	/* Record APDUs if requested */
+	std::string trace_file;
+	
+	pivacy_conf_get_string("emulation.trace", "file", trace_file, "");
 	
-	if ((rv = edna_lib_init()) != ERV_OK)
+	if (!trace_file.empty())
 	{
-		ERROR_MSG("Failed to initialise the edna client library (0x%08X)", rv);
+		if (trace.open(trace_file))
+		{
+			WARNING_MSG("Recording all APDUs to %s; the trace contains PINs and disclosed attributes", trace_file.c_str());
+		}
+		else
+		{
+			ERROR_MSG("Failed to create APDU trace %s", trace_file.c_str());
+		}
+	}
+	
+	/* Serve metrics if requested */
+	bool metrics_enable = false;
+	
+	pivacy_conf_get_bool("metrics", "enable", metrics_enable, false);
+	
+	if (metrics_enable)
+	{
+		std::string metrics_socket;
+		
+		pivacy_conf_get_string("metrics", "socket", metrics_socket, PIVACY_METRICS_SOCKET);
+		
+		metrics_server.start(metrics_socket);
+	}
+	
+	/* Accept control commands if requested */
+	bool control_enable = false;
+	
+	pivacy_conf_get_bool("control", "enable", control_enable, false);
+	
+	if (control_enable)
+	{
+		std::string control_socket;
+		
+		pivacy_conf_get_string("control", "socket", control_socket, PIVACY_CONTROL_SOCKET);
+		
+		control_server.start(control_socket);
+	}
+	
+	/* Set up the transport */
+	std::string transport_type;
+	
+	pivacy_conf_get_string("transport", "type", transport_type, "edna");
+	
+	if (transport_type == "loopback")
+	{
+		std::string socket_path;
+		
+		pivacy_conf_get_string("transport", "socket", socket_path, PIVACY_LOOPBACK_SOCKET);
+		
+		transport = new pivacy_cardemu_transport_loopback(socket_path);
 	}
 	else
 	{
-		INFO_MSG("Initialised edna client library");
+		if (transport_type != "edna")
+		{
+			WARNING_MSG("Unknown transport %s, using edna", transport_type.c_str());
+		}
+		
+		std::string daemon_socket;
+		
+		pivacy_conf_get_string("transport", "edna_socket", daemon_socket, "");
+		
+		pivacy_cardemu_transport_edna* edna_transport = new pivacy_cardemu_transport_edna(AID, sizeof(AID), daemon_socket);
+		
+		edna_transport->get_backoff().configure("transport.reconnect");
+		
+		transport = edna_transport;
+	}
+	
+	if (transport->init())
+	{
+		INFO_MSG("Using the %s transport", transport->get_name());
 		
 		must_run = true;
 		
 		while (must_run)
 		{
-			edna_connected = false;
+			unsigned long long connect_start = pivacy_cardemu_metrics::now();
+			
+			pivacy_cardemu_metrics::i()->record_transport_state(pivacy_cardemu_metrics::TRANSPORT_CONNECTING);
 			
-			/* Try to connect to the edna daemon */
-			while (must_run && (edna_lib_connect(AID, sizeof(AID)) != ERV_OK))
+			if (!transport->connect())
 			{
-				usleep(100000); // 100ms
+				pivacy_cardemu_metrics::i()->record_transport_state(pivacy_cardemu_metrics::TRANSPORT_DISCONNECTED);
+				
+				break;
 			}
 			
-			if (!must_run) break;
-			
-			edna_connected = true;
-			
-			INFO_MSG("Connected to the edna daemon and registered IRMA card emulation");
+			pivacy_cardemu_metrics::i()->record_transport_state(pivacy_cardemu_metrics::TRANSPORT_CONNECTED);
+			pivacy_cardemu_metrics::i()->record_transport_ready(connect_start, pivacy_cardemu_metrics::READY_SINCE_CONNECTING);
 			
 			INFO_MSG("Starting APDU command handling");
 			
-			rv = edna_lib_loop_and_process(&process_apdu, &handle_power_up, &handle_power_down);
+			transport->loop_and_process(&process_apdu, &handle_power_up, &handle_power_down);
 			
-			if (rv != ERV_OK)
-			{
-				ERROR_MSG("APDU handling exited with an error (0x%08X)", rv);
-			}
+			log_signals();
 			
-			edna_lib_disconnect();
+			transport->disconnect();
 			
-			INFO_MSG("Disconnected from the edna daemon");
+			pivacy_cardemu_metrics::i()->record_transport_state(pivacy_cardemu_metrics::TRANSPORT_DISCONNECTED);
 		}
 		
-		edna_lib_uninit();
-		
-		INFO_MSG("Uninitialised edna client library");
+		transport->uninit();
 	}
 	
+	log_signals();
+	
 	/* Clean up */
 	//delete emulator;
 	
+	control_server.stop();
+	metrics_server.stop();
+	
+	trace.close();
+	
 	/* Tell the world we're exiting */
 	INFO_MSG("The pivacy IRMA card emulator version %s has now stopped", VERSION);
 
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_apdu.cpp
+
+ ISO 7816-4 command APDU parsing, including extended-length APDUs
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_apdu.h"
+
+/* APDU offsets */
+#define	OFS_CLA					0
+#define OFS_INS					1
+#define OFS_P1					2
+#define OFS_P2					3
+#define OFS_LC					4
+#define OFS_CDATA				5
+#define OFS_EXT_LC				5
+#define OFS_EXT_CDATA			7
+
+pivacy_cardemu_apdu::pivacy_cardemu_apdu()
+{
+	cla = ins = p1 = p2 = 0;
+	data = NULL;
+	data_len = 0;
+	has_le = false;
+	le = 0;
+	extended = false;
+}
+
+bool pivacy_cardemu_apdu::parse(const unsigned char* c_apdu, size_t len)
+{
+	has_le = false;
+	le = 0;
+	extended = false;
+	data = NULL;
+	data_len = 0;
+
+	if (len < 4)
+	{
+		return false;
+	}
+
+	cla = c_apdu[OFS_CLA];
+	ins = c_apdu[OFS_INS];
+	p1 = c_apdu[OFS_P1];
+	p2 = c_apdu[OFS_P2];
+
+	if (len == 4)
+	{
+		/* Case 1: no data, no response data */
+		return true;
+	}
+
+	size_t b1 = c_apdu[OFS_LC];
+
+	if (len == 5)
+	{
+		/* Case 2S: Le only; 0x00 means 256 */
+		has_le = true;
+		le = (b1 == 0) ? 256 : b1;
+
+		return true;
+	}
+
+	if (b1 != 0)
+	{
+		/* Case 3S: Lc and data; case 4S: Lc, data and Le */
+		if (len == OFS_CDATA + b1)
+		{
+			data = &c_apdu[OFS_CDATA];
+			data_len = b1;
+
+			return true;
+		}
+
+		if (len == OFS_CDATA + b1 + 1)
+		{
+			size_t b_le = c_apdu[len - 1];
+
+			data = &c_apdu[OFS_CDATA];
+			data_len = b1;
+			has_le = true;
+			le = (b_le == 0) ? 256 : b_le;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	/* Extended lengths start with 0x00 followed by two length bytes */
+	if (len < OFS_EXT_CDATA)
+	{
+		return false;
+	}
+
+	extended = true;
+
+	size_t b23 = (c_apdu[OFS_EXT_LC] << 8) + c_apdu[OFS_EXT_LC + 1];
+
+	if (len == OFS_EXT_CDATA)
+	{
+		/* Case 2E: Le only; 0x0000 means 65536 */
+		has_le = true;
+		le = (b23 == 0) ? 65536 : b23;
+
+		return true;
+	}
+
+	if (b23 == 0)
+	{
+		return false;
+	}
+
+	if (len == OFS_EXT_CDATA + b23)
+	{
+		/* Case 3E */
+		data = &c_apdu[OFS_EXT_CDATA];
+		data_len = b23;
+
+		return true;
+	}
+
+	if (len == OFS_EXT_CDATA + b23 + 2)
+	{
+		/* Case 4E */
+		size_t b_le = (c_apdu[len - 2] << 8) + c_apdu[len - 1];
+
+		data = &c_apdu[OFS_EXT_CDATA];
+		data_len = b23;
+		has_le = true;
+		le = (b_le == 0) ? 65536 : b_le;
+
+		return true;
+	}
+
+	return false;
+}
+
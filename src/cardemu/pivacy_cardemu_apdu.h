@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_apdu.h
+
+ ISO 7816-4 command APDU parsing, including extended-length APDUs
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_APDU_H
+#define _PIVACY_CARDEMU_APDU_H
+
+#include <stddef.h>
+
+/**
+ * Parsed command APDU; the command data is not copied but refers to
+ * the buffer that was parsed, which must outlive the parsed APDU
+ */
+class pivacy_cardemu_apdu
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_apdu();
+
+	/**
+	 * Parse a command APDU; all four ISO 7816-4 cases are recognised
+	 * in both their short and their extended-length form
+	 * @param c_apdu the C-APDU
+	 * @param len the length of the C-APDU
+	 * @return false if the APDU is malformed
+	 */
+	bool parse(const unsigned char* c_apdu, size_t len);
+
+	/* Header */
+	unsigned char cla;
+	unsigned char ins;
+	unsigned char p1;
+	unsigned char p2;
+
+	/* Command data (Nc = data_len); points into the parsed C-APDU */
+	const unsigned char* data;
+	size_t data_len;
+
+	/* Maximum number of response data bytes (Ne); only valid if has_le is set */
+	bool has_le;
+	size_t le;
+
+	/* Were the lengths encoded in extended form? */
+	bool extended;
+};
+
+#endif // !_PIVACY_CARDEMU_APDU_H
+
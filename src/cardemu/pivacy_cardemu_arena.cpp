@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_arena.cpp
+
+ Locked memory arena for the GMP integers used while computing a proof
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_arena.h"
+#include "pivacy_log.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Alignment of blocks in the arena */
+#define ARENA_ALIGN(size)		(((size) + 15) & ~((size_t) 15))
+
+/* The compiler may not drop wiping memory that is about to be freed */
+static void* (* volatile wipe_memory)(void*, int, size_t) = memset;
+
+/* The arena the calling thread allocates from */
+static pthread_key_t current_arena_key;
+static pthread_once_t install_once = PTHREAD_ONCE_INIT;
+
+/* All arenas; slots are only changed while no proof is computed */
+static pivacy_cardemu_arena* volatile arenas[PIVACY_MAX_ARENAS] = { NULL };
+static pthread_mutex_t arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+pivacy_cardemu_arena::pivacy_cardemu_arena()
+{
+	region = NULL;
+	size = 0;
+	locked = false;
+	top = 0;
+	high_water = 0;
+	overflows = 0;
+}
+
+pivacy_cardemu_arena::~pivacy_cardemu_arena()
+{
+	if (region == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&arenas_mutex);
+
+	for (size_t i = 0; i < PIVACY_MAX_ARENAS; i++)
+	{
+		if (arenas[i] == this)
+		{
+			arenas[i] = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&arenas_mutex);
+
+	reset();
+
+	if (locked)
+	{
+		munlock(region, size);
+	}
+
+	munmap(region, size);
+}
+
+bool pivacy_cardemu_arena::init(size_t size, bool lock)
+{
+	if ((region != NULL) || (size == 0))
+	{
+		return false;
+	}
+
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	size = ((size + page_size - 1) / page_size) * page_size;
+
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED)
+	{
+		ERROR_MSG("Failed to map %zu bytes for the proof arena", size);
+
+		return false;
+	}
+
+	if (lock)
+	{
+		if (mlock(mem, size) == 0)
+		{
+			locked = true;
+		}
+		else
+		{
+			WARNING_MSG("Failed to lock the proof arena in memory (check RLIMIT_MEMLOCK), it may be swapped out");
+		}
+	}
+
+#ifdef MADV_DONTDUMP
+	/* Keep proof secrets out of core dumps */
+	madvise(mem, size, MADV_DONTDUMP);
+#endif // MADV_DONTDUMP
+
+	pthread_once(&install_once, install);
+
+	pthread_mutex_lock(&arenas_mutex);
+
+	size_t slot = 0;
+
+	while ((slot < PIVACY_MAX_ARENAS) && (arenas[slot] != NULL))
+	{
+		slot++;
+	}
+
+	if (slot == PIVACY_MAX_ARENAS)
+	{
+		pthread_mutex_unlock(&arenas_mutex);
+
+		ERROR_MSG("Too many proof arenas");
+
+		munmap(mem, size);
+
+		locked = false;
+
+		return false;
+	}
+
+	region = (unsigned char*) mem;
+	this->size = size;
+
+	arenas[slot] = this;
+
+	pthread_mutex_unlock(&arenas_mutex);
+
+	return true;
+}
+
+bool pivacy_cardemu_arena::is_enabled() const
+{
+	return region != NULL;
+}
+
+void pivacy_cardemu_arena::reset()
+{
+	if (region == NULL)
+	{
+		return;
+	}
+
+	/* Memory above the high water mark was never handed out */
+	wipe_memory(region, 0, high_water);
+
+	top = 0;
+	high_water = 0;
+}
+
+void pivacy_cardemu_arena::enter()
+{
+	if (region != NULL)
+	{
+		pthread_setspecific(current_arena_key, this);
+	}
+}
+
+void pivacy_cardemu_arena::leave()
+{
+	if (region != NULL)
+	{
+		pthread_setspecific(current_arena_key, NULL);
+	}
+}
+
+/*static*/ void pivacy_cardemu_arena::detach(mpz_class& val)
+{
+	mpz_clear(val.get_mpz_t());
+	mpz_init(val.get_mpz_t());
+}
+
+size_t pivacy_cardemu_arena::get_high_water() const
+{
+	return high_water;
+}
+
+unsigned long pivacy_cardemu_arena::get_overflows() const
+{
+	return overflows;
+}
+
+/*static*/ void pivacy_cardemu_arena::install()
+{
+	pthread_key_create(&current_arena_key, NULL);
+
+	/* The heap functions are compatible with the GMP defaults, so memory allocated before is freed correctly */
+	mp_set_memory_functions(&gmp_allocate, &gmp_reallocate, &gmp_free);
+}
+
+/*static*/ pivacy_cardemu_arena* pivacy_cardemu_arena::owner(const void* ptr)
+{
+	const unsigned char* p = (const unsigned char*) ptr;
+
+	for (size_t i = 0; i < PIVACY_MAX_ARENAS; i++)
+	{
+		pivacy_cardemu_arena* arena = arenas[i];
+
+		if ((arena != NULL) && (p >= arena->region) && (p < (arena->region + arena->size)))
+		{
+			return arena;
+		}
+	}
+
+	return NULL;
+}
+
+/*static*/ void* pivacy_cardemu_arena::heap_allocate(size_t size)
+{
+	void* ptr = malloc(size);
+
+	if (ptr == NULL)
+	{
+		/* GMP cannot handle allocation failures */
+		ERROR_MSG("Out of memory allocating %zu bytes for GMP", size);
+
+		abort();
+	}
+
+	return ptr;
+}
+
+/*static*/ void* pivacy_cardemu_arena::gmp_allocate(size_t size)
+{
+	pivacy_cardemu_arena* arena = (pivacy_cardemu_arena*) pthread_getspecific(current_arena_key);
+
+	if (arena != NULL)
+	{
+		void* ptr = arena->allocate(size);
+
+		if (ptr != NULL)
+		{
+			return ptr;
+		}
+	}
+
+	return heap_allocate(size);
+}
+
+/*static*/ void* pivacy_cardemu_arena::gmp_reallocate(void* ptr, size_t old_size, size_t new_size)
+{
+	pivacy_cardemu_arena* arena = owner(ptr);
+	void* new_ptr = NULL;
+
+	if (arena != NULL)
+	{
+		/* Blocks stay in the arena while it is in use, and move to the heap once it is not */
+		if (arena == pthread_getspecific(current_arena_key))
+		{
+			new_ptr = arena->reallocate(ptr, old_size, new_size);
+
+			if (new_ptr != NULL)
+			{
+				return new_ptr;
+			}
+		}
+
+		new_ptr = heap_allocate(new_size);
+
+		memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+
+		arena->release(ptr, old_size);
+
+		return new_ptr;
+	}
+
+	/* Heap blocks stay on the heap; the old block is wiped rather than left behind by realloc() */
+	new_ptr = heap_allocate(new_size);
+
+	memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+
+	gmp_free(ptr, old_size);
+
+	return new_ptr;
+}
+
+/*static*/ void pivacy_cardemu_arena::gmp_free(void* ptr, size_t size)
+{
+	pivacy_cardemu_arena* arena = owner(ptr);
+
+	if (arena != NULL)
+	{
+		arena->release(ptr, size);
+	}
+	else
+	{
+		wipe_memory(ptr, 0, size);
+
+		free(ptr);
+	}
+}
+
+void* pivacy_cardemu_arena::allocate(size_t size)
+{
+	size_t block_size = ARENA_ALIGN(size);
+
+	if (block_size > (this->size - top))
+	{
+		overflows++;
+
+		return NULL;
+	}
+
+	void* ptr = region + top;
+
+	top += block_size;
+
+	if (top > high_water)
+	{
+		high_water = top;
+	}
+
+	return ptr;
+}
+
+void* pivacy_cardemu_arena::reallocate(void* ptr, size_t old_size, size_t new_size)
+{
+	unsigned char* p = (unsigned char*) ptr;
+	size_t old_block = ARENA_ALIGN(old_size);
+	size_t new_block = ARENA_ALIGN(new_size);
+
+	if ((p + old_block) == (region + top))
+	{
+		/* The last block is resized in place */
+		size_t start = p - region;
+
+		if (new_block > (this->size - start))
+		{
+			overflows++;
+
+			return NULL;
+		}
+
+		top = start + new_block;
+
+		if (top > high_water)
+		{
+			high_water = top;
+		}
+
+		return ptr;
+	}
+
+	if (new_block <= old_block)
+	{
+		return ptr;
+	}
+
+	void* new_ptr = allocate(new_size);
+
+	if (new_ptr != NULL)
+	{
+		memcpy(new_ptr, ptr, old_size);
+	}
+
+	return new_ptr;
+}
+
+void pivacy_cardemu_arena::release(void* ptr, size_t size)
+{
+	unsigned char* p = (unsigned char*) ptr;
+
+	/* Blocks freed on other threads (e.g. by proof workers) are left for reset() */
+	if (pthread_getspecific(current_arena_key) != this)
+	{
+		return;
+	}
+
+	/* Temporaries are mostly freed in reverse order, so the arena works like a stack */
+	if ((p + ARENA_ALIGN(size)) == (region + top))
+	{
+		top = p - region;
+	}
+}
+
+pivacy_cardemu_arena_scope::pivacy_cardemu_arena_scope(pivacy_cardemu_arena& arena) : arena(arena)
+{
+	arena.enter();
+}
+
+pivacy_cardemu_arena_scope::~pivacy_cardemu_arena_scope()
+{
+	arena.leave();
+}
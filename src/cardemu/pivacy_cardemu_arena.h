@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_arena.h
+
+ Locked memory arena for the GMP integers used while computing a proof
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_ARENA_H
+#define _PIVACY_CARDEMU_ARENA_H
+
+#include <gmpxx.h>
+#include <stddef.h>
+
+/* The maximum number of arenas that can exist at the same time */
+#define PIVACY_MAX_ARENAS				4
+
+/* Default arena size in kilobytes */
+#define PIVACY_ARENA_DEFAULT_SIZE		256
+
+/**
+ * Memory arena for GMP; while a thread has entered the arena, all
+ * memory GMP allocates on that thread comes from a single locked
+ * region that is zeroized in one sweep when the arena is reset.
+ *
+ * Once the first arena has been set up, GMP memory that is returned
+ * to the general heap is wiped before it is freed as well.
+ */
+class pivacy_cardemu_arena
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_arena();
+
+	/**
+	 * Destructor; no integer may use arena memory any more
+	 */
+	~pivacy_cardemu_arena();
+
+	/**
+	 * Set up the arena and install the GMP memory functions
+	 * @param size the size of the arena in bytes
+	 * @param lock lock the arena in memory so it is never swapped out
+	 * @return true if the arena can be used
+	 */
+	bool init(size_t size, bool lock);
+
+	/**
+	 * Is the arena set up?
+	 * @return true if the arena can be used
+	 */
+	bool is_enabled() const;
+
+	/**
+	 * Zeroize all memory handed out and start over; no integer may
+	 * use arena memory any more (see detach())
+	 */
+	void reset();
+
+	/**
+	 * Allocate GMP memory for the calling thread from the arena;
+	 * if the arena is full, memory comes from the heap instead
+	 */
+	void enter();
+
+	/**
+	 * Stop allocating GMP memory for the calling thread from the arena
+	 */
+	void leave();
+
+	/**
+	 * Give up the memory of an integer so it survives a reset; must
+	 * be called outside the arena
+	 * @param val the integer
+	 */
+	static void detach(mpz_class& val);
+
+	/**
+	 * Get the most arena memory that was in use since the last reset
+	 * @return the number of bytes
+	 */
+	size_t get_high_water() const;
+
+	/**
+	 * Get the number of allocations that did not fit in the arena
+	 * @return the number of allocations
+	 */
+	unsigned long get_overflows() const;
+
+private:
+	/**
+	 * GMP memory functions
+	 */
+	static void* gmp_allocate(size_t size);
+	static void* gmp_reallocate(void* ptr, size_t old_size, size_t new_size);
+	static void gmp_free(void* ptr, size_t size);
+
+	/**
+	 * Install the GMP memory functions; called once
+	 */
+	static void install();
+
+	/**
+	 * Find the arena a block was allocated from
+	 * @param ptr the block
+	 * @return the arena, or NULL if the block is on the heap
+	 */
+	static pivacy_cardemu_arena* owner(const void* ptr);
+
+	/**
+	 * Allocate from the heap
+	 * @param size the size of the block
+	 * @return the block
+	 */
+	static void* heap_allocate(size_t size);
+
+	/**
+	 * Allocate from the arena
+	 * @param size the size of the block
+	 * @return the block, or NULL if it does not fit
+	 */
+	void* allocate(size_t size);
+
+	/**
+	 * Resize a block allocated from the arena; the block is grown
+	 * in place if it was the last one allocated
+	 * @param ptr the block
+	 * @param old_size the current size of the block
+	 * @param new_size the new size of the block
+	 * @return the resized block, or NULL if it does not fit
+	 */
+	void* reallocate(void* ptr, size_t old_size, size_t new_size);
+
+	/**
+	 * Return a block to the arena; only the last block allocated is
+	 * actually reused, and only on the thread the arena is in use on;
+	 * the rest is reclaimed by reset()
+	 * @param ptr the block
+	 * @param size the size of the block
+	 */
+	void release(void* ptr, size_t size);
+
+	/* The region */
+	unsigned char* region;
+	size_t size;
+	bool locked;
+
+	/* Allocation state */
+	size_t top;
+	size_t high_water;
+	unsigned long overflows;
+};
+
+/**
+ * Allocates GMP memory for the calling thread from an arena for as
+ * long as it is in scope
+ */
+class pivacy_cardemu_arena_scope
+{
+public:
+	/**
+	 * Constructor
+	 * @param arena the arena to enter
+	 */
+	pivacy_cardemu_arena_scope(pivacy_cardemu_arena& arena);
+
+	/**
+	 * Destructor
+	 */
+	~pivacy_cardemu_arena_scope();
+
+private:
+	pivacy_cardemu_arena& arena;
+};
+
+#endif // !_PIVACY_CARDEMU_ARENA_H
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_backoff.cpp
+
+ Reconnect scheduler with exponential backoff, jitter and a ceiling
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_backoff.h"
+#include "pivacy_config.h"
+#include "pivacy_log.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+pivacy_cardemu_backoff::pivacy_cardemu_backoff(unsigned int initial_delay, unsigned int max_delay, unsigned int multiplier, unsigned int jitter)
+{
+	this->initial_delay = initial_delay;
+	this->max_delay = max_delay;
+	this->multiplier = multiplier;
+	this->jitter = jitter;
+
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	seed = (unsigned int) (tv.tv_sec ^ tv.tv_usec ^ getpid());
+
+	reset();
+}
+
+void pivacy_cardemu_backoff::configure(const char* section)
+{
+	int initial = PIVACY_BACKOFF_INITIAL_DELAY;
+	int max = PIVACY_BACKOFF_MAX_DELAY;
+	int mult = PIVACY_BACKOFF_MULTIPLIER;
+	int jit = PIVACY_BACKOFF_JITTER;
+
+	pivacy_conf_get_int(section, "initial_delay", initial, PIVACY_BACKOFF_INITIAL_DELAY);
+	pivacy_conf_get_int(section, "max_delay", max, PIVACY_BACKOFF_MAX_DELAY);
+	pivacy_conf_get_int(section, "multiplier", mult, PIVACY_BACKOFF_MULTIPLIER);
+	pivacy_conf_get_int(section, "jitter", jit, PIVACY_BACKOFF_JITTER);
+
+	if (initial < 1) initial = 1;
+	if (max < initial) max = initial;
+	if (mult < 1) mult = 1;
+	if (jit < 0) jit = 0;
+	if (jit > 100) jit = 100;
+
+	initial_delay = initial;
+	max_delay = max;
+	multiplier = mult;
+	jitter = jit;
+
+	DEBUG_MSG("Reconnecting after %ums, growing %ux per attempt up to %ums with %u%% jitter", initial_delay, multiplier, max_delay, jitter);
+
+	reset();
+}
+
+void pivacy_cardemu_backoff::reset()
+{
+	current_delay = initial_delay;
+	attempts = 0;
+}
+
+unsigned int pivacy_cardemu_backoff::next_delay()
+{
+	unsigned int delay = current_delay;
+
+	/* Grow the delay for the next attempt without overflowing */
+	if (current_delay >= (max_delay / multiplier))
+	{
+		current_delay = max_delay;
+	}
+	else
+	{
+		current_delay *= multiplier;
+	}
+
+	attempts++;
+
+	/* Only ever shorten the delay, so the ceiling holds */
+	if (jitter > 0)
+	{
+		unsigned long long reduction = ((unsigned long long) delay * jitter * (rand_r(&seed) % 1000)) / 100000;
+
+		delay -= (unsigned int) reduction;
+	}
+
+	return (delay > 0) ? delay : 1;
+}
+
+unsigned int pivacy_cardemu_backoff::get_attempts()
+{
+	return attempts;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_backoff.h
+
+ Reconnect scheduler with exponential backoff, jitter and a ceiling
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_BACKOFF_H
+#define _PIVACY_CARDEMU_BACKOFF_H
+
+/* Defaults for the reconnect schedule */
+#define PIVACY_BACKOFF_INITIAL_DELAY	100		// ms
+#define PIVACY_BACKOFF_MAX_DELAY		5000	// ms
+#define PIVACY_BACKOFF_MULTIPLIER		2
+#define PIVACY_BACKOFF_JITTER			20		// percent
+
+/**
+ * Reconnect scheduler; each failed attempt multiplies the delay until
+ * the ceiling is reached, and every delay is shortened by a random
+ * amount so that clients do not retry in lock-step
+ */
+class pivacy_cardemu_backoff
+{
+public:
+	/**
+	 * Constructor
+	 * @param initial_delay the delay after the first failed attempt in milliseconds
+	 * @param max_delay the ceiling for the delay in milliseconds
+	 * @param multiplier the factor by which the delay grows after each failed attempt
+	 * @param jitter the maximum random reduction of a delay in percent
+	 */
+	pivacy_cardemu_backoff(unsigned int initial_delay = PIVACY_BACKOFF_INITIAL_DELAY,
+	                       unsigned int max_delay = PIVACY_BACKOFF_MAX_DELAY,
+	                       unsigned int multiplier = PIVACY_BACKOFF_MULTIPLIER,
+	                       unsigned int jitter = PIVACY_BACKOFF_JITTER);
+
+	/**
+	 * Read the schedule from the configuration
+	 * @param section the configuration section
+	 */
+	void configure(const char* section);
+
+	/**
+	 * Start over with the initial delay
+	 */
+	void reset();
+
+	/**
+	 * Get the delay before the next attempt and advance the schedule
+	 * @return the delay in milliseconds
+	 */
+	unsigned int next_delay();
+
+	/**
+	 * Get the number of delays handed out since the last reset
+	 * @return the number of failed attempts
+	 */
+	unsigned int get_attempts();
+
+private:
+	unsigned int initial_delay;
+	unsigned int max_delay;
+	unsigned int multiplier;
+	unsigned int jitter;
+
+	unsigned int current_delay;
+	unsigned int attempts;
+	unsigned int seed;
+};
+
+#endif // !_PIVACY_CARDEMU_BACKOFF_H
+
@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_consent_policy.cpp
+
+ Remembers the disclosures the user consented to for all time, so the
+ user does not have to be asked again; decisions are kept in an in-memory
+ hash table and persisted in an append-only file
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_consent_policy.h"
+#include "pivacy_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* FNV-1a 64-bit parameters */
+#define FNV_OFFSET_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME			0x100000001b3ULL
+
+/* Initial number of hash buckets; must be a power of two */
+#define INITIAL_BUCKETS		64
+
+/* Compact the policy file on load if less than this fraction of records is live */
+#define COMPACT_LIVE_RATIO	4
+
+/* Maximum length of a line in the policy file */
+#define MAX_LINE			1024
+
+/*static*/ std::auto_ptr<pivacy_cardemu_consent_policy> pivacy_cardemu_consent_policy::_i(NULL);
+/*static*/ pthread_once_t pivacy_cardemu_consent_policy::_i_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_cardemu_consent_policy::create_instance()
+{
+	_i = std::auto_ptr<pivacy_cardemu_consent_policy>(new pivacy_cardemu_consent_policy());
+}
+
+/*static*/ pivacy_cardemu_consent_policy* pivacy_cardemu_consent_policy::i()
+{
+	/* Used by both the emulator and the control server thread */
+	pthread_once(&_i_once, create_instance);
+
+	return _i.get();
+}
+
+pivacy_cardemu_consent_policy::pivacy_cardemu_consent_policy()
+{
+	policy_file = NULL;
+	num_entries = 0;
+	buckets.resize(INITIAL_BUCKETS);
+
+	pthread_mutex_init(&policy_mutex, NULL);
+}
+
+pivacy_cardemu_consent_policy::~pivacy_cardemu_consent_policy()
+{
+	if (policy_file != NULL)
+	{
+		fclose(policy_file);
+	}
+
+	pthread_mutex_destroy(&policy_mutex);
+}
+
+bool pivacy_cardemu_consent_policy::open(const std::string& file_name)
+{
+	pthread_mutex_lock(&policy_mutex);
+
+	if (policy_file != NULL)
+	{
+		fclose(policy_file);
+		policy_file = NULL;
+	}
+
+	buckets.clear();
+	buckets.resize(INITIAL_BUCKETS);
+	num_entries = 0;
+
+	this->file_name = file_name;
+
+	/* Replay the existing records */
+	size_t num_records = 0;
+	FILE* in = fopen(file_name.c_str(), "r");
+
+	if (in != NULL)
+	{
+		char line[MAX_LINE];
+		size_t line_no = 0;
+
+		while (fgets(line, MAX_LINE, in) != NULL)
+		{
+			line_no++;
+
+			size_t len = strlen(line);
+
+			/* A line without a newline was cut off by a crash while appending */
+			if ((len == 0) || (line[len - 1] != '\n'))
+			{
+				WARNING_MSG("Ignoring incomplete record at %s:%zu", file_name.c_str(), line_no);
+
+				continue;
+			}
+
+			line[--len] = '\0';
+
+			if ((len == 0) || (line[0] == '#'))
+			{
+				continue;
+			}
+
+			char op[16];
+			unsigned int cred_id;
+			unsigned int D;
+			int rp_offset = -1;
+
+			if ((sscanf(line, "%15s %x %x %n", op, &cred_id, &D, &rp_offset) != 3) ||
+			    (rp_offset < 0) ||
+			    (line[rp_offset] == '\0') ||
+			    (cred_id > 0xffff) ||
+			    (D > 0xffff))
+			{
+				WARNING_MSG("Ignoring malformed record at %s:%zu", file_name.c_str(), line_no);
+
+				continue;
+			}
+
+			std::string rp_name(line + rp_offset);
+
+			if (!strcmp(op, "grant"))
+			{
+				insert(rp_name, cred_id, D);
+			}
+			else if (!strcmp(op, "revoke"))
+			{
+				remove(rp_name, cred_id, D);
+			}
+			else
+			{
+				WARNING_MSG("Ignoring unknown record type '%s' at %s:%zu", op, file_name.c_str(), line_no);
+
+				continue;
+			}
+
+			num_records++;
+		}
+
+		fclose(in);
+	}
+
+	/* Drop revoked decisions from the file if they make up most of it */
+	if (num_records > COMPACT_LIVE_RATIO * num_entries)
+	{
+		if (!compact())
+		{
+			WARNING_MSG("Failed to compact consent policy file %s", file_name.c_str());
+		}
+	}
+
+	policy_file = fopen(file_name.c_str(), "a");
+
+	if (policy_file == NULL)
+	{
+		ERROR_MSG("Failed to open consent policy file %s", file_name.c_str());
+	}
+	else
+	{
+		INFO_MSG("Loaded %zu consent decision(s) from %s", num_entries, file_name.c_str());
+	}
+
+	bool rv = (policy_file != NULL);
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::is_enabled()
+{
+	pthread_mutex_lock(&policy_mutex);
+
+	bool rv = (policy_file != NULL);
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::is_allowed(const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	size_t bucket;
+	size_t pos;
+
+	pthread_mutex_lock(&policy_mutex);
+
+	bool rv = (policy_file != NULL) && find(rp_name, cred_id, D, bucket, pos);
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::grant(const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	pthread_mutex_lock(&policy_mutex);
+
+	bool rv = false;
+
+	/* Only remember decisions that survive a restart */
+	if ((policy_file != NULL) && append("grant", rp_name, cred_id, D))
+	{
+		insert(rp_name, cred_id, D);
+
+		rv = true;
+	}
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::revoke(const std::string& rp_name, unsigned short cred_id, unsigned short D, size_t& revoked)
+{
+	size_t bucket;
+	size_t pos;
+
+	pthread_mutex_lock(&policy_mutex);
+
+	bool rv = true;
+
+	revoked = 0;
+
+	if (find(rp_name, cred_id, D, bucket, pos))
+	{
+		/* Only forget the decision once its revocation survives a restart */
+		if ((policy_file != NULL) && append("revoke", rp_name, cred_id, D))
+		{
+			remove(rp_name, cred_id, D);
+
+			revoked = 1;
+		}
+		else
+		{
+			rv = false;
+		}
+	}
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::revoke_credential(unsigned short cred_id, size_t& revoked)
+{
+	std::vector<pivacy_consent_entry> entries;
+
+	list(entries);
+
+	bool rv = true;
+
+	revoked = 0;
+
+	for (std::vector<pivacy_consent_entry>::iterator i = entries.begin(); i != entries.end(); i++)
+	{
+		size_t one = 0;
+
+		if (i->cred_id != cred_id)
+		{
+			continue;
+		}
+
+		if (!revoke(i->rp_name, i->cred_id, i->D, one))
+		{
+			rv = false;
+		}
+
+		revoked += one;
+	}
+
+	return rv;
+}
+
+bool pivacy_cardemu_consent_policy::revoke_all(size_t& revoked)
+{
+	pthread_mutex_lock(&policy_mutex);
+
+	std::vector<std::vector<pivacy_consent_entry> > old_buckets;
+	size_t old_entries = num_entries;
+
+	revoked = 0;
+
+	old_buckets.swap(buckets);
+	buckets.resize(INITIAL_BUCKETS);
+	num_entries = 0;
+
+	/* An empty file is the cheapest way to record that nothing is allowed */
+	bool rv = (policy_file != NULL) && compact();
+
+	if (rv)
+	{
+		revoked = old_entries;
+	}
+	else
+	{
+		/* Keep the decisions that are still in the file */
+		buckets.swap(old_buckets);
+		num_entries = old_entries;
+	}
+
+	pthread_mutex_unlock(&policy_mutex);
+
+	return rv;
+}
+
+void pivacy_cardemu_consent_policy::list(std::vector<pivacy_consent_entry>& entries)
+{
+	pthread_mutex_lock(&policy_mutex);
+
+	entries.clear();
+	entries.reserve(num_entries);
+
+	for (std::vector<std::vector<pivacy_consent_entry> >::iterator i = buckets.begin(); i != buckets.end(); i++)
+	{
+		entries.insert(entries.end(), i->begin(), i->end());
+	}
+
+	pthread_mutex_unlock(&policy_mutex);
+}
+
+/*static*/ unsigned long long pivacy_cardemu_consent_policy::hash(const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	unsigned long long h = FNV_OFFSET_BASIS;
+	unsigned char key[4] = { (unsigned char) (cred_id >> 8), (unsigned char) cred_id, (unsigned char) (D >> 8), (unsigned char) D };
+
+	for (size_t i = 0; i < sizeof(key); i++)
+	{
+		h = (h ^ key[i]) * FNV_PRIME;
+	}
+
+	for (size_t i = 0; i < rp_name.size(); i++)
+	{
+		h = (h ^ (unsigned char) rp_name[i]) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+bool pivacy_cardemu_consent_policy::find(const std::string& rp_name, unsigned short cred_id, unsigned short D, size_t& bucket, size_t& pos)
+{
+	bucket = hash(rp_name, cred_id, D) & (buckets.size() - 1);
+
+	const std::vector<pivacy_consent_entry>& chain = buckets[bucket];
+
+	for (pos = 0; pos < chain.size(); pos++)
+	{
+		if ((chain[pos].cred_id == cred_id) && (chain[pos].D == D) && (chain[pos].rp_name == rp_name))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool pivacy_cardemu_consent_policy::insert(const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	size_t bucket;
+	size_t pos;
+
+	if (find(rp_name, cred_id, D, bucket, pos))
+	{
+		return false;
+	}
+
+	/* Keep the load factor below 3/4 */
+	if (4 * (num_entries + 1) > 3 * buckets.size())
+	{
+		std::vector<std::vector<pivacy_consent_entry> > old_buckets(buckets.size() * 2);
+
+		old_buckets.swap(buckets);
+
+		for (std::vector<std::vector<pivacy_consent_entry> >::iterator i = old_buckets.begin(); i != old_buckets.end(); i++)
+		{
+			for (std::vector<pivacy_consent_entry>::iterator j = i->begin(); j != i->end(); j++)
+			{
+				buckets[hash(j->rp_name, j->cred_id, j->D) & (buckets.size() - 1)].push_back(*j);
+			}
+		}
+
+		bucket = hash(rp_name, cred_id, D) & (buckets.size() - 1);
+	}
+
+	pivacy_consent_entry entry;
+
+	entry.rp_name = rp_name;
+	entry.cred_id = cred_id;
+	entry.D = D;
+
+	buckets[bucket].push_back(entry);
+	num_entries++;
+
+	return true;
+}
+
+bool pivacy_cardemu_consent_policy::remove(const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	size_t bucket;
+	size_t pos;
+
+	if (!find(rp_name, cred_id, D, bucket, pos))
+	{
+		return false;
+	}
+
+	std::vector<pivacy_consent_entry>& chain = buckets[bucket];
+
+	chain[pos] = chain.back();
+	chain.pop_back();
+	num_entries--;
+
+	return true;
+}
+
+bool pivacy_cardemu_consent_policy::append(const char* op, const std::string& rp_name, unsigned short cred_id, unsigned short D)
+{
+	/* A relying party name with a line break would corrupt the file */
+	if (rp_name.empty() || (rp_name.find_first_of("\r\n") != std::string::npos))
+	{
+		ERROR_MSG("Cannot store consent decision for invalid relying party name");
+
+		return false;
+	}
+
+	if ((fprintf(policy_file, "%s 0x%04X 0x%04X %s\n", op, cred_id, D, rp_name.c_str()) < 0) ||
+	    (fflush(policy_file) != 0) ||
+	    (fsync(fileno(policy_file)) != 0))
+	{
+		ERROR_MSG("Failed to write to consent policy file %s", file_name.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_consent_policy::compact()
+{
+	std::string tmp_name = file_name + ".tmp";
+	FILE* out = fopen(tmp_name.c_str(), "w");
+
+	if (out == NULL)
+	{
+		return false;
+	}
+
+	bool ok = (fprintf(out, "# Pivacy consent policy; records are appended, later records override earlier ones\n") >= 0);
+
+	for (std::vector<std::vector<pivacy_consent_entry> >::iterator i = buckets.begin(); ok && (i != buckets.end()); i++)
+	{
+		for (std::vector<pivacy_consent_entry>::iterator j = i->begin(); ok && (j != i->end()); j++)
+		{
+			ok = (fprintf(out, "grant 0x%04X 0x%04X %s\n", j->cred_id, j->D, j->rp_name.c_str()) >= 0);
+		}
+	}
+
+	ok = ok && (fflush(out) == 0) && (fsync(fileno(out)) == 0);
+	ok = (fclose(out) == 0) && ok;
+
+	if (!ok || (rename(tmp_name.c_str(), file_name.c_str()) != 0))
+	{
+		unlink(tmp_name.c_str());
+
+		return false;
+	}
+
+	/* Further records must go to the new file */
+	if (policy_file != NULL)
+	{
+		fclose(policy_file);
+
+		policy_file = fopen(file_name.c_str(), "a");
+
+		if (policy_file == NULL)
+		{
+			ERROR_MSG("Failed to reopen consent policy file %s", file_name.c_str());
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_consent_policy.h
+
+ Remembers the disclosures the user consented to for all time, so the
+ user does not have to be asked again; decisions are kept in an in-memory
+ hash table and persisted in an append-only file
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_CONSENT_POLICY_H
+#define _PIVACY_CARDEMU_CONSENT_POLICY_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Policy file format: one record per line, either
+ *
+ *   grant <credential ID> <disclosure mask> <relying party>
+ *   revoke <credential ID> <disclosure mask> <relying party>
+ *
+ * with the credential ID and mask as 4 hexadecimal digits; the relying
+ * party is the rest of the line. Records are only ever appended; later
+ * records override earlier ones. Lines starting with # are ignored
+ */
+
+/**
+ * A consent decision
+ */
+struct pivacy_consent_entry
+{
+	std::string rp_name;
+	unsigned short cred_id;
+	unsigned short D;
+};
+
+/**
+ * Consent policy store
+ */
+class pivacy_cardemu_consent_policy
+{
+public:
+	/**
+	 * Get the one-and-only instance of the consent policy store
+	 * @return the one-and-only instance of the consent policy store
+	 */
+	static pivacy_cardemu_consent_policy* i();
+
+	/**
+	 * Destructor
+	 */
+	~pivacy_cardemu_consent_policy();
+
+	/**
+	 * Load the policy file and use it to store new decisions; the file
+	 * is compacted if it mostly holds revoked decisions
+	 * @param file_name the policy file (created if it does not exist)
+	 * @return true if the policy file can be used
+	 */
+	bool open(const std::string& file_name);
+
+	/**
+	 * Check if the policy store is in use
+	 * @return true if a policy file was opened
+	 */
+	bool is_enabled();
+
+	/**
+	 * Check if the user consented to a disclosure for all time
+	 * @param rp_name the name of the relying party
+	 * @param cred_id the credential ID
+	 * @param D the mask of disclosed attributes
+	 * @return true if the disclosure is allowed without asking the user
+	 */
+	bool is_allowed(const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Remember that the user consented to a disclosure for all time
+	 * @param rp_name the name of the relying party
+	 * @param cred_id the credential ID
+	 * @param D the mask of disclosed attributes
+	 * @return true if the decision was stored
+	 */
+	bool grant(const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Revoke a decision; it is only forgotten once the revocation has
+	 * been stored
+	 * @param rp_name the name of the relying party
+	 * @param cred_id the credential ID
+	 * @param D the mask of disclosed attributes
+	 * @param revoked receives the number of decisions revoked (0 or 1)
+	 * @return false if the revocation could not be stored
+	 */
+	bool revoke(const std::string& rp_name, unsigned short cred_id, unsigned short D, size_t& revoked);
+
+	/**
+	 * Revoke all decisions for a credential
+	 * @param cred_id the credential ID
+	 * @param revoked receives the number of decisions revoked
+	 * @return false if any of the revocations could not be stored
+	 */
+	bool revoke_credential(unsigned short cred_id, size_t& revoked);
+
+	/**
+	 * Revoke all decisions; they are only forgotten once the emptied
+	 * policy file has been stored
+	 * @param revoked receives the number of decisions revoked
+	 * @return false if the revocation could not be stored
+	 */
+	bool revoke_all(size_t& revoked);
+
+	/**
+	 * Get all decisions
+	 * @param entries receives the decisions
+	 */
+	void list(std::vector<pivacy_consent_entry>& entries);
+
+private:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_consent_policy();
+
+	/**
+	 * Create the one-and-only instance
+	 */
+	static void create_instance();
+
+	/**
+	 * Hash a decision key
+	 */
+	static unsigned long long hash(const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Find a decision; the caller must hold the lock
+	 * @return the bucket and position of the decision, or false
+	 */
+	bool find(const std::string& rp_name, unsigned short cred_id, unsigned short D, size_t& bucket, size_t& pos);
+
+	/**
+	 * Add a decision to the hash table; the caller must hold the lock
+	 * @return false if it was already there
+	 */
+	bool insert(const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Remove a decision from the hash table; the caller must hold the lock
+	 * @return false if it was not there
+	 */
+	bool remove(const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Append a record to the policy file; the caller must hold the lock
+	 * @return true if the record was written to disk
+	 */
+	bool append(const char* op, const std::string& rp_name, unsigned short cred_id, unsigned short D);
+
+	/**
+	 * Rewrite the policy file with only the current decisions; the
+	 * caller must hold the lock
+	 * @return true if the file was rewritten
+	 */
+	bool compact();
+
+	std::string file_name;
+	FILE* policy_file;
+
+	/* Hash table with separate chaining; the number of buckets is a power of two */
+	std::vector<std::vector<pivacy_consent_entry> > buckets;
+	size_t num_entries;
+
+	pthread_mutex_t policy_mutex;
+
+	// The one-and-only instance
+	static std::auto_ptr<pivacy_cardemu_consent_policy> _i;
+	static pthread_once_t _i_once;
+};
+
+#endif // !_PIVACY_CARDEMU_CONSENT_POLICY_H
+
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_control.cpp
+
+ Control endpoint for the card emulator on a local UNIX domain socket;
+ used to inspect and revoke remembered consent decisions
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_control.h"
+#include "pivacy_cardemu_consent_policy.h"
+#include "pivacy_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // !MSG_NOSIGNAL
+
+/* Time after which an idle control client is disconnected */
+#define CONTROL_IDLE_TIMEOUT		30000 // ms
+
+/* Maximum length of a command line */
+#define CONTROL_MAX_LINE			1024
+
+pivacy_cardemu_control_server::pivacy_cardemu_control_server()
+{
+	listen_socket = -1;
+	cancel_pipe[0] = cancel_pipe[1] = -1;
+	running = false;
+}
+
+pivacy_cardemu_control_server::~pivacy_cardemu_control_server()
+{
+	stop();
+}
+
+bool pivacy_cardemu_control_server::start(const std::string& socket_path)
+{
+	struct sockaddr_un addr;
+
+	if (running)
+	{
+		return true;
+	}
+
+	if (socket_path.size() >= sizeof(addr.sun_path))
+	{
+		ERROR_MSG("Control socket path %s is too long", socket_path.c_str());
+
+		return false;
+	}
+
+	this->socket_path = socket_path;
+
+	if (pipe(cancel_pipe) != 0)
+	{
+		ERROR_MSG("Failed to create the control cancellation pipe");
+
+		return false;
+	}
+
+	listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path.c_str());
+
+	unlink(socket_path.c_str());
+
+	if ((listen_socket < 0) ||
+	    (bind(listen_socket, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+	    (listen(listen_socket, 4) != 0) ||
+	    (pthread_create(&server_thread, NULL, server_thread_entry, this) != 0))
+	{
+		ERROR_MSG("Failed to accept control commands on %s (%s)", socket_path.c_str(), strerror(errno));
+
+		if (listen_socket >= 0) close(listen_socket);
+		close(cancel_pipe[0]);
+		close(cancel_pipe[1]);
+
+		listen_socket = cancel_pipe[0] = cancel_pipe[1] = -1;
+
+		return false;
+	}
+
+	running = true;
+
+	INFO_MSG("Accepting control commands on %s", socket_path.c_str());
+
+	return true;
+}
+
+void pivacy_cardemu_control_server::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	char c = 0;
+
+	if (write(cancel_pipe[1], &c, 1) != 1)
+	{
+		ERROR_MSG("Failed to signal the control thread");
+	}
+
+	pthread_join(server_thread, NULL);
+
+	close(listen_socket);
+	unlink(socket_path.c_str());
+	close(cancel_pipe[0]);
+	close(cancel_pipe[1]);
+
+	listen_socket = cancel_pipe[0] = cancel_pipe[1] = -1;
+	running = false;
+}
+
+/*static*/ void* pivacy_cardemu_control_server::server_thread_entry(void* arg)
+{
+	((pivacy_cardemu_control_server*) arg)->server_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_control_server::server_loop()
+{
+	struct pollfd fds[2];
+
+	fds[0].fd = listen_socket;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancel_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		fds[0].revents = fds[1].revents = 0;
+
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG("Control server failed (%s)", strerror(errno));
+
+			break;
+		}
+
+		if (fds[1].revents != 0)
+		{
+			break;
+		}
+
+		if (fds[0].revents != 0)
+		{
+			int client = accept(listen_socket, NULL, NULL);
+
+			if (client >= 0)
+			{
+				serve(client);
+
+				close(client);
+			}
+		}
+	}
+}
+
+void pivacy_cardemu_control_server::serve(int client)
+{
+	struct pollfd fds[2];
+	std::string pending;
+
+	fds[0].fd = client;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancel_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		fds[0].revents = fds[1].revents = 0;
+
+		int rv = poll(fds, 2, CONTROL_IDLE_TIMEOUT);
+
+		if ((rv < 0) && (errno == EINTR)) continue;
+
+		/* Leave the cancellation byte for the server loop */
+		if ((rv <= 0) || (fds[1].revents != 0))
+		{
+			break;
+		}
+
+		char buf[256];
+		ssize_t received = recv(client, buf, sizeof(buf), 0);
+
+		if (received <= 0)
+		{
+			break;
+		}
+
+		pending.append(buf, received);
+
+		std::string response;
+		size_t eol;
+
+		while ((eol = pending.find('\n')) != std::string::npos)
+		{
+			std::string command = pending.substr(0, eol);
+
+			pending.erase(0, eol + 1);
+
+			if (!command.empty() && (command[command.size() - 1] == '\r'))
+			{
+				command.erase(command.size() - 1);
+			}
+
+			execute(command, response);
+		}
+
+		if (pending.size() > CONTROL_MAX_LINE)
+		{
+			response += "ERROR command too long\n";
+			pending.clear();
+		}
+
+		size_t sent = 0;
+
+		while (sent < response.size())
+		{
+			ssize_t rv = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+			if (rv < 0)
+			{
+				if (errno == EINTR) continue;
+
+				return;
+			}
+
+			sent += rv;
+		}
+	}
+}
+
+/* Parse a 16-bit value as written in the consent policy file */
+static bool parse_ushort(const char* str, unsigned short& value)
+{
+	char* end = NULL;
+
+	errno = 0;
+
+	unsigned long v = strtoul(str, &end, 0);
+
+	if ((errno != 0) || (end == str) || (*end != '\0') || (v > 0xffff))
+	{
+		return false;
+	}
+
+	value = (unsigned short) v;
+
+	return true;
+}
+
+void pivacy_cardemu_control_server::execute(const std::string& command, std::string& response)
+{
+	pivacy_cardemu_consent_policy* policy = pivacy_cardemu_consent_policy::i();
+	char line[CONTROL_MAX_LINE + 64];
+
+	/* Split off the command word and up to two arguments; the rest is the relying party */
+	char verb[32] = { 0 };
+	char arg1[16] = { 0 };
+	char arg2[16] = { 0 };
+	int rest = -1;
+
+	int num_args = sscanf(command.c_str(), "%31s %15s %15s %n", verb, arg1, arg2, &rest);
+
+	if (num_args < 1)
+	{
+		return;
+	}
+
+	std::string cmd(verb);
+
+	if (cmd == "help")
+	{
+		response += "list\n";
+		response += "revoke <credential ID> <disclosure mask> <relying party>\n";
+		response += "revoke-credential <credential ID>\n";
+		response += "revoke-all\n";
+		response += "OK\n";
+	}
+	else if (cmd == "list")
+	{
+		std::vector<pivacy_consent_entry> entries;
+
+		policy->list(entries);
+
+		for (std::vector<pivacy_consent_entry>::iterator i = entries.begin(); i != entries.end(); i++)
+		{
+			snprintf(line, sizeof(line), "0x%04X 0x%04X %s\n", i->cred_id, i->D, i->rp_name.c_str());
+
+			response += line;
+		}
+
+		snprintf(line, sizeof(line), "OK %zu\n", entries.size());
+
+		response += line;
+	}
+	else if (cmd == "revoke")
+	{
+		unsigned short cred_id;
+		unsigned short D;
+
+		if ((num_args < 3) || (rest < 0) || (command[rest] == '\0') || !parse_ushort(arg1, cred_id) || !parse_ushort(arg2, D))
+		{
+			response += "ERROR usage: revoke <credential ID> <disclosure mask> <relying party>\n";
+		}
+		else
+		{
+			size_t revoked = 0;
+
+			if (!policy->revoke(command.substr(rest), cred_id, D, revoked))
+			{
+				ERROR_MSG("Failed to store revocation of consent for credential 0x%04X with D = 0x%04X", cred_id, D);
+
+				response += "ERROR failed to store revocation\n";
+			}
+			else if (revoked == 0)
+			{
+				response += "ERROR no such decision\n";
+			}
+			else
+			{
+				INFO_MSG("Revoked consent for credential 0x%04X with D = 0x%04X", cred_id, D);
+
+				response += "OK 1\n";
+			}
+		}
+	}
+	else if (cmd == "revoke-credential")
+	{
+		unsigned short cred_id;
+
+		if ((num_args != 2) || !parse_ushort(arg1, cred_id))
+		{
+			response += "ERROR usage: revoke-credential <credential ID>\n";
+		}
+		else
+		{
+			size_t revoked = 0;
+
+			if (!policy->revoke_credential(cred_id, revoked))
+			{
+				ERROR_MSG("Failed to store revocation of consent for credential 0x%04X (%zu revoked)", cred_id, revoked);
+
+				response += "ERROR failed to store revocation\n";
+			}
+			else
+			{
+				INFO_MSG("Revoked %zu consent decision(s) for credential 0x%04X", revoked, cred_id);
+
+				snprintf(line, sizeof(line), "OK %zu\n", revoked);
+
+				response += line;
+			}
+		}
+	}
+	else if (cmd == "revoke-all")
+	{
+		size_t revoked = 0;
+
+		if (!policy->revoke_all(revoked))
+		{
+			ERROR_MSG("Failed to store revocation of all consent decisions");
+
+			response += "ERROR failed to store revocation\n";
+		}
+		else
+		{
+			INFO_MSG("Revoked all %zu consent decision(s)", revoked);
+
+			snprintf(line, sizeof(line), "OK %zu\n", revoked);
+
+			response += line;
+		}
+	}
+	else
+	{
+		response += "ERROR unknown command, try help\n";
+	}
+}
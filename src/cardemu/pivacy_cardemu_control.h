@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_control.h
+
+ Control endpoint for the card emulator on a local UNIX domain socket;
+ used to inspect and revoke remembered consent decisions
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_CONTROL_H
+#define _PIVACY_CARDEMU_CONTROL_H
+
+#include <pthread.h>
+#include <string>
+
+/* Default control socket */
+#define PIVACY_CONTROL_SOCKET		"/tmp/pivacy_cardemu-control"
+
+/*
+ * The control protocol is line based; a client sends one command per line
+ * and receives one or more lines in response, the last of which starts
+ * with "OK" or "ERROR". Commands:
+ *
+ *   list                                    list remembered consent decisions
+ *   revoke <credential ID> <mask> <rp>      revoke a single decision
+ *   revoke-credential <credential ID>       revoke all decisions for a credential
+ *   revoke-all                              revoke all decisions
+ *   help                                    list the commands
+ */
+
+/**
+ * Control server
+ */
+class pivacy_cardemu_control_server
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_control_server();
+
+	/**
+	 * Destructor; stops the server
+	 */
+	~pivacy_cardemu_control_server();
+
+	/**
+	 * Start accepting control commands
+	 * @param socket_path the path of the UNIX domain socket
+	 * @return true if the server was started
+	 */
+	bool start(const std::string& socket_path);
+
+	/**
+	 * Stop accepting control commands
+	 */
+	void stop();
+
+private:
+	/**
+	 * Server thread entry point
+	 */
+	static void* server_thread_entry(void* arg);
+
+	/**
+	 * Server thread main loop
+	 */
+	void server_loop();
+
+	/**
+	 * Serve a single client until it disconnects
+	 * @param client the client socket
+	 */
+	void serve(int client);
+
+	/**
+	 * Execute a single command
+	 * @param command the command line
+	 * @param response receives the response
+	 */
+	void execute(const std::string& command, std::string& response);
+
+	std::string socket_path;
+	int listen_socket;
+	int cancel_pipe[2];
+	pthread_t server_thread;
+	bool running;
+};
+
+#endif // !_PIVACY_CARDEMU_CONTROL_H
+
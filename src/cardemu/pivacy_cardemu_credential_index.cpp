@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_index.cpp
+
+ Constant-time lookup of proof contexts by credential ID and by issuer and
+ credential name
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_credential_index.h"
+#include <string.h>
+
+pivacy_cardemu_credential_index::pivacy_cardemu_credential_index()
+{
+	memset(pages, 0, sizeof(pages));
+
+	count = 0;
+}
+
+pivacy_cardemu_credential_index::~pivacy_cardemu_credential_index()
+{
+	clear();
+}
+
+bool pivacy_cardemu_credential_index::add(pivacy_cardemu_proof_context* ctx, pivacy_cardemu_proof_context*& conflict)
+{
+	unsigned short cred_id = ctx->get_credential_id();
+	std::pair<std::string, std::string> name(ctx->get_credential()->get_issuer(), ctx->get_credential()->get_name());
+
+	conflict = find(cred_id);
+
+	if (conflict == NULL)
+	{
+		std::map<std::pair<std::string, std::string>, pivacy_cardemu_proof_context*>::iterator found = by_name.find(name);
+
+		if (found != by_name.end())
+		{
+			conflict = found->second;
+		}
+	}
+
+	if (conflict != NULL)
+	{
+		return false;
+	}
+
+	pivacy_cardemu_proof_context**& page = pages[cred_id >> PIVACY_CRED_INDEX_PAGE_BITS];
+
+	if (page == NULL)
+	{
+		page = new pivacy_cardemu_proof_context*[PIVACY_CRED_INDEX_PAGE_SIZE];
+
+		memset(page, 0, PIVACY_CRED_INDEX_PAGE_SIZE * sizeof(pivacy_cardemu_proof_context*));
+	}
+
+	page[cred_id & (PIVACY_CRED_INDEX_PAGE_SIZE - 1)] = ctx;
+
+	by_name[name] = ctx;
+
+	count++;
+
+	return true;
+}
+
+pivacy_cardemu_proof_context* pivacy_cardemu_credential_index::find(unsigned short cred_id)
+{
+	pivacy_cardemu_proof_context** page = pages[cred_id >> PIVACY_CRED_INDEX_PAGE_BITS];
+
+	if (page == NULL)
+	{
+		return NULL;
+	}
+
+	return page[cred_id & (PIVACY_CRED_INDEX_PAGE_SIZE - 1)];
+}
+
+pivacy_cardemu_proof_context* pivacy_cardemu_credential_index::find(const std::string& issuer, const std::string& name)
+{
+	std::map<std::pair<std::string, std::string>, pivacy_cardemu_proof_context*>::iterator found = by_name.find(std::make_pair(issuer, name));
+
+	if (found == by_name.end())
+	{
+		return NULL;
+	}
+
+	return found->second;
+}
+
+size_t pivacy_cardemu_credential_index::size()
+{
+	return count;
+}
+
+void pivacy_cardemu_credential_index::clear()
+{
+	for (size_t i = 0; i < PIVACY_CRED_INDEX_NUM_PAGES; i++)
+	{
+		delete[] pages[i];
+
+		pages[i] = NULL;
+	}
+
+	by_name.clear();
+
+	count = 0;
+}
+
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_index.h
+
+ Constant-time lookup of proof contexts by credential ID and by issuer and
+ credential name
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_CREDENTIAL_INDEX_H
+#define _PIVACY_CARDEMU_CREDENTIAL_INDEX_H
+
+#include "pivacy_cardemu_proof_context.h"
+#include <string>
+#include <map>
+
+/* The 16-bit credential ID space is split into pages that are allocated on demand */
+#define PIVACY_CRED_INDEX_PAGE_BITS		8
+#define PIVACY_CRED_INDEX_PAGE_SIZE		(1 << PIVACY_CRED_INDEX_PAGE_BITS)
+#define PIVACY_CRED_INDEX_NUM_PAGES		(65536 / PIVACY_CRED_INDEX_PAGE_SIZE)
+
+/**
+ * Credential index
+ */
+class pivacy_cardemu_credential_index
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_credential_index();
+
+	/**
+	 * Destructor; the indexed proof contexts are not deleted
+	 */
+	~pivacy_cardemu_credential_index();
+
+	/**
+	 * Add a proof context to the index
+	 * @param ctx the proof context (remains owned by the caller)
+	 * @param conflict receives the context that already uses the same
+	 *                 credential ID or issuer and name, if any
+	 * @return false if the context was not added because of a conflict
+	 */
+	bool add(pivacy_cardemu_proof_context* ctx, pivacy_cardemu_proof_context*& conflict);
+
+	/**
+	 * Find a proof context by credential ID
+	 * @param cred_id the credential ID
+	 * @return the proof context or NULL if there is no such credential
+	 */
+	pivacy_cardemu_proof_context* find(unsigned short cred_id);
+
+	/**
+	 * Find a proof context by issuer and credential name
+	 * @param issuer the issuer of the credential
+	 * @param name the name of the credential
+	 * @return the proof context or NULL if there is no such credential
+	 */
+	pivacy_cardemu_proof_context* find(const std::string& issuer, const std::string& name);
+
+	/**
+	 * Get the number of indexed proof contexts
+	 * @return the number of proof contexts
+	 */
+	size_t size();
+
+	/**
+	 * Remove all proof contexts from the index
+	 */
+	void clear();
+
+private:
+	/* Pages of PIVACY_CRED_INDEX_PAGE_SIZE slots, indexed by the high bits of the ID */
+	pivacy_cardemu_proof_context** pages[PIVACY_CRED_INDEX_NUM_PAGES];
+
+	/* Secondary index by (issuer, name) */
+	std::map<std::pair<std::string, std::string>, pivacy_cardemu_proof_context*> by_name;
+
+	size_t count;
+};
+
+#endif // !_PIVACY_CARDEMU_CREDENTIAL_INDEX_H
+
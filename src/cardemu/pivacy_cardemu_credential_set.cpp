@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_set.cpp
+
+ Immutable set of the credentials that can be used for proofs; a new set
+ is published whenever the credential directory changes
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_credential_set.h"
+
+pivacy_cardemu_credential_set::pivacy_cardemu_credential_set(unsigned long generation)
+{
+	max_attributes = 0;
+	refs = 0;
+
+	this->generation = generation;
+}
+
+bool pivacy_cardemu_credential_set::add(pivacy_cardemu_proof_context* ctx, pivacy_cardemu_proof_context*& conflict)
+{
+	if (!index.add(ctx, conflict))
+	{
+		return false;
+	}
+
+	contexts.push_back(ctx);
+
+	if (ctx->num_attributes() > max_attributes)
+	{
+		max_attributes = ctx->num_attributes();
+	}
+
+	return true;
+}
+
+pivacy_cardemu_proof_context* pivacy_cardemu_credential_set::find(unsigned short cred_id)
+{
+	return index.find(cred_id);
+}
+
+bool pivacy_cardemu_credential_set::contains(pivacy_cardemu_proof_context* ctx)
+{
+	return index.find(ctx->get_credential_id()) == ctx;
+}
+
+const std::vector<pivacy_cardemu_proof_context*>& pivacy_cardemu_credential_set::get_contexts()
+{
+	return contexts;
+}
+
+size_t pivacy_cardemu_credential_set::size()
+{
+	return contexts.size();
+}
+
+size_t pivacy_cardemu_credential_set::get_max_attributes()
+{
+	return max_attributes;
+}
+
+unsigned long pivacy_cardemu_credential_set::get_generation()
+{
+	return generation;
+}
+
+void pivacy_cardemu_credential_set::add_ref()
+{
+	__sync_fetch_and_add(&refs, 1);
+}
+
+void pivacy_cardemu_credential_set::drop_ref()
+{
+	__sync_fetch_and_sub(&refs, 1);
+}
+
+bool pivacy_cardemu_credential_set::is_referenced()
+{
+	return __sync_fetch_and_add(&refs, 0) != 0;
+}
+
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_set.h
+
+ Immutable set of the credentials that can be used for proofs; a new set
+ is published whenever the credential directory changes
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_CREDENTIAL_SET_H
+#define _PIVACY_CARDEMU_CREDENTIAL_SET_H
+
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cardemu_credential_index.h"
+#include <vector>
+
+/**
+ * Credential set
+ */
+class pivacy_cardemu_credential_set
+{
+public:
+	/**
+	 * Constructor
+	 * @param generation the generation number of the set
+	 */
+	pivacy_cardemu_credential_set(unsigned long generation);
+
+	/**
+	 * Add a proof context; must only be called before the set is published
+	 * @param ctx the proof context (remains owned by the caller)
+	 * @param conflict receives the context that already uses the same
+	 *                 credential ID or issuer and name, if any
+	 * @return false if the context was not added because of a conflict
+	 */
+	bool add(pivacy_cardemu_proof_context* ctx, pivacy_cardemu_proof_context*& conflict);
+
+	/**
+	 * Find a proof context by credential ID
+	 * @param cred_id the credential ID
+	 * @return the proof context or NULL if there is no such credential
+	 */
+	pivacy_cardemu_proof_context* find(unsigned short cred_id);
+
+	/**
+	 * Check if the set contains a proof context
+	 * @param ctx the proof context
+	 * @return true if the context is in the set
+	 */
+	bool contains(pivacy_cardemu_proof_context* ctx);
+
+	/**
+	 * Get the proof contexts in the set
+	 * @return the proof contexts
+	 */
+	const std::vector<pivacy_cardemu_proof_context*>& get_contexts();
+
+	/**
+	 * Get the number of credentials in the set
+	 * @return the number of credentials
+	 */
+	size_t size();
+
+	/**
+	 * Get the largest number of attributes of any credential in the set
+	 * @return the largest number of attributes
+	 */
+	size_t get_max_attributes();
+
+	/**
+	 * Get the generation number of the set
+	 * @return the generation number
+	 */
+	unsigned long get_generation();
+
+	/**
+	 * Add a reference to the set
+	 */
+	void add_ref();
+
+	/**
+	 * Drop a reference to the set
+	 */
+	void drop_ref();
+
+	/**
+	 * Check if the set is still referenced
+	 * @return true if there are references to the set
+	 */
+	bool is_referenced();
+
+private:
+	std::vector<pivacy_cardemu_proof_context*> contexts;
+
+	pivacy_cardemu_credential_index index;
+
+	size_t max_attributes;
+
+	unsigned long generation;
+
+	volatile unsigned long refs;
+};
+
+#endif // !_PIVACY_CARDEMU_CREDENTIAL_SET_H
+
@@ -0,0 +1,1021 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_store.cpp
+
+ Loads the credentials from the credential directory and reloads changed
+ credentials in the background; readers always get an immutable snapshot
+ of the credential set
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_credential_store.h"
+#include "pivacy_cardemu_metrics.h"
+#include "pivacy_cred_xml_rw.h"
+#include "pivacy_cred_bin_store.h"
+#include "pivacy_pubkey_registry.h"
+#include "pivacy_fixed_base.h"
+#include "pivacy_log.h"
+#include "pivacy_config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif // HAVE_SYS_INOTIFY_H
+
+/* Wait for the directory to be quiet for this long before reloading */
+#define RELOAD_SETTLE_TIME		250		// ms
+
+/* Interval at which to check if retired credentials can be deleted */
+#define RECLAIM_INTERVAL		1000	// ms
+
+/* Upper bound for the number of credential loader threads */
+#define MAX_LOAD_THREADS		16
+
+pivacy_cardemu_credential_store::pivacy_cardemu_credential_store(pivacy_cardemu_precompute_pool& pool, pivacy_cardemu_speculator& speculator) : pool(pool), speculator(speculator)
+{
+	current = NULL;
+	generation = 0;
+	readers = 0;
+
+	inotify_fd = -1;
+	cancel_pipe[0] = cancel_pipe[1] = -1;
+	watching = false;
+
+	/* Load credentials on as many threads as there are CPUs by default */
+	int conf_load_threads = 0;
+
+	pivacy_conf_get_int("emulation.credentials", "load_threads", conf_load_threads, 0);
+
+	if (conf_load_threads <= 0)
+	{
+		conf_load_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if (conf_load_threads < 1)
+	{
+		conf_load_threads = 1;
+	}
+	else if (conf_load_threads > MAX_LOAD_THREADS)
+	{
+		conf_load_threads = MAX_LOAD_THREADS;
+	}
+
+	load_threads = conf_load_threads;
+
+	/* Only read the credential headers up front if requested */
+	lazy = false;
+
+	pivacy_conf_get_bool("emulation.credentials", "lazy", lazy, false);
+
+	if (lazy)
+	{
+		INFO_MSG("Credentials will be loaded when they are first used");
+	}
+
+	pthread_mutex_init(&warm_up_mutex, NULL);
+	pthread_cond_init(&warm_up_cond, NULL);
+	warm_up_running = false;
+	warm_up_stop = false;
+	warm_up_generation = 0;
+}
+
+pivacy_cardemu_credential_store::~pivacy_cardemu_credential_store()
+{
+	stop_warm_up();
+	stop_watching();
+
+	/* All readers must have released their references by now */
+	if (current != NULL)
+	{
+		pivacy_cardemu_credential_set* last_set = current;
+
+		retired_sets.push_back(last_set);
+
+		current = NULL;
+	}
+
+	for (std::vector<pivacy_cardemu_credential_set*>::iterator i = retired_sets.begin(); i != retired_sets.end(); i++)
+	{
+		delete *i;
+	}
+
+	for (std::vector<credential_file*>::iterator i = retired_files.begin(); i != retired_files.end(); i++)
+	{
+		free_file(*i);
+	}
+
+	for (std::map<std::string, credential_file*>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		free_file(i->second);
+	}
+
+	pthread_cond_destroy(&warm_up_cond);
+	pthread_mutex_destroy(&warm_up_mutex);
+}
+
+bool pivacy_cardemu_credential_store::load(const std::string& credential_dir)
+{
+	this->credential_dir = credential_dir;
+
+	if (!rescan())
+	{
+		ERROR_MSG("Failed to open directory %s, cannot load credentials", credential_dir.c_str());
+
+		return false;
+	}
+
+	/* Publish an empty set if there were no credentials */
+	if (current == NULL)
+	{
+		publish();
+	}
+
+	INFO_MSG("Loaded %zu issuer public key(s) for %zu credential(s), sharing them saves %zu bytes", pivacy_pubkey_registry::i()->num_keys(), pivacy_pubkey_registry::i()->num_references(), pivacy_pubkey_registry::i()->get_memory_saved());
+
+	if (pivacy_pubkey_registry::i()->num_failures() > 0)
+	{
+		WARNING_MSG("%zu issuer public key(s) failed to load", pivacy_pubkey_registry::i()->num_failures());
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_credential_store::start_watching()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watching)
+	{
+		return true;
+	}
+
+	inotify_fd = inotify_init();
+
+	if (inotify_fd < 0)
+	{
+		ERROR_MSG("Failed to initialise inotify (%s)", strerror(errno));
+
+		return false;
+	}
+
+	if (inotify_add_watch(inotify_fd, credential_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0)
+	{
+		ERROR_MSG("Failed to watch %s (%s)", credential_dir.c_str(), strerror(errno));
+
+		close(inotify_fd);
+		inotify_fd = -1;
+
+		return false;
+	}
+
+	if (pipe(cancel_pipe) != 0)
+	{
+		ERROR_MSG("Failed to create the credential watcher cancellation pipe");
+
+		close(inotify_fd);
+		inotify_fd = -1;
+
+		return false;
+	}
+
+	if (pthread_create(&watcher_thread, NULL, watcher_thread_entry, this) != 0)
+	{
+		ERROR_MSG("Failed to start the credential watcher thread");
+
+		close(inotify_fd);
+		close(cancel_pipe[0]);
+		close(cancel_pipe[1]);
+
+		inotify_fd = cancel_pipe[0] = cancel_pipe[1] = -1;
+
+		return false;
+	}
+
+	watching = true;
+
+	INFO_MSG("Watching %s for changed credentials", credential_dir.c_str());
+
+	return true;
+#else // !HAVE_SYS_INOTIFY_H
+	WARNING_MSG("Watching the credential directory is not supported on this platform");
+
+	return false;
+#endif // HAVE_SYS_INOTIFY_H
+}
+
+void pivacy_cardemu_credential_store::stop_watching()
+{
+	if (!watching)
+	{
+		return;
+	}
+
+	char c = 0;
+
+	if (write(cancel_pipe[1], &c, 1) != 1)
+	{
+		ERROR_MSG("Failed to signal the credential watcher thread");
+	}
+
+	pthread_join(watcher_thread, NULL);
+
+	close(inotify_fd);
+	close(cancel_pipe[0]);
+	close(cancel_pipe[1]);
+
+	inotify_fd = cancel_pipe[0] = cancel_pipe[1] = -1;
+	watching = false;
+}
+
+void pivacy_cardemu_credential_store::start_warm_up()
+{
+	bool warm_up = true;
+
+	pivacy_conf_get_bool("emulation.credentials", "warm_up", warm_up, true);
+
+	if (!lazy || !warm_up || warm_up_running)
+	{
+		return;
+	}
+
+	warm_up_stop = false;
+
+	if (pthread_create(&warm_up_thread, NULL, warm_up_thread_entry, this) != 0)
+	{
+		ERROR_MSG("Failed to start the credential warm-up thread");
+
+		return;
+	}
+
+	warm_up_running = true;
+}
+
+void pivacy_cardemu_credential_store::stop_warm_up()
+{
+	if (!warm_up_running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&warm_up_mutex);
+
+	warm_up_stop = true;
+
+	pthread_cond_signal(&warm_up_cond);
+	pthread_mutex_unlock(&warm_up_mutex);
+
+	pthread_join(warm_up_thread, NULL);
+
+	warm_up_running = false;
+}
+
+pivacy_cardemu_credential_set* pivacy_cardemu_credential_store::acquire()
+{
+	/*
+	 * While a reader is between reading the current set and adding a
+	 * reference to it, reclaim() does not delete any retired sets
+	 */
+	__sync_fetch_and_add(&readers, 1);
+
+	/* An atomic read of the current set */
+	pivacy_cardemu_credential_set* set = __sync_val_compare_and_swap(&current, (pivacy_cardemu_credential_set*) NULL, (pivacy_cardemu_credential_set*) NULL);
+
+	if (set != NULL)
+	{
+		set->add_ref();
+	}
+
+	__sync_fetch_and_sub(&readers, 1);
+
+	return set;
+}
+
+void pivacy_cardemu_credential_store::release(pivacy_cardemu_credential_set* set)
+{
+	if (set != NULL)
+	{
+		set->drop_ref();
+	}
+}
+
+void pivacy_cardemu_credential_store::load_files(const std::set<std::string>& names, std::map<std::string, credential_file*>& loaded)
+{
+	if (names.empty())
+	{
+		return;
+	}
+
+	std::vector<pending_file> pending(names.size());
+	size_t index = 0;
+
+	for (std::set<std::string>::const_iterator i = names.begin(); i != names.end(); i++, index++)
+	{
+		pending[index].name = *i;
+		pending[index].load_time = 0;
+	}
+
+	/* Phase 1: parse the credential files */
+	unsigned long long phase_start = pivacy_cardemu_metrics::now();
+
+	load_job job;
+
+	job.store = this;
+	job.phase = PHASE_PARSE;
+	job.count = pending.size();
+	job.next = 0;
+	job.pending = &pending;
+	job.key_files = NULL;
+	job.keys = NULL;
+
+	size_t threads = run_phase(job);
+
+	unsigned long long parse_time = pivacy_cardemu_metrics::now() - phase_start;
+
+	/*
+	 * Phase 2: load the distinct public keys the credentials refer to;
+	 * lazily loaded credentials load their key when they are first used
+	 */
+	phase_start = pivacy_cardemu_metrics::now();
+
+	std::set<std::string> distinct_key_files;
+
+	for (std::vector<pending_file>::iterator i = pending.begin(); i != pending.end() && !lazy; i++)
+	{
+		for (std::vector<pivacy_credential*>::iterator j = i->creds.begin(); j != i->creds.end(); j++)
+		{
+			distinct_key_files.insert((*j)->get_issuer_public_key_file_name());
+		}
+	}
+
+	std::vector<std::string> key_files(distinct_key_files.begin(), distinct_key_files.end());
+	std::vector<silvia_pub_key*> keys(key_files.size(), (silvia_pub_key*) NULL);
+
+	job.phase = PHASE_KEYS;
+	job.count = key_files.size();
+	job.next = 0;
+	job.key_files = &key_files;
+	job.keys = &keys;
+
+	run_phase(job);
+
+	unsigned long long key_time = pivacy_cardemu_metrics::now() - phase_start;
+
+	/*
+	 * Phase 3: prepare the proof contexts in the order of the file names,
+	 * so conflicts and the fixed-base memory budget are resolved the same
+	 * way every time; the public keys are taken from the registry
+	 */
+	phase_start = pivacy_cardemu_metrics::now();
+
+	for (std::vector<pending_file>::iterator i = pending.begin(); i != pending.end(); i++)
+	{
+		if (!i->creds.empty())
+		{
+			loaded[i->name] = prepare_file(*i);
+		}
+		else if (i->load_time > 0)
+		{
+			pivacy_cardemu_metrics::i()->record_credential_load(pivacy_cardemu_metrics::now() - i->load_time, false);
+		}
+	}
+
+	unsigned long long prepare_time = pivacy_cardemu_metrics::now() - phase_start;
+
+	/* The credentials now hold their own references to the keys */
+	for (std::vector<silvia_pub_key*>::iterator i = keys.begin(); i != keys.end(); i++)
+	{
+		if (*i != NULL)
+		{
+			pivacy_pubkey_registry::i()->release(*i);
+		}
+	}
+
+	INFO_MSG("Loaded %zu of %zu file(s) using %zu thread(s): parsing took %llums, loading %zu public key(s) took %llums, preparing proofs took %llums", loaded.size(), pending.size(), threads, parse_time / 1000, key_files.size(), key_time / 1000, prepare_time / 1000);
+}
+
+size_t pivacy_cardemu_credential_store::run_phase(load_job& job)
+{
+	size_t num_threads = (job.count < load_threads) ? job.count : load_threads;
+
+	/* Small batches (e.g. a single changed file) are loaded in this thread */
+	if (num_threads <= 1)
+	{
+		loader_thread_entry(&job);
+
+		return 1;
+	}
+
+	std::vector<pthread_t> threads(num_threads - 1);
+	size_t started = 0;
+
+	for (; started < threads.size(); started++)
+	{
+		if (pthread_create(&threads[started], NULL, loader_thread_entry, &job) != 0)
+		{
+			WARNING_MSG("Failed to start a credential loader thread");
+
+			break;
+		}
+	}
+
+	/* This thread works as well */
+	loader_thread_entry(&job);
+
+	for (size_t i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	return started + 1;
+}
+
+/*static*/ void* pivacy_cardemu_credential_store::loader_thread_entry(void* arg)
+{
+	load_job* job = (load_job*) arg;
+	size_t i;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count)
+	{
+		switch(job->phase)
+		{
+		case PHASE_PARSE:
+			job->store->parse_file((*job->pending)[i]);
+			break;
+		case PHASE_KEYS:
+			(*job->keys)[i] = pivacy_pubkey_registry::i()->acquire((*job->key_files)[i], job->store->credential_dir);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+void pivacy_cardemu_credential_store::parse_file(pending_file& file)
+{
+	std::string full_path = credential_dir + "/" + file.name;
+	struct stat entry_status;
+
+	if (lstat(full_path.c_str(), &entry_status) || !S_ISREG(entry_status.st_mode))
+	{
+		return;
+	}
+
+	unsigned long long load_start = pivacy_cardemu_metrics::now();
+
+	if (pivacy_cred_bin_store::is_bin_store(full_path))
+	{
+		pivacy_cred_bin_store store;
+
+		if (store.open(full_path))
+		{
+			for (size_t i = 0; i < store.size(); i++)
+			{
+				pivacy_credential* cred = store.read_credential(i, lazy);
+
+				if (cred != NULL)
+				{
+					file.creds.push_back(cred);
+				}
+			}
+		}
+	}
+	else
+	{
+		// Attempt to read the file as if it were a credential
+		std::string error;
+		pivacy_credential* cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(full_path, lazy, &error);
+
+		if (cred != NULL)
+		{
+			file.creds.push_back(cred);
+		}
+		else if (!error.empty())
+		{
+			WARNING_MSG("Ignoring malformed credential %s", error.c_str());
+		}
+	}
+
+	file.mtime = entry_status.st_mtime;
+	file.size = entry_status.st_size;
+	file.load_time = pivacy_cardemu_metrics::now() - load_start;
+}
+
+pivacy_cardemu_credential_store::credential_file* pivacy_cardemu_credential_store::prepare_file(pending_file& pending)
+{
+	unsigned long long prepare_start = pivacy_cardemu_metrics::now();
+
+	credential_file* file = new credential_file();
+
+	file->creds = pending.creds;
+	file->mtime = pending.mtime;
+	file->size = pending.size;
+
+	if (file->creds.size() > 1)
+	{
+		DEBUG_MSG("Credential store %s holds %zu credentials", pending.name.c_str(), file->creds.size());
+	}
+
+	for (std::vector<pivacy_credential*>::iterator i = file->creds.begin(); i != file->creds.end(); i++)
+	{
+		pivacy_credential* cred = *i;
+		pivacy_cardemu_proof_context* ctx = NULL;
+
+		if (lazy)
+		{
+			DEBUG_MSG("Found credential %s issued by %s, loading it when it is first used", cred->get_name().c_str(), cred->get_issuer().c_str());
+
+			file->ctxs.push_back(new pivacy_cardemu_proof_context(cred, credential_dir + "/" + pending.name, credential_dir));
+
+			continue;
+		}
+
+		// Attempt to read the public key belonging to the credential
+		if (cred->get_issuer_public_key(credential_dir) != NULL)
+		{
+			INFO_MSG("Successfully loaded credential %s issued by %s", cred->get_name().c_str(), cred->get_issuer().c_str());
+
+			const pivacy_fixed_base* fixed_base = cred->get_issuer_fixed_base();
+
+			if (fixed_base->num_tables() < fixed_base->num_bases())
+			{
+				WARNING_MSG("Fixed-base memory budget exceeded, %zu of %zu bases of the public key for %s use the generic path", fixed_base->num_bases() - fixed_base->num_tables(), fixed_base->num_bases(), cred->get_name().c_str());
+			}
+
+			DEBUG_MSG("Fixed-base tables for the public key for %s use %zu bytes", cred->get_name().c_str(), fixed_base->get_memory_usage());
+
+			ctx = new pivacy_cardemu_proof_context(cred);
+		}
+
+		file->ctxs.push_back(ctx);
+	}
+
+	/* Record the time spent on this file, excluding time spent waiting for other files */
+	pending.load_time += pivacy_cardemu_metrics::now() - prepare_start;
+
+	pivacy_cardemu_metrics::i()->record_credential_load(pivacy_cardemu_metrics::now() - pending.load_time, num_usable(file) == file->creds.size());
+
+	return file;
+}
+
+/*static*/ size_t pivacy_cardemu_credential_store::num_usable(credential_file* file)
+{
+	size_t usable = 0;
+
+	for (std::vector<pivacy_cardemu_proof_context*>::iterator i = file->ctxs.begin(); i != file->ctxs.end(); i++)
+	{
+		if (*i != NULL)
+		{
+			usable++;
+		}
+	}
+
+	return usable;
+}
+
+void pivacy_cardemu_credential_store::free_file(credential_file* file)
+{
+	for (std::vector<pivacy_cardemu_proof_context*>::iterator i = file->ctxs.begin(); i != file->ctxs.end(); i++)
+	{
+		if (*i != NULL)
+		{
+			/* Make sure no background work uses the context any more */
+			speculator.forget(*i);
+			pool.remove_credential(*i);
+
+			delete *i;
+		}
+	}
+
+	for (std::vector<pivacy_credential*>::iterator i = file->creds.begin(); i != file->creds.end(); i++)
+	{
+		delete *i;
+	}
+
+	delete file;
+}
+
+void pivacy_cardemu_credential_store::reload(const std::set<std::string>& names)
+{
+	bool changed = false;
+
+	/* A missing public key may have been added */
+	pivacy_pubkey_registry::i()->forget_failures();
+
+	/* Also retry credentials for which the public key failed to load */
+	std::set<std::string> retry;
+
+	for (std::map<std::string, credential_file*>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		if ((num_usable(i->second) < i->second->creds.size()) && (names.find(i->first) == names.end()))
+		{
+			retry.insert(i->first);
+		}
+	}
+
+	std::set<std::string> load_names(names);
+	std::map<std::string, credential_file*> loaded;
+
+	load_names.insert(retry.begin(), retry.end());
+
+	load_files(load_names, loaded);
+
+	for (std::set<std::string>::const_iterator i = names.begin(); i != names.end(); i++)
+	{
+		std::map<std::string, credential_file*>::iterator old_file = files.find(*i);
+		std::map<std::string, credential_file*>::iterator new_file = loaded.find(*i);
+
+		/* The old version may still be in use by a proof */
+		if (old_file != files.end())
+		{
+			DEBUG_MSG("Credential file %s %s", i->c_str(), (new_file != loaded.end()) ? "changed" : "was removed");
+
+			retired_files.push_back(old_file->second);
+			files.erase(old_file);
+
+			changed = true;
+		}
+
+		if (new_file != loaded.end())
+		{
+			files[*i] = new_file->second;
+
+			changed = true;
+		}
+	}
+
+	for (std::set<std::string>::iterator i = retry.begin(); i != retry.end(); i++)
+	{
+		std::map<std::string, credential_file*>::iterator new_file = loaded.find(*i);
+
+		if (new_file == loaded.end())
+		{
+			continue;
+		}
+
+		if (num_usable(new_file->second) > num_usable(files[*i]))
+		{
+			retired_files.push_back(files[*i]);
+			files[*i] = new_file->second;
+
+			changed = true;
+		}
+		else
+		{
+			free_file(new_file->second);
+		}
+	}
+
+	if (changed)
+	{
+		publish();
+	}
+}
+
+bool pivacy_cardemu_credential_store::rescan()
+{
+	DIR* dir = opendir(credential_dir.c_str());
+
+	if (dir == NULL)
+	{
+		return false;
+	}
+
+	std::set<std::string> present;
+	std::set<std::string> changed;
+	struct dirent* entry = NULL;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		std::string name(entry->d_name);
+		std::string full_path = credential_dir + "/" + name;
+		struct stat entry_status;
+
+		if (lstat(full_path.c_str(), &entry_status) || !S_ISREG(entry_status.st_mode))
+		{
+			continue;
+		}
+
+		present.insert(name);
+
+		std::map<std::string, credential_file*>::iterator file = files.find(name);
+
+		if ((file == files.end()) ||
+		    (file->second->mtime != entry_status.st_mtime) ||
+		    (file->second->size != entry_status.st_size))
+		{
+			changed.insert(name);
+		}
+	}
+
+	closedir(dir);
+
+	for (std::map<std::string, credential_file*>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		if (present.find(i->first) == present.end())
+		{
+			changed.insert(i->first);
+		}
+	}
+
+	reload(changed);
+
+	return true;
+}
+
+void pivacy_cardemu_credential_store::publish()
+{
+	pivacy_cardemu_credential_set* set = new pivacy_cardemu_credential_set(++generation);
+
+	for (std::map<std::string, credential_file*>::iterator i = files.begin(); i != files.end(); i++)
+	{
+		for (std::vector<pivacy_cardemu_proof_context*>::iterator j = i->second->ctxs.begin(); j != i->second->ctxs.end(); j++)
+		{
+			pivacy_cardemu_proof_context* ctx = *j;
+			pivacy_cardemu_proof_context* conflict = NULL;
+
+			if (ctx == NULL)
+			{
+				continue;
+			}
+
+			if (!set->add(ctx, conflict))
+			{
+				ERROR_MSG("Credential %s issued by %s (ID 0x%04X) conflicts with credential %s issued by %s (ID 0x%04X), ignoring it", ctx->get_credential()->get_name().c_str(), ctx->get_credential()->get_issuer().c_str(), ctx->get_credential_id(), conflict->get_credential()->get_name().c_str(), conflict->get_credential()->get_issuer().c_str(), conflict->get_credential_id());
+			}
+			else if (ctx->is_materialized())
+			{
+				pool.add_credential(ctx);
+			}
+		}
+	}
+
+	/* The store holds a reference to the current set */
+	set->add_ref();
+
+	__sync_synchronize();
+
+	pivacy_cardemu_credential_set* old_set = __sync_lock_test_and_set(&current, set);
+
+	__sync_synchronize();
+
+	if (old_set != NULL)
+	{
+		old_set->drop_ref();
+
+		retired_sets.push_back(old_set);
+	}
+
+	INFO_MSG("Credential set %lu has %zu credential(s)", set->get_generation(), set->size());
+
+	/* Wake up the warm-up thread */
+	pthread_mutex_lock(&warm_up_mutex);
+	pthread_cond_signal(&warm_up_cond);
+	pthread_mutex_unlock(&warm_up_mutex);
+
+	reclaim();
+}
+
+void pivacy_cardemu_credential_store::reclaim()
+{
+	/* A reader may be about to add a reference to a retired set */
+	if (__sync_fetch_and_add(&readers, 0) != 0)
+	{
+		return;
+	}
+
+	std::vector<pivacy_cardemu_credential_set*>::iterator i = retired_sets.begin();
+
+	while (i != retired_sets.end())
+	{
+		if (!(*i)->is_referenced())
+		{
+			DEBUG_MSG("Deleting credential set %lu", (*i)->get_generation());
+
+			delete *i;
+
+			i = retired_sets.erase(i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	/* Retired files can only be in retired sets */
+	if (retired_sets.empty())
+	{
+		for (std::vector<credential_file*>::iterator j = retired_files.begin(); j != retired_files.end(); j++)
+		{
+			free_file(*j);
+		}
+
+		retired_files.clear();
+	}
+}
+
+/*static*/ void* pivacy_cardemu_credential_store::watcher_thread_entry(void* arg)
+{
+	((pivacy_cardemu_credential_store*) arg)->watcher_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_credential_store::watcher_loop()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	DEBUG_MSG("Entering credential watcher thread");
+
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	std::set<std::string> changed;
+	bool overflow = false;
+	struct pollfd fds[2];
+
+	fds[0].fd = inotify_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancel_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		int timeout = -1;
+
+		if (!changed.empty() || overflow)
+		{
+			timeout = RELOAD_SETTLE_TIME;
+		}
+		else if (!retired_sets.empty() || !retired_files.empty())
+		{
+			timeout = RECLAIM_INTERVAL;
+		}
+
+		fds[0].revents = fds[1].revents = 0;
+
+		int rv = poll(fds, 2, timeout);
+
+		if (rv < 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG("Credential watcher failed (%s)", strerror(errno));
+
+			break;
+		}
+
+		if (fds[1].revents != 0)
+		{
+			break;
+		}
+
+		if (rv == 0)
+		{
+			/* The directory has been quiet for a while */
+			if (overflow)
+			{
+				WARNING_MSG("Missed changes to %s, rescanning all credentials", credential_dir.c_str());
+
+				rescan();
+			}
+			else if (!changed.empty())
+			{
+				reload(changed);
+			}
+
+			changed.clear();
+			overflow = false;
+
+			reclaim();
+
+			continue;
+		}
+
+		ssize_t len = read(inotify_fd, buf, sizeof(buf));
+
+		if (len <= 0)
+		{
+			continue;
+		}
+
+		for (char* p = buf; p < buf + len;)
+		{
+			struct inotify_event* event = (struct inotify_event*) p;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				overflow = true;
+			}
+			else if (event->len > 0)
+			{
+				changed.insert(std::string(event->name));
+			}
+
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	DEBUG_MSG("Exiting credential watcher thread");
+#endif // HAVE_SYS_INOTIFY_H
+}
+
+/*static*/ void* pivacy_cardemu_credential_store::warm_up_thread_entry(void* arg)
+{
+	((pivacy_cardemu_credential_store*) arg)->warm_up_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_credential_store::warm_up_loop()
+{
+	DEBUG_MSG("Entering credential warm-up thread");
+
+	pthread_mutex_lock(&warm_up_mutex);
+
+	while (!warm_up_stop)
+	{
+		pivacy_cardemu_credential_set* set = acquire();
+
+		if ((set == NULL) || (set->get_generation() == warm_up_generation))
+		{
+			release(set);
+
+			pthread_cond_wait(&warm_up_cond, &warm_up_mutex);
+
+			continue;
+		}
+
+		pthread_mutex_unlock(&warm_up_mutex);
+
+		unsigned long long warm_up_start = pivacy_cardemu_metrics::now();
+		size_t materialized = 0;
+
+		const std::vector<pivacy_cardemu_proof_context*>& contexts = set->get_contexts();
+
+		for (std::vector<pivacy_cardemu_proof_context*>::const_iterator i = contexts.begin(); i != contexts.end(); i++)
+		{
+			if (warm_up_must_stop())
+			{
+				break;
+			}
+
+			if (!(*i)->is_materialized() && (*i)->materialize())
+			{
+				pool.add_credential(*i);
+
+				materialized++;
+			}
+		}
+
+		if (materialized > 0)
+		{
+			INFO_MSG("Materialized %zu credential(s) of credential set %lu in the background in %llums", materialized, set->get_generation(), (pivacy_cardemu_metrics::now() - warm_up_start) / 1000);
+		}
+
+		pthread_mutex_lock(&warm_up_mutex);
+
+		warm_up_generation = set->get_generation();
+
+		release(set);
+	}
+
+	pthread_mutex_unlock(&warm_up_mutex);
+
+	DEBUG_MSG("Exiting credential warm-up thread");
+}
+
+bool pivacy_cardemu_credential_store::warm_up_must_stop()
+{
+	pthread_mutex_lock(&warm_up_mutex);
+
+	bool rv = warm_up_stop;
+
+	pthread_mutex_unlock(&warm_up_mutex);
+
+	return rv;
+}
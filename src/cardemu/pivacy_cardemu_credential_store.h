@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_credential_store.h
+
+ Loads the credentials from the credential directory and reloads changed
+ credentials in the background; readers always get an immutable snapshot
+ of the credential set. In lazy mode only the credential headers are read
+ up front and the credentials are materialized when they are first used
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_CREDENTIAL_STORE_H
+#define _PIVACY_CARDEMU_CREDENTIAL_STORE_H
+
+#include "pivacy_credential.h"
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cardemu_credential_set.h"
+#include "pivacy_cardemu_precompute.h"
+#include "pivacy_cardemu_speculator.h"
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+/**
+ * Credential store
+ */
+class pivacy_cardemu_credential_store
+{
+public:
+	/**
+	 * Constructor
+	 * @param pool the pool that precomputes proofs for the credentials
+	 * @param speculator the speculative prover that uses the credentials
+	 */
+	pivacy_cardemu_credential_store(pivacy_cardemu_precompute_pool& pool, pivacy_cardemu_speculator& speculator);
+
+	/**
+	 * Destructor; stops watching and deletes all credentials
+	 */
+	~pivacy_cardemu_credential_store();
+
+	/**
+	 * Load all credentials in a directory and publish the first
+	 * credential set
+	 * @param credential_dir the credential directory
+	 * @return false if the directory could not be read
+	 */
+	bool load(const std::string& credential_dir);
+
+	/**
+	 * Start watching the credential directory for changes; changed
+	 * credentials are reloaded in a background thread
+	 * @return true if the directory is being watched
+	 */
+	bool start_watching();
+
+	/**
+	 * Stop watching the credential directory
+	 */
+	void stop_watching();
+
+	/**
+	 * Start materializing lazily loaded credentials in a background
+	 * thread; does nothing unless lazy loading and warm-up are enabled
+	 */
+	void start_warm_up();
+
+	/**
+	 * Stop materializing credentials in the background
+	 */
+	void stop_warm_up();
+
+	/**
+	 * Get a reference to the current credential set; this never blocks
+	 * @return the current credential set (release with release()), or
+	 *         NULL if no credentials were loaded
+	 */
+	pivacy_cardemu_credential_set* acquire();
+
+	/**
+	 * Release a credential set obtained with acquire()
+	 * @param set the credential set (may be NULL)
+	 */
+	void release(pivacy_cardemu_credential_set* set);
+
+private:
+	/*
+	 * A file in the credential directory that holds credentials; an XML
+	 * credential file holds one, a binary credential store any number
+	 */
+	struct credential_file
+	{
+		std::vector<pivacy_credential*> creds;
+		std::vector<pivacy_cardemu_proof_context*> ctxs;	/* NULL if the public key failed to load */
+		time_t mtime;
+		off_t size;
+	};
+
+	/* A file that is being loaded */
+	struct pending_file
+	{
+		std::string name;
+		std::vector<pivacy_credential*> creds;
+		time_t mtime;
+		off_t size;
+		unsigned long long load_time;
+	};
+
+	/* Loading phases that run in parallel */
+	enum load_phase
+	{
+		PHASE_PARSE,
+		PHASE_KEYS
+	};
+
+	/* Shared state of the threads running a loading phase */
+	struct load_job
+	{
+		pivacy_cardemu_credential_store* store;
+		load_phase phase;
+		size_t count;
+		volatile size_t next;
+		std::vector<pending_file>* pending;
+		std::vector<std::string>* key_files;
+		std::vector<silvia_pub_key*>* keys;
+	};
+
+	/**
+	 * Load credential files; the files are parsed and their public keys
+	 * loaded in parallel, after which the proof contexts are prepared in
+	 * the order of the file names
+	 * @param names the names of the files in the credential directory
+	 * @param loaded receives the files that contain credentials
+	 */
+	void load_files(const std::set<std::string>& names, std::map<std::string, credential_file*>& loaded);
+
+	/**
+	 * Run a loading phase on up to load_threads threads
+	 * @param job the phase to run
+	 * @return the number of threads used
+	 */
+	size_t run_phase(load_job& job);
+
+	/**
+	 * Loader thread entry point
+	 */
+	static void* loader_thread_entry(void* arg);
+
+	/**
+	 * Read a credential file or binary credential store (thread-safe)
+	 * @param file the file; receives the credentials that could be read
+	 */
+	void parse_file(pending_file& file);
+
+	/**
+	 * Prepare proof contexts for the credentials that were read
+	 * @param file the file
+	 * @return the loaded file
+	 */
+	credential_file* prepare_file(pending_file& file);
+
+	/**
+	 * Count the credentials in a file that can be used for proofs
+	 * @param file the file
+	 * @return the number of credentials with a proof context
+	 */
+	static size_t num_usable(credential_file* file);
+
+	/**
+	 * Delete a credential file that is no longer in any credential set
+	 * @param file the file
+	 */
+	void free_file(credential_file* file);
+
+	/**
+	 * Reload changed files
+	 * @param names the names of the files that changed
+	 */
+	void reload(const std::set<std::string>& names);
+
+	/**
+	 * Reload all files that changed since they were loaded
+	 * @return false if the credential directory could not be read
+	 */
+	bool rescan();
+
+	/**
+	 * Build a new credential set from the loaded files and publish it
+	 */
+	void publish();
+
+	/**
+	 * Delete retired credential sets and files that are no longer in use
+	 */
+	void reclaim();
+
+	/**
+	 * Watcher thread entry point
+	 */
+	static void* watcher_thread_entry(void* arg);
+
+	/**
+	 * Watcher thread main loop
+	 */
+	void watcher_loop();
+
+	/**
+	 * Warm-up thread entry point
+	 */
+	static void* warm_up_thread_entry(void* arg);
+
+	/**
+	 * Warm-up thread main loop; materializes the credentials of every
+	 * newly published credential set
+	 */
+	void warm_up_loop();
+
+	/**
+	 * Check if the warm-up thread must stop
+	 * @return true if the warm-up thread must stop
+	 */
+	bool warm_up_must_stop();
+
+	std::string credential_dir;
+
+	/* Maximum number of threads used to load credentials */
+	size_t load_threads;
+
+	/* Only read the credential headers up front */
+	bool lazy;
+
+	/* Loaded files; only used by the loading thread */
+	std::map<std::string, credential_file*> files;
+
+	/* The current credential set */
+	pivacy_cardemu_credential_set* volatile current;
+	unsigned long generation;
+
+	/* Number of readers in acquire() */
+	volatile unsigned long readers;
+
+	/* Replaced credential sets and files that may still be in use */
+	std::vector<pivacy_cardemu_credential_set*> retired_sets;
+	std::vector<credential_file*> retired_files;
+
+	/* Users of the proof contexts */
+	pivacy_cardemu_precompute_pool& pool;
+	pivacy_cardemu_speculator& speculator;
+
+	/* Watcher state */
+	int inotify_fd;
+	int cancel_pipe[2];
+	pthread_t watcher_thread;
+	bool watching;
+
+	/* Warm-up state */
+	pthread_t warm_up_thread;
+	pthread_mutex_t warm_up_mutex;
+	pthread_cond_t warm_up_cond;
+	bool warm_up_running;
+	bool warm_up_stop;
+	unsigned long warm_up_generation;
+};
+
+#endif // !_PIVACY_CARDEMU_CREDENTIAL_STORE_H
+
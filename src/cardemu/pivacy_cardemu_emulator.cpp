@@ -35,30 +35,32 @@
 #include "pivacy_log.h"
 #include "pivacy_errors.h"
 #include "pivacy_config.h"
-#include "pivacy_cred_xml_rw.h"
 #include "silvia_parameters.h"
-#include "silvia_prover.h"
+#include "pivacy_cardemu_prover.h"
+#include "pivacy_fixed_base.h"
+#include "pivacy_multiexp.h"
+#include "pivacy_batch_exp.h"
 #include "pivacy_ui_lib.h"
-#include <dirent.h>
+#include "pivacy_cardemu_metrics.h"
+#include "pivacy_cardemu_consent_policy.h"
 #include <stdio.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <unistd.h>
 
 /* Status words */
-#define SW_OK								"9000"
-#define SW_LENGTH_ERROR						"6700"
-#define SW_SECURITY_STATUS_NOT_SATISFIED	"6982"
-#define SW_WRONG_STATE						"6985"
-#define SW_DATA_UNKNOWN						"6b00"
-#define SW_APPLICATION_UNKNOWN				"6a82"
-#define SW_PIN_INCORRECT					"63c0"
-#define SW_CREDENTIAL_UNKNOWN				"6a80"
-#define SW_ATTRIBUTE_UNKNOWN				"6a88"
-#define SW_ALREADY_SELECTED					"6986"
-#define SW_UNKNOWN_INS						"6d00"
-#define SW_UNKNOWN_CLA						"6e00"
-#define SW_UNKNOWN_ERROR					"6f00"
+#define SW_OK								0x9000
+#define SW_LENGTH_ERROR						0x6700
+#define SW_SECURITY_STATUS_NOT_SATISFIED	0x6982
+#define SW_WRONG_STATE						0x6985
+#define SW_DATA_UNKNOWN						0x6b00
+#define SW_APPLICATION_UNKNOWN				0x6a82
+#define SW_PIN_INCORRECT					0x63c0
+#define SW_CREDENTIAL_UNKNOWN				0x6a80
+#define SW_ATTRIBUTE_UNKNOWN				0x6a88
+#define SW_ALREADY_SELECTED					0x6986
+#define SW_UNKNOWN_INS						0x6d00
+#define SW_UNKNOWN_CLA						0x6e00
+#define SW_UNKNOWN_ERROR					0x6f00
 
 /* APDU classes */
 #define CLA_ISO					0x00
@@ -73,23 +75,177 @@
 #define INS_PROVE_SIGNATURE		0x2b
 #define INS_GET_RESPONSE		0x2c
 
-/* APDU offsets */
-#define	OFS_CLA					0
-#define OFS_INS					1
-#define OFS_P1					2
-#define OFS_P2					3
-#define OFS_LC					4
-#define OFS_CDATA				5
+/* PROVE COMMITMENT modes */
+#define P1_PROOF_COMMITMENT		0x00	/* Return c, the rest is retrieved separately */
+#define P1_PROOF_FULL			0x01	/* Return the full proof in one response */
 
 #define DEFAULT_USER_PIN		"00000000"
 #define DEFAULT_ADMIN_PIN		"000000000000"
 
-pivacy_cardemu_emulator::pivacy_cardemu_emulator()
+/*
+ * Relying party names shown to the user; APDUs do not identify the terminal,
+ * so a decision for all time applies to any terminal and is stored as such
+ */
+#define RP_NAME					"This terminal"
+#define RP_NAME_ANY				"Any terminal"
+
+/* The IRMA application identifier */
+static const unsigned char IRMA_AID[] = { 0xF8, 0x49, 0x52, 0x4D, 0x41, 0x63, 0x61, 0x72, 0x64 };
+
+// Version 0.8 + emu
+// 
+// Encoded as ISO7816 FCI record
+//
+// 0x6F YZ: FCI template (length: 0xYZ bytes)
+//   0xA5 YZ: Proprietary information encoded in BER-TLV (length: 0xYZ bytes)
+//     0x10 YZ: Sequence, version information (length: 0xYZ bytes)
+//       0x02 01: Integer, major (length: 0x01 byte)
+//       0x02 01: Integer, minor (length: 0x01 byte)
+//       0x02 01: Integer, maintenance (optional, length: 0x01 byte)
+//       0x02 01: Integer, build (optional, length: 0x01 byte)
+//       0x10 YZ: Sequence, extra information (optional, length: 0xYZ bytes)
+//         0x0C YZ: UTF-8 string, identifier (length: 0xYZ bytes)
+//         0x02 01: Integer, counter (optional, length: 0x01 byte)
+//         0x04 YZ: Octet string, data (optional, length: 0xYZ bytes)
+static const unsigned char SELECT_FCI[] =
+{
+	0x6F, 0x11,
+	  0xA5, 0x0F,
+	    0x10, 0x0D,
+	      0x02, 0x01, 0x00,					// major version = 0
+	      0x02, 0x01, 0x08,					// minor version = 8
+	      0x10, 0x07,
+	        0x0C, 0x03, 0x45, 0x4D, 0x55	// EMU
+};
+
+/* Does a PIN match the supplied command data? */
+static bool pin_matches(const bytestring& PIN, const unsigned char* data, size_t len)
+{
+	return (PIN.size() == len) && (len > 0) && (memcmp(&PIN[0], data, len) == 0);
+}
+
+/* Format data as hex for logging without allocating; long data is truncated */
+static const char* hex_for_log(const unsigned char* data, size_t len, char* buf, size_t buf_len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i = 0;
+	
+	for (; (i < len) && ((2 * i + 2) < buf_len); i++)
+	{
+		buf[2 * i] = hex[data[i] >> 4];
+		buf[2 * i + 1] = hex[data[i] & 0x0f];
+	}
+	
+	buf[2 * i] = '\0';
+	
+	return buf;
+}
+
+pivacy_cardemu_emulator::pivacy_cardemu_emulator() : speculator(precompute_pool), credential_store(precompute_pool, speculator)
 {
 	pivacy_ui_lib_init();
 	
+	active_set = NULL;
+	
+	/* Nothing is speculated on if loading the credentials fails below */
+	speculate = false;
+	use_ui = true;
+	ui_optional = false;
+	
 	reset();
 	
+	/* Set the memory budget for fixed-base tables before any public keys are loaded */
+	int fixed_base_budget = PIVACY_FIXED_BASE_DEFAULT_BUDGET / 1024;
+	
+	pivacy_conf_get_int("emulation.fixed_base", "memory_budget", fixed_base_budget, PIVACY_FIXED_BASE_DEFAULT_BUDGET / 1024);
+	
+	if (fixed_base_budget < 0)
+	{
+		fixed_base_budget = 0;
+	}
+	
+	pivacy_fixed_base_cache::i()->set_memory_budget((size_t) fixed_base_budget * 1024);
+	
+	/* Select constant-time proof arithmetic if requested */
+	bool constant_time = false;
+	
+	pivacy_conf_get_bool("emulation.arithmetic", "constant_time", constant_time, false);
+	
+	if (constant_time)
+	{
+		INFO_MSG("Using constant-time arithmetic for proofs");
+	}
+	
+	pivacy_multiexp::set_default_constant_time(constant_time);
+	
+	/* Batches of exponentiations use vector instructions unless disabled */
+	bool use_simd = true;
+	
+	pivacy_conf_get_bool("emulation.arithmetic", "simd", use_simd, true);
+	
+	if (!use_simd)
+	{
+		pivacy_batch_exp::set_backend(pivacy_batch_exp::BACKEND_SCALAR);
+	}
+	
+	INFO_MSG("Batched exponentiations use the %s backend (%zu lane(s))", pivacy_batch_exp::get_backend_name(pivacy_batch_exp::get_backend()), pivacy_batch_exp::get_lanes(pivacy_batch_exp::get_backend()));
+	
+	/* Keep proof temporaries in locked memory that is wiped after each proof */
+	bool use_arena = true;
+	bool lock_arena = true;
+	int arena_size = PIVACY_ARENA_DEFAULT_SIZE;
+	
+	pivacy_conf_get_bool("emulation.arena", "enable", use_arena, true);
+	pivacy_conf_get_bool("emulation.arena", "lock", lock_arena, true);
+	pivacy_conf_get_int("emulation.arena", "size", arena_size, PIVACY_ARENA_DEFAULT_SIZE);
+	
+	if (use_arena && (arena_size > 0) && proof_arena.init((size_t) arena_size * 1024, lock_arena))
+	{
+		INFO_MSG("Proofs are computed in a %dKB memory arena", arena_size);
+	}
+	
+	/* Split the exponentiations of a proof over several threads; the thread computing the proof is one of them */
+	int threads = 0;
+	
+	pivacy_conf_get_int("emulation.arithmetic", "threads", threads, 0);
+	
+	if (threads <= 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		
+		threads = (cpus > 0) ? (int) cpus : 1;
+	}
+	
+	if ((threads > 1) && task_pool.start((size_t) threads - 1))
+	{
+		INFO_MSG("Proofs are computed on %d threads", threads);
+		
+		pivacy_cardemu_prover::set_task_pool(&task_pool);
+	}
+	
+	/* Set up the UI before loading credentials; APDUs need it even if that fails */
+	pivacy_conf_get_bool("ui", "enable", use_ui, true);
+	pivacy_conf_get_bool("ui", "optional", ui_optional, false);
+	
+	/* A disabled UI cannot be mandatory */
+	if (!use_ui)
+	{
+		ui_optional = true;
+	}
+	
+	INFO_MSG("The Pivacy UI is %s", use_ui ? "enabled" : "disabled");
+	INFO_MSG("Use of the Pivacy UI is %s", ui_optional ? "optional" : "mandatory");
+	
+	/*
+	 * The UI library connects in the background, so APDUs never wait for it;
+	 * the callback runs on its thread while credentials are still loading, so
+	 * it may only use state that is safe to share (the log and the metrics)
+	 */
+	if (use_ui && (pivacy_ui_auto_connect(&ui_state_changed, this) != PRV_OK))
+	{
+		ERROR_MSG("Failed to start connecting to the Pivacy UI");
+	}
+	
 	/* Load credentials */
 	std::string credential_dir;
 	
@@ -100,181 +256,172 @@ pivacy_cardemu_emulator::pivacy_cardemu_emulator()
 		return;
 	}
 	
-	/* 
-	 * Enumerate all files in the directory and tried to load all
-	 * files with the extension .xml as if they were a pivacy
-	 * credential
-	 */
-	DIR* dir = opendir(credential_dir.c_str());
-	
-	if (dir == NULL)
+	if (!credential_store.load(credential_dir))
 	{
-		ERROR_MSG("Failed to open directory %s, cannot load credentials", credential_dir.c_str());
-		
 		return;
 	}
 	
-	struct dirent* entry = NULL;
+	/* Make sure proofs never need to grow the per-proof buffers */
+	switch_credential_set();
 	
-	while ((entry = readdir(dir)) != NULL)
+	/* Start precomputing proofs in the background */
+	precompute_pool.start();
+	
+	pivacy_conf_get_bool("emulation.precompute", "speculate", speculate, true);
+	
+	if (speculate)
 	{
-		// Check if this is the . or .. entry
-		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
-		{
-			continue;
-		}
+		INFO_MSG("Proofs will be prepared while waiting for user consent");
 		
-		// Convert the name of the entry to a C++ string
-		std::string name(entry->d_name);
-		bool is_regular_file = false;
-
-#if defined(_DIRENT_HAVE_D_TYPE) && defined(_BSD_SOURCE)
-		// Determine the type of the entry
-		switch(entry->d_type)
-		{
-		case DT_DIR:
-			// Do nothing
-			break;
-		case DT_REG:
-			// This is a regular file
-			is_regular_file = true;
-			break;
-		default:
-			// Do nothing
-			break;
-		}
-#else
-		// The entry type has to be determined using lstat
-		struct stat entry_status;
-
-		std::string full_path = credential_dir + "/" + name;
-
-		if (!lstat(full_path.c_str(), &entry_status))
-		{
-			if (S_ISDIR(entry_status.st_mode))
-			{
-				// Do nothing
-			}
-			else if (S_ISREG(entry_status.st_mode))
-			{
-				is_regular_file = true;
-			}
-			else
-			{
-				// Do nothing
-			}
-		}
-#endif
-
-		if (is_regular_file)
-		{
-			// Attempt to read the file as if it were a credential
-			pivacy_credential* cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(credential_dir + "/" + name);
-			
-			if (cred != NULL)
-			{
-				// Attempt to read the public key belonging to the credential
-				if (cred->get_issuer_public_key(credential_dir) != NULL)
-				{
-					INFO_MSG("Successfully loaded credential %s issued by %s", cred->get_name().c_str(), cred->get_issuer().c_str());
-				}
-				
-				credentials.push_back(cred);
-			}
-		}
+		speculator.start();
 	}
-
-	ui_connected = false;
 	
-	pivacy_conf_get_bool("ui", "enable", use_ui, true);
-	pivacy_conf_get_bool("ui", "optional", ui_optional, false);
+	/* Reload credentials when the credential directory changes */
+	bool watch = true;
 	
-	INFO_MSG("The Pivacy UI is %s", use_ui ? "enabled" : "disabled");
-	INFO_MSG("Use of the Pivacy UI is %s", ui_optional ? "optional" : "mandatory");
+	pivacy_conf_get_bool("emulation.credentials", "watch", watch, true);
 	
-	ui_connected = (pivacy_ui_connect() == PRV_OK);
+	if (watch)
+	{
+		credential_store.start_watching();
+	}
+	
+	/* Materialize lazily loaded credentials in the background */
+	credential_store.start_warm_up();
+	
+	/* Remember disclosures the user consents to for all time */
+	std::string policy_file;
 	
-	if (ui_connected)
+	pivacy_conf_get_string("emulation.consent", "policy_file", policy_file, "");
+	
+	if (!policy_file.empty())
 	{
-		pivacy_ui_show_status(PIVACY_STATE_WAIT);
+		pivacy_cardemu_consent_policy::i()->open(policy_file);
 	}
 }
 	
 pivacy_cardemu_emulator::~pivacy_cardemu_emulator()
 {
-	for (std::vector<pivacy_credential*>::iterator i = credentials.begin(); i != credentials.end(); i++)
-	{
-		delete *i;
-	}
+	/* The precomputation threads use the credentials; the store deletes them */
+	credential_store.stop_warm_up();
+	credential_store.stop_watching();
+	credential_store.release(active_set);
+	active_set = NULL;
+	
+	speculator.stop();
+	precompute_pool.stop();
+	
+	pivacy_cardemu_prover::set_task_pool(NULL);
+	task_pool.stop();
 	
 	pivacy_ui_lib_uninit();
 }
 
-void pivacy_cardemu_emulator::process_apdu(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_apdu(const unsigned char* c_apdu, size_t c_len, pivacy_cardemu_response& r_apdu)
 {
-	if (!ui_connected)
+	unsigned long long start = pivacy_cardemu_metrics::now();
+	
+	dispatch_apdu(c_apdu, c_len, r_apdu);
+	
+	/* Never return a truncated response */
+	if (r_apdu.overflowed())
 	{
-		if ((pivacy_ui_connect() != PRV_OK) && !ui_optional)
-		{
-			ERROR_MSG("Not connected to the UI");
-			
-			r_apdu = SW_UNKNOWN_ERROR;
-			
-			return;
-		}
+		ERROR_MSG("Response does not fit in the R-APDU buffer");
 		
+		r_apdu.set_sw(SW_UNKNOWN_ERROR);
+	}
+	
+	pivacy_cardemu_metrics::i()->record_apdu((c_len > 0) ? c_apdu[0] : 0, (c_len > 1) ? c_apdu[1] : 0, start, r_apdu.get_sw());
+}
+
+/*static*/ void pivacy_cardemu_emulator::ui_state_changed(int connected, void* /* cb_data */)
+{
+	if (connected)
+	{
 		INFO_MSG("Connected to the Pivacy UI");
 		
-		ui_connected = true;
+		unsigned long long ui_start = pivacy_cardemu_metrics::now();
+		
+		pivacy_ui_show_status_async(PIVACY_STATE_WAIT);
+		
+		pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_STATUS);
+	}
+	else
+	{
+		WARNING_MSG("Lost the connection to the Pivacy UI, reconnecting in the background");
+	}
+}
+
+void pivacy_cardemu_emulator::dispatch_apdu(const unsigned char* c_apdu, size_t c_len, pivacy_cardemu_response& r_apdu)
+{
+	/* Only a flag is read here; losing the UI is logged when it happens */
+	if (!ui_optional && !pivacy_ui_is_connected())
+	{
+		DEBUG_MSG("Not connected to the UI");
+		
+		r_apdu.set_sw(SW_UNKNOWN_ERROR);
+		
+		return;
+	}
+	
+	if (c_len < 4)
+	{
+		ERROR_MSG("Malformed command APDU of %zu bytes", c_len);
+		
+		r_apdu.set_sw(SW_UNKNOWN_ERROR);
+		
+		return;
 	}
 	
-	if (c_apdu.size() < 4)
+	pivacy_cardemu_apdu cmd;
+	
+	if (!cmd.parse(c_apdu, c_len))
 	{
-		ERROR_MSG("Malformed command APDU of %d bytes", c_apdu.size());
+		ERROR_MSG("Command APDU of %zu bytes has inconsistent lengths", c_len);
 		
-		r_apdu = SW_UNKNOWN_ERROR;
+		r_apdu.set_sw(SW_LENGTH_ERROR);
 		
 		return;
 	}
 	
-	switch(c_apdu[OFS_CLA])
+	switch(cmd.cla)
 	{
 	case CLA_ISO:
-		switch(c_apdu[OFS_INS])
+		switch(cmd.ins)
 		{
 		case INS_SELECT:
-			process_select(c_apdu, r_apdu);
+			process_select(cmd, r_apdu);
 			break;
 		case INS_VERIFY_PIN:
-			process_verify_pin(c_apdu, r_apdu);
+			process_verify_pin(cmd, r_apdu);
 			break;
 		default:
-			r_apdu = SW_UNKNOWN_INS;
+			r_apdu.set_sw(SW_UNKNOWN_INS);
 			break;
 		}
 		break;
 	case CLA_PRIVATE:
-		switch(c_apdu[OFS_INS])
+		switch(cmd.ins)
 		{
 		case INS_PROVE_CREDENTIAL:
-			process_prove_credential(c_apdu, r_apdu);
+			process_prove_credential(cmd, r_apdu);
 			break;
 		case INS_PROVE_COMMITMENT:
-			process_prove_commitment(c_apdu, r_apdu);
+			process_prove_commitment(cmd, r_apdu);
 			break;
 		case INS_PROVE_SIGNATURE:
-			process_prove_signature(c_apdu, r_apdu);
+			process_prove_signature(cmd, r_apdu);
 			break;
 		case INS_GET_RESPONSE:
-			process_get_response(c_apdu, r_apdu);
+			process_get_response(cmd, r_apdu);
 			break;
 		default:
-			r_apdu = SW_UNKNOWN_INS;
+			r_apdu.set_sw(SW_UNKNOWN_INS);
 			break;
 		}
 		break;
 	default:
-		r_apdu = SW_UNKNOWN_CLA;
+		r_apdu.set_sw(SW_UNKNOWN_CLA);
 	}
 }
 
@@ -283,106 +430,132 @@ void pivacy_cardemu_emulator::reset()
 	user_PIN_verified = false;
 	admin_PIN_verified = false;
 	
+	selected_context = NULL;
+	
+	credential_store.release(active_set);
+	active_set = NULL;
+	
 	reset_proof();
 }
 
+void pivacy_cardemu_emulator::switch_credential_set()
+{
+	credential_store.release(active_set);
+	active_set = credential_store.acquire();
+	
+	if (active_set != NULL)
+	{
+		curproof_D.reserve(active_set->get_max_attributes());
+		curproof_a_i_hat.reserve(active_set->get_max_attributes() + 1);
+		curproof_a_i.reserve(active_set->get_max_attributes());
+		curproof_attributes.reserve(active_set->get_max_attributes() + 1);
+		curproof_display_attributes.reserve(active_set->get_max_attributes());
+	}
+}
+
 void pivacy_cardemu_emulator::reset_proof()
 {
 	proof_started = false;
 	proof_have_context_and_D = false;
 	proof_proved = false;
 	
+	speculator.discard();
+	
 	curproof_D.clear();
-	curproof_context.wipe();
-	curproof_A_prime.wipe();
-	curproof_e_hat.wipe();
-	curproof_v_prime_hat.wipe();
-	curproof_attributes.clear();
+	pivacy_wipe_mpz(curproof_context);
+	pivacy_wipe_mpz(curproof_nonce);
+	curproof_display_attributes.clear();
+	
+	wipe_proof_output();
 }
 
-void pivacy_cardemu_emulator::process_select(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::wipe_proof_output()
 {
-	const bytestring IRMA_AID = "F849524D4163617264";
+	pivacy_wipe_mpz(curproof_c);
+	pivacy_wipe_mpz(curproof_A_prime);
+	pivacy_wipe_mpz(curproof_e_hat);
+	pivacy_wipe_mpz(curproof_v_prime_hat);
+	
+	/* The outputs outlive the arena */
+	pivacy_cardemu_arena::detach(curproof_c);
+	pivacy_cardemu_arena::detach(curproof_A_prime);
+	pivacy_cardemu_arena::detach(curproof_e_hat);
+	pivacy_cardemu_arena::detach(curproof_v_prime_hat);
+	
+	for (std::vector<mpz_class>::iterator i = curproof_a_i_hat.begin(); i != curproof_a_i_hat.end(); i++)
+	{
+		pivacy_wipe_mpz(*i);
+	}
 	
-	if (c_apdu.size() < 5)
+	curproof_a_i_hat.clear();
+	curproof_a_i.clear();
+	curproof_attributes.clear();
+	
+	if (proof_arena.is_enabled())
+	{
+		DEBUG_MSG("Proof arena high water mark: %zu bytes, overflows: %lu", proof_arena.get_high_water(), proof_arena.get_overflows());
+	}
+	
+	proof_arena.reset();
+}
+
+void pivacy_cardemu_emulator::process_select(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
+{
+	if (cmd.data_len == 0)
 	{
-		r_apdu = SW_LENGTH_ERROR;
+		r_apdu.set_sw(SW_LENGTH_ERROR);
 	}
-	else if (c_apdu.substr(OFS_CDATA, c_apdu[OFS_LC]) != IRMA_AID)
+	else if ((cmd.data_len != sizeof(IRMA_AID)) || (memcmp(cmd.data, IRMA_AID, sizeof(IRMA_AID)) != 0))
 	{
-		r_apdu = SW_APPLICATION_UNKNOWN;
+		r_apdu.set_sw(SW_APPLICATION_UNKNOWN);
 	}
 	else
 	{
-		// Version 0.8 + emu
-		// 
-		// Encoded as ISO7816 FCI record
-		//
-		// 0x6F YZ: FCI template (length: 0xYZ bytes)
-		//   0xA5 YZ: Proprietary information encoded in BER-TLV (length: 0xYZ bytes)
-		//     0x10 YZ: Sequence, version information (length: 0xYZ bytes)
-		//       0x02 01: Integer, major (length: 0x01 byte)
-		//       0x02 01: Integer, minor (length: 0x01 byte)
-		//       0x02 01: Integer, maintenance (optional, length: 0x01 byte)
-		//       0x02 01: Integer, build (optional, length: 0x01 byte)
-		//       0x10 YZ: Sequence, extra information (optional, length: 0xYZ bytes)
-		//         0x0C YZ: UTF-8 string, identifier (length: 0xYZ bytes)
-		//         0x02 01: Integer, counter (optional, length: 0x01 byte)
-		//         0x04 YZ: Octet string, data (optional, length: 0xYZ bytes)
-
-		r_apdu = "6F11";
-		  r_apdu += "A50F";
-		    r_apdu += "100D";
-		      r_apdu += "020100";		// major version = 0
-		      r_apdu += "020108";		// minor version = 8
-		      r_apdu += "1007";
-		        r_apdu += "0C03454D55";	// EMU
-		r_apdu += "9000";
+		r_apdu.append(SELECT_FCI, sizeof(SELECT_FCI));
+		r_apdu.append_sw(SW_OK);
 	}
 }
 
-void pivacy_cardemu_emulator::process_verify_pin(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_verify_pin(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
 {
-	if (c_apdu.size() < 5)
+	if (cmd.data_len == 0)
 	{
-		r_apdu = SW_LENGTH_ERROR;
+		r_apdu.set_sw(SW_LENGTH_ERROR);
 	}
-	else if ((c_apdu[OFS_P1] != 0x00) || ((c_apdu[OFS_P2] != 0x00) && (c_apdu[OFS_P2] != 0x01)))
+	else if ((cmd.p1 != 0x00) || ((cmd.p2 != 0x00) && (cmd.p2 != 0x01)))
 	{
 		ERROR_MSG("Invalid VERIFY PIN request");
 		
-		r_apdu = SW_DATA_UNKNOWN;
+		r_apdu.set_sw(SW_DATA_UNKNOWN);
 	}
 	else
 	{
-		bytestring supplied_PIN = c_apdu.substr(OFS_CDATA, c_apdu[OFS_LC]);
-		
-		if (c_apdu[OFS_P2] == 0x00)
+		if (cmd.p2 == 0x00)
 		{
-			if (supplied_PIN == user_PIN)
+			if (pin_matches(user_PIN, cmd.data, cmd.data_len))
 			{
-				r_apdu = SW_OK;
+				r_apdu.set_sw(SW_OK);
 				
 				user_PIN_verified = true;
 			}
 			else
 			{
-				r_apdu = SW_PIN_INCORRECT;
+				r_apdu.set_sw(SW_PIN_INCORRECT);
 				
 				user_PIN_verified = false;
 			}
 		}
-		else if (c_apdu[OFS_P2] == 0x01)
+		else if (cmd.p2 == 0x01)
 		{
-			if (supplied_PIN == admin_PIN)
+			if (pin_matches(admin_PIN, cmd.data, cmd.data_len))
 			{
-				r_apdu = SW_OK;
+				r_apdu.set_sw(SW_OK);
 				
 				admin_PIN_verified = true;
 			}
 			else
 			{
-				r_apdu = SW_PIN_INCORRECT;
+				r_apdu.set_sw(SW_PIN_INCORRECT);
 				
 				admin_PIN_verified = false;
 			}
@@ -390,92 +563,148 @@ void pivacy_cardemu_emulator::process_verify_pin(bytestring& c_apdu, bytestring&
 	}
 }
 
-void pivacy_cardemu_emulator::process_prove_credential(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_prove_credential(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
 {
 	reset_proof();
 	
-	if ((c_apdu.size() < 5) || (c_apdu[OFS_LC] != 0x28))
+	if (cmd.data_len != 0x28)
 	{
-		r_apdu = SW_LENGTH_ERROR;
+		r_apdu.set_sw(SW_LENGTH_ERROR);
 	}
-	else if ((c_apdu[OFS_P1] != 0x00) || (c_apdu[OFS_P2] != 0x00))
+	else if ((cmd.p1 != 0x00) || (cmd.p2 != 0x00))
 	{
-		r_apdu = SW_WRONG_STATE;
+		r_apdu.set_sw(SW_WRONG_STATE);
 	}
 	else
 	{
-		unsigned short credential_id = (c_apdu[OFS_CDATA] >> 8) + c_apdu[OFS_CDATA + 1];
+		unsigned short credential_id = (cmd.data[0] << 8) + cmd.data[1];
+		
+		/* The proof uses the credential set that is current when it starts */
+		switch_credential_set();
 		
 		/* Check if this credential exists */
-		selected_credential = NULL;
+		selected_context = (active_set != NULL) ? active_set->find(credential_id) : NULL;
 		
-		for (std::vector<pivacy_credential*>::iterator i = credentials.begin(); i != credentials.end(); i++)
+		if (selected_context == NULL)
 		{
-			if ((*i)->get_credential_id() == credential_id)
-			{
-				selected_credential = *i;
-			}
+			ERROR_MSG("Attempt to start proof for non-existent credential 0x%04X", credential_id);
+			
+			r_apdu.set_sw(SW_CREDENTIAL_UNKNOWN);
 		}
-		
-		if (selected_credential == NULL)
+		else if (!selected_context->materialize())
 		{
-			ERROR_MSG("Attempt to start proof for non-existent credential 0x%04X", credential_id);
+			ERROR_MSG("Failed to load credential 0x%04X", credential_id);
+			
+			selected_context = NULL;
 			
-			r_apdu = SW_CREDENTIAL_UNKNOWN;
+			r_apdu.set_sw(SW_CREDENTIAL_UNKNOWN);
 		}
 		else
 		{
-			unsigned short D_val = (c_apdu[OFS_CDATA + 2] << 8) + c_apdu[OFS_CDATA + 2 + 1];
+			unsigned short D_val = (cmd.data[2] << 8) + cmd.data[2 + 1];
 			
-			curproof_context = c_apdu.substr(OFS_CDATA + 2 + 2, SYSPAR(l_H) / 8);
+			mpz_import(curproof_context.get_mpz_t(), SYSPAR(l_H) / 8, 1, 1, 1, 0, &cmd.data[2 + 2]);
 			
-			time_t timestamp = (c_apdu[OFS_CDATA + 2 + (SYSPAR(l_H) / 8) + 2] << 24) +
-			                   (c_apdu[OFS_CDATA + 2 + (SYSPAR(l_H) / 8) + 3] << 16) +
-			                   (c_apdu[OFS_CDATA + 2 + (SYSPAR(l_H) / 8) + 4] << 8) +
-			                   (c_apdu[OFS_CDATA + 2 + (SYSPAR(l_H) / 8) + 5]);
+			time_t timestamp = (cmd.data[2 + (SYSPAR(l_H) / 8) + 2] << 24) +
+			                   (cmd.data[2 + (SYSPAR(l_H) / 8) + 3] << 16) +
+			                   (cmd.data[2 + (SYSPAR(l_H) / 8) + 4] << 8) +
+			                   (cmd.data[2 + (SYSPAR(l_H) / 8) + 5]);
 			                   
-			INFO_MSG("Started proof with context = %s, D = 0x%04X, timestamp = %d", curproof_context.hex_str().c_str(), D_val, timestamp);
+			char context_hex[2 * 64 + 1];
+			
+			INFO_MSG("Started proof with context = %s, D = 0x%04X, timestamp = %d", hex_for_log(&cmd.data[2 + 2], SYSPAR(l_H) / 8, context_hex, sizeof(context_hex)), D_val, timestamp);
 			
 			/* Convert D to vector of booleans, start at "expiry" */
 			unsigned short D_mask = 0x0002;
-			std::vector<const char*> display_attributes;
+			unsigned short D_disclosed = 0;
 			
-			for (int i = 0; i < selected_credential->get_silvia_credential()->num_attributes(); i++)
+			for (size_t i = 0; i < selected_context->num_attributes(); i++)
 			{
 				if (FLAG_SET(D_val, D_mask))
 				{
 					curproof_D.push_back(true);
+					D_disclosed |= D_mask;
 					
-					INFO_MSG("Revealing attribute %s", selected_credential->get_attribute_names()[i].c_str());
+					INFO_MSG("Revealing attribute %s", selected_context->get_attribute_name(i));
 					
-					display_attributes.push_back(selected_credential->get_attribute_names()[i].c_str());
+					curproof_display_attributes.push_back(selected_context->get_attribute_name(i));
 				}
 				else
 				{
 					curproof_D.push_back(false);
 					
-					INFO_MSG("Keeping attribute %s hidden", selected_credential->get_attribute_names()[i].c_str());
+					INFO_MSG("Keeping attribute %s hidden", selected_context->get_attribute_name(i));
 				}
 				
 				D_mask <<= 1;
 			}
 			
-			r_apdu = SW_OK;
+			r_apdu.set_sw(SW_OK);
 				
+			/* A credential that was loaded lazily has no precomputed proofs yet */
+			precompute_pool.add_credential(selected_context);
+			
 			proof_started = true;
 			proof_have_context_and_D = true;
 			
-			if (ui_connected)
+			/* Prepare the proof while the user looks at the consent screen */
+			if (speculate)
+			{
+				speculator.begin(selected_context, curproof_D);
+			}
+			
+			/* Do not ask again for disclosures the user allowed for all time */
+			pivacy_cardemu_consent_policy* policy = pivacy_cardemu_consent_policy::i();
+			bool use_policy = policy->is_enabled();
+			
+			if (use_policy && policy->is_allowed(RP_NAME_ANY, credential_id, D_disclosed))
+			{
+				INFO_MSG("User consented to this disclosure before, not asking again");
+				
+				if (pivacy_ui_is_connected())
+				{
+					unsigned long long ui_start = pivacy_cardemu_metrics::now();
+					
+					pivacy_ui_show_status_async(PIVACY_STATE_PRESENT);
+					
+					pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_STATUS);
+				}
+			}
+			else if (pivacy_ui_is_connected())
 			{
 				int consent_result;
-				pivacy_rv rv;
+				unsigned long long ui_start = pivacy_cardemu_metrics::now();
+				
+				pivacy_rv rv = pivacy_ui_consent(use_policy ? RP_NAME_ANY : RP_NAME, &curproof_display_attributes[0], curproof_display_attributes.size(), use_policy ? 1 : 0, &consent_result);
 				
-				if (((rv = pivacy_ui_consent("This terminal", &display_attributes[0], display_attributes.size(), 0, &consent_result) != PRV_OK) ||
-				    ((rv = pivacy_ui_show_status(PIVACY_STATE_PRESENT)) != PRV_OK)) && !ui_optional)
+				pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_CONSENT);
+				
+				if ((rv == PRV_OK) && (consent_result == PIVACY_CONSENT_ALWAYS) && use_policy)
+				{
+					if (policy->grant(RP_NAME_ANY, credential_id, D_disclosed))
+					{
+						INFO_MSG("User consented to this disclosure for all time");
+					}
+					else
+					{
+						WARNING_MSG("Failed to remember consent for credential 0x%04X", credential_id);
+					}
+				}
+				
+				if (rv == PRV_OK)
+				{
+					ui_start = pivacy_cardemu_metrics::now();
+					
+					rv = pivacy_ui_show_status_async(PIVACY_STATE_PRESENT);
+					
+					pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_STATUS);
+				}
+				
+				if ((rv != PRV_OK) && !ui_optional)
 				{
 					reset_proof();
 					
-					r_apdu = SW_UNKNOWN_ERROR;
+					r_apdu.set_sw(SW_UNKNOWN_ERROR);
 				}
 				
 				if (rv == PRV_OK)
@@ -484,7 +713,7 @@ void pivacy_cardemu_emulator::process_prove_credential(bytestring& c_apdu, bytes
 					{
 						reset_proof();
 						
-						r_apdu = SW_SECURITY_STATUS_NOT_SATISFIED;
+						r_apdu.set_sw(SW_SECURITY_STATUS_NOT_SATISFIED);
 					}
 				}
 			}
@@ -492,136 +721,211 @@ void pivacy_cardemu_emulator::process_prove_credential(bytestring& c_apdu, bytes
 	}
 }
 
-void pivacy_cardemu_emulator::process_prove_commitment(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_prove_commitment(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
 {
-	if (!proof_started || !proof_have_context_and_D || (selected_credential == NULL))
+	if (!proof_started || !proof_have_context_and_D || (selected_context == NULL))
 	{
-		r_apdu = SW_WRONG_STATE;
+		r_apdu.set_sw(SW_WRONG_STATE);
 		reset_proof();
 	}
-	else if ((c_apdu.size() < 5) || (c_apdu[OFS_LC] != (SYSPAR(l_statzk) / 8)))
+	else if (cmd.data_len != (SYSPAR(l_statzk) / 8))
 	{
-		r_apdu = SW_LENGTH_ERROR;
+		r_apdu.set_sw(SW_LENGTH_ERROR);
 		reset_proof();
 	}
-	else if ((c_apdu[OFS_P1] != 0x00) || (c_apdu[OFS_P2] != 0x00))
+	else if (((cmd.p1 != P1_PROOF_COMMITMENT) && (cmd.p1 != P1_PROOF_FULL)) || (cmd.p2 != 0x00))
 	{
-		r_apdu = SW_DATA_UNKNOWN;
+		r_apdu.set_sw(SW_DATA_UNKNOWN);
 		reset_proof();
 	}
 	else
 	{
 		// Retrieve the nonce
-		bytestring nonce = c_apdu.substr(OFS_CDATA, c_apdu[OFS_LC]);
+		mpz_import(curproof_nonce.get_mpz_t(), cmd.data_len, 1, 1, 1, 0, cmd.data);
+		
+		// Generate the proof; use speculative or precomputed randomness if available
+		pivacy_cardemu_prover* prover = selected_context->get_prover();
+		
+		unsigned long long proof_start = pivacy_cardemu_metrics::now();
+		pivacy_cardemu_metrics::proof_source source = pivacy_cardemu_metrics::PROOF_SPECULATIVE;
 		
-		// Generate the proof
-		silvia_prover prover(selected_credential->get_issuer_public_key(), selected_credential->get_silvia_credential());
+		/* A new commitment replaces the output of an earlier one */
+		wipe_proof_output();
 		
-		mpz_class c;
-		mpz_class A_prime;
-		mpz_class e_hat;
-		mpz_class v_prime_hat;
-		std::vector<mpz_class> a_i_hat;
-		std::vector<silvia_attribute*> a_i;
+		pivacy_proof_randomness* rnd = speculator.claim(selected_context, curproof_D);
 		
-		prover.prove(curproof_D, nonce.mpz_val(), curproof_context.mpz_val(), c, A_prime, e_hat, v_prime_hat, a_i_hat, a_i);
+		if (rnd == NULL)
+		{
+			rnd = precompute_pool.take(selected_context);
+			source = pivacy_cardemu_metrics::PROOF_POOL;
+		}
+		
+		DEBUG_MSG("Proof precomputation pool hits: %lu, misses: %lu", precompute_pool.get_hits(), precompute_pool.get_misses());
+		
+		{
+			/* Temporaries and the output stay in the proof arena until the proof is reset */
+			pivacy_cardemu_arena_scope arena_scope(proof_arena);
+			
+			if (rnd == NULL)
+			{
+				rnd = prover->precompute(curproof_D);
+				source = pivacy_cardemu_metrics::PROOF_INLINE;
+			}
+			
+			prover->prove(rnd, curproof_D, curproof_nonce, curproof_context, curproof_c, curproof_A_prime, curproof_e_hat, curproof_v_prime_hat, curproof_a_i_hat, curproof_a_i);
+			
+			delete rnd;
+		}
 		
-		// Save proof output
-		std::vector<mpz_class>::iterator a_i_hat_it = a_i_hat.begin();
-		std::vector<silvia_attribute*>::iterator a_i_it = a_i.begin();
+		pivacy_cardemu_metrics::i()->record_proof(proof_start, source);
 		
-		curproof_A_prime = bytestring(A_prime);
-		curproof_e_hat = bytestring(e_hat);
-		curproof_v_prime_hat = bytestring(v_prime_hat);
+		// Index the responses; disclosed attributes were encoded when the credential was loaded
+		std::vector<mpz_class>::const_iterator a_i_hat_it = curproof_a_i_hat.begin();
+		proof_response response;
 		
 		/* Add hidden master secret */
-		curproof_attributes.push_back(bytestring(*a_i_hat_it));
+		response.disclosed = NULL;
+		response.hidden = &(*a_i_hat_it);
+		curproof_attributes.push_back(response);
 		a_i_hat_it++;
 		
-		for (std::vector<bool>::iterator i = curproof_D.begin(); i != curproof_D.end(); i++)
+		for (size_t i = 0; i < curproof_D.size(); i++)
 		{
-			if ((*i) == true)
+			if (curproof_D[i])
 			{
-				curproof_attributes.push_back(bytestring((*a_i_it)->rep()));
-				a_i_it++;
+				response.disclosed = &selected_context->get_encoded_attribute(i);
+				response.hidden = NULL;
 			}
 			else
 			{
-				curproof_attributes.push_back(bytestring(*a_i_hat_it));
+				response.disclosed = NULL;
+				response.hidden = &(*a_i_hat_it);
 				a_i_hat_it++;
 			}
+			
+			curproof_attributes.push_back(response);
 		}
 		
-		// Return c
-		r_apdu = bytestring(c);
-		r_apdu += SW_OK;
-		
 		proof_proved = true;
+		
+		if (cmd.p1 == P1_PROOF_FULL)
+		{
+			/*
+			 * Return the whole proof as a sequence of length-value
+			 * pairs with a 2-byte length: c, A', e^, v'^ and the
+			 * responses in the order of GET RESPONSE
+			 */
+			r_apdu.append_lv(curproof_c);
+			r_apdu.append_lv(curproof_A_prime);
+			r_apdu.append_lv(curproof_e_hat);
+			r_apdu.append_lv(curproof_v_prime_hat);
+			
+			for (std::vector<proof_response>::iterator i = curproof_attributes.begin(); i != curproof_attributes.end(); i++)
+			{
+				if (i->disclosed != NULL)
+				{
+					r_apdu.append_lv(*i->disclosed);
+				}
+				else
+				{
+					r_apdu.append_lv(*i->hidden);
+				}
+			}
+			
+			if (!cmd.has_le || r_apdu.overflowed() || (r_apdu.size() > cmd.le))
+			{
+				ERROR_MSG("Full proof does not fit in the expected response length");
+				
+				r_apdu.set_sw(SW_LENGTH_ERROR);
+			}
+			else
+			{
+				r_apdu.append_sw(SW_OK);
+			}
+			
+			reset_proof();
+		}
+		else
+		{
+			// Return c
+			r_apdu.append(curproof_c);
+			r_apdu.append_sw(SW_OK);
+		}
 	}
 }
 
-void pivacy_cardemu_emulator::process_prove_signature(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_prove_signature(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
 {
-	if (c_apdu[OFS_P2] != 0x00)
+	if (cmd.p2 != 0x00)
 	{
-		r_apdu = SW_DATA_UNKNOWN;
+		r_apdu.set_sw(SW_DATA_UNKNOWN);
 		reset_proof();
 	}
 	else if (!proof_proved)
 	{
-		r_apdu = SW_WRONG_STATE;
+		r_apdu.set_sw(SW_WRONG_STATE);
 		reset_proof();
 	}
 	else
 	{
-		switch(c_apdu[OFS_P1])
+		switch(cmd.p1)
 		{
 		case 0x01: // A'
-			r_apdu = curproof_A_prime;
-			r_apdu += SW_OK;
+			r_apdu.append(curproof_A_prime);
+			r_apdu.append_sw(SW_OK);
 			break;
 		case 0x02: // e^
-			r_apdu = curproof_e_hat;
-			r_apdu += SW_OK;
+			r_apdu.append(curproof_e_hat);
+			r_apdu.append_sw(SW_OK);
 			break;
 		case 0x03: // v'^
-			r_apdu = curproof_v_prime_hat;
-			r_apdu += SW_OK;
+			r_apdu.append(curproof_v_prime_hat);
+			r_apdu.append_sw(SW_OK);
 			break;
 		default:   // ????
-			r_apdu = SW_DATA_UNKNOWN;
+			r_apdu.set_sw(SW_DATA_UNKNOWN);
 			reset_proof();
 			break;
 		}
 	}
 }
 
-void pivacy_cardemu_emulator::process_get_response(bytestring& c_apdu, bytestring& r_apdu)
+void pivacy_cardemu_emulator::process_get_response(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu)
 {
-	if (c_apdu[OFS_P2] != 0x00)
+	if (cmd.p2 != 0x00)
 	{
-		r_apdu = SW_DATA_UNKNOWN;
+		r_apdu.set_sw(SW_DATA_UNKNOWN);
 		
 		reset_proof();
 	}
 	else if (!proof_proved)
 	{
-		r_apdu = SW_WRONG_STATE;
+		r_apdu.set_sw(SW_WRONG_STATE);
 		
 		reset_proof();
 	}
-	else if (c_apdu[OFS_P1] > curproof_attributes.size() + 1)
+	else if (cmd.p1 >= curproof_attributes.size())
 	{
-		r_apdu = SW_DATA_UNKNOWN;
+		r_apdu.set_sw(SW_DATA_UNKNOWN);
 		
 		reset_proof();
 	}
 	else
 	{
-		r_apdu = curproof_attributes[c_apdu[OFS_P1]];
-		r_apdu += "9000";
+		const proof_response& response = curproof_attributes[cmd.p1];
 		
-		if (c_apdu[OFS_P1] == (curproof_attributes.size() - 1))
+		if (response.disclosed != NULL)
+		{
+			r_apdu.append(*response.disclosed);
+		}
+		else
+		{
+			r_apdu.append(*response.hidden);
+		}
+		
+		r_apdu.append_sw(SW_OK);
+		
+		if (cmd.p1 == (curproof_attributes.size() - 1))
 		{
 			reset_proof();
 		}
@@ -634,9 +938,13 @@ void pivacy_cardemu_emulator::power_up()
 	
 	reset();
 	
-	if (ui_connected)
+	if (pivacy_ui_is_connected())
 	{
-		pivacy_ui_show_status(PIVACY_STATE_PRESENT);
+		unsigned long long ui_start = pivacy_cardemu_metrics::now();
+		
+		pivacy_ui_show_status_async(PIVACY_STATE_PRESENT);
+		
+		pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_STATUS);
 	}
 }
 
@@ -646,8 +954,12 @@ void pivacy_cardemu_emulator::power_down()
 	
 	reset();
 	
-	if (ui_connected)
+	if (pivacy_ui_is_connected())
 	{
-		pivacy_ui_show_status(PIVACY_STATE_WAIT);
+		unsigned long long ui_start = pivacy_cardemu_metrics::now();
+		
+		pivacy_ui_show_status_async(PIVACY_STATE_WAIT);
+		
+		pivacy_cardemu_metrics::i()->record_ui(ui_start, pivacy_cardemu_metrics::UI_STATUS);
 	}
 }
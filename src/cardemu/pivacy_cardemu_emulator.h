@@ -34,6 +34,15 @@
 #define _PIVACY_CARDEMU_EMULATOR_H
 
 #include "pivacy_credential.h"
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cardemu_credential_set.h"
+#include "pivacy_cardemu_credential_store.h"
+#include "pivacy_cardemu_apdu.h"
+#include "pivacy_cardemu_response.h"
+#include "pivacy_cardemu_precompute.h"
+#include "pivacy_cardemu_speculator.h"
+#include "pivacy_cardemu_arena.h"
+#include "pivacy_cardemu_task_pool.h"
 #include "silvia_bytestring.h"
 #include <vector>
 
@@ -55,11 +64,12 @@ public:
 	~pivacy_cardemu_emulator();
 	
 	/**
-	 * Process an APDU
+	 * Process an APDU; the R-APDU is written to the caller's buffer
 	 * @param c_apdu the C-APDU
+	 * @param c_len the length of the C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_apdu(bytestring& c_apdu, bytestring& r_apdu);
+	void process_apdu(const unsigned char* c_apdu, size_t c_len, pivacy_cardemu_response& r_apdu);
 	
 	/**
 	 * Handle power up events
@@ -83,63 +93,117 @@ private:
 	void reset_proof();
 	
 	/**
-	 * Process SELECT
+	 * Wipe the output of the current proof and sweep the proof arena
+	 */
+	void wipe_proof_output();
+	
+	/**
+	 * Switch to the current credential set
+	 */
+	void switch_credential_set();
+	
+	/**
+	 * Dispatch an APDU to the handler for its instruction
 	 * @param c_apdu the C-APDU
+	 * @param c_len the length of the C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_select(bytestring& c_apdu, bytestring& r_apdu);
+	void dispatch_apdu(const unsigned char* c_apdu, size_t c_len, pivacy_cardemu_response& r_apdu);
+	
+	/**
+	 * Process SELECT
+	 * @param cmd the parsed C-APDU
+	 * @param r_apdu the R-APDU
+	 */
+	void process_select(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
 	
 	/**
 	 * Process VERIFY PIN
-	 * @param c_apdu the C-APDU
+	 * @param cmd the parsed C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_verify_pin(bytestring& c_apdu, bytestring& r_apdu);
+	void process_verify_pin(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
 	
 	/**
 	 * Process PROVE CREDENTIAL
-	 * @param c_apdu the C-APDU
+	 * @param cmd the parsed C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_prove_credential(bytestring& c_apdu, bytestring& r_apdu);
+	void process_prove_credential(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
 	
 	/**
-	 * Process PROVE COMMITMENT
-	 * @param c_apdu the C-APDU
+	 * Process PROVE COMMITMENT; with P1 = 0x01 the full proof is
+	 * returned at once, which requires an extended-length APDU
+	 * @param cmd the parsed C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_prove_commitment(bytestring& c_apdu, bytestring& r_apdu);
+	void process_prove_commitment(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
 	
 	/**
 	 * Process PROVE SIGNATURE
-	 * @param c_apdu the C-APDU
+	 * @param cmd the parsed C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_prove_signature(bytestring& c_apdu, bytestring& r_apdu);
+	void process_prove_signature(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
 	
 	/**
 	 * Process GET RESPONSE
-	 * @param c_apdu the C-APDU
+	 * @param cmd the parsed C-APDU
 	 * @param r_apdu the R-APDU
 	 */
-	void process_get_response(bytestring& c_apdu, bytestring& r_apdu);
+	void process_get_response(const pivacy_cardemu_apdu& cmd, pivacy_cardemu_response& r_apdu);
+	
+	/**
+	 * Called by the UI library when the connection to the UI changes
+	 * @param connected 1 if connected, 0 if disconnected
+	 * @param cb_data the emulator
+	 */
+	static void ui_state_changed(int connected, void* cb_data);
 
-	/* The credentials */
-	std::vector<pivacy_credential*> credentials;
+	/* Memory for proof computations; must be declared before the integers that use it */
+	pivacy_cardemu_arena proof_arena;
+	
+	/* Workers that proof commitments are split over */
+	pivacy_cardemu_task_pool task_pool;
+	
+	/* Precomputed proof randomness */
+	pivacy_cardemu_precompute_pool precompute_pool;
+	
+	/* Speculative proof work while waiting for consent */
+	pivacy_cardemu_speculator speculator;
+	bool speculate;
+	
+	/* The credentials; must be declared after their users above */
+	pivacy_cardemu_credential_store credential_store;
+	
+	/* The credential set used for the current proof */
+	pivacy_cardemu_credential_set* active_set;
 	
 	/* The selected credential*/
-	pivacy_credential* selected_credential;
+	pivacy_cardemu_proof_context* selected_context;
+	
+	/* A response for GET RESPONSE: a disclosed attribute or the response for a hidden one */
+	struct proof_response
+	{
+		const bytestring* disclosed;
+		const mpz_class* hidden;
+	};
 	
-	/* The current proof */
+	/* The current proof; outputs are kept in the proof arena and exported straight into R-APDUs */
 	bool proof_started;
 	bool proof_have_context_and_D;
 	bool proof_proved;
 	std::vector<bool> curproof_D;
-	bytestring curproof_context;
-	bytestring curproof_A_prime;
-	bytestring curproof_e_hat;
-	bytestring curproof_v_prime_hat;
-	std::vector<bytestring> curproof_attributes;
+	mpz_class curproof_context;
+	mpz_class curproof_nonce;
+	mpz_class curproof_c;
+	mpz_class curproof_A_prime;
+	mpz_class curproof_e_hat;
+	mpz_class curproof_v_prime_hat;
+	std::vector<mpz_class> curproof_a_i_hat;
+	std::vector<silvia_attribute*> curproof_a_i;
+	std::vector<proof_response> curproof_attributes;
+	std::vector<const char*> curproof_display_attributes;
 	
 	/* Authentication */
 	bytestring user_PIN;
@@ -147,10 +211,9 @@ private:
 	bool user_PIN_verified;
 	bool admin_PIN_verified;
 	
-	/* UI state */
+	/* UI state; the connection itself is kept up by the UI library */
 	bool use_ui;
 	bool ui_optional;
-	bool ui_connected;
 };
 
 #endif // !_PIVACY_CARDEMU_EMULATOR_H
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_metrics.cpp
+
+ Lock-free counters and latency histograms for the card emulator, served
+ in Prometheus text format on a local UNIX domain socket
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_metrics.h"
+#include "pivacy_log.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // !MSG_NOSIGNAL
+
+/* Time to wait for an HTTP request line from a metrics client */
+#define METRICS_REQUEST_TIMEOUT		100 // ms
+
+static const char* apdu_ins_names[pivacy_cardemu_metrics::INS_COUNT] =
+{
+	"select",
+	"verify_pin",
+	"prove_credential",
+	"prove_commitment",
+	"prove_signature",
+	"get_response",
+	"other"
+};
+
+static const char* proof_source_names[pivacy_cardemu_metrics::PROOF_SOURCE_COUNT] =
+{
+	"speculative",
+	"pool",
+	"inline"
+};
+
+static const char* ui_call_names[pivacy_cardemu_metrics::UI_CALL_COUNT] =
+{
+	"consent",
+	"status"
+};
+
+static const char* transport_state_names[pivacy_cardemu_metrics::TRANSPORT_STATE_COUNT] =
+{
+	"disconnected",
+	"connecting",
+	"connected"
+};
+
+static const char* ready_since_names[pivacy_cardemu_metrics::READY_SINCE_COUNT] =
+{
+	"connecting",
+	"socket"
+};
+
+/* Status words that are counted separately; the last counter is for all others */
+static const unsigned short known_sws[] =
+{
+	0x9000, 0x6700, 0x6982, 0x6985, 0x6b00, 0x6a82, 0x63c0,
+	0x6a80, 0x6a88, 0x6986, 0x6d00, 0x6e00, 0x6f00
+};
+
+#define NUM_KNOWN_SWS	(sizeof(known_sws) / sizeof(known_sws[0]))
+
+pivacy_histogram::pivacy_histogram()
+{
+	for (size_t i = 0; i < PIVACY_HIST_BUCKETS; i++)
+	{
+		counts[i] = 0;
+	}
+
+	sum = 0;
+}
+
+/*static*/ size_t pivacy_histogram::bucket(unsigned long long usec)
+{
+	if (usec < PIVACY_HIST_SUB)
+	{
+		return (size_t) usec;
+	}
+
+	size_t e = 63 - __builtin_clzll(usec);
+	size_t sub = (usec >> (e - PIVACY_HIST_SUB_BITS)) & (PIVACY_HIST_SUB - 1);
+	size_t b = ((e - PIVACY_HIST_SUB_BITS + 1) << PIVACY_HIST_SUB_BITS) + sub;
+
+	return (b < PIVACY_HIST_BUCKETS) ? b : (PIVACY_HIST_BUCKETS - 1);
+}
+
+/*static*/ unsigned long long pivacy_histogram::bucket_max(size_t b)
+{
+	if (b < PIVACY_HIST_SUB)
+	{
+		return b;
+	}
+
+	size_t e = (b >> PIVACY_HIST_SUB_BITS) + PIVACY_HIST_SUB_BITS - 1;
+	size_t sub = b & (PIVACY_HIST_SUB - 1);
+
+	return ((unsigned long long) (PIVACY_HIST_SUB + sub + 1) << (e - PIVACY_HIST_SUB_BITS)) - 1;
+}
+
+void pivacy_histogram::record(unsigned long long usec)
+{
+	__sync_fetch_and_add(&counts[bucket(usec)], 1);
+	__sync_fetch_and_add(&sum, usec);
+}
+
+void pivacy_histogram::write_prometheus(std::string& out, const char* name, const char* labels)
+{
+	char line[256];
+	const char* sep = (labels[0] == '\0') ? "" : ",";
+	unsigned long cumulative = 0;
+	size_t last = 0;
+
+	/* Only write buckets up to the largest one in use */
+	for (size_t b = 0; b < PIVACY_HIST_BUCKETS; b++)
+	{
+		if (counts[b] != 0) last = b;
+	}
+
+	for (size_t b = 0; b <= last; b++)
+	{
+		/* Empty buckets carry no information */
+		if (counts[b] == 0) continue;
+
+		cumulative += counts[b];
+
+		snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%.6f\"} %lu\n", name, labels, sep, bucket_max(b) / 1000000.0, cumulative);
+
+		out += line;
+	}
+
+	for (size_t b = last + 1; b < PIVACY_HIST_BUCKETS; b++)
+	{
+		cumulative += counts[b];
+	}
+
+	snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, cumulative);
+	out += line;
+
+	if (labels[0] == '\0')
+	{
+		snprintf(line, sizeof(line), "%s_sum %.6f\n%s_count %lu\n", name, sum / 1000000.0, name, cumulative);
+	}
+	else
+	{
+		snprintf(line, sizeof(line), "%s_sum{%s} %.6f\n%s_count{%s} %lu\n", name, labels, sum / 1000000.0, name, labels, cumulative);
+	}
+
+	out += line;
+}
+
+/*static*/ std::auto_ptr<pivacy_cardemu_metrics> pivacy_cardemu_metrics::_i(NULL);
+/*static*/ pthread_once_t pivacy_cardemu_metrics::_i_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_cardemu_metrics::create_instance()
+{
+	_i = std::auto_ptr<pivacy_cardemu_metrics>(new pivacy_cardemu_metrics());
+
+	_i->credentials_loaded = 0;
+	_i->credentials_failed = 0;
+
+	for (size_t i = 0; i < PROOF_SOURCE_COUNT; i++)
+	{
+		_i->proofs[i] = 0;
+	}
+
+	for (size_t i = 0; i < (sizeof(_i->status_words) / sizeof(_i->status_words[0])); i++)
+	{
+		_i->status_words[i] = 0;
+	}
+
+	for (size_t i = 0; i < TRANSPORT_STATE_COUNT; i++)
+	{
+		_i->transport_transitions[i] = 0;
+	}
+
+	_i->connect_attempts_ok = 0;
+	_i->connect_attempts_failed = 0;
+	_i->transport_current_state = TRANSPORT_DISCONNECTED;
+	_i->transport_state_since = now();
+}
+
+/*static*/ pivacy_cardemu_metrics* pivacy_cardemu_metrics::i()
+{
+	/* Metrics are recorded from several threads, any of which may be first */
+	pthread_once(&_i_once, create_instance);
+
+	return _i.get();
+}
+
+/*static*/ unsigned long long pivacy_cardemu_metrics::now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((unsigned long long) tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+/*static*/ size_t pivacy_cardemu_metrics::sw_index(unsigned short sw)
+{
+	for (size_t i = 0; i < NUM_KNOWN_SWS; i++)
+	{
+		if (known_sws[i] == sw) return i;
+	}
+
+	return NUM_KNOWN_SWS;
+}
+
+void pivacy_cardemu_metrics::record_apdu(unsigned char cla, unsigned char ins, unsigned long long start, unsigned short sw)
+{
+	apdu_ins i = INS_OTHER;
+
+	if (cla == 0x00)
+	{
+		if (ins == 0xa4) i = INS_SELECT;
+		else if (ins == 0x20) i = INS_VERIFY_PIN;
+	}
+	else if (cla == 0x80)
+	{
+		switch(ins)
+		{
+		case 0x20: i = INS_PROVE_CREDENTIAL; break;
+		case 0x2a: i = INS_PROVE_COMMITMENT; break;
+		case 0x2b: i = INS_PROVE_SIGNATURE; break;
+		case 0x2c: i = INS_GET_RESPONSE; break;
+		}
+	}
+
+	apdu_latency[i].record(now() - start);
+
+	__sync_fetch_and_add(&status_words[sw_index(sw)], 1);
+}
+
+void pivacy_cardemu_metrics::record_proof(unsigned long long start, proof_source source)
+{
+	proof_latency.record(now() - start);
+
+	__sync_fetch_and_add(&proofs[source], 1);
+}
+
+void pivacy_cardemu_metrics::record_ui(unsigned long long start, ui_call call)
+{
+	ui_latency[call].record(now() - start);
+}
+
+void pivacy_cardemu_metrics::record_credential_load(unsigned long long start, bool ok)
+{
+	credential_load_latency.record(now() - start);
+
+	if (ok)
+	{
+		__sync_fetch_and_add(&credentials_loaded, 1);
+	}
+	else
+	{
+		__sync_fetch_and_add(&credentials_failed, 1);
+	}
+}
+
+void pivacy_cardemu_metrics::record_transport_state(transport_state state)
+{
+	__sync_lock_test_and_set(&transport_state_since, now());
+	__sync_lock_test_and_set(&transport_current_state, (int) state);
+
+	__sync_fetch_and_add(&transport_transitions[state], 1);
+}
+
+void pivacy_cardemu_metrics::record_connect_attempt(bool ok)
+{
+	if (ok)
+	{
+		__sync_fetch_and_add(&connect_attempts_ok, 1);
+	}
+	else
+	{
+		__sync_fetch_and_add(&connect_attempts_failed, 1);
+	}
+}
+
+void pivacy_cardemu_metrics::record_transport_ready(unsigned long long start, ready_since since)
+{
+	transport_ready_latency[since].record(now() - start);
+}
+
+void pivacy_cardemu_metrics::render(std::string& out)
+{
+	char labels[64];
+	char line[128];
+
+	out += "# HELP pivacy_cardemu_apdu_duration_seconds Time to process an APDU\n";
+	out += "# TYPE pivacy_cardemu_apdu_duration_seconds histogram\n";
+
+	for (size_t i = 0; i < INS_COUNT; i++)
+	{
+		snprintf(labels, sizeof(labels), "ins=\"%s\"", apdu_ins_names[i]);
+
+		apdu_latency[i].write_prometheus(out, "pivacy_cardemu_apdu_duration_seconds", labels);
+	}
+
+	out += "# HELP pivacy_cardemu_status_words_total Responses by status word\n";
+	out += "# TYPE pivacy_cardemu_status_words_total counter\n";
+
+	for (size_t i = 0; i <= NUM_KNOWN_SWS; i++)
+	{
+		if (i < NUM_KNOWN_SWS)
+		{
+			snprintf(line, sizeof(line), "pivacy_cardemu_status_words_total{sw=\"%04x\"} %lu\n", known_sws[i], status_words[i]);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "pivacy_cardemu_status_words_total{sw=\"other\"} %lu\n", status_words[i]);
+		}
+
+		out += line;
+	}
+
+	out += "# HELP pivacy_cardemu_proof_duration_seconds Time to compute a proof once the nonce is known\n";
+	out += "# TYPE pivacy_cardemu_proof_duration_seconds histogram\n";
+
+	proof_latency.write_prometheus(out, "pivacy_cardemu_proof_duration_seconds", "");
+
+	out += "# HELP pivacy_cardemu_proofs_total Proofs by source of the proof randomness\n";
+	out += "# TYPE pivacy_cardemu_proofs_total counter\n";
+
+	for (size_t i = 0; i < PROOF_SOURCE_COUNT; i++)
+	{
+		snprintf(line, sizeof(line), "pivacy_cardemu_proofs_total{source=\"%s\"} %lu\n", proof_source_names[i], proofs[i]);
+
+		out += line;
+	}
+
+	out += "# HELP pivacy_cardemu_ui_duration_seconds UI round trip time\n";
+	out += "# TYPE pivacy_cardemu_ui_duration_seconds histogram\n";
+
+	for (size_t i = 0; i < UI_CALL_COUNT; i++)
+	{
+		snprintf(labels, sizeof(labels), "call=\"%s\"", ui_call_names[i]);
+
+		ui_latency[i].write_prometheus(out, "pivacy_cardemu_ui_duration_seconds", labels);
+	}
+
+	out += "# HELP pivacy_cardemu_credential_load_duration_seconds Time to load a credential\n";
+	out += "# TYPE pivacy_cardemu_credential_load_duration_seconds histogram\n";
+
+	credential_load_latency.write_prometheus(out, "pivacy_cardemu_credential_load_duration_seconds", "");
+
+	out += "# HELP pivacy_cardemu_credentials_total Credentials by load result\n";
+	out += "# TYPE pivacy_cardemu_credentials_total counter\n";
+
+	snprintf(line, sizeof(line), "pivacy_cardemu_credentials_total{result=\"loaded\"} %lu\n", credentials_loaded);
+	out += line;
+	snprintf(line, sizeof(line), "pivacy_cardemu_credentials_total{result=\"failed\"} %lu\n", credentials_failed);
+	out += line;
+
+	out += "# HELP pivacy_cardemu_transport_state Current connection state of the transport\n";
+	out += "# TYPE pivacy_cardemu_transport_state gauge\n";
+
+	int current_state = __sync_add_and_fetch(&transport_current_state, 0);
+
+	for (size_t i = 0; i < TRANSPORT_STATE_COUNT; i++)
+	{
+		snprintf(line, sizeof(line), "pivacy_cardemu_transport_state{state=\"%s\"} %d\n", transport_state_names[i], (current_state == (int) i) ? 1 : 0);
+
+		out += line;
+	}
+
+	out += "# HELP pivacy_cardemu_transport_state_since_seconds Time of the last change of the transport connection state\n";
+	out += "# TYPE pivacy_cardemu_transport_state_since_seconds gauge\n";
+
+	snprintf(line, sizeof(line), "pivacy_cardemu_transport_state_since_seconds %.6f\n", __sync_add_and_fetch(&transport_state_since, 0) / 1000000.0);
+	out += line;
+
+	out += "# HELP pivacy_cardemu_transport_transitions_total Transport connection state changes by new state\n";
+	out += "# TYPE pivacy_cardemu_transport_transitions_total counter\n";
+
+	for (size_t i = 0; i < TRANSPORT_STATE_COUNT; i++)
+	{
+		snprintf(line, sizeof(line), "pivacy_cardemu_transport_transitions_total{state=\"%s\"} %lu\n", transport_state_names[i], transport_transitions[i]);
+
+		out += line;
+	}
+
+	out += "# HELP pivacy_cardemu_transport_connect_attempts_total Attempts to connect the transport by result\n";
+	out += "# TYPE pivacy_cardemu_transport_connect_attempts_total counter\n";
+	snprintf(line, sizeof(line), "pivacy_cardemu_transport_connect_attempts_total{result=\"ok\"} %lu\n", connect_attempts_ok);
+	out += line;
+	snprintf(line, sizeof(line), "pivacy_cardemu_transport_connect_attempts_total{result=\"failed\"} %lu\n", connect_attempts_failed);
+	out += line;
+
+	out += "# HELP pivacy_cardemu_transport_ready_duration_seconds Time until the transport was ready, from the start of connecting or from the appearance of the daemon socket\n";
+	out += "# TYPE pivacy_cardemu_transport_ready_duration_seconds histogram\n";
+
+	for (size_t i = 0; i < READY_SINCE_COUNT; i++)
+	{
+		snprintf(labels, sizeof(labels), "since=\"%s\"", ready_since_names[i]);
+
+		transport_ready_latency[i].write_prometheus(out, "pivacy_cardemu_transport_ready_duration_seconds", labels);
+	}
+}
+
+pivacy_cardemu_metrics_server::pivacy_cardemu_metrics_server()
+{
+	listen_socket = -1;
+	cancel_pipe[0] = cancel_pipe[1] = -1;
+	running = false;
+}
+
+pivacy_cardemu_metrics_server::~pivacy_cardemu_metrics_server()
+{
+	stop();
+}
+
+bool pivacy_cardemu_metrics_server::start(const std::string& socket_path)
+{
+	struct sockaddr_un addr;
+
+	if (running)
+	{
+		return true;
+	}
+
+	if (socket_path.size() >= sizeof(addr.sun_path))
+	{
+		ERROR_MSG("Metrics socket path %s is too long", socket_path.c_str());
+
+		return false;
+	}
+
+	this->socket_path = socket_path;
+
+	if (pipe(cancel_pipe) != 0)
+	{
+		ERROR_MSG("Failed to create the metrics cancellation pipe");
+
+		return false;
+	}
+
+	listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path.c_str());
+
+	unlink(socket_path.c_str());
+
+	if ((listen_socket < 0) ||
+	    (bind(listen_socket, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+	    (listen(listen_socket, 4) != 0) ||
+	    (pthread_create(&server_thread, NULL, server_thread_entry, this) != 0))
+	{
+		ERROR_MSG("Failed to serve metrics on %s (%s)", socket_path.c_str(), strerror(errno));
+
+		if (listen_socket >= 0) close(listen_socket);
+		close(cancel_pipe[0]);
+		close(cancel_pipe[1]);
+
+		listen_socket = cancel_pipe[0] = cancel_pipe[1] = -1;
+
+		return false;
+	}
+
+	running = true;
+
+	INFO_MSG("Serving metrics on %s", socket_path.c_str());
+
+	return true;
+}
+
+void pivacy_cardemu_metrics_server::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	char c = 0;
+
+	if (write(cancel_pipe[1], &c, 1) != 1)
+	{
+		ERROR_MSG("Failed to signal the metrics thread");
+	}
+
+	pthread_join(server_thread, NULL);
+
+	close(listen_socket);
+	unlink(socket_path.c_str());
+	close(cancel_pipe[0]);
+	close(cancel_pipe[1]);
+
+	listen_socket = cancel_pipe[0] = cancel_pipe[1] = -1;
+	running = false;
+}
+
+/*static*/ void* pivacy_cardemu_metrics_server::server_thread_entry(void* arg)
+{
+	((pivacy_cardemu_metrics_server*) arg)->server_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_metrics_server::server_loop()
+{
+	struct pollfd fds[2];
+
+	fds[0].fd = listen_socket;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancel_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		fds[0].revents = fds[1].revents = 0;
+
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG("Metrics server failed (%s)", strerror(errno));
+
+			break;
+		}
+
+		if (fds[1].revents != 0)
+		{
+			break;
+		}
+
+		if (fds[0].revents != 0)
+		{
+			int client = accept(listen_socket, NULL, NULL);
+
+			if (client >= 0)
+			{
+				serve(client);
+
+				close(client);
+			}
+		}
+	}
+}
+
+void pivacy_cardemu_metrics_server::serve(int client)
+{
+	struct pollfd pfd;
+	char request[512];
+	ssize_t request_len = 0;
+
+	/* See if the client sends an HTTP request */
+	pfd.fd = client;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, METRICS_REQUEST_TIMEOUT) > 0)
+	{
+		request_len = recv(client, request, sizeof(request), 0);
+	}
+
+	std::string response;
+
+	if ((request_len >= 4) && !memcmp(request, "GET ", 4))
+	{
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+	}
+
+	pivacy_cardemu_metrics::i()->render(response);
+
+	size_t sent = 0;
+
+	while (sent < response.size())
+	{
+		ssize_t rv = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+		if (rv < 0)
+		{
+			if (errno == EINTR) continue;
+
+			break;
+		}
+
+		sent += rv;
+	}
+}
+
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_metrics.h
+
+ Lock-free counters and latency histograms for the card emulator, served
+ in Prometheus text format on a local UNIX domain socket
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_METRICS_H
+#define _PIVACY_CARDEMU_METRICS_H
+
+#include <pthread.h>
+#include <memory>
+#include <string>
+
+/*
+ * Histograms have log-linear buckets: values below 2^SUB_BITS microseconds
+ * have a bucket of their own, each larger power of two is split into
+ * 2^SUB_BITS buckets (so the relative error is at most 25%)
+ */
+#define PIVACY_HIST_SUB_BITS		2
+#define PIVACY_HIST_SUB				(1 << PIVACY_HIST_SUB_BITS)
+#define PIVACY_HIST_BUCKETS			(38 * PIVACY_HIST_SUB)
+
+/* Default UNIX domain socket name */
+#define PIVACY_METRICS_SOCKET		"/tmp/pivacy_cardemu-metrics"
+
+/**
+ * Latency histogram; recording a value takes two atomic additions
+ */
+class pivacy_histogram
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_histogram();
+
+	/**
+	 * Record a value
+	 * @param usec the value in microseconds
+	 */
+	void record(unsigned long long usec);
+
+	/**
+	 * Append the histogram in Prometheus text format
+	 * @param out the output
+	 * @param name the metric name
+	 * @param labels the labels (e.g. "ins=\"select\"") or an empty string
+	 */
+	void write_prometheus(std::string& out, const char* name, const char* labels);
+
+private:
+	/**
+	 * Determine the bucket for a value
+	 * @param usec the value in microseconds
+	 * @return the bucket
+	 */
+	static size_t bucket(unsigned long long usec);
+
+	/**
+	 * Determine the largest value in a bucket
+	 * @param b the bucket
+	 * @return the largest value in microseconds
+	 */
+	static unsigned long long bucket_max(size_t b);
+
+	volatile unsigned long counts[PIVACY_HIST_BUCKETS];
+	volatile unsigned long long sum;
+};
+
+/**
+ * Emulator metrics
+ */
+class pivacy_cardemu_metrics
+{
+public:
+	/* APDU instructions */
+	enum apdu_ins
+	{
+		INS_SELECT = 0,
+		INS_VERIFY_PIN,
+		INS_PROVE_CREDENTIAL,
+		INS_PROVE_COMMITMENT,
+		INS_PROVE_SIGNATURE,
+		INS_GET_RESPONSE,
+		INS_OTHER,
+		INS_COUNT
+	};
+
+	/* Where the randomness for a proof came from */
+	enum proof_source
+	{
+		PROOF_SPECULATIVE = 0,
+		PROOF_POOL,
+		PROOF_INLINE,
+		PROOF_SOURCE_COUNT
+	};
+
+	/* UI calls */
+	enum ui_call
+	{
+		UI_CONSENT = 0,
+		UI_STATUS,
+		UI_CALL_COUNT
+	};
+
+	/* Connection state of the transport */
+	enum transport_state
+	{
+		TRANSPORT_DISCONNECTED = 0,
+		TRANSPORT_CONNECTING,
+		TRANSPORT_CONNECTED,
+		TRANSPORT_STATE_COUNT
+	};
+
+	/* What the time until the transport was ready is measured from */
+	enum ready_since
+	{
+		READY_SINCE_CONNECTING = 0,
+		READY_SINCE_SOCKET,
+		READY_SINCE_COUNT
+	};
+
+	/**
+	 * Get the one-and-only instance of the metrics
+	 * @return the one-and-only instance of the metrics
+	 */
+	static pivacy_cardemu_metrics* i();
+
+	/**
+	 * Get the current time for latency measurements
+	 * @return the current time in microseconds
+	 */
+	static unsigned long long now();
+
+	/**
+	 * Record a processed APDU
+	 * @param cla the instruction class
+	 * @param ins the instruction
+	 * @param start the time processing started (see now())
+	 * @param sw the status word of the response
+	 */
+	void record_apdu(unsigned char cla, unsigned char ins, unsigned long long start, unsigned short sw);
+
+	/**
+	 * Record the computation of a proof
+	 * @param start the time the computation started (see now())
+	 * @param source where the proof randomness came from
+	 */
+	void record_proof(unsigned long long start, proof_source source);
+
+	/**
+	 * Record a UI round trip
+	 * @param start the time the call was made (see now())
+	 * @param call the UI call
+	 */
+	void record_ui(unsigned long long start, ui_call call);
+
+	/**
+	 * Record the loading of a credential
+	 * @param start the time loading started (see now())
+	 * @param ok true if the credential can be used
+	 */
+	void record_credential_load(unsigned long long start, bool ok);
+
+	/**
+	 * Record a change of the connection state of the transport
+	 * @param state the new state
+	 */
+	void record_transport_state(transport_state state);
+
+	/**
+	 * Record an attempt to connect the transport
+	 * @param ok true if the attempt succeeded
+	 */
+	void record_connect_attempt(bool ok);
+
+	/**
+	 * Record the time it took for the transport to become ready
+	 * @param start the time measurement started (see now())
+	 * @param since what the measurement started with
+	 */
+	void record_transport_ready(unsigned long long start, ready_since since);
+
+	/**
+	 * Render all metrics in Prometheus text format
+	 * @param out receives the metrics
+	 */
+	void render(std::string& out);
+
+private:
+	/**
+	 * Create the one-and-only instance
+	 */
+	static void create_instance();
+
+	// The one-and-only instance
+	static std::auto_ptr<pivacy_cardemu_metrics> _i;
+	static pthread_once_t _i_once;
+
+	/**
+	 * Map a status word to a counter
+	 * @param sw the status word
+	 * @return the index of the counter
+	 */
+	static size_t sw_index(unsigned short sw);
+
+	pivacy_histogram apdu_latency[INS_COUNT];
+	pivacy_histogram proof_latency;
+	pivacy_histogram ui_latency[UI_CALL_COUNT];
+	pivacy_histogram credential_load_latency;
+	pivacy_histogram transport_ready_latency[READY_SINCE_COUNT];
+
+	volatile unsigned long proofs[PROOF_SOURCE_COUNT];
+	volatile unsigned long credentials_loaded;
+	volatile unsigned long credentials_failed;
+	volatile unsigned long status_words[16];
+	volatile unsigned long transport_transitions[TRANSPORT_STATE_COUNT];
+	volatile unsigned long connect_attempts_ok;
+	volatile unsigned long connect_attempts_failed;
+	volatile int transport_current_state;
+	volatile unsigned long long transport_state_since;
+};
+
+/**
+ * Serves the metrics on a UNIX domain socket; a client that sends an
+ * HTTP request gets an HTTP response, other clients just get the metrics
+ */
+class pivacy_cardemu_metrics_server
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_metrics_server();
+
+	/**
+	 * Destructor; stops the server
+	 */
+	~pivacy_cardemu_metrics_server();
+
+	/**
+	 * Start serving metrics
+	 * @param socket_path the path of the UNIX domain socket
+	 * @return true if the server was started
+	 */
+	bool start(const std::string& socket_path);
+
+	/**
+	 * Stop serving metrics
+	 */
+	void stop();
+
+private:
+	/**
+	 * Server thread entry point
+	 */
+	static void* server_thread_entry(void* arg);
+
+	/**
+	 * Server thread main loop
+	 */
+	void server_loop();
+
+	/**
+	 * Serve a single client
+	 * @param client the client socket
+	 */
+	void serve(int client);
+
+	std::string socket_path;
+	int listen_socket;
+	int cancel_pipe[2];
+	pthread_t server_thread;
+	bool running;
+};
+
+#endif // !_PIVACY_CARDEMU_METRICS_H
+
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_params.cpp
+
+ Idemix system parameters for the card emulator
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_params.h"
+#include "pivacy_config.h"
+#include "pivacy_log.h"
+#include "silvia_parameters.h"
+#include <string>
+
+void pivacy_cardemu_set_parameters()
+{
+	#define DEFAULT_L_N			1024
+	#define DEFAULT_L_M			256
+	#define DEFAULT_L_STATZK	80
+	#define DEFAULT_L_H			256
+	#define DEFAULT_L_V			1700
+	#define DEFAULT_L_E			597
+	#define DEFAULT_L_E_PRIME	120
+	#define DEFAULT_HASH_TYPE	"sha256"
+	
+	////////////////////////////////////////////////////////////////////
+	// Set the system parameters in the silvia library
+	////////////////////////////////////////////////////////////////////
+	
+	int l_n, l_m, l_statzk, l_H, l_v, l_e, l_e_prime;
+	std::string hash_type;
+	
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_n", l_n, DEFAULT_L_N);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_m", l_m, DEFAULT_L_M);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_statzk", l_statzk, DEFAULT_L_STATZK);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_H", l_H, DEFAULT_L_H);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_v", l_v, DEFAULT_L_V);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_e", l_e, DEFAULT_L_E);
+	pivacy_conf_get_int("emulation.idemix_parameters", "l_e_prime", l_e_prime, DEFAULT_L_E_PRIME);
+	pivacy_conf_get_string("emulation.idemix_parameters", "hash_type", hash_type, DEFAULT_HASH_TYPE);
+	
+	INFO_MSG("The following Idemix system parameters will be used:");
+	INFO_MSG("l(n)      = %d", l_n);
+	INFO_MSG("l(m)      = %d", l_m);
+	INFO_MSG("l(statzk) = %d", l_statzk);
+	INFO_MSG("l(H)      = %d", l_H);
+	INFO_MSG("l(v)      = %d", l_v);
+	INFO_MSG("l(e)      = %d", l_e);
+	INFO_MSG("l(e')     = %d", l_e_prime);
+	INFO_MSG("hash type = %s", hash_type.c_str());
+	
+	silvia_system_parameters::i()->set_l_n(l_n);
+	silvia_system_parameters::i()->set_l_m(l_m);
+	silvia_system_parameters::i()->set_l_statzk(l_statzk);
+	silvia_system_parameters::i()->set_l_H(l_H);
+	silvia_system_parameters::i()->set_l_v(l_v);
+	silvia_system_parameters::i()->set_l_e(l_e);
+	silvia_system_parameters::i()->set_l_e_prime(l_e_prime);
+	silvia_system_parameters::i()->set_hash_type(hash_type);
+	
+	// Proof arithmetic is done with fixed-width Montgomery arithmetic
+	// for the modulus sizes that have an instantiation
+	if ((l_n == 1024) || (l_n == 2048) || (l_n == 4096))
+	{
+		INFO_MSG("Using %d-bit Montgomery arithmetic", l_n);
+	}
+	else
+	{
+		WARNING_MSG("No Montgomery arithmetic for l(n) = %d, falling back to generic arithmetic", l_n);
+	}
+}
+
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_precompute.cpp
+
+ Pool of precomputed proof randomness, filled by a background thread
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_precompute.h"
+#include "pivacy_log.h"
+#include "pivacy_config.h"
+#include <sched.h>
+
+#define DEFAULT_POOL_SIZE		2
+#define DEFAULT_LOW_WATER		1
+
+pivacy_cardemu_precompute_pool::pivacy_cardemu_precompute_pool()
+{
+	int conf_pool_size = 0;
+	int conf_low_water = 0;
+
+	pivacy_conf_get_bool("emulation.precompute", "enable", enabled, true);
+	pivacy_conf_get_int("emulation.precompute", "pool_size", conf_pool_size, DEFAULT_POOL_SIZE);
+	pivacy_conf_get_int("emulation.precompute", "low_water", conf_low_water, DEFAULT_LOW_WATER);
+
+	if (conf_pool_size < 1)
+	{
+		enabled = false;
+		conf_pool_size = 1;
+	}
+
+	/* The low water mark must be in [1, pool_size] */
+	if (conf_low_water < 1)
+	{
+		conf_low_water = 1;
+	}
+	else if (conf_low_water > conf_pool_size)
+	{
+		conf_low_water = conf_pool_size;
+	}
+
+	pool_size = conf_pool_size;
+	low_water = conf_low_water;
+
+	hits = 0;
+	misses = 0;
+
+	busy_ctx = NULL;
+	running = false;
+	must_run = false;
+
+	pthread_mutex_init(&pool_mutex, NULL);
+	pthread_cond_init(&refill_cond, NULL);
+	pthread_cond_init(&idle_cond, NULL);
+
+	if (enabled)
+	{
+		INFO_MSG("Precomputing %u proof(s) per credential, refilling below %u", pool_size, low_water);
+	}
+	else
+	{
+		INFO_MSG("Proof precomputation is disabled");
+	}
+}
+
+pivacy_cardemu_precompute_pool::~pivacy_cardemu_precompute_pool()
+{
+	stop();
+
+	for (std::map<pivacy_cardemu_proof_context*, pool_entry>::iterator i = pool.begin(); i != pool.end(); i++)
+	{
+		/* The destructor of the randomness wipes it */
+		for (std::deque<pivacy_proof_randomness*>::iterator j = i->second.ready.begin(); j != i->second.ready.end(); j++)
+		{
+			delete *j;
+		}
+	}
+
+	pthread_cond_destroy(&idle_cond);
+	pthread_cond_destroy(&refill_cond);
+	pthread_mutex_destroy(&pool_mutex);
+}
+
+void pivacy_cardemu_precompute_pool::add_credential(pivacy_cardemu_proof_context* ctx)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+
+	if (pool.find(ctx) == pool.end())
+	{
+		pool_entry& entry = pool[ctx];
+
+		entry.prover = ctx->get_prover();
+		entry.refilling = true;
+
+		pthread_cond_signal(&refill_cond);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void pivacy_cardemu_precompute_pool::remove_credential(pivacy_cardemu_proof_context* ctx)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	while (busy_ctx == ctx)
+	{
+		pthread_cond_wait(&idle_cond, &pool_mutex);
+	}
+
+	std::map<pivacy_cardemu_proof_context*, pool_entry>::iterator entry = pool.find(ctx);
+
+	if (entry != pool.end())
+	{
+		/* The destructor of the randomness wipes it */
+		for (std::deque<pivacy_proof_randomness*>::iterator i = entry->second.ready.begin(); i != entry->second.ready.end(); i++)
+		{
+			delete *i;
+		}
+
+		pool.erase(entry);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void pivacy_cardemu_precompute_pool::start()
+{
+	if (!enabled || running)
+	{
+		return;
+	}
+
+	must_run = true;
+
+	if (pthread_create(&refill_thread, NULL, refill_thread_entry, this) != 0)
+	{
+		ERROR_MSG("Failed to start the proof precomputation thread");
+
+		must_run = false;
+
+		return;
+	}
+
+	running = true;
+}
+
+void pivacy_cardemu_precompute_pool::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+
+	must_run = false;
+
+	pthread_cond_signal(&refill_cond);
+	pthread_mutex_unlock(&pool_mutex);
+
+	pthread_join(refill_thread, NULL);
+
+	running = false;
+}
+
+pivacy_proof_randomness* pivacy_cardemu_precompute_pool::take(pivacy_cardemu_proof_context* ctx)
+{
+	pivacy_proof_randomness* rnd = NULL;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	std::map<pivacy_cardemu_proof_context*, pool_entry>::iterator entry = pool.find(ctx);
+
+	if ((entry != pool.end()) && !entry->second.ready.empty())
+	{
+		rnd = entry->second.ready.front();
+		entry->second.ready.pop_front();
+
+		hits++;
+	}
+	else
+	{
+		misses++;
+	}
+
+	if ((entry != pool.end()) && (entry->second.ready.size() < low_water))
+	{
+		entry->second.refilling = true;
+
+		pthread_cond_signal(&refill_cond);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	return rnd;
+}
+
+unsigned long pivacy_cardemu_precompute_pool::get_hits()
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	unsigned long rv = hits;
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	return rv;
+}
+
+unsigned long pivacy_cardemu_precompute_pool::get_misses()
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	unsigned long rv = misses;
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	return rv;
+}
+
+/*static*/ void* pivacy_cardemu_precompute_pool::refill_thread_entry(void* arg)
+{
+	/* Precomputation should only use otherwise idle CPU time */
+#ifdef SCHED_IDLE
+	struct sched_param param = { 0 };
+
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+	{
+		WARNING_MSG("Failed to lower the priority of the proof precomputation thread");
+	}
+#endif // SCHED_IDLE
+
+	/* Keep the work on this thread so it does not run at normal priority on the task pool */
+	pivacy_cardemu_prover::set_background_thread(true);
+
+	((pivacy_cardemu_precompute_pool*) arg)->refill_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_precompute_pool::refill_loop()
+{
+	DEBUG_MSG("Entering proof precomputation thread");
+
+	pthread_mutex_lock(&pool_mutex);
+
+	while (must_run)
+	{
+		/* Find a credential that needs more precomputed proofs */
+		std::map<pivacy_cardemu_proof_context*, pool_entry>::iterator entry = pool.begin();
+
+		while ((entry != pool.end()) && !entry->second.refilling)
+		{
+			entry++;
+		}
+
+		if (entry == pool.end())
+		{
+			pthread_cond_wait(&refill_cond, &pool_mutex);
+
+			continue;
+		}
+
+		/* Compute the missing entries as one batch without holding the lock */
+		pivacy_cardemu_prover* prover = entry->second.prover;
+		size_t count = (entry->second.ready.size() < pool_size) ? (pool_size - entry->second.ready.size()) : 1;
+		std::vector<pivacy_proof_randomness*> rnds;
+
+		busy_ctx = entry->first;
+
+		pthread_mutex_unlock(&pool_mutex);
+
+		prover->precompute(count, rnds);
+
+		pthread_mutex_lock(&pool_mutex);
+
+		/* The entry cannot have been removed while it was busy */
+		busy_ctx = NULL;
+
+		pthread_cond_broadcast(&idle_cond);
+
+		entry->second.ready.insert(entry->second.ready.end(), rnds.begin(), rnds.end());
+
+		if (entry->second.ready.size() >= pool_size)
+		{
+			entry->second.refilling = false;
+
+			DEBUG_MSG("Proof precomputation pool for credential 0x%04X is full", entry->first->get_credential_id());
+		}
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	DEBUG_MSG("Exiting proof precomputation thread");
+}
+
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_precompute.h
+
+ Pool of precomputed proof randomness, filled by a background thread
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_PRECOMPUTE_H
+#define _PIVACY_CARDEMU_PRECOMPUTE_H
+
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cardemu_prover.h"
+#include <pthread.h>
+#include <deque>
+#include <map>
+
+/**
+ * Precomputation pool
+ */
+class pivacy_cardemu_precompute_pool
+{
+public:
+	/**
+	 * Constructor; reads the pool settings from the configuration
+	 */
+	pivacy_cardemu_precompute_pool();
+
+	/**
+	 * Destructor; stops the background thread and wipes all unused entries
+	 */
+	~pivacy_cardemu_precompute_pool();
+
+	/**
+	 * Add a credential to the pool
+	 * @param ctx the proof context of the credential to precompute proofs for
+	 */
+	void add_credential(pivacy_cardemu_proof_context* ctx);
+
+	/**
+	 * Remove a credential from the pool and wipe its precomputed proofs;
+	 * waits for the background thread to finish working on it
+	 * @param ctx the proof context of the credential
+	 */
+	void remove_credential(pivacy_cardemu_proof_context* ctx);
+
+	/**
+	 * Start the background thread
+	 */
+	void start();
+
+	/**
+	 * Stop the background thread
+	 */
+	void stop();
+
+	/**
+	 * Take precomputed proof randomness for the specified credential
+	 * @param ctx the proof context of the credential
+	 * @return proof randomness owned by the caller, or NULL if the pool is empty
+	 */
+	pivacy_proof_randomness* take(pivacy_cardemu_proof_context* ctx);
+
+	/**
+	 * Get the number of pool hits
+	 * @return the number of times take() returned precomputed randomness
+	 */
+	unsigned long get_hits();
+
+	/**
+	 * Get the number of pool misses
+	 * @return the number of times take() found the pool empty
+	 */
+	unsigned long get_misses();
+
+private:
+	/**
+	 * Background thread entry point
+	 */
+	static void* refill_thread_entry(void* arg);
+
+	/**
+	 * Background thread main loop
+	 */
+	void refill_loop();
+
+	/* Per-credential pool state */
+	struct pool_entry
+	{
+		pivacy_cardemu_prover* prover;	/* owned by the proof context */
+		std::deque<pivacy_proof_randomness*> ready;
+		bool refilling;
+	};
+
+	std::map<pivacy_cardemu_proof_context*, pool_entry> pool;
+
+	/* Settings */
+	bool enabled;
+	size_t pool_size;
+	size_t low_water;
+
+	/* Statistics */
+	unsigned long hits;
+	unsigned long misses;
+
+	/* Thread state */
+	pthread_t refill_thread;
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t refill_cond;
+	pthread_cond_t idle_cond;
+	pivacy_cardemu_proof_context* busy_ctx;
+	bool running;
+	bool must_run;
+};
+
+#endif // !_PIVACY_CARDEMU_PRECOMPUTE_H
+
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_proof_context.cpp
+
+ Per-credential state needed to run a proof, prepared once when the
+ credential is loaded
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cred_xml_rw.h"
+#include "pivacy_cred_bin_store.h"
+#include "pivacy_log.h"
+#include <assert.h>
+
+pivacy_cardemu_proof_context::pivacy_cardemu_proof_context(pivacy_credential* cred) :
+	cred(cred),
+	full_cred(NULL),
+	ready(false),
+	pubkey(NULL),
+	prover(NULL)
+{
+	pthread_mutex_init(&materialize_mutex, NULL);
+
+	/* The names are owned by the credential and never change */
+	const std::vector<std::string>& names = cred->get_attribute_names();
+
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		attribute_names.push_back(names[i].c_str());
+	}
+
+	assert(cred->get_issuer_public_key() != NULL);
+
+	prepare(cred);
+}
+
+pivacy_cardemu_proof_context::pivacy_cardemu_proof_context(pivacy_credential* cred, const std::string& source_file, const std::string& base_path) :
+	cred(cred),
+	source_file(source_file),
+	base_path(base_path),
+	full_cred(NULL),
+	ready(false),
+	pubkey(NULL),
+	prover(NULL)
+{
+	pthread_mutex_init(&materialize_mutex, NULL);
+
+	/* The names are owned by the credential and never change */
+	const std::vector<std::string>& names = cred->get_attribute_names();
+
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		attribute_names.push_back(names[i].c_str());
+	}
+}
+
+pivacy_cardemu_proof_context::~pivacy_cardemu_proof_context()
+{
+	/* The prover refers to the credential */
+	delete prover;
+	delete full_cred;
+
+	pthread_mutex_destroy(&materialize_mutex);
+}
+
+bool pivacy_cardemu_proof_context::materialize()
+{
+	pthread_mutex_lock(&materialize_mutex);
+
+	if (!ready)
+	{
+		full_cred = read_source();
+
+		if (full_cred != NULL)
+		{
+			prepare(full_cred);
+
+			DEBUG_MSG("Materialized credential %s issued by %s (ID 0x%04X)", cred->get_name().c_str(), cred->get_issuer().c_str(), cred->get_credential_id());
+		}
+	}
+
+	bool rv = ready;
+
+	pthread_mutex_unlock(&materialize_mutex);
+
+	return rv;
+}
+
+bool pivacy_cardemu_proof_context::is_materialized()
+{
+	pthread_mutex_lock(&materialize_mutex);
+
+	bool rv = ready;
+
+	pthread_mutex_unlock(&materialize_mutex);
+
+	return rv;
+}
+
+void pivacy_cardemu_proof_context::prepare(pivacy_credential* full_cred)
+{
+	pubkey = full_cred->get_issuer_public_key();
+
+	assert(pubkey != NULL);
+
+	prover = new pivacy_cardemu_prover(pubkey, full_cred->get_silvia_credential(), full_cred->get_issuer_fixed_base());
+
+	std::vector<silvia_attribute*> attributes = full_cred->get_silvia_credential()->get_attributes();
+
+	if (attribute_names.size() < attributes.size())
+	{
+		WARNING_MSG("Credential %s has %zu attributes but only %zu attribute names", cred->get_name().c_str(), attributes.size(), attribute_names.size());
+	}
+
+	for (size_t i = 0; i < attributes.size(); i++)
+	{
+		encoded_attributes.push_back(bytestring(attributes[i]->rep()));
+	}
+
+	attribute_names.resize(attributes.size(), "(unnamed attribute)");
+
+	ready = true;
+}
+
+pivacy_credential* pivacy_cardemu_proof_context::read_source()
+{
+	pivacy_credential* full = NULL;
+	std::string error;
+
+	if (pivacy_cred_bin_store::is_bin_store(source_file))
+	{
+		pivacy_cred_bin_store store;
+		size_t index = 0;
+
+		if (store.open(source_file) && store.find(cred->get_credential_id(), index))
+		{
+			full = store.read_credential(index);
+		}
+	}
+	else
+	{
+		full = pivacy_credential_xml_rw::i()->read_pivacy_credential(source_file, false, &error);
+	}
+
+	if (full == NULL)
+	{
+		WARNING_MSG("Failed to read credential 0x%04X from %s%s%s", cred->get_credential_id(), source_file.c_str(), error.empty() ? "" : ": ", error.c_str());
+
+		return NULL;
+	}
+
+	/* The file may have been replaced since the header was read */
+	if ((full->get_credential_id() != cred->get_credential_id()) ||
+	    (full->get_name() != cred->get_name()) ||
+	    (full->get_issuer() != cred->get_issuer()) ||
+	    (full->get_issuer_public_key_file_name() != cred->get_issuer_public_key_file_name()) ||
+	    (full->get_silvia_credential()->num_attributes() != attribute_names.size()))
+	{
+		WARNING_MSG("Credential 0x%04X in %s changed since it was loaded", cred->get_credential_id(), source_file.c_str());
+
+		delete full;
+
+		return NULL;
+	}
+
+	if (full->get_issuer_public_key(base_path) == NULL)
+	{
+		WARNING_MSG("Failed to load the issuer public key for credential %s issued by %s", cred->get_name().c_str(), cred->get_issuer().c_str());
+
+		delete full;
+
+		return NULL;
+	}
+
+	return full;
+}
+
+pivacy_credential* pivacy_cardemu_proof_context::get_credential()
+{
+	return cred;
+}
+
+unsigned short pivacy_cardemu_proof_context::get_credential_id()
+{
+	return cred->get_credential_id();
+}
+
+silvia_pub_key* pivacy_cardemu_proof_context::get_public_key()
+{
+	return pubkey;
+}
+
+pivacy_cardemu_prover* pivacy_cardemu_proof_context::get_prover()
+{
+	return prover;
+}
+
+size_t pivacy_cardemu_proof_context::num_attributes()
+{
+	/* Known from the header, before the context is ready */
+	return attribute_names.size();
+}
+
+const bytestring& pivacy_cardemu_proof_context::get_encoded_attribute(size_t i)
+{
+	assert(i < encoded_attributes.size());
+
+	return encoded_attributes[i];
+}
+
+const char* pivacy_cardemu_proof_context::get_attribute_name(size_t i)
+{
+	assert(i < attribute_names.size());
+
+	return attribute_names[i];
+}
+
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_proof_context.h
+
+ Per-credential state needed to run a proof, prepared once when the
+ credential is loaded or, for credentials of which only the header was
+ read, when the credential is first used
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_PROOF_CONTEXT_H
+#define _PIVACY_CARDEMU_PROOF_CONTEXT_H
+
+#include "pivacy_credential.h"
+#include "pivacy_cardemu_prover.h"
+#include "silvia_bytestring.h"
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/**
+ * Prepared proof context
+ */
+class pivacy_cardemu_proof_context
+{
+public:
+	/**
+	 * Constructor; the issuer public key of the credential must have
+	 * been loaded
+	 * @param cred the credential (remains owned by the caller)
+	 */
+	pivacy_cardemu_proof_context(pivacy_credential* cred);
+
+	/**
+	 * Constructor for a credential of which only the header was read;
+	 * the rest of the credential and the issuer public key are read
+	 * from the source file by materialize()
+	 * @param cred the credential header (remains owned by the caller)
+	 * @param source_file the credential file or binary credential store
+	 * @param base_path the directory to look for the public key in
+	 */
+	pivacy_cardemu_proof_context(pivacy_credential* cred, const std::string& source_file, const std::string& base_path);
+
+	/**
+	 * Destructor
+	 */
+	~pivacy_cardemu_proof_context();
+
+	/**
+	 * Make sure the context is ready for proofs; this must be called
+	 * before using the prover or the encoded attributes (thread-safe)
+	 * @return true if the context is ready
+	 */
+	bool materialize();
+
+	/**
+	 * Check if the context is ready for proofs (thread-safe)
+	 * @return true if the context is ready
+	 */
+	bool is_materialized();
+
+	/**
+	 * Get the credential; for a credential of which only the header was
+	 * read this has no silvia credential
+	 * @return the credential
+	 */
+	pivacy_credential* get_credential();
+
+	/**
+	 * Get the credential ID
+	 * @return the credential ID
+	 */
+	unsigned short get_credential_id();
+
+	/**
+	 * Get the issuer public key
+	 * @return the issuer public key (NULL until the context is ready)
+	 */
+	silvia_pub_key* get_public_key();
+
+	/**
+	 * Get the prover for the credential
+	 * @return the prover (NULL until the context is ready)
+	 */
+	pivacy_cardemu_prover* get_prover();
+
+	/**
+	 * Get the number of attributes (excluding the master secret)
+	 * @return the number of attributes
+	 */
+	size_t num_attributes();
+
+	/**
+	 * Get an attribute encoded for disclosure
+	 * @param i the index of the attribute
+	 * @return the encoded attribute
+	 */
+	const bytestring& get_encoded_attribute(size_t i);
+
+	/**
+	 * Get the name of an attribute, as shown on the consent screen
+	 * @param i the index of the attribute
+	 * @return the name of the attribute
+	 */
+	const char* get_attribute_name(size_t i);
+
+private:
+	/**
+	 * Prepare the prover and encoded attributes
+	 * @param full_cred the fully read credential; its public key must
+	 *        have been loaded
+	 */
+	void prepare(pivacy_credential* full_cred);
+
+	/**
+	 * Read the rest of the credential from the source file
+	 * @return the fully read credential with its public key loaded, or
+	 *         NULL if it no longer matches the header
+	 */
+	pivacy_credential* read_source();
+
+	pivacy_credential* cred;
+
+	/* Source of a credential of which only the header was read */
+	std::string source_file;
+	std::string base_path;
+
+	/* The fully read credential if it was materialized later; owned */
+	pivacy_credential* full_cred;
+
+	pthread_mutex_t materialize_mutex;
+	bool ready;
+
+	/* Resolved once; the credential owns the public key */
+	silvia_pub_key* pubkey;
+
+	pivacy_cardemu_prover* prover;
+
+	std::vector<bytestring> encoded_attributes;
+	std::vector<const char*> attribute_names;
+};
+
+#endif // !_PIVACY_CARDEMU_PROOF_CONTEXT_H
+
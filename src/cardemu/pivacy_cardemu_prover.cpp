@@ -0,0 +1,648 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_prover.cpp
+
+ Split-phase IRMA proof generation; the nonce-independent part of a proof
+ can be computed ahead of time so only hashing and the linear responses
+ remain once the terminal has sent its nonce
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_prover.h"
+#include "pivacy_multiexp.h"
+#include "pivacy_batch_exp.h"
+#include "pivacy_log.h"
+#include "silvia_parameters.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void pivacy_wipe_mpz(mpz_class& val)
+{
+	mpz_ptr v = val.get_mpz_t();
+
+	memset(v->_mp_d, 0, v->_mp_alloc * sizeof(mp_limb_t));
+
+	v->_mp_size = 0;
+}
+
+pivacy_proof_randomness::pivacy_proof_randomness()
+{
+	committed = false;
+}
+
+pivacy_proof_randomness::~pivacy_proof_randomness()
+{
+	wipe();
+}
+
+void pivacy_proof_randomness::wipe()
+{
+	pivacy_wipe_mpz(A_prime);
+	pivacy_wipe_mpz(v_prime);
+	pivacy_wipe_mpz(e_tilde);
+	pivacy_wipe_mpz(v_prime_tilde);
+	pivacy_wipe_mpz(Z_tilde_base);
+	pivacy_wipe_mpz(Z_tilde);
+
+	for (std::vector<mpz_class>::iterator i = a_tilde.begin(); i != a_tilde.end(); i++)
+	{
+		pivacy_wipe_mpz(*i);
+	}
+
+	for (std::vector<mpz_class>::iterator i = R_a_tilde.begin(); i != R_a_tilde.end(); i++)
+	{
+		pivacy_wipe_mpz(*i);
+	}
+
+	a_tilde.clear();
+	R_a_tilde.clear();
+	committed_D.clear();
+	committed = false;
+}
+
+/* Append an ASN.1 DER length field */
+static void der_append_length(std::vector<unsigned char>& out, size_t len)
+{
+	if (len < 0x80)
+	{
+		out.push_back((unsigned char) len);
+	}
+	else
+	{
+		unsigned char len_bytes[sizeof(size_t)];
+		size_t num_len_bytes = 0;
+
+		while (len > 0)
+		{
+			len_bytes[num_len_bytes++] = len & 0xff;
+			len >>= 8;
+		}
+
+		out.push_back(0x80 | num_len_bytes);
+
+		while (num_len_bytes > 0)
+		{
+			out.push_back(len_bytes[--num_len_bytes]);
+		}
+	}
+}
+
+/* Append a (non-negative) ASN.1 DER INTEGER */
+static void der_append_integer(std::vector<unsigned char>& out, const mpz_class& val)
+{
+	size_t val_len = (mpz_sizeinbase(val.get_mpz_t(), 2) + 7) / 8;
+	std::vector<unsigned char> val_bytes(val_len + 1, 0);
+	size_t written = 0;
+
+	mpz_export(&val_bytes[1], &written, 1, 1, 1, 0, val.get_mpz_t());
+
+	/* Zero is encoded as a single zero byte; a leading zero keeps the value positive */
+	size_t ofs = ((written > 0) && ((val_bytes[1] & 0x80) == 0)) ? 1 : 0;
+
+	out.push_back(0x02);
+	der_append_length(out, written + 1 - ofs);
+	out.insert(out.end(), val_bytes.begin() + ofs, val_bytes.begin() + written + 1);
+}
+
+/* Randomise the signature: A' = A * S^r_A mod n and v' = v - e * r_A; wipes r_A and S^r_A */
+static void apply_randomiser(pivacy_proof_randomness* rnd, silvia_credential* cred, const mpz_class& n, mpz_class& S_r_A, mpz_class& r_A)
+{
+	rnd->A_prime = (cred->get_A() * S_r_A) % n;
+	rnd->v_prime = cred->get_v() - (cred->get_e() * r_A);
+
+	pivacy_wipe_mpz(r_A);
+	pivacy_wipe_mpz(S_r_A);
+}
+
+/* Randomise the signature, computing S^r_A on its own; wipes r_A */
+static void randomise_signature(pivacy_proof_randomness* rnd, silvia_credential* cred, const mpz_class& n, const pivacy_fixed_base* fixed_base, mpz_class& r_A)
+{
+	mpz_class S_r_A;
+
+	pivacy_multiexp S_r_A_exp(n, fixed_base);
+
+	S_r_A_exp.add_fixed(pivacy_fixed_base::BASE_S, r_A);
+	S_r_A_exp.compute(S_r_A);
+
+	apply_randomiser(rnd, cred, n, S_r_A, r_A);
+}
+
+/* Randomises the signature if that still has to be done and computes A'^e~ */
+class pivacy_randomise_task : public pivacy_cardemu_task
+{
+public:
+	pivacy_randomise_task(pivacy_proof_randomness* rnd, silvia_credential* cred, const mpz_class& n, const pivacy_fixed_base* fixed_base, mpz_class* r_A)
+	: rnd(rnd), cred(cred), n(n), fixed_base(fixed_base), r_A(r_A)
+	{
+	}
+
+	virtual void run()
+	{
+		if (r_A != NULL)
+		{
+			randomise_signature(rnd, cred, n, fixed_base, *r_A);
+		}
+
+		pivacy_multiexp A_e(n, fixed_base);
+
+		A_e.add(rnd->A_prime, rnd->e_tilde);
+		A_e.compute(result);
+	}
+
+	mpz_class result;
+
+private:
+	pivacy_proof_randomness* rnd;
+	silvia_credential* cred;
+	const mpz_class& n;
+	const pivacy_fixed_base* fixed_base;
+	mpz_class* r_A;
+};
+
+/* Computes a share of the fixed-base terms of Z~ */
+class pivacy_commit_task : public pivacy_cardemu_task
+{
+public:
+	pivacy_commit_task(const mpz_class& n, const pivacy_fixed_base* fixed_base)
+	: exp(n, fixed_base), bits(0)
+	{
+	}
+
+	virtual void run()
+	{
+		exp.compute(result);
+	}
+
+	pivacy_multiexp exp;
+	size_t bits;
+	mpz_class result;
+};
+
+/*static*/ pivacy_cardemu_task_pool* pivacy_cardemu_prover::task_pool = NULL;
+/*static*/ pthread_key_t pivacy_cardemu_prover::background_key;
+/*static*/ pthread_once_t pivacy_cardemu_prover::background_key_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_cardemu_prover::set_task_pool(pivacy_cardemu_task_pool* pool)
+{
+	task_pool = pool;
+}
+
+/*static*/ void pivacy_cardemu_prover::create_background_key()
+{
+	pthread_key_create(&background_key, NULL);
+}
+
+/*static*/ void pivacy_cardemu_prover::set_background_thread(bool background)
+{
+	pthread_once(&background_key_once, create_background_key);
+
+	/* Any non-NULL value marks the thread */
+	pthread_setspecific(background_key, background ? &background_key : NULL);
+}
+
+/*static*/ bool pivacy_cardemu_prover::use_task_pool()
+{
+	if ((task_pool == NULL) || (task_pool->get_threads() == 0))
+	{
+		return false;
+	}
+
+	pthread_once(&background_key_once, create_background_key);
+
+	/* Background work must not compete with foreground proofs for the workers */
+	return (pthread_getspecific(background_key) == NULL);
+}
+
+pivacy_cardemu_prover::pivacy_cardemu_prover(silvia_pub_key* pubkey, silvia_credential* cred, const pivacy_fixed_base* fixed_base /* = NULL */)
+{
+	this->pubkey = pubkey;
+	this->cred = cred;
+
+	if (fixed_base == NULL)
+	{
+		/* Without tables all fixed-base terms take the generic path */
+		pivacy_fixed_base* bases = new pivacy_fixed_base(pubkey->get_n());
+
+		bases->add_base(pubkey->get_S());
+		bases->add_base(pubkey->get_Z());
+
+		for (size_t i = 0; i < pubkey->get_R().size(); i++)
+		{
+			bases->add_base(pubkey->get_R()[i]);
+		}
+
+		own_fixed_base.reset(bases);
+
+		fixed_base = bases;
+	}
+
+	this->fixed_base = fixed_base;
+}
+
+mpz_class pivacy_cardemu_prover::get_random(size_t bits)
+{
+	std::vector<unsigned char> rand_bytes((bits + 7) / 8);
+	mpz_class rand_val;
+
+	if (RAND_bytes(&rand_bytes[0], rand_bytes.size()) != 1)
+	{
+		ERROR_MSG("Failed to generate %zu random bits", bits);
+
+		/* Proofs with predictable randomness reveal the secrets, so never continue */
+		abort();
+	}
+
+	mpz_import(rand_val.get_mpz_t(), rand_bytes.size(), 1, 1, 1, 0, &rand_bytes[0]);
+
+	memset(&rand_bytes[0], 0, rand_bytes.size());
+
+	/* Remove excess bits */
+	mpz_fdiv_r_2exp(rand_val.get_mpz_t(), rand_val.get_mpz_t(), bits);
+
+	return rand_val;
+}
+
+mpz_class pivacy_cardemu_prover::hash_challenge(const mpz_class& context, const mpz_class& A_prime, const mpz_class& Z_tilde, const mpz_class& n1)
+{
+	std::vector<unsigned char> seq_contents;
+
+	der_append_integer(seq_contents, mpz_class(4));
+	der_append_integer(seq_contents, context);
+	der_append_integer(seq_contents, A_prime);
+	der_append_integer(seq_contents, Z_tilde);
+	der_append_integer(seq_contents, n1);
+
+	std::vector<unsigned char> seq;
+
+	seq.push_back(0x30);
+	der_append_length(seq, seq_contents.size());
+	seq.insert(seq.end(), seq_contents.begin(), seq_contents.end());
+
+	const EVP_MD* md = NULL;
+
+	if (SYSPAR(hash_type) == "sha1")
+	{
+		md = EVP_sha1();
+	}
+	else if (SYSPAR(hash_type) == "sha512")
+	{
+		md = EVP_sha512();
+	}
+	else
+	{
+		md = EVP_sha256();
+	}
+
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len = 0;
+
+	EVP_Digest(&seq[0], seq.size(), digest, &digest_len, md, NULL);
+
+	mpz_class c;
+
+	mpz_import(c.get_mpz_t(), digest_len, 1, 1, 1, 0, digest);
+
+	return c;
+}
+
+pivacy_proof_randomness* pivacy_cardemu_prover::generate(mpz_class& r_A)
+{
+	pivacy_proof_randomness* rnd = new pivacy_proof_randomness();
+
+	/* The randomiser for the signature */
+	r_A = get_random(SYSPAR(l_n) + SYSPAR(l_statzk));
+
+	/* Generate the randomisers; the master secret comes first */
+	rnd->e_tilde = get_random(SYSPAR(l_e_prime) + SYSPAR(l_statzk) + SYSPAR(l_H));
+	rnd->v_prime_tilde = get_random(SYSPAR(l_v) + SYSPAR(l_statzk) + SYSPAR(l_H));
+
+	rnd->a_tilde.resize(cred->num_attributes() + 1);
+
+	for (size_t i = 0; i < rnd->a_tilde.size(); i++)
+	{
+		rnd->a_tilde[i] = get_random(SYSPAR(l_m) + SYSPAR(l_statzk) + SYSPAR(l_H) + 1);
+	}
+
+	return rnd;
+}
+
+pivacy_proof_randomness* pivacy_cardemu_prover::precompute()
+{
+	std::vector<pivacy_proof_randomness*> rnds;
+
+	precompute(1, rnds);
+
+	return rnds[0];
+}
+
+void pivacy_cardemu_prover::precompute(size_t count, std::vector<pivacy_proof_randomness*>& rnds)
+{
+	const mpz_class& n = pubkey->get_n();
+
+	assert(pubkey->get_R().size() >= (cred->num_attributes() + 1));
+
+	/*
+	 * Apart from A'^e~, all exponentiations only depend on the
+	 * randomisers: S^r_A, S^v'~ and R_i^a~_i for all attributes
+	 * (including the master secret); which of the latter end up in Z~
+	 * depends on the disclosure selection, which is only known once
+	 * the proof is completed
+	 */
+	size_t first_rnd = rnds.size();
+	std::vector<mpz_class> r_A(count);
+	std::vector<size_t> first(count);
+	std::vector<mpz_class> powers;
+	pivacy_batch_exp batch(n, fixed_base);
+
+	for (size_t p = 0; p < count; p++)
+	{
+		pivacy_proof_randomness* rnd = generate(r_A[p]);
+
+		rnds.push_back(rnd);
+
+		first[p] = batch.add_fixed(pivacy_fixed_base::BASE_S, r_A[p]);
+		batch.add_fixed(pivacy_fixed_base::BASE_S, rnd->v_prime_tilde);
+
+		for (size_t i = 0; i < rnd->a_tilde.size(); i++)
+		{
+			batch.add_fixed(pivacy_fixed_base::BASE_R0 + i, rnd->a_tilde[i]);
+		}
+	}
+
+	batch.compute(powers);
+	batch.clear();
+
+	/* Randomise the signatures; A'^e~ for all proofs is the second batch */
+	for (size_t p = 0; p < count; p++)
+	{
+		pivacy_proof_randomness* rnd = rnds[first_rnd + p];
+
+		apply_randomiser(rnd, cred, n, powers[first[p]], r_A[p]);
+
+		rnd->R_a_tilde.assign(powers.begin() + first[p] + 2, powers.begin() + first[p] + 2 + rnd->a_tilde.size());
+
+		batch.add(rnd->A_prime, rnd->e_tilde);
+	}
+
+	std::vector<mpz_class> A_e_tilde;
+
+	batch.compute(A_e_tilde);
+
+	/* Commit to e~ and v'~ */
+	for (size_t p = 0; p < count; p++)
+	{
+		pivacy_proof_randomness* rnd = rnds[first_rnd + p];
+
+		rnd->Z_tilde_base = (A_e_tilde[p] * powers[first[p] + 1]) % n;
+	}
+
+	for (std::vector<mpz_class>::iterator i = powers.begin(); i != powers.end(); i++)
+	{
+		pivacy_wipe_mpz(*i);
+	}
+}
+
+pivacy_proof_randomness* pivacy_cardemu_prover::precompute(const std::vector<bool>& D)
+{
+	assert(D.size() == cred->num_attributes());
+	assert(pubkey->get_R().size() >= (cred->num_attributes() + 1));
+
+	mpz_class r_A;
+	pivacy_proof_randomness* rnd = generate(r_A);
+
+	if (use_task_pool())
+	{
+		/* Randomising the signature is the longest chain, so it runs alongside the commitments */
+		commit_parallel(rnd, D, &r_A);
+	}
+	else
+	{
+		randomise_signature(rnd, cred, pubkey->get_n(), fixed_base, r_A);
+
+		commit(rnd, D);
+	}
+
+	return rnd;
+}
+
+void pivacy_cardemu_prover::prove
+(
+	pivacy_proof_randomness* rnd,
+	const std::vector<bool>& D,
+	const mpz_class& n1,
+	const mpz_class& context,
+	mpz_class& c,
+	mpz_class& A_prime,
+	mpz_class& e_hat,
+	mpz_class& v_prime_hat,
+	std::vector<mpz_class>& a_i_hat,
+	std::vector<silvia_attribute*>& a_i
+)
+{
+	assert(D.size() == cred->num_attributes());
+	assert(rnd->a_tilde.size() == (D.size() + 1));
+
+	/* Complete the commitment unless this was already done for the same selection */
+	if (!rnd->committed || (rnd->committed_D != D))
+	{
+		commit(rnd, D);
+	}
+
+	/* Compute the challenge */
+	A_prime = rnd->A_prime;
+
+	c = hash_challenge(context, A_prime, rnd->Z_tilde, n1);
+
+	/* Compute the responses */
+	mpz_class e_prime = cred->get_e() - (mpz_class(1) << (SYSPAR(l_e) - 1));
+
+	e_hat = rnd->e_tilde + (c * e_prime);
+	v_prime_hat = rnd->v_prime_tilde + (c * rnd->v_prime);
+
+	std::vector<silvia_attribute*> attributes = cred->get_attributes();
+
+	a_i_hat.clear();
+	a_i.clear();
+
+	a_i_hat.push_back(rnd->a_tilde[0] + (c * cred->get_secret().rep()));
+
+	for (size_t i = 0; i < D.size(); i++)
+	{
+		if (D[i])
+		{
+			a_i.push_back(attributes[i]);
+		}
+		else
+		{
+			a_i_hat.push_back(rnd->a_tilde[i + 1] + (c * attributes[i]->rep()));
+		}
+	}
+
+	pivacy_wipe_mpz(e_prime);
+	rnd->wipe();
+}
+
+void pivacy_cardemu_prover::commit(pivacy_proof_randomness* rnd, const std::vector<bool>& D)
+{
+	assert(D.size() == cred->num_attributes());
+	assert(rnd->a_tilde.size() == (D.size() + 1));
+
+	const mpz_class& n = pubkey->get_n();
+
+	if (rnd->R_a_tilde.size() == rnd->a_tilde.size())
+	{
+		/* Add the precomputed commitments to the hidden attributes; the master secret is never disclosed */
+		rnd->Z_tilde = (rnd->Z_tilde_base * rnd->R_a_tilde[0]) % n;
+
+		for (size_t i = 0; i < D.size(); i++)
+		{
+			if (!D[i])
+			{
+				rnd->Z_tilde = (rnd->Z_tilde * rnd->R_a_tilde[i + 1]) % n;
+			}
+		}
+	}
+	else if (use_task_pool())
+	{
+		commit_parallel(rnd, D, NULL);
+
+		return;
+	}
+	else
+	{
+		/* Compute Z~ = A'^e~ * S^v'~ * prod(R_i^a~_i) over the hidden attributes in one go */
+		pivacy_multiexp Z_tilde(n, fixed_base);
+
+		Z_tilde.add(rnd->A_prime, rnd->e_tilde);
+		Z_tilde.add_fixed(pivacy_fixed_base::BASE_S, rnd->v_prime_tilde);
+		Z_tilde.add_fixed(pivacy_fixed_base::BASE_R0, rnd->a_tilde[0]);
+
+		for (size_t i = 0; i < D.size(); i++)
+		{
+			if (!D[i])
+			{
+				Z_tilde.add_fixed(pivacy_fixed_base::BASE_R0 + i + 1, rnd->a_tilde[i + 1]);
+			}
+		}
+
+		Z_tilde.compute(rnd->Z_tilde);
+	}
+
+	rnd->committed_D = D;
+	rnd->committed = true;
+}
+
+void pivacy_cardemu_prover::commit_parallel(pivacy_proof_randomness* rnd, const std::vector<bool>& D, mpz_class* r_A)
+{
+	assert(D.size() == cred->num_attributes());
+	assert(rnd->a_tilde.size() == (D.size() + 1));
+
+	const mpz_class& n = pubkey->get_n();
+
+	/* The fixed-base terms S^v'~, R_0^a~_0 and R_i^a~_i for the hidden attributes */
+	std::vector<size_t> indices;
+	std::vector<const mpz_class*> exponents;
+
+	indices.push_back(pivacy_fixed_base::BASE_S);
+	exponents.push_back(&rnd->v_prime_tilde);
+	indices.push_back(pivacy_fixed_base::BASE_R0);
+	exponents.push_back(&rnd->a_tilde[0]);
+
+	for (size_t i = 0; i < D.size(); i++)
+	{
+		if (!D[i])
+		{
+			indices.push_back(pivacy_fixed_base::BASE_R0 + i + 1);
+			exponents.push_back(&rnd->a_tilde[i + 1]);
+		}
+	}
+
+	/*
+	 * Split the terms into one share per worker; S^v'~ has by far the
+	 * largest exponent, so adding each term to the lightest share in
+	 * this order keeps the shares balanced
+	 */
+	size_t num_shares = task_pool->get_threads();
+
+	if (num_shares > indices.size())
+	{
+		num_shares = indices.size();
+	}
+
+	std::vector<pivacy_commit_task*> shares;
+
+	for (size_t i = 0; i < num_shares; i++)
+	{
+		shares.push_back(new pivacy_commit_task(n, fixed_base));
+	}
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		pivacy_commit_task* lightest = shares[0];
+
+		for (size_t j = 1; j < shares.size(); j++)
+		{
+			if (shares[j]->bits < lightest->bits)
+			{
+				lightest = shares[j];
+			}
+		}
+
+		lightest->exp.add_fixed(indices[i], *exponents[i]);
+		lightest->bits += mpz_sizeinbase(exponents[i]->get_mpz_t(), 2);
+	}
+
+	/* Run the tasks; the calling thread picks up whatever the workers have not started */
+	pivacy_cardemu_task_group group(task_pool);
+	pivacy_randomise_task A_e(rnd, cred, n, fixed_base, r_A);
+
+	group.add(&A_e);
+
+	for (std::vector<pivacy_commit_task*>::iterator i = shares.begin(); i != shares.end(); i++)
+	{
+		group.add(*i);
+	}
+
+	group.wait();
+
+	/* Z~ = A'^e~ * S^v'~ * prod(R_i^a~_i) over the hidden attributes */
+	rnd->Z_tilde = A_e.result;
+
+	for (std::vector<pivacy_commit_task*>::iterator i = shares.begin(); i != shares.end(); i++)
+	{
+		rnd->Z_tilde = (rnd->Z_tilde * (*i)->result) % n;
+
+		delete *i;
+	}
+
+	rnd->committed_D = D;
+	rnd->committed = true;
+}
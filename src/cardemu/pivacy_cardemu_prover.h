@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_prover.h
+
+ Split-phase IRMA proof generation; the nonce-independent part of a proof
+ can be computed ahead of time so only hashing and the linear responses
+ remain once the terminal has sent its nonce
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_PROVER_H
+#define _PIVACY_CARDEMU_PROVER_H
+
+#include <gmpxx.h>
+#include "silvia_types.h"
+#include "pivacy_fixed_base.h"
+#include "pivacy_cardemu_task_pool.h"
+#include <vector>
+#include <memory>
+#include <pthread.h>
+
+/**
+ * Overwrite the limbs of a big integer with zeroes
+ * @param val the value to wipe
+ */
+void pivacy_wipe_mpz(mpz_class& val);
+
+/**
+ * Nonce-independent proof randomness; an instance may only be used for
+ * a single proof and is wiped after use
+ */
+class pivacy_proof_randomness
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_proof_randomness();
+
+	/**
+	 * Destructor; wipes the randomness
+	 */
+	~pivacy_proof_randomness();
+
+	/**
+	 * Wipe all secret values
+	 */
+	void wipe();
+
+	/* Randomised signature A' = A * S^r_A mod n */
+	mpz_class A_prime;
+
+	/* v' = v - e * r_A */
+	mpz_class v_prime;
+
+	/* Randomisers for e', v' and the attributes (master secret first) */
+	mpz_class e_tilde;
+	mpz_class v_prime_tilde;
+	std::vector<mpz_class> a_tilde;
+
+	/* A'^e~ * S^v'~ mod n */
+	mpz_class Z_tilde_base;
+
+	/* R_i^a~_i mod n for the master secret and each attribute (empty if
+	   the randomness was computed for a specific disclosure selection) */
+	std::vector<mpz_class> R_a_tilde;
+
+	/* The commitment Z~ over the hidden attributes, once known */
+	bool committed;
+	std::vector<bool> committed_D;
+	mpz_class Z_tilde;
+};
+
+/**
+ * IRMA prover
+ */
+class pivacy_cardemu_prover
+{
+public:
+	/**
+	 * Constructor
+	 * @param pubkey the issuer public key
+	 * @param cred the credential to prove
+	 * @param fixed_base fixed-base tables for the issuer public key (optional)
+	 */
+	pivacy_cardemu_prover(silvia_pub_key* pubkey, silvia_credential* cred, const pivacy_fixed_base* fixed_base = NULL);
+
+	/**
+	 * Set the pool that commitments for a known disclosure selection
+	 * are split over; the pool must outlive all provers using it
+	 * @param pool the task pool, or NULL to compute on the calling thread only
+	 */
+	static void set_task_pool(pivacy_cardemu_task_pool* pool);
+
+	/**
+	 * Mark the calling thread as a background thread; proofs started
+	 * on a background thread are computed on that thread only, so they
+	 * keep its (idle) priority instead of occupying the task pool
+	 * @param background true for a background thread
+	 */
+	static void set_background_thread(bool background);
+
+	/**
+	 * Compute the nonce-independent part of a proof for any disclosure
+	 * selection
+	 * @return new proof randomness, owned by the caller
+	 */
+	pivacy_proof_randomness* precompute();
+
+	/**
+	 * Compute the nonce-independent part of several proofs for any
+	 * disclosure selection; the exponentiations of all proofs are
+	 * computed together as batches
+	 * @param count the number of proofs
+	 * @param rnds receives the new proof randomness, owned by the caller
+	 */
+	void precompute(size_t count, std::vector<pivacy_proof_randomness*>& rnds);
+
+	/**
+	 * Compute the nonce-independent part of a proof for a known
+	 * disclosure selection; this is cheaper than precompute() since
+	 * the commitments to the hidden attributes are computed together
+	 * @param D the disclosure selection (true = disclose)
+	 * @return new proof randomness, owned by the caller
+	 */
+	pivacy_proof_randomness* precompute(const std::vector<bool>& D);
+
+	/**
+	 * Compute the commitment Z~ for the specified disclosure selection;
+	 * this only depends on the selection, not on the verifier nonce
+	 * @param rnd the proof randomness
+	 * @param D the disclosure selection (true = disclose)
+	 */
+	void commit(pivacy_proof_randomness* rnd, const std::vector<bool>& D);
+
+	/**
+	 * Complete a proof using previously computed randomness; commits
+	 * to the hidden attributes if that has not been done yet. The
+	 * randomness is wiped once the proof has been computed
+	 * @param rnd the proof randomness
+	 * @param D the disclosure selection (true = disclose)
+	 * @param n1 the nonce supplied by the verifier
+	 * @param context the context supplied by the verifier
+	 * @param c the challenge
+	 * @param A_prime the randomised signature
+	 * @param e_hat the response for e
+	 * @param v_prime_hat the response for v'
+	 * @param a_i_hat the responses for the hidden attributes (master secret first)
+	 * @param a_i the disclosed attributes
+	 */
+	void prove
+	(
+		pivacy_proof_randomness* rnd,
+		const std::vector<bool>& D,
+		const mpz_class& n1,
+		const mpz_class& context,
+		mpz_class& c,
+		mpz_class& A_prime,
+		mpz_class& e_hat,
+		mpz_class& v_prime_hat,
+		std::vector<mpz_class>& a_i_hat,
+		std::vector<silvia_attribute*>& a_i
+	);
+
+private:
+	/**
+	 * Generate the randomisers for a proof
+	 * @param r_A receives the randomiser for the signature; the caller
+	 *            randomises the signature with it
+	 * @return new proof randomness without a randomised signature or commitments
+	 */
+	pivacy_proof_randomness* generate(mpz_class& r_A);
+
+	/**
+	 * Check if commitments should be split over the task pool
+	 * @return true if a pool with running workers was set and the
+	 *         calling thread is not a background thread
+	 */
+	static bool use_task_pool();
+
+	/**
+	 * Create the key marking background threads
+	 */
+	static void create_background_key();
+
+	/**
+	 * Compute the commitment Z~ for the specified disclosure selection
+	 * on the task pool; the calling thread takes part in the work
+	 * @param rnd the proof randomness
+	 * @param D the disclosure selection (true = disclose)
+	 * @param r_A the randomiser for the signature if the signature
+	 *            still has to be randomised (wiped), NULL otherwise
+	 */
+	void commit_parallel(pivacy_proof_randomness* rnd, const std::vector<bool>& D, mpz_class* r_A);
+
+	/**
+	 * Generate a random number
+	 * @param bits the size of the number in bits
+	 * @return a random number of at most the specified size
+	 */
+	mpz_class get_random(size_t bits);
+
+	/**
+	 * Compute the Fiat-Shamir challenge over the ASN.1 DER encoded
+	 * sequence (count, context, A', Z~, n1), as done by the IRMA card
+	 * @return the challenge
+	 */
+	mpz_class hash_challenge(const mpz_class& context, const mpz_class& A_prime, const mpz_class& Z_tilde, const mpz_class& n1);
+
+	silvia_pub_key* pubkey;
+	silvia_credential* cred;
+
+	/* Fixed-base tables; a table-less instance is owned by the prover if none were specified */
+	const pivacy_fixed_base* fixed_base;
+	std::auto_ptr<pivacy_fixed_base> own_fixed_base;
+
+	static pivacy_cardemu_task_pool* task_pool;
+	static pthread_key_t background_key;
+	static pthread_once_t background_key_once;
+};
+
+#endif // !_PIVACY_CARDEMU_PROVER_H
+
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_replay.cpp
+
+ Replays APDU traces recorded by the card emulator directly into the
+ emulator (without edna) and reports per-instruction latencies
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_config.h"
+#include "pivacy_log.h"
+#include "pivacy_errors.h"
+#include "pivacy_cardemu_emulator.h"
+#include "pivacy_cardemu_params.h"
+#include "pivacy_cardemu_trace.h"
+#include "silvia_bytestring.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Instruction classes that are reported separately */
+enum replay_ins
+{
+	RI_SELECT = 0,
+	RI_VERIFY_PIN,
+	RI_PROVE_CREDENTIAL,
+	RI_PROVE_COMMITMENT,
+	RI_PROVE_SIGNATURE,
+	RI_GET_RESPONSE,
+	RI_OTHER,
+	RI_COUNT
+};
+
+static const char* replay_ins_names[RI_COUNT] =
+{
+	"SELECT",
+	"VERIFY PIN",
+	"PROVE CREDENTIAL",
+	"PROVE COMMITMENT",
+	"PROVE SIGNATURE",
+	"GET RESPONSE",
+	"other"
+};
+
+/* Latency histogram buckets are powers of two in microseconds */
+#define REPLAY_HIST_BUCKETS		32
+#define REPLAY_HIST_WIDTH		40
+
+/* Latency statistics for an instruction class */
+struct replay_stats
+{
+	std::vector<unsigned long> latencies;
+	unsigned long long recorded_total;
+	size_t sw_mismatches;
+};
+
+void version(void)
+{
+	printf("Pivacy IRMA card emulator trace replay version %s\n", VERSION);
+	printf("\n");
+	printf("Copyright (c) 2013 Roland van Rijswijk-Deij\n\n");
+	printf("Use, modification and redistribution of this software is subject to the terms\n");
+	printf("of the license agreement. This software is licensed under a 2-clause BSD-style\n");
+	printf("license a copy of which is included as the file LICENSE in the distribution.\n");
+}
+
+void usage(void)
+{
+	printf("Pivacy IRMA card emulator trace replay version %s\n\n", VERSION);
+	printf("Usage:\n");
+	printf("\tpivacy_cardemu_replay -t <trace-file> [-c <config-file>] [-n <count>] [-r]\n");
+	printf("\tpivacy_cardemu_replay -h\n");
+	printf("\tpivacy_cardemu_replay -v\n");
+	printf("\n");
+	printf("\t-t <trace-file>  Trace recorded by pivacy_cardemu\n");
+	printf("\t-c <config-file> Emulator configuration file (defaults to\n");
+	printf("\t                 %s)\n", DEFAULT_PIVACY_CARDEMU_CONF);
+	printf("\t-n <count>       Replay the trace <count> times (defaults to 1)\n");
+	printf("\t-r               Replay in real time, keeping the recorded time\n");
+	printf("\t                 between APDUs rather than replaying back-to-back\n");
+	printf("\n");
+	printf("\t-h               Print this help message\n");
+	printf("\n");
+	printf("\t-v               Print the version number\n");
+}
+
+replay_ins classify(const bytestring& c_apdu)
+{
+	if (c_apdu.size() < 2) return RI_OTHER;
+
+	if (c_apdu[0] == 0x00)
+	{
+		switch(c_apdu[1])
+		{
+		case 0xa4: return RI_SELECT;
+		case 0x20: return RI_VERIFY_PIN;
+		}
+	}
+	else if (c_apdu[0] == 0x80)
+	{
+		switch(c_apdu[1])
+		{
+		case 0x20: return RI_PROVE_CREDENTIAL;
+		case 0x2a: return RI_PROVE_COMMITMENT;
+		case 0x2b: return RI_PROVE_SIGNATURE;
+		case 0x2c: return RI_GET_RESPONSE;
+		}
+	}
+
+	return RI_OTHER;
+}
+
+bool same_status(unsigned short sw, const bytestring& recorded)
+{
+	size_t len = recorded.size();
+
+	if (len < 2) return sw == 0;
+
+	return sw == ((recorded[len - 2] << 8) + recorded[len - 1]);
+}
+
+unsigned long percentile(const std::vector<unsigned long>& sorted, size_t pct)
+{
+	return sorted[((sorted.size() - 1) * pct) / 100];
+}
+
+void print_histogram(const std::vector<unsigned long>& latencies)
+{
+	size_t buckets[REPLAY_HIST_BUCKETS] = { 0 };
+	size_t lo = REPLAY_HIST_BUCKETS;
+	size_t hi = 0;
+	size_t max_count = 0;
+
+	for (size_t i = 0; i < latencies.size(); i++)
+	{
+		size_t b = 0;
+
+		while ((b < (REPLAY_HIST_BUCKETS - 1)) && ((latencies[i] >> (b + 1)) != 0)) b++;
+
+		buckets[b]++;
+
+		if (b < lo) lo = b;
+		if (b > hi) hi = b;
+		if (buckets[b] > max_count) max_count = buckets[b];
+	}
+
+	for (size_t b = lo; b <= hi; b++)
+	{
+		printf("\t[%9lu, %9lu) us %7zu ", (b == 0) ? 0UL : (1UL << b), 1UL << (b + 1), buckets[b]);
+
+		for (size_t j = 0; j < (buckets[b] * REPLAY_HIST_WIDTH + max_count - 1) / max_count; j++)
+		{
+			printf("#");
+		}
+
+		printf("\n");
+	}
+}
+
+void report(replay_stats* stats, const std::vector<unsigned long long>& sessions, unsigned long long total)
+{
+	printf("\nPer-instruction latency:\n");
+
+	for (size_t i = 0; i < RI_COUNT; i++)
+	{
+		std::vector<unsigned long>& l = stats[i].latencies;
+
+		if (l.empty()) continue;
+
+		std::sort(l.begin(), l.end());
+
+		unsigned long long sum = 0;
+
+		for (size_t j = 0; j < l.size(); j++) sum += l[j];
+
+		printf("\n%s: %zu APDUs, mean %.3f ms (recorded %.3f ms)\n",
+			replay_ins_names[i],
+			l.size(),
+			(double) sum / l.size() / 1000.0,
+			(double) stats[i].recorded_total / l.size() / 1000.0);
+		printf("\tmin %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			l.front() / 1000.0,
+			percentile(l, 50) / 1000.0,
+			percentile(l, 90) / 1000.0,
+			percentile(l, 99) / 1000.0,
+			l.back() / 1000.0);
+
+		if (stats[i].sw_mismatches > 0)
+		{
+			printf("\t%zu responses had a different status word than recorded\n", stats[i].sw_mismatches);
+		}
+
+		print_histogram(l);
+	}
+
+	if (!sessions.empty())
+	{
+		unsigned long long sum = 0;
+
+		for (size_t i = 0; i < sessions.size(); i++) sum += sessions[i];
+
+		printf("\n%zu sessions, mean session time %.3f ms\n", sessions.size(), (double) sum / sessions.size() / 1000.0);
+	}
+
+	printf("Total replay time %.3f ms\n", total / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string config_file = DEFAULT_PIVACY_CARDEMU_CONF;
+	std::string trace_file;
+	size_t count = 1;
+	bool real_time = false;
+	int c = 0;
+
+	while ((c = getopt(argc, argv, "t:c:n:rhv")) != -1)
+	{
+		switch (c)
+		{
+		case 'h':
+			usage();
+			return 0;
+		case 'v':
+			version();
+			return 0;
+		case 't':
+			trace_file = std::string(optarg);
+			break;
+		case 'c':
+			config_file = std::string(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'r':
+			real_time = true;
+			break;
+		}
+	}
+
+	if (trace_file.empty() || (count == 0))
+	{
+		usage();
+
+		return 0;
+	}
+
+	/* Load the configuration */
+	if (pivacy_init_config_handling(config_file.c_str()) != PRV_OK)
+	{
+		fprintf(stderr, "Failed to load the configuration, exiting\n");
+
+		return PRV_CONFIG_ERROR;
+	}
+
+	/* Initialise logging */
+	if (pivacy_init_log() != PRV_OK)
+	{
+		fprintf(stderr, "Failed to initialise logging, exiting\n");
+
+		return PRV_LOG_INIT_FAIL;
+	}
+
+	pivacy_cardemu_trace_reader trace;
+
+	if (!trace.open(trace_file))
+	{
+		fprintf(stderr, "Failed to open trace %s\n", trace_file.c_str());
+
+		pivacy_uninit_log();
+		pivacy_uninit_config_handling();
+
+		return PRV_FILE_ERROR;
+	}
+
+	pivacy_cardemu_set_parameters();
+
+	pivacy_cardemu_emulator* emulator = new pivacy_cardemu_emulator();
+
+	replay_stats stats[RI_COUNT];
+	std::vector<unsigned long long> sessions;
+	std::vector<unsigned char> r_buf(PIVACY_MAX_RAPDU_LEN);
+
+	for (size_t i = 0; i < RI_COUNT; i++)
+	{
+		stats[i].recorded_total = 0;
+		stats[i].sw_mismatches = 0;
+	}
+
+	unsigned long long replay_start = pivacy_trace_now();
+
+	for (size_t it = 0; it < count; it++)
+	{
+		pivacy_cardemu_trace_record record;
+		unsigned long long pass_start = pivacy_trace_now();
+		unsigned long long session_start = pass_start;
+		unsigned long long first_timestamp = 0;
+		bool first = true;
+		bool in_session = false;
+
+		trace.rewind();
+
+		while (trace.next(record))
+		{
+			if (first)
+			{
+				first_timestamp = record.timestamp;
+				first = false;
+			}
+
+			if (real_time)
+			{
+				unsigned long long due = pass_start + (record.timestamp - first_timestamp);
+				unsigned long long now = pivacy_trace_now();
+
+				if (due > now) usleep(due - now);
+			}
+
+			switch(record.type)
+			{
+			case PIVACY_TRACE_POWER_UP:
+				emulator->power_up();
+
+				session_start = pivacy_trace_now();
+				in_session = true;
+				break;
+			case PIVACY_TRACE_POWER_DOWN:
+				emulator->power_down();
+
+				if (in_session)
+				{
+					sessions.push_back(pivacy_trace_now() - session_start);
+				}
+
+				in_session = false;
+				break;
+			case PIVACY_TRACE_APDU:
+				{
+					pivacy_cardemu_response r_apdu(&r_buf[0], r_buf.size());
+					replay_ins ins = classify(record.c_apdu);
+
+					unsigned long long start = pivacy_trace_now();
+
+					emulator->process_apdu((record.c_apdu.size() > 0) ? &record.c_apdu[0] : NULL, record.c_apdu.size(), r_apdu);
+
+					stats[ins].latencies.push_back(pivacy_trace_now() - start);
+					stats[ins].recorded_total += record.duration;
+
+					if (!same_status(r_apdu.get_sw(), record.r_apdu))
+					{
+						stats[ins].sw_mismatches++;
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	unsigned long long total = pivacy_trace_now() - replay_start;
+
+	delete emulator;
+
+	report(stats, sessions, total);
+
+	trace.close();
+
+	/* Uninitialise logging and configuration handling */
+	if (pivacy_uninit_log() != PRV_OK)
+	{
+		fprintf(stderr, "Failed to uninitialise logging\n");
+	}
+
+	pivacy_uninit_config_handling();
+
+	return PRV_OK;
+}
+
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_response.cpp
+
+ Response APDU writer that fills a caller-supplied buffer
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_response.h"
+#include <string.h>
+
+pivacy_cardemu_response::pivacy_cardemu_response(unsigned char* buffer, size_t capacity)
+{
+	this->buffer = buffer;
+	this->capacity = capacity;
+	len = 0;
+	overflow = false;
+}
+
+bool pivacy_cardemu_response::reserve(size_t data_len)
+{
+	if (overflow || (capacity < 2) || (data_len > (capacity - 2 - len)))
+	{
+		overflow = true;
+
+		return false;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_response::append(const unsigned char* data, size_t data_len)
+{
+	if (!reserve(data_len))
+	{
+		return false;
+	}
+
+	if (data_len > 0)
+	{
+		memcpy(&buffer[len], data, data_len);
+
+		len += data_len;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_response::append(const bytestring& data)
+{
+	if (data.size() == 0)
+	{
+		return reserve(0);
+	}
+
+	return append(&data[0], data.size());
+}
+
+bool pivacy_cardemu_response::append(const mpz_class& value)
+{
+	/* Zero has one digit in any base, so it takes up a single byte */
+	size_t value_len = (mpz_sizeinbase(value.get_mpz_t(), 2) + 7) / 8;
+
+	if (!reserve(value_len))
+	{
+		return false;
+	}
+
+	/* mpz_export writes nothing for zero */
+	buffer[len] = 0x00;
+
+	mpz_export(&buffer[len], NULL, 1, 1, 1, 0, value.get_mpz_t());
+
+	len += value_len;
+
+	return true;
+}
+
+bool pivacy_cardemu_response::append_lv(const bytestring& data)
+{
+	if ((data.size() > 0xffff) || !reserve(2 + data.size()))
+	{
+		overflow = true;
+
+		return false;
+	}
+
+	buffer[len++] = (unsigned char) ((data.size() >> 8) & 0xff);
+	buffer[len++] = (unsigned char) (data.size() & 0xff);
+
+	return append(data);
+}
+
+bool pivacy_cardemu_response::append_lv(const mpz_class& value)
+{
+	size_t value_len = (mpz_sizeinbase(value.get_mpz_t(), 2) + 7) / 8;
+
+	if ((value_len > 0xffff) || !reserve(2 + value_len))
+	{
+		overflow = true;
+
+		return false;
+	}
+
+	buffer[len++] = (unsigned char) ((value_len >> 8) & 0xff);
+	buffer[len++] = (unsigned char) (value_len & 0xff);
+
+	return append(value);
+}
+
+void pivacy_cardemu_response::append_sw(unsigned short sw)
+{
+	/* Response data always leaves room for the status word */
+	if (overflow || (capacity < 2))
+	{
+		return;
+	}
+
+	buffer[len++] = (unsigned char) ((sw >> 8) & 0xff);
+	buffer[len++] = (unsigned char) (sw & 0xff);
+}
+
+void pivacy_cardemu_response::set_sw(unsigned short sw)
+{
+	len = 0;
+	overflow = false;
+
+	append_sw(sw);
+}
+
+unsigned short pivacy_cardemu_response::get_sw() const
+{
+	if (overflow || (len < 2))
+	{
+		return 0;
+	}
+
+	return (buffer[len - 2] << 8) + buffer[len - 1];
+}
+
+bool pivacy_cardemu_response::overflowed() const
+{
+	return overflow;
+}
+
+const unsigned char* pivacy_cardemu_response::data() const
+{
+	return buffer;
+}
+
+size_t pivacy_cardemu_response::size() const
+{
+	return len;
+}
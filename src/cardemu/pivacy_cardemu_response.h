@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_response.h
+
+ Response APDU writer that fills a caller-supplied buffer
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_RESPONSE_H
+#define _PIVACY_CARDEMU_RESPONSE_H
+
+#include "silvia_bytestring.h"
+#include <gmpxx.h>
+
+/* The longest R-APDU: 65536 data bytes (extended Le) and the status word */
+#define PIVACY_MAX_RAPDU_LEN			(65536 + 2)
+
+/**
+ * Response APDU writer; data is written directly into the buffer
+ * that is passed to the constructor, which must outlive the writer
+ */
+class pivacy_cardemu_response
+{
+public:
+	/**
+	 * Constructor
+	 * @param buffer the buffer to write the R-APDU to
+	 * @param capacity the size of the buffer
+	 */
+	pivacy_cardemu_response(unsigned char* buffer, size_t capacity);
+
+	/**
+	 * Append response data; data is only written if the status
+	 * word still fits behind it, otherwise the response overflows
+	 * @param data the data
+	 * @param len the length of the data
+	 * @return false if the data did not fit
+	 */
+	bool append(const unsigned char* data, size_t len);
+
+	/**
+	 * Append response data
+	 * @param data the data
+	 * @return false if the data did not fit
+	 */
+	bool append(const bytestring& data);
+
+	/**
+	 * Append a big integer as unsigned big-endian bytes without
+	 * leading zeroes; zero is written as a single zero byte
+	 * @param value the value
+	 * @return false if the value did not fit
+	 */
+	bool append(const mpz_class& value);
+
+	/**
+	 * Append data preceded by its 2-byte length
+	 * @param data the data
+	 * @return false if the data did not fit
+	 */
+	bool append_lv(const bytestring& data);
+
+	/**
+	 * Append a big integer preceded by its 2-byte length
+	 * @param value the value
+	 * @return false if the value did not fit
+	 */
+	bool append_lv(const mpz_class& value);
+
+	/**
+	 * Complete the response by appending the status word
+	 * @param sw the status word
+	 */
+	void append_sw(unsigned short sw);
+
+	/**
+	 * Discard any response data and respond with only a status word
+	 * @param sw the status word
+	 */
+	void set_sw(unsigned short sw);
+
+	/**
+	 * Get the status word of a completed response
+	 * @return the status word, or 0 if there is none
+	 */
+	unsigned short get_sw() const;
+
+	/**
+	 * Did response data not fit in the buffer?
+	 * @return true if the response overflowed
+	 */
+	bool overflowed() const;
+
+	/**
+	 * Get the R-APDU
+	 * @return the start of the buffer
+	 */
+	const unsigned char* data() const;
+
+	/**
+	 * Get the length of the R-APDU
+	 * @return the number of bytes written
+	 */
+	size_t size() const;
+
+private:
+	/**
+	 * Check whether data plus the status word fits in the buffer
+	 * @param len the length of the data
+	 * @return false (and mark the response as overflowed) if not
+	 */
+	bool reserve(size_t len);
+
+	/* The buffer */
+	unsigned char* buffer;
+	size_t capacity;
+	size_t len;
+
+	/* Did response data not fit? */
+	bool overflow;
+};
+
+#endif // !_PIVACY_CARDEMU_RESPONSE_H
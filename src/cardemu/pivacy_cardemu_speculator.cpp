@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_speculator.cpp
+
+ Speculative computation of the nonce-independent part of a proof while
+ the user is asked for consent
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_speculator.h"
+#include "pivacy_log.h"
+
+pivacy_cardemu_speculator::pivacy_cardemu_speculator(pivacy_cardemu_precompute_pool& pool) : pool(pool)
+{
+	job_ctx = NULL;
+	job_pending = false;
+	job_busy = false;
+	busy_ctx = NULL;
+	job_generation = 0;
+	job_result = NULL;
+
+	running = false;
+	must_run = false;
+
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+}
+
+pivacy_cardemu_speculator::~pivacy_cardemu_speculator()
+{
+	stop();
+
+	discard();
+
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&job_cond);
+	pthread_mutex_destroy(&job_mutex);
+}
+
+void pivacy_cardemu_speculator::start()
+{
+	if (running)
+	{
+		return;
+	}
+
+	must_run = true;
+
+	if (pthread_create(&worker_thread, NULL, worker_thread_entry, this) != 0)
+	{
+		ERROR_MSG("Failed to start the speculative proof thread");
+
+		must_run = false;
+
+		return;
+	}
+
+	running = true;
+}
+
+void pivacy_cardemu_speculator::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&job_mutex);
+
+	must_run = false;
+
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	pthread_join(worker_thread, NULL);
+
+	running = false;
+}
+
+void pivacy_cardemu_speculator::begin(pivacy_cardemu_proof_context* ctx, const std::vector<bool>& D)
+{
+	if (!running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&job_mutex);
+
+	/* Work still in progress for an earlier job is discarded by the worker */
+	if (job_result != NULL)
+	{
+		delete job_result;
+
+		job_result = NULL;
+	}
+
+	job_generation++;
+	job_ctx = ctx;
+	job_D = D;
+	job_pending = true;
+
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+}
+
+pivacy_proof_randomness* pivacy_cardemu_speculator::claim(pivacy_cardemu_proof_context* ctx, const std::vector<bool>& D)
+{
+	pivacy_proof_randomness* rnd = NULL;
+
+	pthread_mutex_lock(&job_mutex);
+
+	if ((job_ctx == ctx) && (job_D == D))
+	{
+		unsigned long generation = job_generation;
+
+		while ((job_pending || job_busy) && (generation == job_generation) && must_run)
+		{
+			pthread_cond_wait(&done_cond, &job_mutex);
+		}
+
+		if (generation == job_generation)
+		{
+			rnd = job_result;
+
+			job_result = NULL;
+			job_ctx = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&job_mutex);
+
+	return rnd;
+}
+
+void pivacy_cardemu_speculator::discard()
+{
+	pthread_mutex_lock(&job_mutex);
+
+	/* The destructor of the randomness wipes it */
+	if (job_result != NULL)
+	{
+		delete job_result;
+
+		job_result = NULL;
+	}
+
+	job_generation++;
+	job_ctx = NULL;
+	job_D.clear();
+	job_pending = false;
+
+	pthread_mutex_unlock(&job_mutex);
+}
+
+void pivacy_cardemu_speculator::forget(pivacy_cardemu_proof_context* ctx)
+{
+	pthread_mutex_lock(&job_mutex);
+
+	while (job_busy && (busy_ctx == ctx))
+	{
+		pthread_cond_wait(&done_cond, &job_mutex);
+	}
+
+	if (job_ctx == ctx)
+	{
+		if (job_result != NULL)
+		{
+			delete job_result;
+
+			job_result = NULL;
+		}
+
+		job_generation++;
+		job_ctx = NULL;
+		job_D.clear();
+		job_pending = false;
+	}
+
+	pthread_mutex_unlock(&job_mutex);
+}
+
+/*static*/ void* pivacy_cardemu_speculator::worker_thread_entry(void* arg)
+{
+	/* Speculative proofs must not occupy the task pool needed by the proof the terminal waits for */
+	pivacy_cardemu_prover::set_background_thread(true);
+
+	((pivacy_cardemu_speculator*) arg)->worker_loop();
+
+	return NULL;
+}
+
+void pivacy_cardemu_speculator::worker_loop()
+{
+	DEBUG_MSG("Entering speculative proof thread");
+
+	pthread_mutex_lock(&job_mutex);
+
+	while (must_run)
+	{
+		if (!job_pending)
+		{
+			pthread_cond_wait(&job_cond, &job_mutex);
+
+			continue;
+		}
+
+		pivacy_cardemu_proof_context* ctx = job_ctx;
+		std::vector<bool> D = job_D;
+		unsigned long generation = job_generation;
+
+		job_pending = false;
+		job_busy = true;
+		busy_ctx = ctx;
+
+		pthread_mutex_unlock(&job_mutex);
+
+		/* Take randomness from the pool if possible and commit to the hidden attributes */
+		pivacy_cardemu_prover* prover = ctx->get_prover();
+
+		pivacy_proof_randomness* rnd = pool.take(ctx);
+
+		if (rnd == NULL)
+		{
+			rnd = prover->precompute(D);
+		}
+		else
+		{
+			prover->commit(rnd, D);
+		}
+
+		pthread_mutex_lock(&job_mutex);
+
+		job_busy = false;
+		busy_ctx = NULL;
+
+		if (generation == job_generation)
+		{
+			job_result = rnd;
+
+			DEBUG_MSG("Speculative proof for credential 0x%04X ready", ctx->get_credential_id());
+		}
+		else
+		{
+			/* The proof was abandoned while we were working on it */
+			delete rnd;
+		}
+
+		pthread_cond_broadcast(&done_cond);
+	}
+
+	pthread_mutex_unlock(&job_mutex);
+
+	DEBUG_MSG("Exiting speculative proof thread");
+}
+
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_speculator.h
+
+ Speculative computation of the nonce-independent part of a proof while
+ the user is asked for consent
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_SPECULATOR_H
+#define _PIVACY_CARDEMU_SPECULATOR_H
+
+#include "pivacy_cardemu_proof_context.h"
+#include "pivacy_cardemu_prover.h"
+#include "pivacy_cardemu_precompute.h"
+#include <pthread.h>
+#include <vector>
+
+/**
+ * Speculative prover
+ */
+class pivacy_cardemu_speculator
+{
+public:
+	/**
+	 * Constructor
+	 * @param pool the pool to take precomputed randomness from
+	 */
+	pivacy_cardemu_speculator(pivacy_cardemu_precompute_pool& pool);
+
+	/**
+	 * Destructor; stops the worker thread and wipes speculative state
+	 */
+	~pivacy_cardemu_speculator();
+
+	/**
+	 * Start the worker thread
+	 */
+	void start();
+
+	/**
+	 * Stop the worker thread
+	 */
+	void stop();
+
+	/**
+	 * Start speculative work for a proof; any previous speculative
+	 * state is discarded
+	 * @param ctx the proof context of the credential that will be proved
+	 * @param D the disclosure selection (true = disclose)
+	 */
+	void begin(pivacy_cardemu_proof_context* ctx, const std::vector<bool>& D);
+
+	/**
+	 * Claim the result of the speculative work, waiting for it to
+	 * complete if necessary
+	 * @param ctx the proof context of the credential that is being proved
+	 * @param D the disclosure selection (true = disclose)
+	 * @return proof randomness committed to D owned by the caller, or
+	 *         NULL if no speculative work was done for this proof
+	 */
+	pivacy_proof_randomness* claim(pivacy_cardemu_proof_context* ctx, const std::vector<bool>& D);
+
+	/**
+	 * Throw away and wipe any speculative state
+	 */
+	void discard();
+
+	/**
+	 * Make sure a proof context is no longer used; waits for work in
+	 * progress for the context to complete
+	 * @param ctx the proof context
+	 */
+	void forget(pivacy_cardemu_proof_context* ctx);
+
+private:
+	/**
+	 * Worker thread entry point
+	 */
+	static void* worker_thread_entry(void* arg);
+
+	/**
+	 * Worker thread main loop
+	 */
+	void worker_loop();
+
+	/* Source of precomputed randomness */
+	pivacy_cardemu_precompute_pool& pool;
+
+	/* The current job */
+	pivacy_cardemu_proof_context* job_ctx;
+	std::vector<bool> job_D;
+	bool job_pending;
+	bool job_busy;
+	pivacy_cardemu_proof_context* busy_ctx;
+	unsigned long job_generation;
+	pivacy_proof_randomness* job_result;
+
+	/* Thread state */
+	pthread_t worker_thread;
+	pthread_mutex_t job_mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	bool running;
+	bool must_run;
+};
+
+#endif // !_PIVACY_CARDEMU_SPECULATOR_H
+
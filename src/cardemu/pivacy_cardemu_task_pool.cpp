@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_task_pool.cpp
+
+ Small work-stealing thread pool for splitting a proof into tasks
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_task_pool.h"
+#include "pivacy_log.h"
+#include <sched.h>
+
+pivacy_cardemu_task::pivacy_cardemu_task()
+{
+	group = NULL;
+}
+
+pivacy_cardemu_task::~pivacy_cardemu_task()
+{
+}
+
+pivacy_cardemu_task_group::pivacy_cardemu_task_group(pivacy_cardemu_task_pool* pool)
+{
+	this->pool = pool;
+	outstanding = 0;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+pivacy_cardemu_task_group::~pivacy_cardemu_task_group()
+{
+	wait();
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void pivacy_cardemu_task_group::add(pivacy_cardemu_task* task)
+{
+	task->group = this;
+
+	pthread_mutex_lock(&mutex);
+
+	outstanding++;
+
+	pthread_mutex_unlock(&mutex);
+
+	if ((pool == NULL) || !pool->submit(task))
+	{
+		local_tasks.push_back(task);
+	}
+}
+
+void pivacy_cardemu_task_group::wait()
+{
+	/* Help out with tasks no worker has started on yet */
+	for (std::vector<pivacy_cardemu_task*>::iterator i = local_tasks.begin(); i != local_tasks.end(); i++)
+	{
+		(*i)->run();
+
+		done();
+	}
+
+	local_tasks.clear();
+
+	if (pool != NULL)
+	{
+		pivacy_cardemu_task* task = NULL;
+
+		while ((task = pool->reclaim(this)) != NULL)
+		{
+			task->run();
+
+			done();
+		}
+	}
+
+	/* Wait for the tasks the workers are running */
+	pthread_mutex_lock(&mutex);
+
+	while (outstanding > 0)
+	{
+		pthread_cond_wait(&cond, &mutex);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void pivacy_cardemu_task_group::done()
+{
+	pthread_mutex_lock(&mutex);
+
+	if (--outstanding == 0)
+	{
+		pthread_cond_broadcast(&cond);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+pivacy_cardemu_task_pool::pivacy_cardemu_task_pool()
+{
+	next_worker = 0;
+	queued = 0;
+	running = false;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+pivacy_cardemu_task_pool::~pivacy_cardemu_task_pool()
+{
+	stop();
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool pivacy_cardemu_task_pool::start(size_t threads)
+{
+	if (running || (threads == 0))
+	{
+		return false;
+	}
+
+	/* Create all queues before any worker starts stealing from them */
+	for (size_t i = 0; i < threads; i++)
+	{
+		worker* w = new worker();
+
+		w->pool = this;
+		w->index = i;
+
+		pthread_mutex_init(&w->mutex, NULL);
+
+		workers.push_back(w);
+	}
+
+	running = true;
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		if (pthread_create(&workers[i]->thread, NULL, worker_thread_entry, workers[i]) != 0)
+		{
+			ERROR_MSG("Failed to start proof worker thread %zu", i);
+
+			/* Only stop the workers that were started */
+			for (size_t j = i; j < workers.size(); j++)
+			{
+				pthread_mutex_destroy(&workers[j]->mutex);
+
+				delete workers[j];
+			}
+
+			workers.resize(i);
+
+			stop();
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void pivacy_cardemu_task_pool::stop()
+{
+	pthread_mutex_lock(&mutex);
+
+	running = false;
+
+	pthread_cond_broadcast(&cond);
+
+	pthread_mutex_unlock(&mutex);
+
+	for (std::vector<worker*>::iterator i = workers.begin(); i != workers.end(); i++)
+	{
+		pthread_join((*i)->thread, NULL);
+
+		pthread_mutex_destroy(&(*i)->mutex);
+
+		delete *i;
+	}
+
+	workers.clear();
+}
+
+size_t pivacy_cardemu_task_pool::get_threads() const
+{
+	return workers.size();
+}
+
+bool pivacy_cardemu_task_pool::submit(pivacy_cardemu_task* task)
+{
+	pthread_mutex_lock(&mutex);
+
+	if (!running || workers.empty())
+	{
+		pthread_mutex_unlock(&mutex);
+
+		return false;
+	}
+
+	worker* w = workers[next_worker++ % workers.size()];
+
+	pthread_mutex_lock(&w->mutex);
+
+	w->queue.push_back(task);
+
+	pthread_mutex_unlock(&w->mutex);
+
+	/* Taking a task does not need the pool mutex, so the count is kept atomically */
+	__sync_fetch_and_add(&queued, 1);
+
+	pthread_cond_signal(&cond);
+
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+pivacy_cardemu_task* pivacy_cardemu_task_pool::take(size_t index)
+{
+	pivacy_cardemu_task* task = NULL;
+
+	for (size_t i = 0; (i < workers.size()) && (task == NULL); i++)
+	{
+		worker* w = workers[(index + i) % workers.size()];
+
+		pthread_mutex_lock(&w->mutex);
+
+		if (!w->queue.empty())
+		{
+			/* The most recent task of our own queue, the oldest of someone else's */
+			if (i == 0)
+			{
+				task = w->queue.back();
+				w->queue.pop_back();
+			}
+			else
+			{
+				task = w->queue.front();
+				w->queue.pop_front();
+			}
+		}
+
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	if (task != NULL)
+	{
+		__sync_fetch_and_sub(&queued, 1);
+	}
+
+	return task;
+}
+
+pivacy_cardemu_task* pivacy_cardemu_task_pool::reclaim(pivacy_cardemu_task_group* group)
+{
+	pivacy_cardemu_task* task = NULL;
+
+	for (size_t i = 0; (i < workers.size()) && (task == NULL); i++)
+	{
+		worker* w = workers[i];
+
+		pthread_mutex_lock(&w->mutex);
+
+		for (std::deque<pivacy_cardemu_task*>::iterator t = w->queue.begin(); t != w->queue.end(); t++)
+		{
+			if ((*t)->group == group)
+			{
+				task = *t;
+
+				w->queue.erase(t);
+
+				break;
+			}
+		}
+
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	if (task != NULL)
+	{
+		__sync_fetch_and_sub(&queued, 1);
+	}
+
+	return task;
+}
+
+/*static*/ void* pivacy_cardemu_task_pool::worker_thread_entry(void* arg)
+{
+	worker* w = (worker*) arg;
+
+	w->pool->worker_thread(w->index);
+
+	return NULL;
+}
+
+void pivacy_cardemu_task_pool::worker_thread(size_t index)
+{
+	DEBUG_MSG("Entering proof worker thread %zu", index);
+
+	while (true)
+	{
+		pthread_mutex_lock(&mutex);
+
+		/* Tasks are only counted under the mutex, so no wake-up is missed; taking them is not */
+		while (running && (__sync_add_and_fetch(&queued, 0) == 0))
+		{
+			pthread_cond_wait(&cond, &mutex);
+		}
+
+		bool stopping = !running;
+
+		pthread_mutex_unlock(&mutex);
+
+		if (stopping)
+		{
+			break;
+		}
+
+		pivacy_cardemu_task* task = take(index);
+
+		if (task == NULL)
+		{
+			/* Another thread took the last task but has not counted it yet */
+			sched_yield();
+
+			continue;
+		}
+
+		pivacy_cardemu_task_group* group = task->group;
+
+		task->run();
+
+		group->done();
+	}
+
+	DEBUG_MSG("Exiting proof worker thread %zu", index);
+}
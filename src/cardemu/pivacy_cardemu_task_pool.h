@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_task_pool.h
+
+ Small work-stealing thread pool for splitting a proof into tasks
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_TASK_POOL_H
+#define _PIVACY_CARDEMU_TASK_POOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+class pivacy_cardemu_task_group;
+class pivacy_cardemu_task_pool;
+
+/**
+ * A unit of work for the task pool
+ */
+class pivacy_cardemu_task
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_task();
+
+	/**
+	 * Destructor
+	 */
+	virtual ~pivacy_cardemu_task();
+
+	/**
+	 * Do the work
+	 */
+	virtual void run() = 0;
+
+private:
+	friend class pivacy_cardemu_task_group;
+	friend class pivacy_cardemu_task_pool;
+
+	/* The group the task was added to */
+	pivacy_cardemu_task_group* group;
+};
+
+/**
+ * Tasks that are waited for together; while waiting, the calling
+ * thread runs the tasks of the group that no worker has taken yet,
+ * so a group also completes if the pool is busy or not running
+ */
+class pivacy_cardemu_task_group
+{
+public:
+	/**
+	 * Constructor
+	 * @param pool the pool to run tasks on (may be NULL)
+	 */
+	pivacy_cardemu_task_group(pivacy_cardemu_task_pool* pool);
+
+	/**
+	 * Destructor; waits for all tasks
+	 */
+	~pivacy_cardemu_task_group();
+
+	/**
+	 * Add a task; the task must stay valid until wait() returns
+	 * @param task the task
+	 */
+	void add(pivacy_cardemu_task* task);
+
+	/**
+	 * Wait until all tasks that were added have been run
+	 */
+	void wait();
+
+private:
+	friend class pivacy_cardemu_task_pool;
+
+	/**
+	 * Called when a task of the group has been run
+	 */
+	void done();
+
+	/* The pool */
+	pivacy_cardemu_task_pool* pool;
+
+	/* Tasks that are run by the waiting thread because there are no workers */
+	std::vector<pivacy_cardemu_task*> local_tasks;
+
+	/* The number of tasks that have not been run yet */
+	size_t outstanding;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/**
+ * Work-stealing thread pool; each worker takes tasks from the back
+ * of its own queue and, when that is empty, steals from the front of
+ * the queues of other workers
+ */
+class pivacy_cardemu_task_pool
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_task_pool();
+
+	/**
+	 * Destructor; stops the workers
+	 */
+	~pivacy_cardemu_task_pool();
+
+	/**
+	 * Start the workers
+	 * @param threads the number of worker threads
+	 * @return true if all workers were started
+	 */
+	bool start(size_t threads);
+
+	/**
+	 * Stop the workers; no task group may be in use
+	 */
+	void stop();
+
+	/**
+	 * Get the number of worker threads
+	 * @return the number of running workers
+	 */
+	size_t get_threads() const;
+
+private:
+	friend class pivacy_cardemu_task_group;
+
+	/* A worker and its queue */
+	struct worker
+	{
+		pivacy_cardemu_task_pool* pool;
+		size_t index;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		std::deque<pivacy_cardemu_task*> queue;
+	};
+
+	/**
+	 * Queue a task on one of the workers
+	 * @param task the task
+	 * @return false if there are no workers
+	 */
+	bool submit(pivacy_cardemu_task* task);
+
+	/**
+	 * Take a task; own tasks come first, then tasks of other workers
+	 * @param index the index of the worker
+	 * @return the task, or NULL if all queues are empty
+	 */
+	pivacy_cardemu_task* take(size_t index);
+
+	/**
+	 * Take back a queued task of a group
+	 * @param group the group
+	 * @return the task, or NULL if no task of the group is queued
+	 */
+	pivacy_cardemu_task* reclaim(pivacy_cardemu_task_group* group);
+
+	/**
+	 * Worker thread
+	 */
+	static void* worker_thread_entry(void* arg);
+	void worker_thread(size_t index);
+
+	/* The workers */
+	std::vector<worker*> workers;
+	size_t next_worker;
+
+	/* The number of queued tasks; workers sleep while there are none */
+	volatile size_t queued;
+	bool running;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+#endif // !_PIVACY_CARDEMU_TASK_POOL_H
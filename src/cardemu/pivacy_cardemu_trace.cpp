@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_trace.cpp
+
+ Binary traces of the APDUs and power events seen by the card emulator,
+ for offline replay
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_trace.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+unsigned long long pivacy_trace_now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((unsigned long long) tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+pivacy_cardemu_trace_writer::pivacy_cardemu_trace_writer()
+{
+	trace_file = NULL;
+	start_time = 0;
+}
+
+pivacy_cardemu_trace_writer::~pivacy_cardemu_trace_writer()
+{
+	close();
+}
+
+bool pivacy_cardemu_trace_writer::open(const std::string& file_name)
+{
+	close();
+
+	/* Traces hold PINs and disclosed attributes, so only the owner may read them */
+	int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	/* An existing trace keeps its mode when it is truncated */
+	if (fchmod(fd, 0600) != 0)
+	{
+		::close(fd);
+
+		return false;
+	}
+
+	trace_file = fdopen(fd, "wb");
+
+	if (trace_file == NULL)
+	{
+		::close(fd);
+
+		return false;
+	}
+
+	fwrite(PIVACY_TRACE_MAGIC, 1, strlen(PIVACY_TRACE_MAGIC), trace_file);
+	write_int(PIVACY_TRACE_VERSION, 1);
+
+	start_time = pivacy_trace_now();
+
+	return true;
+}
+
+void pivacy_cardemu_trace_writer::close()
+{
+	if (trace_file != NULL)
+	{
+		fclose(trace_file);
+
+		trace_file = NULL;
+	}
+}
+
+void pivacy_cardemu_trace_writer::record_apdu(unsigned long long start, const unsigned char* c_apdu, size_t c_len, const unsigned char* r_apdu, size_t r_len)
+{
+	if (trace_file == NULL)
+	{
+		return;
+	}
+
+	unsigned long long now = pivacy_trace_now();
+
+	write_int(PIVACY_TRACE_APDU, 1);
+	write_int(start - start_time, 8);
+	write_int(now - start, 4);
+	write_data(c_apdu, c_len);
+	write_data(r_apdu, r_len);
+}
+
+void pivacy_cardemu_trace_writer::record_event(unsigned char type)
+{
+	if (trace_file == NULL)
+	{
+		return;
+	}
+
+	write_int(type, 1);
+	write_int(pivacy_trace_now() - start_time, 8);
+
+	if (type == PIVACY_TRACE_POWER_DOWN)
+	{
+		fflush(trace_file);
+	}
+}
+
+void pivacy_cardemu_trace_writer::write_int(unsigned long long val, size_t len)
+{
+	unsigned char buf[8];
+
+	for (size_t i = 0; i < len; i++)
+	{
+		buf[len - 1 - i] = (unsigned char) (val & 0xff);
+		val >>= 8;
+	}
+
+	fwrite(buf, 1, len, trace_file);
+}
+
+void pivacy_cardemu_trace_writer::write_data(const unsigned char* data, size_t len)
+{
+	write_int(len, 4);
+
+	if (len > 0)
+	{
+		fwrite(data, 1, len, trace_file);
+	}
+}
+
+pivacy_cardemu_trace_reader::pivacy_cardemu_trace_reader()
+{
+	trace_file = NULL;
+	first_record = 0;
+}
+
+pivacy_cardemu_trace_reader::~pivacy_cardemu_trace_reader()
+{
+	close();
+}
+
+bool pivacy_cardemu_trace_reader::open(const std::string& file_name)
+{
+	close();
+
+	trace_file = fopen(file_name.c_str(), "rb");
+
+	if (trace_file == NULL)
+	{
+		return false;
+	}
+
+	char magic[sizeof(PIVACY_TRACE_MAGIC) - 1];
+	unsigned long long version = 0;
+
+	if ((fread(magic, 1, sizeof(magic), trace_file) != sizeof(magic)) ||
+	    memcmp(magic, PIVACY_TRACE_MAGIC, sizeof(magic)) ||
+	    !read_int(version, 1) ||
+	    (version != PIVACY_TRACE_VERSION))
+	{
+		close();
+
+		return false;
+	}
+
+	first_record = ftell(trace_file);
+
+	return true;
+}
+
+void pivacy_cardemu_trace_reader::rewind()
+{
+	if (trace_file != NULL)
+	{
+		fseek(trace_file, first_record, SEEK_SET);
+	}
+}
+
+void pivacy_cardemu_trace_reader::close()
+{
+	if (trace_file != NULL)
+	{
+		fclose(trace_file);
+
+		trace_file = NULL;
+	}
+}
+
+bool pivacy_cardemu_trace_reader::next(pivacy_cardemu_trace_record& record)
+{
+	unsigned long long type;
+	unsigned long long duration;
+
+	if ((trace_file == NULL) || !read_int(type, 1) || !read_int(record.timestamp, 8))
+	{
+		return false;
+	}
+
+	record.type = (unsigned char) type;
+	record.duration = 0;
+
+	switch(record.type)
+	{
+	case PIVACY_TRACE_APDU:
+		if (!read_int(duration, 4) || !read_data(record.c_apdu) || !read_data(record.r_apdu))
+		{
+			return false;
+		}
+
+		record.duration = (unsigned long) duration;
+		break;
+	case PIVACY_TRACE_POWER_UP:
+	case PIVACY_TRACE_POWER_DOWN:
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_trace_reader::read_int(unsigned long long& val, size_t len)
+{
+	unsigned char buf[8];
+
+	if (fread(buf, 1, len, trace_file) != len)
+	{
+		return false;
+	}
+
+	val = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		val = (val << 8) | buf[i];
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_trace_reader::read_data(bytestring& data)
+{
+	unsigned long long len;
+
+	if (!read_int(len, 4) || (len > PIVACY_TRACE_MAX_DATA))
+	{
+		return false;
+	}
+
+	std::vector<unsigned char> buf(len + 1);
+
+	if (fread(&buf[0], 1, len, trace_file) != len)
+	{
+		return false;
+	}
+
+	data = bytestring(&buf[0], len);
+
+	return true;
+}
+
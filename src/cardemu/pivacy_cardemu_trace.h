@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_trace.h
+
+ Binary traces of the APDUs and power events seen by the card emulator,
+ for offline replay
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_TRACE_H
+#define _PIVACY_CARDEMU_TRACE_H
+
+#include "silvia_bytestring.h"
+#include <stdio.h>
+#include <string>
+
+/*
+ * Trace file format: the magic "PIVACYTR" followed by a version byte and
+ * a sequence of records. All integers are big-endian. Each record starts
+ * with a type byte and an 8-byte timestamp in microseconds since the
+ * trace was opened; APDU records continue with the 4-byte processing
+ * time in microseconds and the C-APDU and R-APDU, each preceded by a
+ * 4-byte length (extended APDUs do not fit in two bytes; version 1 traces
+ * had 2-byte lengths and are not read)
+ */
+#define PIVACY_TRACE_MAGIC			"PIVACYTR"
+#define PIVACY_TRACE_VERSION		0x02
+
+/* Longer data is taken to be a corrupt trace */
+#define PIVACY_TRACE_MAX_DATA		(1024 * 1024)
+
+/* Record types */
+#define PIVACY_TRACE_APDU			0x01
+#define PIVACY_TRACE_POWER_UP		0x02
+#define PIVACY_TRACE_POWER_DOWN		0x03
+
+/**
+ * Get the current time
+ * @return the current time in microseconds
+ */
+unsigned long long pivacy_trace_now();
+
+/**
+ * Trace record
+ */
+struct pivacy_cardemu_trace_record
+{
+	unsigned char type;
+	unsigned long long timestamp;
+	unsigned long duration;
+	bytestring c_apdu;
+	bytestring r_apdu;
+};
+
+/**
+ * Trace writer
+ */
+class pivacy_cardemu_trace_writer
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_trace_writer();
+
+	/**
+	 * Destructor; closes the trace
+	 */
+	~pivacy_cardemu_trace_writer();
+
+	/**
+	 * Create a new trace file
+	 * @param file_name the name of the trace file
+	 * @return true if the file was created
+	 */
+	bool open(const std::string& file_name);
+
+	/**
+	 * Close the trace file
+	 */
+	void close();
+
+	/**
+	 * Record an APDU exchange
+	 * @param start the time processing started (see pivacy_trace_now())
+	 * @param c_apdu the C-APDU
+	 * @param c_len the length of the C-APDU
+	 * @param r_apdu the R-APDU
+	 * @param r_len the length of the R-APDU
+	 */
+	void record_apdu(unsigned long long start, const unsigned char* c_apdu, size_t c_len, const unsigned char* r_apdu, size_t r_len);
+
+	/**
+	 * Record a power event; the trace is flushed at power down
+	 * @param type PIVACY_TRACE_POWER_UP or PIVACY_TRACE_POWER_DOWN
+	 */
+	void record_event(unsigned char type);
+
+private:
+	/**
+	 * Write a big-endian integer
+	 * @param val the value
+	 * @param len the number of bytes
+	 */
+	void write_int(unsigned long long val, size_t len);
+
+	/**
+	 * Write data preceded by its length
+	 * @param data the data
+	 * @param len the length of the data
+	 */
+	void write_data(const unsigned char* data, size_t len);
+
+	FILE* trace_file;
+	unsigned long long start_time;
+};
+
+/**
+ * Trace reader
+ */
+class pivacy_cardemu_trace_reader
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cardemu_trace_reader();
+
+	/**
+	 * Destructor; closes the trace
+	 */
+	~pivacy_cardemu_trace_reader();
+
+	/**
+	 * Open a trace file
+	 * @param file_name the name of the trace file
+	 * @return true if the file was opened and is a trace
+	 */
+	bool open(const std::string& file_name);
+
+	/**
+	 * Rewind to the first record
+	 */
+	void rewind();
+
+	/**
+	 * Close the trace file
+	 */
+	void close();
+
+	/**
+	 * Read the next record
+	 * @param record receives the record
+	 * @return false at the end of the trace or if the trace is corrupt
+	 */
+	bool next(pivacy_cardemu_trace_record& record);
+
+private:
+	/**
+	 * Read a big-endian integer
+	 * @param val receives the value
+	 * @param len the number of bytes
+	 * @return false at the end of the file
+	 */
+	bool read_int(unsigned long long& val, size_t len);
+
+	/**
+	 * Read a byte string preceded by its length
+	 * @param data receives the byte string
+	 * @return false at the end of the file
+	 */
+	bool read_data(bytestring& data);
+
+	FILE* trace_file;
+	long first_record;
+};
+
+#endif // !_PIVACY_CARDEMU_TRACE_H
+
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_transport.h
+
+ Transports that deliver APDUs and power events to the card emulator
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_TRANSPORT_H
+#define _PIVACY_CARDEMU_TRANSPORT_H
+
+#include <stdlib.h>
+
+/* Callbacks into the emulator */
+typedef int (*pivacy_apdu_handler)(const unsigned char* apdu_data, size_t apdu_len, unsigned char* rdata, size_t* rdata_len);
+typedef void (*pivacy_power_handler)(void);
+
+/**
+ * Transport base class
+ */
+class pivacy_cardemu_transport
+{
+public:
+	/**
+	 * Destructor
+	 */
+	virtual ~pivacy_cardemu_transport() { }
+
+	/**
+	 * Get the name of the transport
+	 * @return the name of the transport
+	 */
+	virtual const char* get_name() = 0;
+
+	/**
+	 * Initialise the transport
+	 * @return true if successful
+	 */
+	virtual bool init() = 0;
+
+	/**
+	 * Uninitialise the transport
+	 */
+	virtual void uninit() = 0;
+
+	/**
+	 * Wait for a connection to the reader side
+	 * @return true if connected, false if cancelled or on a fatal error
+	 */
+	virtual bool connect() = 0;
+
+	/**
+	 * Process APDUs and power events until the connection is closed or
+	 * the transport is cancelled
+	 * @param apdu_handler the APDU callback
+	 * @param power_up_handler the power up callback
+	 * @param power_down_handler the power down callback
+	 * @return true if the connection was closed normally
+	 */
+	virtual bool loop_and_process(pivacy_apdu_handler apdu_handler, pivacy_power_handler power_up_handler, pivacy_power_handler power_down_handler) = 0;
+
+	/**
+	 * Close the connection
+	 */
+	virtual void disconnect() = 0;
+
+	/**
+	 * Cancel waiting for a connection or processing; safe to call from
+	 * a signal handler
+	 */
+	virtual void cancel() = 0;
+};
+
+#endif // !_PIVACY_CARDEMU_TRANSPORT_H
+
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_transport_edna.cpp
+
+ Transport through the edna daemon
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_transport_edna.h"
+#include "pivacy_cardemu_metrics.h"
+#include "pivacy_log.h"
+#include "edna.h"
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif // HAVE_SYS_INOTIFY_H
+
+pivacy_cardemu_transport_edna::pivacy_cardemu_transport_edna(const unsigned char* aid, size_t aid_len, const std::string& daemon_socket)
+{
+	this->aid = aid;
+	this->aid_len = aid_len;
+	this->daemon_socket = daemon_socket;
+
+	inotify_fd = -1;
+	cancel_pipe[0] = cancel_pipe[1] = -1;
+	socket_appeared = 0;
+
+	cancelled = 0;
+	connected = 0;
+}
+
+pivacy_cardemu_transport_edna::~pivacy_cardemu_transport_edna()
+{
+	if (inotify_fd >= 0) close(inotify_fd);
+	if (cancel_pipe[0] >= 0) close(cancel_pipe[0]);
+	if (cancel_pipe[1] >= 0) close(cancel_pipe[1]);
+}
+
+const char* pivacy_cardemu_transport_edna::get_name()
+{
+	return "edna";
+}
+
+pivacy_cardemu_backoff& pivacy_cardemu_transport_edna::get_backoff()
+{
+	return backoff;
+}
+
+bool pivacy_cardemu_transport_edna::init()
+{
+	edna_rv rv = ERV_OK;
+
+	if ((rv = edna_lib_init()) != ERV_OK)
+	{
+		ERROR_MSG("Failed to initialise the edna client library (0x%08X)", rv);
+
+		return false;
+	}
+
+	INFO_MSG("Initialised edna client library");
+
+	/* Wakes up the wait between connection attempts when cancelled */
+	if (pipe(cancel_pipe) != 0)
+	{
+		ERROR_MSG("Failed to create the edna cancellation pipe");
+
+		edna_lib_uninit();
+
+		return false;
+	}
+
+	fcntl(cancel_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(cancel_pipe[1], F_SETFL, O_NONBLOCK);
+
+	start_watching();
+
+	return true;
+}
+
+void pivacy_cardemu_transport_edna::start_watching()
+{
+	if (daemon_socket.empty())
+	{
+		return;
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	size_t slash = daemon_socket.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : ((slash == 0) ? "/" : daemon_socket.substr(0, slash));
+
+	daemon_socket_name = (slash == std::string::npos) ? daemon_socket : daemon_socket.substr(slash + 1);
+
+	inotify_fd = inotify_init();
+
+	if (inotify_fd < 0)
+	{
+		WARNING_MSG("Failed to initialise inotify (%s), only retrying periodically", strerror(errno));
+
+		return;
+	}
+
+	fcntl(inotify_fd, F_SETFL, O_NONBLOCK);
+
+	/* The socket is created when the daemon starts listening */
+	if (inotify_add_watch(inotify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO) < 0)
+	{
+		WARNING_MSG("Failed to watch %s for the edna daemon socket (%s), only retrying periodically", dir.c_str(), strerror(errno));
+
+		close(inotify_fd);
+		inotify_fd = -1;
+
+		return;
+	}
+
+	INFO_MSG("Watching for the edna daemon socket %s", daemon_socket.c_str());
+#else // !HAVE_SYS_INOTIFY_H
+	WARNING_MSG("No inotify support, only retrying to connect to the edna daemon periodically");
+#endif // HAVE_SYS_INOTIFY_H
+}
+
+void pivacy_cardemu_transport_edna::uninit()
+{
+	edna_lib_uninit();
+
+	if (inotify_fd >= 0) close(inotify_fd);
+	if (cancel_pipe[0] >= 0) close(cancel_pipe[0]);
+	if (cancel_pipe[1] >= 0) close(cancel_pipe[1]);
+
+	inotify_fd = cancel_pipe[0] = cancel_pipe[1] = -1;
+
+	INFO_MSG("Uninitialised edna client library");
+}
+
+void pivacy_cardemu_transport_edna::wait_for_daemon(unsigned int delay)
+{
+	struct pollfd fds[2];
+	nfds_t nfds = 1;
+
+	fds[0].fd = cancel_pipe[0];
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+
+	if (inotify_fd >= 0)
+	{
+		fds[1].fd = inotify_fd;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		nfds = 2;
+	}
+
+	unsigned long long deadline = pivacy_cardemu_metrics::now() + (delay * 1000ULL);
+
+	while (!cancelled)
+	{
+		unsigned long long now = pivacy_cardemu_metrics::now();
+
+		if (now >= deadline)
+		{
+			return;
+		}
+
+		int rv = poll(fds, nfds, (int) ((deadline - now + 999) / 1000));
+
+		if (rv < 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG("Waiting for the edna daemon failed (%s)", strerror(errno));
+
+			return;
+		}
+
+		if ((rv == 0) || (fds[0].revents != 0))
+		{
+			return;
+		}
+
+#ifdef HAVE_SYS_INOTIFY_H
+		if ((nfds == 2) && (fds[1].revents != 0))
+		{
+			char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+			ssize_t len;
+			bool appeared = false;
+
+			while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+			{
+				for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len)
+				{
+					struct inotify_event* event = (struct inotify_event*) p;
+
+					if ((event->len > 0) && (daemon_socket_name == event->name))
+					{
+						appeared = true;
+					}
+				}
+			}
+
+			/* Try again right away; the daemon is likely to be up */
+			if (appeared)
+			{
+				DEBUG_MSG("The edna daemon socket %s appeared", daemon_socket.c_str());
+
+				socket_appeared = pivacy_cardemu_metrics::now();
+
+				backoff.reset();
+
+				return;
+			}
+		}
+#endif // HAVE_SYS_INOTIFY_H
+	}
+}
+
+bool pivacy_cardemu_transport_edna::connect()
+{
+	/* The daemon may have restarted, so start with a short delay */
+	backoff.reset();
+	socket_appeared = 0;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	/* Forget about sockets that appeared before this attempt */
+	if (inotify_fd >= 0)
+	{
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+		while (read(inotify_fd, buf, sizeof(buf)) > 0);
+	}
+#endif // HAVE_SYS_INOTIFY_H
+
+	/* Try to connect to the edna daemon */
+	while (!cancelled)
+	{
+		bool ok = (edna_lib_connect(aid, aid_len) == ERV_OK);
+
+		pivacy_cardemu_metrics::i()->record_connect_attempt(ok);
+
+		if (ok)
+		{
+			break;
+		}
+
+		unsigned int delay = backoff.next_delay();
+
+		if (backoff.get_attempts() == 1)
+		{
+			INFO_MSG("Waiting for the edna daemon");
+		}
+
+		DEBUG_MSG("Failed to connect to the edna daemon, retrying in %ums", delay);
+
+		wait_for_daemon(delay);
+	}
+
+	if (cancelled)
+	{
+		return false;
+	}
+
+	connected = 1;
+
+	if (socket_appeared != 0)
+	{
+		pivacy_cardemu_metrics::i()->record_transport_ready(socket_appeared, pivacy_cardemu_metrics::READY_SINCE_SOCKET);
+	}
+
+	INFO_MSG("Connected to the edna daemon and registered IRMA card emulation");
+
+	return true;
+}
+
+bool pivacy_cardemu_transport_edna::loop_and_process(pivacy_apdu_handler apdu_handler, pivacy_power_handler power_up_handler, pivacy_power_handler power_down_handler)
+{
+	edna_rv rv = edna_lib_loop_and_process(apdu_handler, power_up_handler, power_down_handler);
+
+	if (rv != ERV_OK)
+	{
+		ERROR_MSG("APDU handling exited with an error (0x%08X)", rv);
+
+		return false;
+	}
+
+	return true;
+}
+
+void pivacy_cardemu_transport_edna::disconnect()
+{
+	connected = 0;
+
+	edna_lib_disconnect();
+
+	INFO_MSG("Disconnected from the edna daemon");
+}
+
+void pivacy_cardemu_transport_edna::cancel()
+{
+	cancelled = 1;
+
+	/* Only async-signal-safe calls from here on */
+	if (cancel_pipe[1] >= 0)
+	{
+		char c = 0;
+
+		if (write(cancel_pipe[1], &c, 1) != 1)
+		{
+			/* The pipe is full, so the wait is interrupted anyway */
+		}
+	}
+
+	if (connected)
+	{
+		edna_lib_cancel();
+	}
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_transport_edna.h
+
+ Transport through the edna daemon
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_TRANSPORT_EDNA_H
+#define _PIVACY_CARDEMU_TRANSPORT_EDNA_H
+
+#include "pivacy_cardemu_transport.h"
+#include "pivacy_cardemu_backoff.h"
+#include <signal.h>
+#include <string>
+
+class pivacy_cardemu_transport_edna : public pivacy_cardemu_transport
+{
+public:
+	/**
+	 * Constructor
+	 * @param aid the application ID to register
+	 * @param aid_len the length of the application ID
+	 * @param daemon_socket the socket of the edna daemon; if set, a new
+	 * connection is attempted as soon as it appears (optional)
+	 */
+	pivacy_cardemu_transport_edna(const unsigned char* aid, size_t aid_len, const std::string& daemon_socket = "");
+
+	/**
+	 * Destructor
+	 */
+	virtual ~pivacy_cardemu_transport_edna();
+
+	/**
+	 * Get the reconnect schedule
+	 * @return the reconnect schedule
+	 */
+	pivacy_cardemu_backoff& get_backoff();
+
+	virtual const char* get_name();
+	virtual bool init();
+	virtual void uninit();
+	virtual bool connect();
+	virtual bool loop_and_process(pivacy_apdu_handler apdu_handler, pivacy_power_handler power_up_handler, pivacy_power_handler power_down_handler);
+	virtual void disconnect();
+	virtual void cancel();
+
+private:
+	/**
+	 * Watch the directory of the daemon socket
+	 */
+	void start_watching();
+
+	/**
+	 * Wait before the next connection attempt
+	 * @param delay the maximum time to wait in milliseconds
+	 */
+	void wait_for_daemon(unsigned int delay);
+
+	const unsigned char* aid;
+	size_t aid_len;
+
+	pivacy_cardemu_backoff backoff;
+
+	std::string daemon_socket;
+	std::string daemon_socket_name;
+	int inotify_fd;
+	int cancel_pipe[2];
+	unsigned long long socket_appeared;
+
+	volatile sig_atomic_t cancelled;
+	volatile sig_atomic_t connected;
+};
+
+#endif // !_PIVACY_CARDEMU_TRANSPORT_EDNA_H
+
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_transport_loopback.cpp
+
+ Transport over a local UNIX domain socket that stands in for the edna
+ daemon, e.g. for load testing
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cardemu_transport_loopback.h"
+#include "pivacy_loopback_proto.h"
+#include "pivacy_log.h"
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // !MSG_NOSIGNAL
+
+pivacy_cardemu_transport_loopback::pivacy_cardemu_transport_loopback(const std::string& socket_path)
+{
+	this->socket_path = socket_path;
+
+	listen_socket = -1;
+	client_socket = -1;
+	cancel_pipe[0] = cancel_pipe[1] = -1;
+
+	rx_buf.resize(LOOPBACK_MAX_MSG);
+	tx_buf.resize(LOOPBACK_MAX_MSG + 2);
+}
+
+pivacy_cardemu_transport_loopback::~pivacy_cardemu_transport_loopback()
+{
+	uninit();
+}
+
+const char* pivacy_cardemu_transport_loopback::get_name()
+{
+	return "loopback";
+}
+
+bool pivacy_cardemu_transport_loopback::init()
+{
+	struct sockaddr_un addr;
+
+	if (socket_path.size() >= sizeof(addr.sun_path))
+	{
+		ERROR_MSG("Loopback socket path %s is too long", socket_path.c_str());
+
+		return false;
+	}
+
+	if (pipe(cancel_pipe) != 0)
+	{
+		ERROR_MSG("Failed to create the loopback cancellation pipe");
+
+		return false;
+	}
+
+	fcntl(cancel_pipe[1], F_SETFL, O_NONBLOCK);
+
+	listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listen_socket < 0)
+	{
+		ERROR_MSG("Failed to create the loopback socket (%s)", strerror(errno));
+
+		uninit();
+
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path.c_str());
+
+	unlink(socket_path.c_str());
+
+	if ((bind(listen_socket, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+	    (listen(listen_socket, 1) != 0))
+	{
+		ERROR_MSG("Failed to listen on loopback socket %s (%s)", socket_path.c_str(), strerror(errno));
+
+		uninit();
+
+		return false;
+	}
+
+	INFO_MSG("Listening for loopback connections on %s", socket_path.c_str());
+
+	return true;
+}
+
+void pivacy_cardemu_transport_loopback::uninit()
+{
+	disconnect();
+
+	if (listen_socket >= 0)
+	{
+		close(listen_socket);
+		unlink(socket_path.c_str());
+
+		listen_socket = -1;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (cancel_pipe[i] >= 0)
+		{
+			close(cancel_pipe[i]);
+
+			cancel_pipe[i] = -1;
+		}
+	}
+}
+
+bool pivacy_cardemu_transport_loopback::wait_readable(int fd)
+{
+	struct pollfd fds[2];
+
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancel_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		fds[0].revents = fds[1].revents = 0;
+
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			return false;
+		}
+
+		if (fds[1].revents != 0)
+		{
+			/* Cancelled; leave the byte in the pipe so all waits end */
+			return false;
+		}
+
+		if (fds[0].revents != 0)
+		{
+			return true;
+		}
+	}
+}
+
+bool pivacy_cardemu_transport_loopback::connect()
+{
+	while (wait_readable(listen_socket))
+	{
+		client_socket = accept(listen_socket, NULL, NULL);
+
+		if (client_socket >= 0)
+		{
+			INFO_MSG("Accepted loopback connection");
+
+			return true;
+		}
+
+		if ((errno != EINTR) && (errno != ECONNABORTED))
+		{
+			ERROR_MSG("Failed to accept a loopback connection (%s)", strerror(errno));
+
+			return false;
+		}
+	}
+
+	return false;
+}
+
+bool pivacy_cardemu_transport_loopback::read_full(unsigned char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		if (!wait_readable(client_socket))
+		{
+			return false;
+		}
+
+		ssize_t received = read(client_socket, buf, len);
+
+		if (received < 0)
+		{
+			if (errno == EINTR) continue;
+
+			return false;
+		}
+
+		if (received == 0)
+		{
+			return false;
+		}
+
+		buf += received;
+		len -= received;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_transport_loopback::write_msg(const unsigned char* buf, size_t len)
+{
+	tx_buf[0] = (len >> 8) & 0xff;
+	tx_buf[1] = len & 0xff;
+
+	memcpy(&tx_buf[2], buf, len);
+
+	size_t to_send = len + 2;
+	size_t sent = 0;
+
+	while (sent < to_send)
+	{
+		ssize_t rv = send(client_socket, &tx_buf[sent], to_send - sent, MSG_NOSIGNAL);
+
+		if (rv < 0)
+		{
+			if (errno == EINTR) continue;
+
+			return false;
+		}
+
+		sent += rv;
+	}
+
+	return true;
+}
+
+bool pivacy_cardemu_transport_loopback::loop_and_process(pivacy_apdu_handler apdu_handler, pivacy_power_handler power_up_handler, pivacy_power_handler power_down_handler)
+{
+	std::vector<unsigned char> r_apdu(LOOPBACK_MAX_MSG);
+
+	while (true)
+	{
+		unsigned char len_buf[2];
+
+		if (!read_full(len_buf, 2))
+		{
+			/* The client closed the connection or we were cancelled */
+			return true;
+		}
+
+		size_t len = (len_buf[0] << 8) + len_buf[1];
+
+		if ((len == 0) || !read_full(&rx_buf[0], len))
+		{
+			ERROR_MSG("Malformed loopback message");
+
+			return false;
+		}
+
+		switch(rx_buf[0])
+		{
+		case LOOPBACK_APDU:
+			{
+				size_t r_len = r_apdu.size();
+
+				apdu_handler(&rx_buf[1], len - 1, &r_apdu[0], &r_len);
+
+				if (!write_msg(&r_apdu[0], r_len))
+				{
+					ERROR_MSG("Failed to send R-APDU to the loopback client");
+
+					return false;
+				}
+			}
+			break;
+		case LOOPBACK_POWER_UP:
+			power_up_handler();
+			break;
+		case LOOPBACK_POWER_DOWN:
+			power_down_handler();
+			break;
+		default:
+			ERROR_MSG("Unknown loopback message type 0x%02X", rx_buf[0]);
+
+			return false;
+		}
+	}
+}
+
+void pivacy_cardemu_transport_loopback::disconnect()
+{
+	if (client_socket >= 0)
+	{
+		close(client_socket);
+
+		client_socket = -1;
+
+		INFO_MSG("Closed loopback connection");
+	}
+}
+
+void pivacy_cardemu_transport_loopback::cancel()
+{
+	if (cancel_pipe[1] >= 0)
+	{
+		char c = 0;
+
+		/* write() is async-signal-safe */
+		if (write(cancel_pipe[1], &c, 1) < 0)
+		{
+			/* The pipe is full, so a wake-up is already pending */
+		}
+	}
+}
+
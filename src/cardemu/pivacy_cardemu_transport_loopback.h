@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_cardemu_transport_loopback.h
+
+ Transport over a local UNIX domain socket that stands in for the edna
+ daemon, e.g. for load testing
+ *****************************************************************************/
+
+#ifndef _PIVACY_CARDEMU_TRANSPORT_LOOPBACK_H
+#define _PIVACY_CARDEMU_TRANSPORT_LOOPBACK_H
+
+#include "pivacy_cardemu_transport.h"
+#include <string>
+#include <vector>
+
+class pivacy_cardemu_transport_loopback : public pivacy_cardemu_transport
+{
+public:
+	/**
+	 * Constructor
+	 * @param socket_path the path of the UNIX domain socket to listen on
+	 */
+	pivacy_cardemu_transport_loopback(const std::string& socket_path);
+
+	/**
+	 * Destructor
+	 */
+	virtual ~pivacy_cardemu_transport_loopback();
+
+	virtual const char* get_name();
+	virtual bool init();
+	virtual void uninit();
+	virtual bool connect();
+	virtual bool loop_and_process(pivacy_apdu_handler apdu_handler, pivacy_power_handler power_up_handler, pivacy_power_handler power_down_handler);
+	virtual void disconnect();
+	virtual void cancel();
+
+private:
+	/**
+	 * Wait until a descriptor is readable or the transport is cancelled
+	 * @param fd the descriptor
+	 * @return true if the descriptor is readable
+	 */
+	bool wait_readable(int fd);
+
+	/**
+	 * Read exactly the requested number of bytes from the client
+	 * @param buf the buffer
+	 * @param len the number of bytes to read
+	 * @return false if the connection was closed or the transport cancelled
+	 */
+	bool read_full(unsigned char* buf, size_t len);
+
+	/**
+	 * Write a message preceded by its length to the client
+	 * @param buf the message
+	 * @param len the length of the message
+	 * @return false if the connection was closed
+	 */
+	bool write_msg(const unsigned char* buf, size_t len);
+
+	std::string socket_path;
+
+	int listen_socket;
+	int client_socket;
+
+	/* Written to by cancel() to wake up blocking calls */
+	int cancel_pipe[2];
+
+	/* Message buffers */
+	std::vector<unsigned char> rx_buf;
+	std::vector<unsigned char> tx_buf;
+};
+
+#endif // !_PIVACY_CARDEMU_TRANSPORT_LOOPBACK_H
+
@@ -0,0 +1,75 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_batch_avx2.cpp
+
+ AVX2 backend of the batch exponentiation engine: four 64-bit lanes per
+ vector, each holding a 28-bit digit of an independent exponentiation
+ *****************************************************************************/
+
+#include "config.h"
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+
+/* Everything below, including the kernel templates, is compiled for avx2 */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#include "pivacy_batch_kernel.h"
+#include <immintrin.h>
+
+struct pivacy_batch_avx2
+{
+	typedef __m256i vec;
+
+	static const size_t LANES = PIVACY_BATCH_AVX2_LANES;
+
+	static inline vec zero() { return _mm256_setzero_si256(); }
+	static inline vec set1(uint64_t v) { return _mm256_set1_epi64x((int64_t) v); }
+	static inline vec load(const uint64_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+	static inline void store(uint64_t* p, vec v) { _mm256_storeu_si256((__m256i*) p, v); }
+	static inline vec add(vec a, vec b) { return _mm256_add_epi64(a, b); }
+	static inline vec sub(vec a, vec b) { return _mm256_sub_epi64(a, b); }
+	static inline vec mul(vec a, vec b) { return _mm256_mul_epu32(a, b); }
+	static inline vec band(vec a, vec b) { return _mm256_and_si256(a, b); }
+	static inline vec bor(vec a, vec b) { return _mm256_or_si256(a, b); }
+	static inline vec bandnot(vec a, vec b) { return _mm256_andnot_si256(a, b); }
+	static inline vec shr_digit(vec a) { return _mm256_srli_epi64(a, PIVACY_BATCH_DIGIT_BITS); }
+	static inline vec shr63(vec a) { return _mm256_srli_epi64(a, 63); }
+	static inline vec eq(vec a, vec b) { return _mm256_cmpeq_epi64(a, b); }
+};
+
+void pivacy_batch_powm_avx2(const pivacy_batch_job& job)
+{
+	pivacy_batch_powm<pivacy_batch_avx2>(job);
+}
+
+#pragma GCC pop_options
+
+#endif // __GNUC__ && !__clang__ && __x86_64__
@@ -0,0 +1,385 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_batch_exp.cpp
+
+ Batches of independent exponentiations b_i^e_i mod n; on CPUs with
+ vector instructions several exponentiations are computed side by side
+ in the lanes of a vector, on all others they are computed one by one
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_batch_exp.h"
+#include "pivacy_batch_kernel.h"
+#include "pivacy_multiexp.h"
+#include <assert.h>
+#include <string.h>
+
+/*static*/ pivacy_batch_exp::backend pivacy_batch_exp::selected_backend = pivacy_batch_exp::BACKEND_AUTO;
+
+pivacy_batch_exp::pivacy_batch_exp(const mpz_class& n, const pivacy_fixed_base* fixed_base /* = NULL */)
+{
+	assert((fixed_base == NULL) || (fixed_base->get_modulus() == n));
+
+	this->n = n;
+	this->fixed_base = fixed_base;
+
+	/* Montgomery constants for the kernel digits: R = 2^(28 * digits) */
+	digits = (mpz_sizeinbase(n.get_mpz_t(), 2) + PIVACY_BATCH_DIGIT_BITS - 1) / PIVACY_BATCH_DIGIT_BITS;
+	n_digits.resize(digits, 0);
+	one_digits.resize(digits, 0);
+	n0_inv = 0;
+
+	if (mpz_odd_p(n.get_mpz_t()))
+	{
+		mpz_class radix = mpz_class(1) << PIVACY_BATCH_DIGIT_BITS;
+		mpz_class inv;
+		mpz_class one;
+
+		mpz_invert(inv.get_mpz_t(), n.get_mpz_t(), radix.get_mpz_t());
+
+		n0_inv = (uint32_t) ((0 - mpz_get_ui(inv.get_mpz_t())) & PIVACY_BATCH_DIGIT_MASK);
+
+		mpz_mul_2exp(one.get_mpz_t(), mpz_class(1).get_mpz_t(), PIVACY_BATCH_DIGIT_BITS * digits);
+		mpz_mod(one.get_mpz_t(), one.get_mpz_t(), n.get_mpz_t());
+
+		mpz_export(&n_digits[0], NULL, -1, sizeof(uint32_t), 0, (32 - PIVACY_BATCH_DIGIT_BITS), n.get_mpz_t());
+		mpz_export(&one_digits[0], NULL, -1, sizeof(uint32_t), 0, (32 - PIVACY_BATCH_DIGIT_BITS), one.get_mpz_t());
+	}
+}
+
+pivacy_batch_exp::~pivacy_batch_exp()
+{
+	clear();
+}
+
+/*static*/ bool pivacy_batch_exp::set_backend(backend b)
+{
+	if ((b != BACKEND_AUTO) && !is_supported(b))
+	{
+		return false;
+	}
+
+	selected_backend = b;
+
+	return true;
+}
+
+/*static*/ pivacy_batch_exp::backend pivacy_batch_exp::get_backend()
+{
+	if (selected_backend != BACKEND_AUTO)
+	{
+		return selected_backend;
+	}
+
+	if (is_supported(BACKEND_AVX512))
+	{
+		return BACKEND_AVX512;
+	}
+
+	return BACKEND_SCALAR;
+}
+
+/*static*/ bool pivacy_batch_exp::is_supported(backend b)
+{
+	switch(b)
+	{
+	case BACKEND_SCALAR:
+		return true;
+#ifdef PIVACY_BATCH_X86
+	case BACKEND_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case BACKEND_AVX512:
+		return __builtin_cpu_supports("avx512f");
+#endif // PIVACY_BATCH_X86
+	default:
+		return false;
+	}
+}
+
+/*static*/ const char* pivacy_batch_exp::get_backend_name(backend b)
+{
+	switch(b)
+	{
+	case BACKEND_AUTO:
+		return "auto";
+	case BACKEND_SCALAR:
+		return "scalar";
+	case BACKEND_AVX2:
+		return "avx2";
+	case BACKEND_AVX512:
+		return "avx512";
+	default:
+		return "unknown";
+	}
+}
+
+/*static*/ size_t pivacy_batch_exp::get_lanes(backend b)
+{
+	switch(b)
+	{
+	case BACKEND_AVX2:
+		return PIVACY_BATCH_AVX2_LANES;
+	case BACKEND_AVX512:
+		return PIVACY_BATCH_AVX512_LANES;
+	default:
+		return 1;
+	}
+}
+
+size_t pivacy_batch_exp::add(const mpz_class& b, const mpz_class& e)
+{
+	assert(sgn(e) >= 0);
+
+	terms.push_back(term());
+
+	term& new_term = terms.back();
+
+	mpz_mod(new_term.b.get_mpz_t(), b.get_mpz_t(), n.get_mpz_t());
+	new_term.e = e;
+
+	return terms.size() - 1;
+}
+
+size_t pivacy_batch_exp::add_fixed(size_t index, const mpz_class& e)
+{
+	assert(fixed_base != NULL);
+	assert(sgn(e) >= 0);
+
+	size_t bits = (sgn(e) == 0) ? 0 : mpz_sizeinbase(e.get_mpz_t(), 2);
+
+	/* Without a usable table the base is just another exponentiation to batch */
+	if (pivacy_multiexp::get_default_constant_time() || !fixed_base->covers(index, bits))
+	{
+		return add(fixed_base->get_base(index), e);
+	}
+
+	terms.push_back(term());
+
+	term& new_term = terms.back();
+
+	new_term.e = e;
+	new_term.fixed = true;
+	new_term.index = index;
+
+	return terms.size() - 1;
+}
+
+void pivacy_batch_exp::compute(std::vector<mpz_class>& results)
+{
+	results.resize(terms.size());
+
+	/* Fixed-base terms use their tables; the rest fill the lanes of the backend */
+	std::vector<size_t> batched;
+
+	for (size_t i = 0; i < terms.size(); i++)
+	{
+		if (terms[i].fixed)
+		{
+			compute_single(terms[i], results[i]);
+		}
+		else
+		{
+			batched.push_back(i);
+		}
+	}
+
+	backend b = get_backend();
+	size_t lanes = get_lanes(b);
+	size_t done = 0;
+
+	/* The kernel needs an odd modulus whose column sums fit in 64 bits */
+	if ((lanes > 1) && mpz_odd_p(n.get_mpz_t()) && (digits <= PIVACY_BATCH_MAX_DIGITS))
+	{
+		/* A vector with a single exponentiation is slower than computing it on its own */
+		while ((batched.size() - done) >= 2)
+		{
+			size_t count = batched.size() - done;
+
+			if (count > lanes)
+			{
+				count = lanes;
+			}
+
+			compute_lanes(b, lanes, &batched[done], count, results);
+
+			done += count;
+		}
+	}
+
+	for (; done < batched.size(); done++)
+	{
+		compute_single(terms[batched[done]], results[batched[done]]);
+	}
+}
+
+void pivacy_batch_exp::clear()
+{
+	for (std::vector<term>::iterator i = terms.begin(); i != terms.end(); i++)
+	{
+		mpz_ptr e = i->e.get_mpz_t();
+
+		memset(e->_mp_d, 0, e->_mp_alloc * sizeof(mp_limb_t));
+	}
+
+	terms.clear();
+}
+
+void pivacy_batch_exp::compute_lanes(backend b, size_t lanes, const size_t* which, size_t count, std::vector<mpz_class>& results)
+{
+	assert((count > 0) && (count <= lanes));
+
+	/* All lanes go through the same number of windows, enough for the largest exponent */
+	size_t bits = 1;
+
+	for (size_t l = 0; l < count; l++)
+	{
+		const mpz_class& e = terms[which[l]].e;
+
+		if ((sgn(e) != 0) && (mpz_sizeinbase(e.get_mpz_t(), 2) > bits))
+		{
+			bits = mpz_sizeinbase(e.get_mpz_t(), 2);
+		}
+	}
+
+	size_t num_windows = (bits + PIVACY_BATCH_WINDOW - 1) / PIVACY_BATCH_WINDOW;
+
+	std::vector<uint64_t> bases(digits * lanes, 0);
+	std::vector<uint64_t> windows(num_windows * lanes, 0);
+	std::vector<uint64_t> lane_results(digits * lanes, 0);
+	std::vector<uint64_t> workspace(PIVACY_BATCH_WORKSPACE(digits, lanes), 0);
+	std::vector<uint32_t> lane_digits(digits, 0);
+
+	for (size_t l = 0; l < lanes; l++)
+	{
+		/* Unused lanes compute 1^0 */
+		if (l >= count)
+		{
+			for (size_t j = 0; j < digits; j++)
+			{
+				bases[(j * lanes) + l] = one_digits[j];
+			}
+
+			continue;
+		}
+
+		const term& t = terms[which[l]];
+
+		/* The base in Montgomery form, bR mod n */
+		mpz_class b_mont;
+
+		mpz_mul_2exp(b_mont.get_mpz_t(), t.b.get_mpz_t(), PIVACY_BATCH_DIGIT_BITS * digits);
+		mpz_mod(b_mont.get_mpz_t(), b_mont.get_mpz_t(), n.get_mpz_t());
+
+		memset(&lane_digits[0], 0, digits * sizeof(uint32_t));
+		mpz_export(&lane_digits[0], NULL, -1, sizeof(uint32_t), 0, (32 - PIVACY_BATCH_DIGIT_BITS), b_mont.get_mpz_t());
+
+		for (size_t j = 0; j < digits; j++)
+		{
+			bases[(j * lanes) + l] = lane_digits[j];
+		}
+
+		mpz_ptr b_mont_z = b_mont.get_mpz_t();
+
+		memset(b_mont_z->_mp_d, 0, b_mont_z->_mp_alloc * sizeof(mp_limb_t));
+
+		/* The exponent, most significant window first */
+		for (size_t w = 0; w < num_windows; w++)
+		{
+			size_t pos = (num_windows - 1 - w) * PIVACY_BATCH_WINDOW;
+			uint64_t window = 0;
+
+			for (size_t q = PIVACY_BATCH_WINDOW; q > 0; q--)
+			{
+				window = (window << 1) | mpz_tstbit(t.e.get_mpz_t(), pos + q - 1);
+			}
+
+			windows[(w * lanes) + l] = window;
+		}
+	}
+
+	pivacy_batch_job job;
+
+	job.digits = digits;
+	job.n = &n_digits[0];
+	job.n0_inv = n0_inv;
+	job.one = &one_digits[0];
+	job.bases = &bases[0];
+	job.windows = &windows[0];
+	job.num_windows = num_windows;
+	job.results = &lane_results[0];
+	job.workspace = &workspace[0];
+
+	switch(b)
+	{
+#ifdef PIVACY_BATCH_X86
+	case BACKEND_AVX2:
+		pivacy_batch_powm_avx2(job);
+		break;
+	case BACKEND_AVX512:
+		pivacy_batch_powm_avx512(job);
+		break;
+#endif // PIVACY_BATCH_X86
+	default:
+		assert(false);
+	}
+
+	for (size_t l = 0; l < count; l++)
+	{
+		for (size_t j = 0; j < digits; j++)
+		{
+			lane_digits[j] = (uint32_t) lane_results[(j * lanes) + l];
+		}
+
+		mpz_import(results[which[l]].get_mpz_t(), digits, -1, sizeof(uint32_t), 0, (32 - PIVACY_BATCH_DIGIT_BITS), &lane_digits[0]);
+	}
+
+	/* The table and results hold powers of the bases and the windows are the exponents */
+	memset(&bases[0], 0, bases.size() * sizeof(uint64_t));
+	memset(&windows[0], 0, windows.size() * sizeof(uint64_t));
+	memset(&lane_results[0], 0, lane_results.size() * sizeof(uint64_t));
+	memset(&workspace[0], 0, workspace.size() * sizeof(uint64_t));
+	memset(&lane_digits[0], 0, lane_digits.size() * sizeof(uint32_t));
+}
+
+void pivacy_batch_exp::compute_single(const term& t, mpz_class& result)
+{
+	pivacy_multiexp single(n, fixed_base);
+
+	if (t.fixed)
+	{
+		single.add_fixed(t.index, t.e);
+	}
+	else
+	{
+		single.add(t.b, t.e);
+	}
+
+	single.compute(result);
+}
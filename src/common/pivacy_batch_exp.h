@@ -0,0 +1,177 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_batch_exp.h
+
+ Batches of independent exponentiations b_i^e_i mod n; on CPUs with
+ vector instructions several exponentiations are computed side by side
+ in the lanes of a vector, on all others they are computed one by one
+ *****************************************************************************/
+
+#ifndef _PIVACY_BATCH_EXP_H
+#define _PIVACY_BATCH_EXP_H
+
+#include <gmpxx.h>
+#include "pivacy_fixed_base.h"
+#include <stdint.h>
+#include <vector>
+
+class pivacy_batch_exp
+{
+public:
+	/* Implementations of the exponentiations */
+	enum backend
+	{
+		BACKEND_AUTO = 0,
+		BACKEND_SCALAR,
+		BACKEND_AVX2,
+		BACKEND_AVX512
+	};
+
+	/**
+	 * Constructor
+	 * @param n the modulus
+	 * @param fixed_base fixed-base tables for the modulus (optional)
+	 */
+	pivacy_batch_exp(const mpz_class& n, const pivacy_fixed_base* fixed_base = NULL);
+
+	/**
+	 * Destructor; wipes the exponents
+	 */
+	~pivacy_batch_exp();
+
+	/**
+	 * Select the backend for all batches; BACKEND_AUTO (the default)
+	 * selects AVX-512 if the CPU supports it and the scalar backend
+	 * otherwise, as four AVX2 lanes are no faster than one scalar core
+	 * @param b the backend
+	 * @return false if the CPU or the build does not support the backend
+	 */
+	static bool set_backend(backend b);
+
+	/**
+	 * Get the backend batches are computed with
+	 * @return the backend (never BACKEND_AUTO)
+	 */
+	static backend get_backend();
+
+	/**
+	 * Check if a backend can be used
+	 * @param b the backend
+	 * @return true if the CPU and the build support the backend
+	 */
+	static bool is_supported(backend b);
+
+	/**
+	 * Get the name of a backend
+	 * @param b the backend
+	 * @return the name of the backend
+	 */
+	static const char* get_backend_name(backend b);
+
+	/**
+	 * Get the number of exponentiations a backend computes side by side
+	 * @param b the backend
+	 * @return the number of lanes (1 for the scalar backend)
+	 */
+	static size_t get_lanes(backend b);
+
+	/**
+	 * Add an exponentiation b^e to the batch; the exponent must not be negative
+	 * @param b the base
+	 * @param e the exponent
+	 * @return the index of the result
+	 */
+	size_t add(const mpz_class& b, const mpz_class& e);
+
+	/**
+	 * Add an exponentiation g^e for a base with a fixed-base table;
+	 * it is computed with the table if the table covers the exponent
+	 * and constant-time arithmetic is not in use, and is batched
+	 * otherwise. Must only be used if fixed-base tables were specified
+	 * @param index the index of the base in the fixed-base tables
+	 * @param e the exponent
+	 * @return the index of the result
+	 */
+	size_t add_fixed(size_t index, const mpz_class& e);
+
+	/**
+	 * Compute all exponentiations in the batch
+	 * @param results receives b_i^e_i mod n in the order they were added
+	 */
+	void compute(std::vector<mpz_class>& results);
+
+	/**
+	 * Remove all exponentiations and wipe the exponents
+	 */
+	void clear();
+
+private:
+	/* An exponentiation in the batch */
+	struct term
+	{
+		term() : fixed(false), index(0) { }
+
+		mpz_class b;
+		mpz_class e;
+		bool fixed;
+		size_t index;
+	};
+
+	/**
+	 * Compute up to one vector of exponentiations
+	 * @param b the backend
+	 * @param lanes the number of lanes of the backend
+	 * @param which the indices of the terms to compute
+	 * @param count the number of terms (at most lanes)
+	 * @param results receives the results
+	 */
+	void compute_lanes(backend b, size_t lanes, const size_t* which, size_t count, std::vector<mpz_class>& results);
+
+	/**
+	 * Compute a single exponentiation on its own
+	 * @param t the term
+	 * @param result receives the result
+	 */
+	void compute_single(const term& t, mpz_class& result);
+
+	mpz_class n;
+	const pivacy_fixed_base* fixed_base;
+	std::vector<term> terms;
+
+	/* Montgomery constants for the vector backends */
+	size_t digits;
+	std::vector<uint32_t> n_digits;
+	std::vector<uint32_t> one_digits;
+	uint32_t n0_inv;
+
+	static backend selected_backend;
+};
+
+#endif // !_PIVACY_BATCH_EXP_H
@@ -0,0 +1,274 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_batch_kernel.h
+
+ Lane-parallel Montgomery exponentiation for the SIMD backends of the
+ batch exponentiation engine; each lane of a vector computes an
+ independent exponentiation modulo the same odd modulus
+ *****************************************************************************/
+
+#ifndef _PIVACY_BATCH_KERNEL_H
+#define _PIVACY_BATCH_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The x86 backends are compiled for their instruction set with a target
+ * pragma, so the rest of the code does not depend on it; the CPU is
+ * checked at run time before they are used
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define PIVACY_BATCH_X86
+#endif // __GNUC__ && !__clang__ && __x86_64__
+
+/*
+ * Numbers are stored as 28-bit digits, so the products of a Montgomery
+ * multiplication can be summed in 64-bit lanes without carrying after
+ * every step; this holds for up to 127 digits (3556 bits)
+ */
+#define PIVACY_BATCH_DIGIT_BITS		28
+#define PIVACY_BATCH_DIGIT_MASK		((1UL << PIVACY_BATCH_DIGIT_BITS) - 1)
+#define PIVACY_BATCH_MAX_DIGITS		127
+
+/* Fixed window size; every window costs the same, whatever the exponent bits */
+#define PIVACY_BATCH_WINDOW		4
+#define PIVACY_BATCH_TABLE		(1 << PIVACY_BATCH_WINDOW)
+
+/* Lanes per backend */
+#define PIVACY_BATCH_AVX2_LANES		4
+#define PIVACY_BATCH_AVX512_LANES	8
+
+/* Size of the workspace in 64-bit words */
+#define PIVACY_BATCH_WORKSPACE(digits, lanes)	((PIVACY_BATCH_TABLE + 4) * (digits) * (lanes))
+
+/*
+ * A batch of exponentiations. Numbers are stored as digits (least
+ * significant first) in 64-bit words, with the digits of all lanes
+ * interleaved: digit j of lane l is at [j * lanes + l]
+ */
+struct pivacy_batch_job
+{
+	/* The modulus and -n^-1 mod 2^28 */
+	size_t digits;
+	const uint32_t* n;
+	uint32_t n0_inv;
+
+	/* R mod n, with R = 2^(28 * digits) */
+	const uint32_t* one;
+
+	/* The bases in Montgomery form */
+	const uint64_t* bases;
+
+	/* The exponents as windows, most significant first: window w of lane l is at [w * lanes + l] */
+	const uint64_t* windows;
+	size_t num_windows;
+
+	/* Receives the results (not in Montgomery form) */
+	uint64_t* results;
+
+	/* Scratch space of PIVACY_BATCH_WORKSPACE(digits, lanes) words */
+	uint64_t* workspace;
+};
+
+#ifdef PIVACY_BATCH_X86
+/**
+ * Compute a batch of 4 exponentiations using AVX2
+ * @param job the batch
+ */
+void pivacy_batch_powm_avx2(const pivacy_batch_job& job);
+
+/**
+ * Compute a batch of 8 exponentiations using AVX-512
+ * @param job the batch
+ */
+void pivacy_batch_powm_avx512(const pivacy_batch_job& job);
+#endif // PIVACY_BATCH_X86
+
+/*
+ * The kernels are templates over a vector type V that provides LANES,
+ * vec, zero(), set1(), load(), store(), add(), sub(), mul() (of the low
+ * 32 bits of each lane), band(), bor(), bandnot() (~a & b), shr_digit()
+ * (by PIVACY_BATCH_DIGIT_BITS), shr63() and eq() (all ones where equal).
+ * They are only instantiated by the backends, after selecting the
+ * instruction set
+ */
+
+/**
+ * Montgomery multiplication r = a * b / R mod n; r may be the same as a
+ * or b. Each row adds a_i * b + m * n to the columns without carrying,
+ * only the carry out of the column that becomes zero is moved up. The
+ * final subtraction is done with masks, so the running time does not
+ * depend on the values
+ * @param job the batch
+ * @param r receives the product
+ * @param a the first operand
+ * @param b the second operand
+ * @param t scratch space of 2 * digits vectors
+ */
+template <class V> inline void pivacy_batch_montmul(const pivacy_batch_job& job, uint64_t* r, const uint64_t* a, const uint64_t* b, uint64_t* t)
+{
+	typedef typename V::vec vec;
+
+	const size_t s = job.digits;
+	const size_t L = V::LANES;
+	const vec mask = V::set1(PIVACY_BATCH_DIGIT_MASK);
+	const vec n0_inv = V::set1(job.n0_inv);
+
+	for (size_t j = 0; j < (2 * s); j++)
+	{
+		V::store(t + (j * L), V::zero());
+	}
+
+	for (size_t i = 0; i < s; i++)
+	{
+		uint64_t* t_i = t + (i * L);
+		vec a_i = V::load(a + (i * L));
+
+		/* m makes column i a multiple of the radix, so its carry is exact */
+		vec x = V::add(V::load(t_i), V::mul(a_i, V::load(b)));
+		vec m = V::band(V::mul(V::band(x, mask), n0_inv), mask);
+
+		x = V::add(x, V::mul(m, V::set1(job.n[0])));
+
+		V::store(t_i + L, V::add(V::load(t_i + L), V::shr_digit(x)));
+
+		for (size_t j = 1; j < s; j++)
+		{
+			V::store(t_i + (j * L), V::add(V::load(t_i + (j * L)), V::add(V::mul(a_i, V::load(b + (j * L))), V::mul(m, V::set1(job.n[j])))));
+		}
+	}
+
+	/* Normalise the upper half into digits; the result is below 2n */
+	vec carry = V::zero();
+
+	for (size_t j = 0; j < s; j++)
+	{
+		vec x = V::add(V::load(t + ((s + j) * L)), carry);
+
+		V::store(t + (j * L), V::band(x, mask));
+		carry = V::shr_digit(x);
+	}
+
+	/* Compute t - n and keep t only in the lanes where that borrows */
+	vec borrow = V::zero();
+
+	for (size_t j = 0; j < s; j++)
+	{
+		vec x = V::sub(V::sub(V::load(t + (j * L)), V::set1(job.n[j])), borrow);
+
+		V::store(r + (j * L), V::band(x, mask));
+		borrow = V::shr63(x);
+	}
+
+	vec keep = V::sub(V::zero(), V::shr63(V::sub(carry, borrow)));
+
+	for (size_t j = 0; j < s; j++)
+	{
+		V::store(r + (j * L), V::bor(V::band(keep, V::load(t + (j * L))), V::bandnot(keep, V::load(r + (j * L)))));
+	}
+}
+
+/**
+ * Fixed-window exponentiation of all lanes; table entries are selected
+ * by scanning the whole table, so neither the running time nor the
+ * memory access pattern depends on the exponents
+ * @param job the batch
+ */
+template <class V> inline void pivacy_batch_powm(const pivacy_batch_job& job)
+{
+	typedef typename V::vec vec;
+
+	const size_t s = job.digits;
+	const size_t L = V::LANES;
+	const size_t entry = s * L;
+
+	uint64_t* table = job.workspace;
+	uint64_t* acc = table + (PIVACY_BATCH_TABLE * entry);
+	uint64_t* sel = acc + entry;
+	uint64_t* t = sel + entry;	/* 2 * entry */
+
+	/* table[k] = base^k in Montgomery form */
+	for (size_t j = 0; j < s; j++)
+	{
+		V::store(table + (j * L), V::set1(job.one[j]));
+		V::store(table + entry + (j * L), V::load(job.bases + (j * L)));
+	}
+
+	for (size_t k = 2; k < PIVACY_BATCH_TABLE; k++)
+	{
+		pivacy_batch_montmul<V>(job, table + (k * entry), table + ((k - 1) * entry), table + entry, t);
+	}
+
+	for (size_t j = 0; j < s; j++)
+	{
+		V::store(acc + (j * L), V::set1(job.one[j]));
+	}
+
+	for (size_t w = 0; w < job.num_windows; w++)
+	{
+		if (w > 0)
+		{
+			for (size_t q = 0; q < PIVACY_BATCH_WINDOW; q++)
+			{
+				pivacy_batch_montmul<V>(job, acc, acc, acc, t);
+			}
+		}
+
+		vec window = V::load(job.windows + (w * L));
+
+		for (size_t j = 0; j < s; j++)
+		{
+			V::store(sel + (j * L), V::zero());
+		}
+
+		for (size_t k = 0; k < PIVACY_BATCH_TABLE; k++)
+		{
+			vec match = V::eq(window, V::set1(k));
+
+			for (size_t j = 0; j < s; j++)
+			{
+				V::store(sel + (j * L), V::bor(V::load(sel + (j * L)), V::band(match, V::load(table + (k * entry) + (j * L)))));
+			}
+		}
+
+		pivacy_batch_montmul<V>(job, acc, acc, sel, t);
+	}
+
+	/* Leave Montgomery form by multiplying with 1 */
+	for (size_t j = 0; j < s; j++)
+	{
+		V::store(sel + (j * L), V::set1((j == 0) ? 1 : 0));
+	}
+
+	pivacy_batch_montmul<V>(job, job.results, acc, sel, t);
+}
+
+#endif // !_PIVACY_BATCH_KERNEL_H
@@ -0,0 +1,631 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*****************************************************************************
+ pivacy_cred_bin_store.cpp
+
+ Memory-mappable binary store that holds a set of pivacy credentials
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_cred_bin_store.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* FNV-1a 64-bit parameters */
+#define FNV_OFFSET_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME			0x100000001b3ULL
+
+/* Records and strings are padded to this alignment */
+#define STORE_ALIGNMENT		8
+
+/* Largest offset that fits in the index */
+#define MAX_STORE_SIZE		0xffffffffULL
+
+static unsigned long long get_le(const unsigned char* p, size_t len)
+{
+	unsigned long long val = 0;
+
+	for (size_t i = len; i > 0; i--)
+	{
+		val = (val << 8) | p[i - 1];
+	}
+
+	return val;
+}
+
+static void put_le(unsigned char* p, unsigned long long val, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		p[i] = (unsigned char) (val & 0xff);
+		val >>= 8;
+	}
+}
+
+static void append_le(std::vector<unsigned char>& buf, unsigned long long val, size_t len)
+{
+	buf.resize(buf.size() + len);
+
+	put_le(&buf[buf.size() - len], val, len);
+}
+
+static void pad(std::vector<unsigned char>& buf)
+{
+	buf.resize((buf.size() + STORE_ALIGNMENT - 1) & ~((size_t) STORE_ALIGNMENT - 1), 0);
+}
+
+static unsigned long long checksum(const unsigned char* data, size_t len)
+{
+	unsigned long long hash = FNV_OFFSET_BASIS;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static bool cred_id_less(pivacy_credential* a, pivacy_credential* b)
+{
+	return a->get_credential_id() < b->get_credential_id();
+}
+
+pivacy_cred_bin_store::pivacy_cred_bin_store()
+{
+	base = NULL;
+	length = 0;
+	index = NULL;
+	num_creds = 0;
+}
+
+pivacy_cred_bin_store::~pivacy_cred_bin_store()
+{
+	close();
+}
+
+bool pivacy_cred_bin_store::open(const std::string& file_name)
+{
+	close();
+
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat file_status;
+
+	if ((fstat(fd, &file_status) != 0) || !S_ISREG(file_status.st_mode) || (file_status.st_size < PIVACY_CRED_STORE_HEADER_SIZE))
+	{
+		::close(fd);
+
+		return false;
+	}
+
+	void* mapped = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	/* The mapping stays valid after the file is closed */
+	::close(fd);
+
+	if (mapped == MAP_FAILED)
+	{
+		return false;
+	}
+
+	base = (const unsigned char*) mapped;
+	length = file_status.st_size;
+
+	if (!check())
+	{
+		close();
+
+		return false;
+	}
+
+	return true;
+}
+
+void pivacy_cred_bin_store::close()
+{
+	if (base != NULL)
+	{
+		munmap((void*) base, length);
+	}
+
+	base = NULL;
+	length = 0;
+	index = NULL;
+	num_creds = 0;
+}
+
+size_t pivacy_cred_bin_store::size() const
+{
+	return num_creds;
+}
+
+unsigned short pivacy_cred_bin_store::get_credential_id(size_t index) const
+{
+	return (unsigned short) get_le(this->index + (index * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE), 2);
+}
+
+bool pivacy_cred_bin_store::find(unsigned short cred_id, size_t& index) const
+{
+	size_t low = 0;
+	size_t high = num_creds;
+
+	while (low < high)
+	{
+		size_t mid = low + ((high - low) / 2);
+		unsigned short mid_id = get_credential_id(mid);
+
+		if (mid_id == cred_id)
+		{
+			index = mid;
+
+			return true;
+		}
+		else if (mid_id < cred_id)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return false;
+}
+
+pivacy_credential* pivacy_cred_bin_store::read_credential(size_t index, bool header_only /* = false */) const
+{
+	if (index >= num_creds)
+	{
+		return NULL;
+	}
+
+	/* The record bounds were checked when the store was opened */
+	const unsigned char* record = base + get_le(this->index + (index * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE) + 4, 4);
+	const unsigned char* end = record + get_le(record, 4);
+
+	unsigned short cred_id = (unsigned short) get_le(record + 4, 2);
+	size_t num_attributes = get_le(record + 6, 2);
+	size_t num_strings = get_le(record + 8, 2);
+	size_t num_integers = get_le(record + 10, 2);
+
+	if ((num_strings != (3 + num_attributes)) || (num_integers != (4 + num_attributes)))
+	{
+		return NULL;
+	}
+
+	const unsigned char* p = record + PIVACY_CRED_STORE_RECORD_HEADER_SIZE;
+
+	std::string name;
+	std::string issuer;
+	std::string issuer_pubkey_file;
+	std::vector<std::string> attribute_names(num_attributes);
+
+	if (!read_string(p, end, name) ||
+	    !read_string(p, end, issuer) ||
+	    !read_string(p, end, issuer_pubkey_file))
+	{
+		return NULL;
+	}
+
+	for (size_t i = 0; i < num_attributes; i++)
+	{
+		if (!read_string(p, end, attribute_names[i]))
+		{
+			return NULL;
+		}
+	}
+
+	// Construct credential
+	pivacy_credential* pivacy_cred = new pivacy_credential(name, issuer, issuer_pubkey_file);
+
+	for (size_t i = 0; i < num_attributes; i++)
+	{
+		pivacy_cred->add_attribute_name(attribute_names[i]);
+	}
+
+	pivacy_cred->set_credential_id(cred_id);
+
+	if (header_only)
+	{
+		return pivacy_cred;
+	}
+
+	mpz_class secret;
+	mpz_class A;
+	mpz_class e;
+	mpz_class v;
+	std::vector<mpz_class> attribute_values(num_attributes);
+
+	if (!read_integer(p, end, secret) ||
+	    !read_integer(p, end, A) ||
+	    !read_integer(p, end, e) ||
+	    !read_integer(p, end, v))
+	{
+		delete pivacy_cred;
+
+		return NULL;
+	}
+
+	for (size_t i = 0; i < num_attributes; i++)
+	{
+		if (!read_integer(p, end, attribute_values[i]))
+		{
+			delete pivacy_cred;
+
+			return NULL;
+		}
+	}
+
+	std::vector<silvia_attribute*> attributes;
+
+	for (size_t i = 0; i < num_attributes; i++)
+	{
+		attributes.push_back(new silvia_integer_attribute(attribute_values[i]));
+	}
+
+	// Construct internal silvia credential
+	silvia_credential* silvia_cred = new silvia_credential(silvia_integer_attribute(secret), attributes, A, e, v);
+
+	pivacy_cred->set_silvia_credential(silvia_cred);
+
+	return pivacy_cred;
+}
+
+/*static*/ bool pivacy_cred_bin_store::is_bin_store(const std::string& file_name)
+{
+	FILE* f = fopen(file_name.c_str(), "r");
+
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	char magic[8];
+
+	bool rv = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) && (memcmp(magic, PIVACY_CRED_STORE_MAGIC, sizeof(magic)) == 0);
+
+	fclose(f);
+
+	return rv;
+}
+
+/*static*/ bool pivacy_cred_bin_store::write(const std::string& file_name, const std::vector<pivacy_credential*>& creds)
+{
+	// Sort the credentials by their ID
+	std::vector<pivacy_credential*> sorted(creds);
+
+	std::sort(sorted.begin(), sorted.end(), cred_id_less);
+
+	for (size_t i = 1; i < sorted.size(); i++)
+	{
+		if (sorted[i]->get_credential_id() == sorted[i - 1]->get_credential_id())
+		{
+			return false;
+		}
+	}
+
+	// Reserve space for the header and the index
+	std::vector<unsigned char> buf(PIVACY_CRED_STORE_HEADER_SIZE + (sorted.size() * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE), 0);
+
+	pad(buf);
+
+	// Append the records
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		pivacy_credential* cred = sorted[i];
+		silvia_credential* silvia_cred = cred->get_silvia_credential();
+
+		if (silvia_cred == NULL)
+		{
+			return false;
+		}
+
+		const std::vector<std::string>& attribute_names = cred->get_attribute_names();
+		std::vector<silvia_attribute*> attribute_values = silvia_cred->get_attributes();
+		size_t num_attributes = attribute_values.size();
+
+		if ((attribute_names.size() != num_attributes) || (num_attributes > (0xffff - 4)))
+		{
+			return false;
+		}
+
+		std::vector<unsigned char> record;
+
+		append_le(record, 0, 4);
+		append_le(record, cred->get_credential_id(), 2);
+		append_le(record, num_attributes, 2);
+		append_le(record, 3 + num_attributes, 2);
+		append_le(record, 4 + num_attributes, 2);
+		append_le(record, 0, 4);
+
+		if (!write_string(record, cred->get_name()) ||
+		    !write_string(record, cred->get_issuer()) ||
+		    !write_string(record, cred->get_issuer_public_key_file_name()))
+		{
+			return false;
+		}
+
+		for (size_t j = 0; j < num_attributes; j++)
+		{
+			if (!write_string(record, attribute_names[j]))
+			{
+				return false;
+			}
+		}
+
+		if (!write_integer(record, silvia_cred->get_secret().rep()) ||
+		    !write_integer(record, silvia_cred->get_A()) ||
+		    !write_integer(record, silvia_cred->get_e()) ||
+		    !write_integer(record, silvia_cred->get_v()))
+		{
+			return false;
+		}
+
+		for (size_t j = 0; j < num_attributes; j++)
+		{
+			if (!write_integer(record, attribute_values[j]->rep()))
+			{
+				return false;
+			}
+		}
+
+		put_le(&record[0], record.size(), 4);
+
+		if ((buf.size() + record.size()) > MAX_STORE_SIZE)
+		{
+			return false;
+		}
+
+		unsigned char* entry = &buf[PIVACY_CRED_STORE_HEADER_SIZE + (i * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE)];
+
+		put_le(entry, cred->get_credential_id(), 2);
+		put_le(entry + 2, 0, 2);
+		put_le(entry + 4, buf.size(), 4);
+
+		buf.insert(buf.end(), record.begin(), record.end());
+	}
+
+	// Fill in the header
+	unsigned char* header = &buf[0];
+
+	memcpy(header, PIVACY_CRED_STORE_MAGIC, 8);
+	put_le(header + 8, PIVACY_CRED_STORE_VERSION, 4);
+	put_le(header + 12, PIVACY_CRED_STORE_HEADER_SIZE, 4);
+	put_le(header + 16, sorted.size(), 4);
+	put_le(header + 20, PIVACY_CRED_STORE_HEADER_SIZE, 4);
+	put_le(header + 24, buf.size(), 8);
+	put_le(header + 32, checksum(&buf[PIVACY_CRED_STORE_HEADER_SIZE], buf.size() - PIVACY_CRED_STORE_HEADER_SIZE), 8);
+	put_le(header + 40, 0, 8);
+
+	// Write to a temporary file first so readers never see a partial store
+	std::string tmp_file_name = file_name + ".tmp";
+
+	FILE* store_file = fopen(tmp_file_name.c_str(), "w");
+
+	if (store_file == NULL)
+	{
+		return false;
+	}
+
+	bool rv = (fwrite(&buf[0], 1, buf.size(), store_file) == buf.size());
+
+	rv = (fclose(store_file) == 0) && rv;
+
+	if (rv)
+	{
+		rv = (rename(tmp_file_name.c_str(), file_name.c_str()) == 0);
+	}
+
+	if (!rv)
+	{
+		unlink(tmp_file_name.c_str());
+	}
+
+	return rv;
+}
+
+bool pivacy_cred_bin_store::check()
+{
+	if ((length < PIVACY_CRED_STORE_HEADER_SIZE) || (memcmp(base, PIVACY_CRED_STORE_MAGIC, 8) != 0))
+	{
+		return false;
+	}
+
+	size_t header_size = get_le(base + 12, 4);
+	size_t index_offset = get_le(base + 20, 4);
+
+	num_creds = get_le(base + 16, 4);
+
+	if ((get_le(base + 8, 4) != PIVACY_CRED_STORE_VERSION) ||
+	    (header_size != PIVACY_CRED_STORE_HEADER_SIZE) ||
+	    (get_le(base + 24, 8) != length))
+	{
+		return false;
+	}
+
+	// Check the index bounds
+	if ((index_offset < header_size) || (index_offset > length) ||
+	    (num_creds > ((length - index_offset) / PIVACY_CRED_STORE_INDEX_ENTRY_SIZE)))
+	{
+		return false;
+	}
+
+	if (checksum(base + header_size, length - header_size) != get_le(base + 32, 8))
+	{
+		return false;
+	}
+
+	index = base + index_offset;
+
+	size_t records_start = index_offset + (num_creds * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE);
+
+	// Check that the index is sorted and the records are within bounds
+	for (size_t i = 0; i < num_creds; i++)
+	{
+		const unsigned char* entry = index + (i * PIVACY_CRED_STORE_INDEX_ENTRY_SIZE);
+		unsigned short cred_id = (unsigned short) get_le(entry, 2);
+		size_t offset = get_le(entry + 4, 4);
+
+		if ((i > 0) && (cred_id <= get_credential_id(i - 1)))
+		{
+			return false;
+		}
+
+		if ((offset < records_start) || ((offset % STORE_ALIGNMENT) != 0) ||
+		    (offset > (length - PIVACY_CRED_STORE_RECORD_HEADER_SIZE)))
+		{
+			return false;
+		}
+
+		size_t record_size = get_le(base + offset, 4);
+
+		if ((record_size < PIVACY_CRED_STORE_RECORD_HEADER_SIZE) || ((record_size % STORE_ALIGNMENT) != 0) ||
+		    (record_size > (length - offset)) ||
+		    (get_le(base + offset + 4, 2) != cred_id))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*static*/ bool pivacy_cred_bin_store::read_string(const unsigned char*& p, const unsigned char* end, std::string& value)
+{
+	if ((end - p) < 2)
+	{
+		return false;
+	}
+
+	size_t len = get_le(p, 2);
+	size_t padded_len = (2 + len + STORE_ALIGNMENT - 1) & ~((size_t) STORE_ALIGNMENT - 1);
+
+	if ((size_t) (end - p) < padded_len)
+	{
+		return false;
+	}
+
+	value.assign((const char*) p + 2, len);
+
+	p += padded_len;
+
+	return true;
+}
+
+/*static*/ bool pivacy_cred_bin_store::read_integer(const unsigned char*& p, const unsigned char* end, mpz_class& value)
+{
+	if ((end - p) < 8)
+	{
+		return false;
+	}
+
+	size_t num_words = get_le(p, 4);
+
+	if ((((size_t) (end - p) - 8) / 8) < num_words)
+	{
+		return false;
+	}
+
+	p += 8;
+
+	if (num_words == 0)
+	{
+		value = 0;
+	}
+	else
+	{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) && (GMP_LIMB_BITS == 64) && (__GNU_MP_VERSION >= 6)
+		/* The words are the limbs */
+		mp_limb_t* limbs = mpz_limbs_write(value.get_mpz_t(), num_words);
+
+		memcpy(limbs, p, num_words * 8);
+
+		mpz_limbs_finish(value.get_mpz_t(), num_words);
+#else
+		mpz_import(value.get_mpz_t(), num_words, -1, 8, -1, 0, p);
+#endif
+	}
+
+	p += num_words * 8;
+
+	return true;
+}
+
+/*static*/ bool pivacy_cred_bin_store::write_string(std::vector<unsigned char>& record, const std::string& value)
+{
+	if (value.size() > 0xffff)
+	{
+		return false;
+	}
+
+	append_le(record, value.size(), 2);
+
+	record.insert(record.end(), value.begin(), value.end());
+
+	pad(record);
+
+	return true;
+}
+
+/*static*/ bool pivacy_cred_bin_store::write_integer(std::vector<unsigned char>& record, const mpz_class& value)
+{
+	if (sgn(value) < 0)
+	{
+		return false;
+	}
+
+	size_t num_words = (sgn(value) == 0) ? 0 : ((mpz_sizeinbase(value.get_mpz_t(), 2) + 63) / 64);
+
+	append_le(record, num_words, 4);
+	append_le(record, 0, 4);
+
+	if (num_words > 0)
+	{
+		size_t pos = record.size();
+		size_t written = 0;
+
+		record.resize(pos + (num_words * 8), 0);
+
+		mpz_export(&record[pos], &written, -1, 8, -1, 0, value.get_mpz_t());
+	}
+
+	return true;
+}
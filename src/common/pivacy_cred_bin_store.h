@@ -0,0 +1,207 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*****************************************************************************
+ pivacy_cred_bin_store.h
+
+ Memory-mappable binary store that holds a set of pivacy credentials
+ *****************************************************************************/
+
+#ifndef _PIVACY_CRED_BIN_STORE_H
+#define _PIVACY_CRED_BIN_STORE_H
+
+#include <gmpxx.h>
+#include "pivacy_credential.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Store file format; all integers are little-endian. The file starts with
+ * a fixed-size header:
+ *
+ *   magic "PIVACYCS" (8), version (4), header size (4), number of
+ *   credentials (4), index offset (4), file size (8), FNV-1a checksum of
+ *   everything after the header (8), reserved (8)
+ *
+ * The header is followed by the index, one entry per credential sorted
+ * by credential ID:
+ *
+ *   credential ID (2), reserved (2), record offset (4)
+ *
+ * Each record is 8-byte aligned and starts with a fixed-size header:
+ *
+ *   record size (4), credential ID (2), number of attributes (2), number
+ *   of strings (2), number of integers (2), reserved (4)
+ *
+ * followed by the strings (name, issuer, issuer public key file and the
+ * attribute names), each a 2-byte length and the characters, and the big
+ * integers (secret, A, e, v and the attribute values), each a 4-byte
+ * number of 64-bit words, 4 reserved bytes and the words, least
+ * significant first. Strings are padded to a multiple of 8 bytes, so the
+ * words of the big integers are 8-byte aligned and can be copied to the
+ * limbs of a GMP integer directly on little-endian 64-bit hosts
+ */
+#define PIVACY_CRED_STORE_MAGIC				"PIVACYCS"
+#define PIVACY_CRED_STORE_VERSION			1
+#define PIVACY_CRED_STORE_HEADER_SIZE		48
+#define PIVACY_CRED_STORE_INDEX_ENTRY_SIZE	8
+#define PIVACY_CRED_STORE_RECORD_HEADER_SIZE	16
+
+/**
+ * Read-only view of a binary credential store
+ */
+class pivacy_cred_bin_store
+{
+public:
+	/**
+	 * Constructor
+	 */
+	pivacy_cred_bin_store();
+
+	/**
+	 * Destructor; unmaps the store
+	 */
+	~pivacy_cred_bin_store();
+
+	/**
+	 * Map a store file into memory and check its integrity; may be
+	 * called from several threads at once on different objects
+	 * @param file_name the name of the store file
+	 * @return true if the file is a valid store
+	 */
+	bool open(const std::string& file_name);
+
+	/**
+	 * Unmap the store
+	 */
+	void close();
+
+	/**
+	 * Get the number of credentials in the store
+	 * @return the number of credentials
+	 */
+	size_t size() const;
+
+	/**
+	 * Get the ID of a credential
+	 * @param index the position of the credential in the index
+	 * @return the credential ID
+	 */
+	unsigned short get_credential_id(size_t index) const;
+
+	/**
+	 * Look up a credential by its ID
+	 * @param cred_id the credential ID
+	 * @param index receives the position of the credential in the index
+	 * @return true if the store holds a credential with this ID
+	 */
+	bool find(unsigned short cred_id, size_t& index) const;
+
+	/**
+	 * Read a credential from the store
+	 * @param index the position of the credential in the index
+	 * @param header_only only read the name, issuer, ID, public key file
+	 *        and attribute names; the credential has no silvia credential
+	 * @return a new pivacy credential object or NULL if the record is
+	 *         malformed
+	 */
+	pivacy_credential* read_credential(size_t index, bool header_only = false) const;
+
+	/**
+	 * Check if a file looks like a binary credential store
+	 * @param file_name the name of the file
+	 * @return true if the file starts with the store magic
+	 */
+	static bool is_bin_store(const std::string& file_name);
+
+	/**
+	 * Write a set of credentials to a store file; the file is replaced
+	 * atomically
+	 * @param file_name the name of the store file
+	 * @param creds the credentials; their IDs must be unique
+	 * @return true if the store was successfully written
+	 */
+	static bool write(const std::string& file_name, const std::vector<pivacy_credential*>& creds);
+
+private:
+	/* Not copyable */
+	pivacy_cred_bin_store(const pivacy_cred_bin_store&);
+	pivacy_cred_bin_store& operator=(const pivacy_cred_bin_store&);
+
+	/**
+	 * Check the header, checksum, index and record headers of the
+	 * mapped file
+	 * @return true if the store is consistent
+	 */
+	bool check();
+
+	/**
+	 * Read a string from a record
+	 * @param p the position in the record; moved past the string
+	 * @param end the end of the record
+	 * @param value receives the string
+	 * @return false if the string does not fit in the record
+	 */
+	static bool read_string(const unsigned char*& p, const unsigned char* end, std::string& value);
+
+	/**
+	 * Read a big integer from a record
+	 * @param p the position in the record; moved past the integer
+	 * @param end the end of the record
+	 * @param value receives the integer
+	 * @return false if the integer does not fit in the record
+	 */
+	static bool read_integer(const unsigned char*& p, const unsigned char* end, mpz_class& value);
+
+	/**
+	 * Append a string to a record
+	 * @param record the record
+	 * @param value the string
+	 * @return false if the string is too long
+	 */
+	static bool write_string(std::vector<unsigned char>& record, const std::string& value);
+
+	/**
+	 * Append a big integer to a record
+	 * @param record the record
+	 * @param value the (non-negative) integer
+	 * @return false if the integer is negative
+	 */
+	static bool write_integer(std::vector<unsigned char>& record, const mpz_class& value);
+
+	/* The mapped file */
+	const unsigned char* base;
+	size_t length;
+
+	/* The index */
+	const unsigned char* index;
+	size_t num_creds;
+};
+
+#endif // !_PIVACY_CRED_BIN_STORE_H
+
@@ -37,313 +37,579 @@
 #include <vector>
 #include <memory>
 #include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include "pivacy_cred_xml_rw.h"
 #include "silvia_bytestring.h"
 
 // Initialise the one-and-only instance
 /*static*/ std::auto_ptr<pivacy_credential_xml_rw> pivacy_credential_xml_rw::_i(NULL);
+/*static*/ pthread_once_t pivacy_credential_xml_rw::_i_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_credential_xml_rw::create_instance()
+{
+	_i = std::auto_ptr<pivacy_credential_xml_rw>(new pivacy_credential_xml_rw());
+}
 
 /*static*/ pivacy_credential_xml_rw* pivacy_credential_xml_rw::i()
 {
-	if (_i.get() == NULL)
-	{
-		_i = std::auto_ptr<pivacy_credential_xml_rw>(new pivacy_credential_xml_rw());
-	}
+	/* Credentials may be read from several threads at once */
+	pthread_once(&_i_once, create_instance);
 
 	return _i.get();
 }
 
-pivacy_credential* pivacy_credential_xml_rw::read_pivacy_credential(const std::string cred_file_name)
+pivacy_credential_xml_rw::pivacy_credential_xml_rw()
 {
-	////////////////////////////////////////////////////////////////////
-	// Read the credential XML file
-	////////////////////////////////////////////////////////////////////
-	xmlDocPtr xmldoc = xmlParseFile(cred_file_name.c_str());
+	/* libxml2 must be initialised before it is used by multiple threads */
+	xmlInitParser();
+}
+
+/* Elements of a credential file */
+enum credential_element
+{
+	ELEM_CREDENTIAL,
+	ELEM_NAME,
+	ELEM_ISSUER_ID,
+	ELEM_ID,
+	ELEM_SECRET,
+	ELEM_ATTRIBUTES,
+	ELEM_ATTRIBUTE,
+	ELEM_ATTRIBUTE_NAME,
+	ELEM_ATTRIBUTE_VALUE,
+	ELEM_SIGNATURE,
+	ELEM_SIGNATURE_A,
+	ELEM_SIGNATURE_E,
+	ELEM_SIGNATURE_V,
+	ELEM_ISSUER_PUBKEY_FILE
+};
+
+static const char* element_names[] =
+{
+	"Credential",
+	"Name",
+	"IssuerID",
+	"Id",
+	"Secret",
+	"Attributes",
+	"Attribute",
+	"Name",
+	"Value",
+	"Signature",
+	"A",
+	"e",
+	"v",
+	"IssuerPublicKeyFile"
+};
+
+/* The elements that may appear in each element */
+struct credential_element_rule
+{
+	credential_element parent;
+	credential_element element;
+	bool repeatable;
+};
+
+static const credential_element_rule element_rules[] =
+{
+	{ ELEM_CREDENTIAL,	ELEM_NAME,					false },
+	{ ELEM_CREDENTIAL,	ELEM_ISSUER_ID,				false },
+	{ ELEM_CREDENTIAL,	ELEM_ID,					false },
+	{ ELEM_CREDENTIAL,	ELEM_SECRET,				false },
+	{ ELEM_CREDENTIAL,	ELEM_ATTRIBUTES,			false },
+	{ ELEM_CREDENTIAL,	ELEM_SIGNATURE,				false },
+	{ ELEM_CREDENTIAL,	ELEM_ISSUER_PUBKEY_FILE,	false },
+	{ ELEM_ATTRIBUTES,	ELEM_ATTRIBUTE,				true },
+	{ ELEM_ATTRIBUTE,	ELEM_ATTRIBUTE_NAME,		false },
+	{ ELEM_ATTRIBUTE,	ELEM_ATTRIBUTE_VALUE,		false },
+	{ ELEM_SIGNATURE,	ELEM_SIGNATURE_A,			false },
+	{ ELEM_SIGNATURE,	ELEM_SIGNATURE_E,			false },
+	{ ELEM_SIGNATURE,	ELEM_SIGNATURE_V,			false }
+};
+
+#define NUM_ELEMENT_RULES	(sizeof(element_rules) / sizeof(element_rules[0]))
+
+/* Credential > Attributes > Attribute > Name is the deepest nesting */
+#define MAX_CREDENTIAL_DEPTH	4
+
+#define ELEM_BIT(elem)			(1U << (elem))
+
+/* State of the streaming credential parser */
+struct credential_parse_state
+{
+	xmlTextReaderPtr reader;
+	const std::string* file_name;
+	bool header_only;
+	std::string* error;
 	
-	// Check integrity
-	xmlNodePtr root_elem = xmlDocGetRootElement(xmldoc);
+	/* Set once the root element turned out to be a credential */
+	bool is_credential;
+	bool complete;
 	
-	if ((root_elem == NULL) || (xmlStrcasecmp(root_elem->name, (const xmlChar*) "Credential") != 0))
-	{
-		xmlFreeDoc(xmldoc);
-		
-		return NULL;
-	}
+	/* Open elements and the child elements seen in each of them */
+	credential_element stack[MAX_CREDENTIAL_DEPTH];
+	unsigned int seen[MAX_CREDENTIAL_DEPTH];
+	size_t depth;
+	
+	/* Text of the innermost element */
+	std::string text;
 	
-	// Parse the data
 	std::string name;
-	bool name_set = false;
 	std::string issuer;
-	bool issuer_set = false;
-	unsigned short id = 0;
-	bool id_set = false;
+	unsigned short id;
 	std::string issuer_pubkey_file;
-	silvia_integer_attribute secret(0);
+	mpz_class secret;
 	std::vector<std::string> attribute_names;
-	std::vector<silvia_attribute*> attribute_values;
-	mpz_class A(0);
-	mpz_class e(0);
-	mpz_class v(0);
+	std::vector<mpz_class> attribute_values;
+	mpz_class A;
+	mpz_class e;
+	mpz_class v;
+	
+	/* The attribute that is being read */
+	silvia_attr_t attribute_type;
+	std::string attribute_name;
+	std::string attribute_value;
+};
+
+static bool is_leaf(credential_element elem)
+{
+	return (elem != ELEM_CREDENTIAL) && (elem != ELEM_ATTRIBUTES) && (elem != ELEM_ATTRIBUTE) && (elem != ELEM_SIGNATURE);
+}
+
+static bool is_space(const char* str)
+{
+	while (*str != '\0')
+	{
+		if (!isspace((unsigned char) *str)) return false;
+		
+		str++;
+	}
+	
+	return true;
+}
+
+/* Record the first error with its location; errors are only reported for credential files */
+static bool parse_error(credential_parse_state& state, int line, const char* format, ...)
+{
+	if (state.is_credential && (state.error != NULL) && state.error->empty())
+	{
+		char msg[512];
+		va_list args;
+		
+		va_start(args, format);
+		vsnprintf(msg, sizeof(msg), format, args);
+		va_end(args);
+		
+		char location[32];
+		
+		snprintf(location, sizeof(location), ":%d: ", line);
+		
+		*state.error = *state.file_name + location + msg;
+	}
+	
+	return false;
+}
+
+static void reader_error(void* arg, const char* msg, xmlParserSeverities severity, xmlTextReaderLocatorPtr locator)
+{
+	credential_parse_state& state = *((credential_parse_state*) arg);
+	
+	if ((severity != XML_PARSER_SEVERITY_ERROR) && (severity != XML_PARSER_SEVERITY_VALIDITY_ERROR))
+	{
+		return;
+	}
+	
+	/* libxml2 messages end with a newline */
+	std::string trimmed(msg);
+	
+	while (!trimmed.empty() && isspace((unsigned char) trimmed[trimmed.size() - 1]))
+	{
+		trimmed.erase(trimmed.size() - 1);
+	}
 	
-	xmlNodePtr child_elem = root_elem->xmlChildrenNode;
+	parse_error(state, xmlTextReaderLocatorLineNumber(locator), "%s", trimmed.c_str());
+}
+
+/* The line of the current node; the parser itself may already be further ahead */
+static int current_line(xmlTextReaderPtr reader)
+{
+	xmlNodePtr node = xmlTextReaderCurrentNode(reader);
+	
+	if (node != NULL)
+	{
+		return (int) xmlGetLineNo(node);
+	}
+	
+	return xmlTextReaderGetParserLineNumber(reader);
+}
+
+/* Parse a non-negative decimal integer; surrounding white space is ignored */
+static bool parse_integer(const std::string& text, mpz_class& value)
+{
+	size_t start = 0;
+	size_t end = text.size();
+	
+	while ((start < end) && isspace((unsigned char) text[start])) start++;
+	while ((end > start) && isspace((unsigned char) text[end - 1])) end--;
+	
+	if (start == end)
+	{
+		return false;
+	}
+	
+	for (size_t i = start; i < end; i++)
+	{
+		if (!isdigit((unsigned char) text[i])) return false;
+	}
+	
+	return (mpz_set_str(value.get_mpz_t(), text.substr(start, end - start).c_str(), 10) == 0);
+}
+
+static bool end_element(credential_parse_state& state)
+{
+	int line = current_line(state.reader);
+	
+	state.depth--;
 	
-	while (child_elem != NULL)
+	credential_element elem = state.stack[state.depth];
+	unsigned int children = state.seen[state.depth];
+	
+	switch(elem)
 	{
-		if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "Name") == 0)
+	case ELEM_CREDENTIAL:
+		if (!(children & ELEM_BIT(ELEM_NAME)) || !(children & ELEM_BIT(ELEM_ISSUER_ID)) || !(children & ELEM_BIT(ELEM_ID)))
 		{
-			xmlChar* name_value = xmlNodeListGetString(xmldoc, child_elem->xmlChildrenNode, 1);
-			
-			if (name_value != NULL)
-			{
-				name = std::string((const char*) name_value);
-				
-				xmlFree(name_value);
-				
-				name_set = true;
-			}
+			return parse_error(state, line, "credential must have a <Name>, <IssuerID> and <Id>");
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "IssuerID") == 0)
+		
+		if (state.attribute_names.empty())
 		{
-			xmlChar* issuer_value = xmlNodeListGetString(xmldoc, child_elem->xmlChildrenNode, 1);
-			
-			if (issuer_value != NULL)
-			{
-				issuer = std::string((const char*) issuer_value);
-				
-				xmlFree(issuer_value);
-				
-				issuer_set = true;
-			}
+			return parse_error(state, line, "credential has no attributes");
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "Id") == 0)
+		
+		state.complete = true;
+		break;
+	case ELEM_NAME:
+		if (state.text.empty())
 		{
-			xmlChar* id_value = xmlNodeListGetString(xmldoc, child_elem->xmlChildrenNode, 1);
-			
-			if (id_value != NULL)
-			{
-				id = (unsigned short) atoi((const char*) id_value);
-				
-				xmlFree(id_value);
-				
-				id_set = true;
-			}
+			return parse_error(state, line, "empty credential name");
+		}
+		
+		state.name = state.text;
+		break;
+	case ELEM_ISSUER_ID:
+		if (state.text.empty())
+		{
+			return parse_error(state, line, "empty issuer ID");
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "Secret") == 0)
+		
+		state.issuer = state.text;
+		break;
+	case ELEM_ID:
 		{
-			xmlChar* secret_value = xmlNodeListGetString(xmldoc, child_elem->xmlChildrenNode, 1);
+			mpz_class id;
 			
-			if (secret_value != NULL)
+			if (!parse_integer(state.text, id) || (id > 0xffff))
 			{
-				secret = mpz_class((const char*) secret_value);
-				
-				xmlFree(secret_value);
+				return parse_error(state, line, "invalid credential ID \"%s\"", state.text.c_str());
 			}
+			
+			state.id = (unsigned short) id.get_ui();
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "Attributes") == 0)
+		break;
+	case ELEM_SECRET:
+		if (!state.header_only && !parse_integer(state.text, state.secret))
 		{
-			xmlNodePtr attribute = child_elem->xmlChildrenNode;
-			
-			while (attribute != NULL)
-			{
-				if (xmlStrcasecmp(attribute->name, (const xmlChar*) "Attribute") == 0)
-				{
-					// Get attribute type
-					silvia_attr_t silvia_attr_type = SILVIA_UNDEFINED_ATTR;
-					
-					xmlChar* attr_type = xmlGetProp(attribute, (const xmlChar*) "type");
-					
-					if (attr_type == NULL)
-					{
-						// Malformed specification!
-						xmlFreeDoc(xmldoc);
-						
-						return NULL;
-					}
-					
-					if (xmlStrcasecmp(attr_type, (const xmlChar*) "int") == 0)
-					{
-						silvia_attr_type = SILVIA_INT_ATTR;
-					}
-					else if (xmlStrcasecmp(attr_type, (const xmlChar*) "string") == 0)
-					{
-						silvia_attr_type = SILVIA_STRING_ATTR;
-					}
-					
-					xmlFree(attr_type);
-					
-					// Now read the value and the name
-					std::string name;
-					std::string value;
-					
-					xmlNodePtr attribute_data = attribute->xmlChildrenNode;
-					
-					while (attribute_data != NULL)
-					{
-						if (xmlStrcasecmp(attribute_data->name, (const xmlChar*) "Name") == 0)
-						{
-							xmlChar* attribute_name = xmlNodeListGetString(xmldoc, attribute_data->xmlChildrenNode, 1);
-							
-							if (attribute_name != NULL)
-							{
-								name = std::string((const char*) attribute_name);
-								
-								xmlFree(attribute_name);
-							}
-						}
-						else if (xmlStrcasecmp(attribute_data->name, (const xmlChar*) "Value") == 0)
-						{
-							xmlChar* attribute_value = xmlNodeListGetString(xmldoc, attribute_data->xmlChildrenNode, 1);
-							
-							if (attribute_value != NULL)
-							{
-								value = std::string((const char*) attribute_value);
-								
-								xmlFree(attribute_value);
-							}
-						}
-						
-						attribute_data = attribute_data->next;
-					}
-					
-					if (name.empty() || value.empty())
-					{
-						// Malformed specification
-						xmlFreeDoc(xmldoc);
-						
-						return NULL;
-					}
-					
-					attribute_names.push_back(name);
-					
-					switch(silvia_attr_type)
-					{
-					case SILVIA_INT_ATTR:
-						{
-							silvia_integer_attribute* new_attr = new silvia_integer_attribute(mpz_class(value.c_str()));
-							attribute_values.push_back(new_attr);
-						}
-						break;
-					case SILVIA_STRING_ATTR:
-						{
-							// FIXME: there is no check to see if the integer representation overflows the system parameter value l_m
-							bytestring int_val((const unsigned char*) value.c_str(), value.size());
-						
-							silvia_integer_attribute* new_attr = new silvia_integer_attribute(int_val.mpz_val());
-							attribute_values.push_back(new_attr);
-						}
-						break;
-					default:
-						// Malformed specification
-						xmlFreeDoc(xmldoc);
-						
-						return NULL;
-					}
-				}
-				
-				attribute = attribute->next;
-			}
+			return parse_error(state, line, "invalid secret");
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "Signature") == 0)
+		break;
+	case ELEM_ATTRIBUTE:
+		if (!(children & ELEM_BIT(ELEM_ATTRIBUTE_NAME)) || !(children & ELEM_BIT(ELEM_ATTRIBUTE_VALUE)))
 		{
-			bool A_set = false;
-			bool e_set = false;
-			bool v_set = false;
-			
-			xmlNodePtr sig_component = child_elem->xmlChildrenNode;
-			
-			while (sig_component != NULL)
+			return parse_error(state, line, "attribute must have a <Name> and a <Value>");
+		}
+		
+		state.attribute_names.push_back(state.attribute_name);
+		
+		if (!state.header_only)
+		{
+			if (state.attribute_type == SILVIA_INT_ATTR)
 			{
-				if (xmlStrcasecmp(sig_component->name, (const xmlChar*) "A") == 0)
-				{
-					xmlChar* A_val = xmlNodeListGetString(xmldoc, sig_component->xmlChildrenNode, 1);
-					
-					if (A_val != NULL)
-					{
-						A = mpz_class((const char*) A_val);
-						
-						A_set = true;
-						
-						xmlFree(A_val);
-					}
-				}
-				if (xmlStrcasecmp(sig_component->name, (const xmlChar*) "e") == 0)
-				{
-					xmlChar* e_val = xmlNodeListGetString(xmldoc, sig_component->xmlChildrenNode, 1);
-					
-					if (e_val != NULL)
-					{
-						e = mpz_class((const char*) e_val);
-						
-						e_set = true;
-						
-						xmlFree(e_val);
-					}
-				}
-				if (xmlStrcasecmp(sig_component->name, (const xmlChar*) "v") == 0)
+				state.attribute_values.push_back(mpz_class());
+				
+				if (!parse_integer(state.attribute_value, state.attribute_values.back()))
 				{
-					xmlChar* v_val = xmlNodeListGetString(xmldoc, sig_component->xmlChildrenNode, 1);
-					
-					if (v_val != NULL)
-					{
-						v = mpz_class((const char*) v_val);
-						
-						v_set = true;
-						
-						xmlFree(v_val);
-					}
+					return parse_error(state, line, "invalid value \"%s\" for integer attribute %s", state.attribute_value.c_str(), state.attribute_name.c_str());
 				}
-				
-				sig_component = sig_component->next;
 			}
-			
-			if (!A_set || !e_set || !v_set)
+			else
 			{
-				// Malformed specification
-				xmlFreeDoc(xmldoc);
+				// FIXME: there is no check to see if the integer representation overflows the system parameter value l_m
+				bytestring int_val((const unsigned char*) state.attribute_value.c_str(), state.attribute_value.size());
 				
-				return NULL;
+				state.attribute_values.push_back(int_val.mpz_val());
 			}
 		}
-		else if (xmlStrcasecmp(child_elem->name, (const xmlChar*) "IssuerPublicKeyFile") == 0)
+		break;
+	case ELEM_ATTRIBUTE_NAME:
+		if (state.text.empty())
 		{
-			xmlChar* issuer_pubkey_file_value = xmlNodeListGetString(xmldoc, child_elem->xmlChildrenNode, 1);
-			
-			if (issuer_pubkey_file_value != NULL)
+			return parse_error(state, line, "empty attribute name");
+		}
+		
+		state.attribute_name = state.text;
+		break;
+	case ELEM_ATTRIBUTE_VALUE:
+		if (state.text.empty())
+		{
+			return parse_error(state, line, "empty value for attribute");
+		}
+		
+		state.attribute_value = state.text;
+		break;
+	case ELEM_SIGNATURE:
+		if (!(children & ELEM_BIT(ELEM_SIGNATURE_A)) || !(children & ELEM_BIT(ELEM_SIGNATURE_E)) || !(children & ELEM_BIT(ELEM_SIGNATURE_V)))
+		{
+			return parse_error(state, line, "signature must have an <A>, <e> and <v>");
+		}
+		break;
+	case ELEM_SIGNATURE_A:
+		if (!state.header_only && !parse_integer(state.text, state.A))
+		{
+			return parse_error(state, line, "invalid signature value A");
+		}
+		break;
+	case ELEM_SIGNATURE_E:
+		if (!state.header_only && !parse_integer(state.text, state.e))
+		{
+			return parse_error(state, line, "invalid signature value e");
+		}
+		break;
+	case ELEM_SIGNATURE_V:
+		if (!state.header_only && !parse_integer(state.text, state.v))
+		{
+			return parse_error(state, line, "invalid signature value v");
+		}
+		break;
+	case ELEM_ATTRIBUTES:
+		break;
+	case ELEM_ISSUER_PUBKEY_FILE:
+		state.issuer_pubkey_file = state.text;
+		break;
+	}
+	
+	return true;
+}
+
+static bool start_element(credential_parse_state& state)
+{
+	int line = current_line(state.reader);
+	const char* name = (const char*) xmlTextReaderConstName(state.reader);
+	credential_element elem = ELEM_CREDENTIAL;
+	
+	if (state.depth == 0)
+	{
+		/* Stop at once if this is not a credential */
+		if (state.is_credential || (strcasecmp(name, element_names[ELEM_CREDENTIAL]) != 0))
+		{
+			return parse_error(state, line, "unexpected element <%s>", name);
+		}
+		
+		state.is_credential = true;
+	}
+	else
+	{
+		credential_element parent = state.stack[state.depth - 1];
+		const credential_element_rule* rule = NULL;
+		
+		for (size_t i = 0; i < NUM_ELEMENT_RULES; i++)
+		{
+			if ((element_rules[i].parent == parent) && (strcasecmp(name, element_names[element_rules[i].element]) == 0))
 			{
-				issuer_pubkey_file = std::string((const char*) issuer_pubkey_file_value);
+				rule = &element_rules[i];
 				
-				xmlFree(issuer_pubkey_file_value);
+				break;
 			}
 		}
 		
-		child_elem = child_elem->next;
+		if (rule == NULL)
+		{
+			return parse_error(state, line, "unexpected element <%s> in <%s>", name, element_names[parent]);
+		}
+		
+		elem = rule->element;
+		
+		if (!rule->repeatable && (state.seen[state.depth - 1] & ELEM_BIT(elem)))
+		{
+			return parse_error(state, line, "duplicate element <%s> in <%s>", name, element_names[parent]);
+		}
+		
+		state.seen[state.depth - 1] |= ELEM_BIT(elem);
 	}
 	
-	xmlFreeDoc(xmldoc);
+	if (elem == ELEM_ATTRIBUTE)
+	{
+		xmlChar* attr_type = xmlTextReaderGetAttribute(state.reader, (const xmlChar*) "type");
+		
+		if (attr_type == NULL)
+		{
+			return parse_error(state, line, "attribute has no type");
+		}
+		
+		if (xmlStrcasecmp(attr_type, (const xmlChar*) "int") == 0)
+		{
+			state.attribute_type = SILVIA_INT_ATTR;
+		}
+		else if (xmlStrcasecmp(attr_type, (const xmlChar*) "string") == 0)
+		{
+			state.attribute_type = SILVIA_STRING_ATTR;
+		}
+		else
+		{
+			parse_error(state, line, "unknown attribute type \"%s\"", (const char*) attr_type);
+			
+			xmlFree(attr_type);
+			
+			return false;
+		}
+		
+		xmlFree(attr_type);
+	}
+	
+	/* Leaf elements cannot have children, so this cannot overflow */
+	assert(state.depth < MAX_CREDENTIAL_DEPTH);
+	
+	state.stack[state.depth] = elem;
+	state.seen[state.depth] = 0;
+	state.depth++;
+	state.text.clear();
+	
+	if (xmlTextReaderIsEmptyElement(state.reader))
+	{
+		return end_element(state);
+	}
+	
+	return true;
+}
+
+static bool text_node(credential_parse_state& state)
+{
+	const char* value = (const char*) xmlTextReaderConstValue(state.reader);
+	
+	if ((state.depth > 0) && is_leaf(state.stack[state.depth - 1]))
+	{
+		if (value != NULL)
+		{
+			state.text.append(value);
+		}
+		
+		return true;
+	}
 	
-	if (!name_set || !issuer_set || !id_set || attribute_names.empty() || attribute_values.empty() || (attribute_names.size() != attribute_values.size()))
+	if ((value != NULL) && !is_space(value))
+	{
+		return parse_error(state, current_line(state.reader), "unexpected text in <%s>", (state.depth > 0) ? element_names[state.stack[state.depth - 1]] : "document");
+	}
+	
+	return true;
+}
+
+pivacy_credential* pivacy_credential_xml_rw::read_pivacy_credential(const std::string cred_file_name, bool header_only /* = false */, std::string* error /* = NULL */)
+{
+	////////////////////////////////////////////////////////////////////
+	// Read the credential XML file in a single pass
+	////////////////////////////////////////////////////////////////////
+	xmlTextReaderPtr reader = xmlReaderForFile(cred_file_name.c_str(), NULL, XML_PARSE_NONET);
+	
+	if (reader == NULL)
+	{
+		return NULL;
+	}
+	
+	credential_parse_state state;
+	
+	state.reader = reader;
+	state.file_name = &cred_file_name;
+	state.header_only = header_only;
+	state.error = error;
+	state.is_credential = false;
+	state.complete = false;
+	state.depth = 0;
+	state.id = 0;
+	state.attribute_type = SILVIA_UNDEFINED_ATTR;
+	state.text.reserve(1024);
+	state.attribute_names.reserve(8);
+	state.attribute_values.reserve(8);
+	
+	if (error != NULL)
+	{
+		error->clear();
+	}
+	
+	xmlTextReaderSetErrorHandler(reader, reader_error, &state);
+	
+	bool ok = true;
+	int rv = 0;
+	
+	while (ok && ((rv = xmlTextReaderRead(reader)) == 1))
+	{
+		switch(xmlTextReaderNodeType(reader))
+		{
+		case XML_READER_TYPE_ELEMENT:
+			ok = start_element(state);
+			break;
+		case XML_READER_TYPE_END_ELEMENT:
+			ok = end_element(state);
+			break;
+		case XML_READER_TYPE_TEXT:
+		case XML_READER_TYPE_CDATA:
+			ok = text_node(state);
+			break;
+		default:
+			break;
+		}
+	}
+	
+	xmlFreeTextReader(reader);
+	
+	/* Parse errors were reported through the error handler */
+	if (!ok || (rv != 0) || !state.complete)
 	{
 		return NULL;
 	}
 	
 	// Construct credential
-	pivacy_credential* pivacy_cred = new pivacy_credential(name, issuer, issuer_pubkey_file);
+	pivacy_credential* pivacy_cred = new pivacy_credential(state.name, state.issuer, state.issuer_pubkey_file);
 	
 	// Add attribute names
-	for (std::vector<std::string>::iterator i = attribute_names.begin(); i != attribute_names.end(); i++)
+	for (std::vector<std::string>::iterator i = state.attribute_names.begin(); i != state.attribute_names.end(); i++)
 	{
 		pivacy_cred->add_attribute_name(*i);
 	}
 	
 	// Set ID
-	pivacy_cred->set_credential_id(id);
+	pivacy_cred->set_credential_id(state.id);
 	
 	// Construct internal silvia credential
-	silvia_credential* silvia_cred = new silvia_credential(secret, attribute_values, A, e, v);
-	
-	pivacy_cred->set_silvia_credential(silvia_cred);
+	if (!header_only)
+	{
+		std::vector<silvia_attribute*> attribute_values;
+		
+		for (std::vector<mpz_class>::iterator i = state.attribute_values.begin(); i != state.attribute_values.end(); i++)
+		{
+			attribute_values.push_back(new silvia_integer_attribute(*i));
+		}
+		
+		silvia_credential* silvia_cred = new silvia_credential(silvia_integer_attribute(state.secret), attribute_values, state.A, state.e, state.v);
+		
+		pivacy_cred->set_silvia_credential(silvia_cred);
+	}
 	
 	return pivacy_cred;
 }
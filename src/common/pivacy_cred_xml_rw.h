@@ -37,6 +37,7 @@
 
 #include <gmpxx.h>
 #include "pivacy_credential.h"
+#include <pthread.h>
 #include <vector>
 #include <memory>
 
@@ -53,11 +54,17 @@ public:
 	static pivacy_credential_xml_rw* i();
 	
 	/**
-	 * Reads a pivacy credential
+	 * Reads a pivacy credential in a single streaming pass; the file is
+	 * validated strictly. May be called from several threads at once
 	 * @param cred_file_name the filename of the credential file
+	 * @param header_only only read the name, issuer, ID, public key file
+	 *        and attribute names; the credential has no silvia credential
+	 * @param error receives the file name, line number and cause of the
+	 *        first error if the file is a malformed credential; left
+	 *        empty if the file is not a credential at all
 	 * @return A new pivacy credential object
 	 */
-	pivacy_credential* read_pivacy_credential(const std::string cred_file_name);
+	pivacy_credential* read_pivacy_credential(const std::string cred_file_name, bool header_only = false, std::string* error = NULL);
 	
 	/**
 	 * Writes out a pivacy credential
@@ -68,8 +75,19 @@ public:
 	bool write_pivacy_credential(const std::string cred_file_name, pivacy_credential* cred);
 	
 private:
+	/**
+	 * Constructor; initialises libxml2 for use from multiple threads
+	 */
+	pivacy_credential_xml_rw();
+	
+	/**
+	 * Create the one-and-only instance
+	 */
+	static void create_instance();
+	
 	// The one-and-only instance
 	static std::auto_ptr<pivacy_credential_xml_rw> _i;
+	static pthread_once_t _i_once;
 };
 
 #endif // !_PIVACY_CRED_XML_RW_H
@@ -34,12 +34,14 @@
 
 #include "config.h"
 #include "pivacy_credential.h"
-#include "silvia_idemix_xmlreader.h"
+#include "pivacy_pubkey_registry.h"
 
 pivacy_credential::pivacy_credential(const std::string& name, const std::string& issuer, const std::string& issuer_pubkey_file)
 {
 	silvia_cred = NULL;
 	silvia_pubkey = NULL;
+	fixed_base = NULL;
+	pubkey_failed = false;
 	cred_id = 0;
 	this->name = name;
 	this->issuer = issuer;
@@ -55,7 +57,7 @@ pivacy_credential::~pivacy_credential()
 	
 	if (silvia_pubkey != NULL)
 	{
-		delete silvia_pubkey;
+		pivacy_pubkey_registry::i()->release(silvia_pubkey);
 	}
 }
 
@@ -111,19 +113,26 @@ const std::string pivacy_credential::get_issuer_public_key_file_name()
 
 silvia_pub_key* pivacy_credential::get_issuer_public_key(const std::string base_path /* = ""*/)
 {
-	if (silvia_pubkey != NULL)
+	if ((silvia_pubkey != NULL) || pubkey_failed)
 	{
 		return silvia_pubkey;
 	}
 	
-	silvia_pubkey = silvia_idemix_xmlreader::i()->read_idemix_pubkey(issuer_pubkey_file);
+	silvia_pubkey = pivacy_pubkey_registry::i()->acquire(issuer_pubkey_file, base_path);
 	
 	if (silvia_pubkey != NULL)
 	{
-		return silvia_pubkey;
+		fixed_base = pivacy_fixed_base_cache::i()->get_tables(silvia_pubkey);
+	}
+	else
+	{
+		pubkey_failed = true;
 	}
-	
-	silvia_pubkey = silvia_idemix_xmlreader::i()->read_idemix_pubkey(base_path + "/" + issuer_pubkey_file);
 	
 	return silvia_pubkey;
 }
+
+const pivacy_fixed_base* pivacy_credential::get_issuer_fixed_base()
+{
+	return fixed_base;
+}
@@ -37,6 +37,7 @@
 
 #include <gmpxx.h>
 #include "silvia_types.h"
+#include "pivacy_fixed_base.h"
 #include <vector>
 #include <string>
 
@@ -112,11 +113,22 @@ public:
 	const std::string get_issuer_public_key_file_name();
 	
 	/**
-	 * Get the issuer public key
+	 * Get the issuer public key; the key is shared with all other
+	 * credentials that use the same key file. A failure to load the key
+	 * is remembered, later calls do not try to load it again
+	 * @param base_path the directory to look in if the key file is not found
 	 * @return the issuer public key or NULL if the public key could not be loaded
 	 */
 	silvia_pub_key* get_issuer_public_key(const std::string base_path = "");
 	
+	/**
+	 * Get the fixed-base tables for the issuer public key; these are
+	 * built when the public key is loaded and shared by all credentials
+	 * from the same issuer
+	 * @return the fixed-base tables or NULL if the public key has not been loaded
+	 */
+	const pivacy_fixed_base* get_issuer_fixed_base();
+	
 private:
 	std::string name;
 	std::string issuer;
@@ -127,6 +139,9 @@ private:
 	silvia_credential* silvia_cred;
 	
 	silvia_pub_key* silvia_pubkey;
+	bool pubkey_failed;
+	
+	const pivacy_fixed_base* fixed_base;
 	
 	unsigned short cred_id;
 };
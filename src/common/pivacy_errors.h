@@ -42,6 +42,7 @@
 
 /* General errors */
 #define PRV_LOG_INIT_FAIL		0x81000003	/* Failed to initialise logging */
+#define PRV_FILE_ERROR			0x81000004	/* Failed to open or read a file */
 
 /* Configuration errors */
 #define PRV_NO_CONFIG			0x81001000	/* No configuration file was specified */
@@ -0,0 +1,326 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_fixed_base.cpp
+
+ Fixed-base precomputation tables for the bases of issuer public keys; a
+ table holds g^(2^(w*j)) for each base g so exponentiations need no
+ squarings at all
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_fixed_base.h"
+#include "pivacy_montgomery.h"
+#include "silvia_parameters.h"
+#include <assert.h>
+
+/* Definitions for when the indices are bound to references (e.g. by std::vector::push_back) */
+/*static*/ const size_t pivacy_fixed_base::BASE_S;
+/*static*/ const size_t pivacy_fixed_base::BASE_Z;
+/*static*/ const size_t pivacy_fixed_base::BASE_R0;
+
+pivacy_fixed_base::pivacy_fixed_base(const mpz_class& n, unsigned int w /* = PIVACY_FIXED_BASE_WINDOW */)
+{
+	assert((w > 0) && (w <= 16));
+
+	this->n = n;
+	this->w = w;
+
+	memory_usage = 0;
+
+	montgomery = pivacy_montgomery_supported(n);
+	limbs = mpz_size(n.get_mpz_t());
+}
+
+size_t pivacy_fixed_base::add_base(const mpz_class& g)
+{
+	powers.push_back(std::vector<mpz_class>(1));
+	mont_powers.push_back(std::vector<mp_limb_t>());
+
+	mpz_mod(powers.back()[0].get_mpz_t(), g.get_mpz_t(), n.get_mpz_t());
+
+	return powers.size() - 1;
+}
+
+bool pivacy_fixed_base::build_table(size_t index, size_t max_bits, size_t& budget)
+{
+	assert(index < powers.size());
+
+	size_t entries = (max_bits + w - 1) / w;
+
+	if (num_entries(index) > 1)
+	{
+		/* Tables are only built once */
+		return (entries <= num_entries(index));
+	}
+
+	size_t table_size = entries * limbs * sizeof(mp_limb_t);
+
+	if ((entries <= 1) || (table_size > budget))
+	{
+		return false;
+	}
+
+	/* Compute g^(2^(w*j)) */
+	std::vector<mpz_class> table(entries);
+
+	table[0] = powers[index][0];
+
+	for (size_t j = 1; j < entries; j++)
+	{
+		table[j] = table[j - 1];
+
+		for (unsigned int k = 0; k < w; k++)
+		{
+			mpz_mul(table[j].get_mpz_t(), table[j].get_mpz_t(), table[j].get_mpz_t());
+			mpz_tdiv_r(table[j].get_mpz_t(), table[j].get_mpz_t(), n.get_mpz_t());
+		}
+	}
+
+	if (montgomery)
+	{
+		/* Store the table in Montgomery form, zero padded to the size of the modulus */
+		mont_powers[index].resize(entries * limbs, 0);
+
+		for (size_t j = 0; j < entries; j++)
+		{
+			mpz_mul_2exp(table[j].get_mpz_t(), table[j].get_mpz_t(), limbs * GMP_NUMB_BITS);
+			mpz_mod(table[j].get_mpz_t(), table[j].get_mpz_t(), n.get_mpz_t());
+
+			mpz_export(&mont_powers[index][j * limbs], NULL, -1, sizeof(mp_limb_t), 0, 0, table[j].get_mpz_t());
+		}
+	}
+	else
+	{
+		powers[index].swap(table);
+	}
+
+	budget -= table_size;
+	memory_usage += table_size;
+
+	return true;
+}
+
+size_t pivacy_fixed_base::num_entries(size_t index) const
+{
+	return montgomery ? (mont_powers[index].size() / limbs) : powers[index].size();
+}
+
+const mpz_class& pivacy_fixed_base::get_modulus() const
+{
+	return n;
+}
+
+unsigned int pivacy_fixed_base::get_window() const
+{
+	return w;
+}
+
+size_t pivacy_fixed_base::num_bases() const
+{
+	return powers.size();
+}
+
+const mpz_class& pivacy_fixed_base::get_base(size_t index) const
+{
+	assert(index < powers.size());
+
+	return powers[index][0];
+}
+
+bool pivacy_fixed_base::covers(size_t index, size_t bits) const
+{
+	return (index < powers.size()) && (num_entries(index) > 1) && (bits <= (num_entries(index) * w));
+}
+
+const mpz_class& pivacy_fixed_base::get_power(size_t index, size_t j) const
+{
+	assert(!montgomery && (index < powers.size()) && (j < powers[index].size()));
+
+	return powers[index][j];
+}
+
+const mp_limb_t* pivacy_fixed_base::get_mont_power(size_t index, size_t j) const
+{
+	assert(montgomery && (index < mont_powers.size()) && (j < num_entries(index)));
+
+	return &mont_powers[index][j * limbs];
+}
+
+bool pivacy_fixed_base::is_montgomery() const
+{
+	return montgomery;
+}
+
+size_t pivacy_fixed_base::num_tables() const
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < powers.size(); i++)
+	{
+		if (num_entries(i) > 1) count++;
+	}
+
+	return count;
+}
+
+size_t pivacy_fixed_base::get_memory_usage() const
+{
+	return memory_usage;
+}
+
+/*static*/ std::auto_ptr<pivacy_fixed_base_cache> pivacy_fixed_base_cache::_i(NULL);
+/*static*/ pthread_once_t pivacy_fixed_base_cache::_i_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_fixed_base_cache::create_instance()
+{
+	_i = std::auto_ptr<pivacy_fixed_base_cache>(new pivacy_fixed_base_cache());
+}
+
+/*static*/ pivacy_fixed_base_cache* pivacy_fixed_base_cache::i()
+{
+	/* Credentials are loaded from several threads at once */
+	pthread_once(&_i_once, create_instance);
+
+	return _i.get();
+}
+
+pivacy_fixed_base_cache::pivacy_fixed_base_cache()
+{
+	budget = PIVACY_FIXED_BASE_DEFAULT_BUDGET;
+	used = 0;
+
+	pthread_mutex_init(&cache_mutex, NULL);
+}
+
+pivacy_fixed_base_cache::~pivacy_fixed_base_cache()
+{
+	for (std::map<silvia_pub_key*, pivacy_fixed_base*>::iterator i = tables.begin(); i != tables.end(); i++)
+	{
+		delete i->second;
+	}
+
+	pthread_mutex_destroy(&cache_mutex);
+}
+
+void pivacy_fixed_base_cache::set_memory_budget(size_t budget)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	this->budget = budget;
+
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+const pivacy_fixed_base* pivacy_fixed_base_cache::get_tables(silvia_pub_key* pubkey)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	std::map<silvia_pub_key*, pivacy_fixed_base*>::iterator found = tables.find(pubkey);
+
+	if (found != tables.end())
+	{
+		pthread_mutex_unlock(&cache_mutex);
+
+		return found->second;
+	}
+
+	pivacy_fixed_base* fb = new pivacy_fixed_base(pubkey->get_n());
+
+	/* Exponent sizes: S is raised to v'~ and r_A, the R_i to the attribute randomisers */
+	size_t S_bits = SYSPAR(l_v) + SYSPAR(l_statzk) + SYSPAR(l_H);
+	size_t r_A_bits = SYSPAR(l_n) + SYSPAR(l_statzk);
+	size_t R_bits = SYSPAR(l_m) + SYSPAR(l_statzk) + SYSPAR(l_H) + 1;
+	size_t Z_bits = SYSPAR(l_H);
+
+	if (r_A_bits > S_bits) S_bits = r_A_bits;
+
+	fb->add_base(pubkey->get_S());
+	fb->add_base(pubkey->get_Z());
+
+	for (size_t i = 0; i < pubkey->get_R().size(); i++)
+	{
+		fb->add_base(pubkey->get_R()[i]);
+	}
+
+	/*
+	 * Build the tables in order of their use in proofs so the most
+	 * useful ones exist if the budget runs out; R_0 is the base for the
+	 * master secret, which is always hidden, and Z is not used by the
+	 * prover at all. Bases without a table use the generic path
+	 */
+	size_t remaining = (used < budget) ? (budget - used) : 0;
+
+	fb->build_table(pivacy_fixed_base::BASE_S, S_bits, remaining);
+
+	for (size_t i = 0; i < pubkey->get_R().size(); i++)
+	{
+		fb->build_table(pivacy_fixed_base::BASE_R0 + i, R_bits, remaining);
+	}
+
+	fb->build_table(pivacy_fixed_base::BASE_Z, Z_bits, remaining);
+
+	used += fb->get_memory_usage();
+
+	tables[pubkey] = fb;
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	return fb;
+}
+
+void pivacy_fixed_base_cache::release_tables(silvia_pub_key* pubkey)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	std::map<silvia_pub_key*, pivacy_fixed_base*>::iterator found = tables.find(pubkey);
+
+	if (found != tables.end())
+	{
+		used -= found->second->get_memory_usage();
+
+		delete found->second;
+
+		tables.erase(found);
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+size_t pivacy_fixed_base_cache::get_memory_usage()
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	size_t rv = used;
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	return rv;
+}
+
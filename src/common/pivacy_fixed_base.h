@@ -0,0 +1,246 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_fixed_base.h
+
+ Fixed-base precomputation tables for the bases of issuer public keys; a
+ table holds g^(2^(w*j)) for each base g so exponentiations need no
+ squarings at all. For moduli with a Montgomery instantiation the tables
+ are kept in Montgomery form
+ *****************************************************************************/
+
+#ifndef _PIVACY_FIXED_BASE_H
+#define _PIVACY_FIXED_BASE_H
+
+#include <gmpxx.h>
+#include "silvia_types.h"
+#include <pthread.h>
+#include <vector>
+#include <map>
+#include <memory>
+
+/* Default window size for fixed-base tables */
+#define PIVACY_FIXED_BASE_WINDOW		6
+
+/* Default memory budget for all fixed-base tables together */
+#define PIVACY_FIXED_BASE_DEFAULT_BUDGET	(1024 * 1024)
+
+class pivacy_fixed_base
+{
+public:
+	/* Indices of the bases of an issuer public key */
+	static const size_t BASE_S = 0;
+	static const size_t BASE_Z = 1;
+	static const size_t BASE_R0 = 2;
+
+	/**
+	 * Constructor
+	 * @param n the modulus
+	 * @param w the window size in bits
+	 */
+	pivacy_fixed_base(const mpz_class& n, unsigned int w = PIVACY_FIXED_BASE_WINDOW);
+
+	/**
+	 * Add a base without a table
+	 * @param g the base
+	 * @return the index of the base
+	 */
+	size_t add_base(const mpz_class& g);
+
+	/**
+	 * Build the table for a base if it fits in the budget
+	 * @param index the index of the base
+	 * @param max_bits the largest exponent size the table should cover
+	 * @param budget the remaining memory budget in bytes; is decreased
+	 *               by the size of the table
+	 * @return true if the table covers exponents of max_bits bits
+	 */
+	bool build_table(size_t index, size_t max_bits, size_t& budget);
+
+	/**
+	 * Get the modulus
+	 * @return the modulus
+	 */
+	const mpz_class& get_modulus() const;
+
+	/**
+	 * Get the window size
+	 * @return the window size in bits
+	 */
+	unsigned int get_window() const;
+
+	/**
+	 * Get the number of bases
+	 * @return the number of bases
+	 */
+	size_t num_bases() const;
+
+	/**
+	 * Get a base
+	 * @param index the index of the base
+	 * @return the base
+	 */
+	const mpz_class& get_base(size_t index) const;
+
+	/**
+	 * Check if the table for a base covers an exponent
+	 * @param index the index of the base
+	 * @param bits the size of the exponent in bits
+	 * @return true if there is a table for the base that is large enough
+	 */
+	bool covers(size_t index, size_t bits) const;
+
+	/**
+	 * Check if the tables are kept in Montgomery form
+	 * @return true if the tables are in Montgomery form
+	 */
+	bool is_montgomery() const;
+
+	/**
+	 * Get a precomputed power of a base (tables not in Montgomery form)
+	 * @param index the index of the base
+	 * @param j the window number
+	 * @return g^(2^(w*j)) mod n
+	 */
+	const mpz_class& get_power(size_t index, size_t j) const;
+
+	/**
+	 * Get a precomputed power of a base (tables in Montgomery form)
+	 * @param index the index of the base
+	 * @param j the window number
+	 * @return g^(2^(w*j)) mod n in Montgomery form, as many limbs as the modulus
+	 */
+	const mp_limb_t* get_mont_power(size_t index, size_t j) const;
+
+	/**
+	 * Get the number of bases that have a table
+	 * @return the number of tables
+	 */
+	size_t num_tables() const;
+
+	/**
+	 * Get the amount of memory used by the tables
+	 * @return the memory usage in bytes
+	 */
+	size_t get_memory_usage() const;
+
+private:
+	/**
+	 * Get the number of table entries for a base
+	 * @param index the index of the base
+	 * @return the number of entries
+	 */
+	size_t num_entries(size_t index) const;
+
+	mpz_class n;
+	unsigned int w;
+	size_t memory_usage;
+	bool montgomery;
+	size_t limbs;
+
+	/* powers[i][0] is the base itself; a base without a table has only that */
+	std::vector<std::vector<mpz_class> > powers;
+
+	/* The tables in Montgomery form; limbs entries per power */
+	std::vector<std::vector<mp_limb_t> > mont_powers;
+};
+
+/**
+ * Process-wide cache of the fixed-base tables for each issuer public
+ * key; tables are shared by all credentials from the same issuer
+ */
+class pivacy_fixed_base_cache
+{
+public:
+	/**
+	 * Get the one-and-only instance of the cache
+	 * @return the one-and-only instance of the cache
+	 */
+	static pivacy_fixed_base_cache* i();
+
+	/**
+	 * Set the memory budget for all tables together; only affects
+	 * tables that are built afterwards
+	 * @param budget the memory budget in bytes
+	 */
+	void set_memory_budget(size_t budget);
+
+	/**
+	 * Get the tables for an issuer public key, building them if this
+	 * key has not been seen before. Tables belong to the key object, as
+	 * shared by the public key registry, and stay valid until they are
+	 * released
+	 * @param pubkey the issuer public key
+	 * @return the tables (owned by the cache)
+	 */
+	const pivacy_fixed_base* get_tables(silvia_pub_key* pubkey);
+
+	/**
+	 * Delete the tables for an issuer public key and return their memory
+	 * to the budget; the registry does this when it deletes the key
+	 * @param pubkey the issuer public key
+	 */
+	void release_tables(silvia_pub_key* pubkey);
+
+	/**
+	 * Get the amount of memory used by all tables
+	 * @return the memory usage in bytes
+	 */
+	size_t get_memory_usage();
+
+	/**
+	 * Destructor
+	 */
+	~pivacy_fixed_base_cache();
+
+private:
+	/**
+	 * Constructor
+	 */
+	pivacy_fixed_base_cache();
+
+	/**
+	 * Create the one-and-only instance
+	 */
+	static void create_instance();
+
+	// The one-and-only instance
+	static std::auto_ptr<pivacy_fixed_base_cache> _i;
+	static pthread_once_t _i_once;
+
+	/* Tables by public key; keys with the same modulus can have different bases */
+	std::map<silvia_pub_key*, pivacy_fixed_base*> tables;
+
+	size_t budget;
+	size_t used;
+	pthread_mutex_t cache_mutex;
+};
+
+#endif // !_PIVACY_FIXED_BASE_H
+
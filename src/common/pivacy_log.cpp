@@ -38,6 +38,7 @@
 #include <stdarg.h>
 #include <syslog.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /* The log level */
 static int log_level = PIVACY_LOGLEVEL;
@@ -51,6 +52,9 @@ static bool log_syslog = 1;
 /* Should we log to stdout? */
 static bool log_stdout = 0;
 
+/* Serialises access to the log buffers; log messages may come from several threads */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* Initialise logging */
 pivacy_rv pivacy_init_log(void)
 {
@@ -124,6 +128,8 @@ void pivacy_log(const int log_at_level, const char* file, const int line, const
 		return;
 	}
 
+	pthread_mutex_lock(&log_mutex);
+
 	/* Print the log message */
 	va_start(args, format);
 
@@ -176,5 +182,7 @@ void pivacy_log(const int log_at_level, const char* file, const int line, const
 	{
 		syslog(log_at_level, "%s", log_buf);
 	}
+
+	pthread_mutex_unlock(&log_mutex);
 }
 
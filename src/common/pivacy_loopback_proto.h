@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Pivacy
+ * Protocol between a loopback client (e.g. a load generator) and the
+ * card emulator; stands in for the edna daemon
+ */
+
+#ifndef _PIVACY_LOOPBACK_PROTO_H
+#define _PIVACY_LOOPBACK_PROTO_H
+
+/* Default UNIX domain socket name */
+#define PIVACY_LOOPBACK_SOCKET		"/tmp/pivacy_cardemu-loopback"
+
+/*
+ * Every message is preceded by a 16-bit big-endian length. Messages
+ * from the client start with a type byte; APDU messages continue with
+ * the C-APDU and are answered with a message containing just the R-APDU.
+ * Power events are not answered
+ */
+#define LOOPBACK_APDU				0x01
+#define LOOPBACK_POWER_UP			0x02
+#define LOOPBACK_POWER_DOWN			0x03
+
+/* Maximum message size */
+#define LOOPBACK_MAX_MSG			0xffff
+
+#endif /* !_PIVACY_LOOPBACK_PROTO_H */
+
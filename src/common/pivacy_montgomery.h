@@ -0,0 +1,306 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_montgomery.h
+
+ Fixed-width Montgomery arithmetic on GMP limbs; instantiated for the
+ modulus sizes used by IRMA (1024, 2048 and 4096 bits) so all operands
+ have a fixed size and live on the stack or in preallocated buffers
+ *****************************************************************************/
+
+#ifndef _PIVACY_MONTGOMERY_H
+#define _PIVACY_MONTGOMERY_H
+
+#include <gmpxx.h>
+#include <assert.h>
+#include <string.h>
+
+#if GMP_NAIL_BITS != 0
+#error "Montgomery arithmetic requires a GMP build without nail bits"
+#endif
+
+/* Number of limbs for a modulus of the specified size */
+#define PIVACY_MONT_LIMBS(bits)		((bits) / GMP_NUMB_BITS)
+
+/* Window size for (constant-time) fixed-window exponentiation */
+#define PIVACY_MONT_SEC_WINDOW		4
+
+/**
+ * Check if there is a Montgomery instantiation for a modulus
+ * @param n the modulus
+ * @return true if the modulus is odd and of a supported size
+ */
+inline bool pivacy_montgomery_supported(const mpz_class& n)
+{
+	size_t limbs = mpz_size(n.get_mpz_t());
+
+	if (mpz_even_p(n.get_mpz_t()))
+	{
+		return false;
+	}
+
+	return (limbs == PIVACY_MONT_LIMBS(1024)) ||
+	       (limbs == PIVACY_MONT_LIMBS(2048)) ||
+	       (limbs == PIVACY_MONT_LIMBS(4096));
+}
+
+/**
+ * Montgomery arithmetic modulo an odd N-limb modulus n with R = 2^(N * GMP_NUMB_BITS);
+ * values in Montgomery form are aR mod n stored as exactly N limbs
+ */
+template <size_t N> class pivacy_montgomery
+{
+public:
+	/**
+	 * Constructor
+	 * @param n the modulus; must be odd and exactly N limbs in size
+	 */
+	pivacy_montgomery(const mpz_class& n)
+	{
+		assert(mpz_size(n.get_mpz_t()) == N);
+		assert(mpz_odd_p(n.get_mpz_t()));
+
+		export_limbs(this->n, n);
+
+		/* -n^-1 mod 2^GMP_NUMB_BITS by Newton iteration; each step doubles the correct bits */
+		mp_limb_t inv = this->n[0];
+
+		for (int i = 0; i < 6; i++)
+		{
+			inv *= 2 - (this->n[0] * inv);
+		}
+
+		n0inv = -inv;
+
+		/* R mod n is the Montgomery form of 1 */
+		mpz_class R_mod_n;
+
+		mpz_setbit(R_mod_n.get_mpz_t(), N * GMP_NUMB_BITS);
+		mpz_mod(R_mod_n.get_mpz_t(), R_mod_n.get_mpz_t(), n.get_mpz_t());
+
+		export_limbs(one_mont, R_mod_n);
+
+		/* R^2 mod n is used to convert to Montgomery form */
+		mpz_class R2;
+
+		mpz_mul(R2.get_mpz_t(), R_mod_n.get_mpz_t(), R_mod_n.get_mpz_t());
+		mpz_mod(R2.get_mpz_t(), R2.get_mpz_t(), n.get_mpz_t());
+
+		export_limbs(R2_mod_n, R2);
+	}
+
+	/**
+	 * Store the N least significant limbs of a value (zero padded)
+	 * @param r receives the limbs
+	 * @param a the value; must be non-negative
+	 */
+	static void export_limbs(mp_limb_t* r, const mpz_class& a)
+	{
+		size_t size = mpz_size(a.get_mpz_t());
+
+		assert(size <= N);
+
+		if (size > 0)
+		{
+			memcpy(r, mpz_limbs_read(a.get_mpz_t()), size * sizeof(mp_limb_t));
+		}
+
+		if (size < N)
+		{
+			memset(r + size, 0, (N - size) * sizeof(mp_limb_t));
+		}
+	}
+
+	/**
+	 * Convert to Montgomery form
+	 * @param r receives aR mod n
+	 * @param a the value; must be less than n
+	 */
+	void to_mont(mp_limb_t* r, const mpz_class& a) const
+	{
+		mp_limb_t a_limbs[N];
+
+		export_limbs(a_limbs, a);
+
+		mul(r, a_limbs, R2_mod_n);
+	}
+
+	/**
+	 * Convert from Montgomery form
+	 * @param r receives a mod n
+	 * @param a the value in Montgomery form
+	 */
+	void from_mont(mpz_class& r, const mp_limb_t* a) const
+	{
+		mp_limb_t t[2 * N];
+
+		memcpy(t, a, N * sizeof(mp_limb_t));
+		memset(t + N, 0, N * sizeof(mp_limb_t));
+
+		mp_limb_t* r_limbs = mpz_limbs_write(r.get_mpz_t(), N);
+
+		redc(r_limbs, t);
+
+		mpz_limbs_finish(r.get_mpz_t(), N);
+	}
+
+	/**
+	 * Get the Montgomery form of 1
+	 * @param r receives R mod n
+	 */
+	void one(mp_limb_t* r) const
+	{
+		memcpy(r, one_mont, N * sizeof(mp_limb_t));
+	}
+
+	/**
+	 * Montgomery multiplication; r may alias a or b
+	 * @param r receives abR^-1 mod n
+	 */
+	void mul(mp_limb_t* r, const mp_limb_t* a, const mp_limb_t* b) const
+	{
+		mp_limb_t t[2 * N];
+
+		mpn_mul_n(t, a, b, N);
+
+		redc(r, t);
+	}
+
+	/**
+	 * Montgomery squaring; r may alias a
+	 * @param r receives a^2R^-1 mod n
+	 */
+	void sqr(mp_limb_t* r, const mp_limb_t* a) const
+	{
+		mp_limb_t t[2 * N];
+
+		mpn_sqr(t, a, N);
+
+		redc(r, t);
+	}
+
+	/**
+	 * Constant-time exponentiation with fixed windows; the running time
+	 * only depends on the specified exponent size and not on the value
+	 * of the exponent or the base
+	 * @param r receives the result in Montgomery form
+	 * @param b the base in Montgomery form
+	 * @param e the exponent; must be non-negative
+	 * @param bits the exponent size to process; must be at least the
+	 *             actual size of the exponent
+	 */
+	void powm_sec(mp_limb_t* r, const mp_limb_t* b, const mpz_class& e, size_t bits) const
+	{
+		const size_t w = PIVACY_MONT_SEC_WINDOW;
+
+		mp_limb_t table[((size_t) 1 << w) * N];
+		mp_limb_t factor[N];
+
+		one(&table[0]);
+		memcpy(&table[N], b, N * sizeof(mp_limb_t));
+
+		for (size_t j = 2; j < ((size_t) 1 << w); j++)
+		{
+			mul(&table[j * N], &table[(j - 1) * N], b);
+		}
+
+		one(r);
+
+		for (size_t pos = ((bits + w - 1) / w) * w; pos > 0; pos -= w)
+		{
+			for (size_t k = 0; k < w; k++)
+			{
+				sqr(r, r);
+			}
+
+			mpn_sec_tabselect(factor, table, N, (mp_size_t) 1 << w, digit(e, pos - w, w));
+
+			mul(r, r, factor);
+		}
+
+		memset(table, 0, sizeof(table));
+		memset(factor, 0, sizeof(factor));
+	}
+
+	/**
+	 * Extract w bits of an exponent
+	 * @param e the exponent
+	 * @param pos the position of the least significant bit
+	 * @param w the number of bits
+	 * @return the digit
+	 */
+	static mp_limb_t digit(const mpz_class& e, size_t pos, size_t w)
+	{
+		mp_limb_t d = 0;
+
+		for (size_t k = w; k > 0; k--)
+		{
+			d = (d << 1) | mpz_tstbit(e.get_mpz_t(), pos + k - 1);
+		}
+
+		return d;
+	}
+
+private:
+	/**
+	 * Montgomery reduction without data-dependent branches; t is destroyed
+	 * @param r receives tR^-1 mod n
+	 * @param t the value to reduce (2N limbs, less than nR)
+	 */
+	void redc(mp_limb_t* r, mp_limb_t* t) const
+	{
+		/*
+		 * Each step clears the lowest remaining limb of t; the carry out
+		 * of the step belongs at limb i + N and is kept in the cleared
+		 * limb until the end, where it no longer influences u
+		 */
+		for (size_t i = 0; i < N; i++)
+		{
+			mp_limb_t u = t[i] * n0inv;
+
+			t[i] = mpn_addmul_1(t + i, n, N, u);
+		}
+
+		mp_limb_t carry = mpn_add_n(r, t + N, t, N);
+
+		/* The result is less than 2n; subtract n if it is at least n */
+		mp_limb_t reduced[N];
+		mp_limb_t borrow = mpn_sub_n(reduced, r, n, N);
+
+		mpn_cnd_swap(carry | (borrow ^ 1), r, reduced, N);
+	}
+
+	mp_limb_t n[N];
+	mp_limb_t n0inv;
+	mp_limb_t one_mont[N];
+	mp_limb_t R2_mod_n[N];
+};
+
+#endif // !_PIVACY_MONTGOMERY_H
+
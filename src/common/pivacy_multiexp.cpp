@@ -0,0 +1,753 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_multiexp.cpp
+
+ Simultaneous multi-exponentiation (interleaved sliding windows over a
+ shared squaring chain); computes prod(b_i^e_i) mod n
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_multiexp.h"
+#include "pivacy_montgomery.h"
+#include <assert.h>
+#include <string.h>
+
+/*static*/ bool pivacy_multiexp::default_constant_time = false;
+
+/*static*/ void pivacy_multiexp::set_default_constant_time(bool constant_time)
+{
+	default_constant_time = constant_time;
+}
+
+/*static*/ bool pivacy_multiexp::get_default_constant_time()
+{
+	return default_constant_time;
+}
+
+pivacy_multiexp::pivacy_multiexp(const mpz_class& n, const pivacy_fixed_base* fixed_base /* = NULL */)
+{
+	assert((fixed_base == NULL) || (fixed_base->get_modulus() == n));
+
+	this->n = n;
+	this->fixed_base = fixed_base;
+
+	constant_time = default_constant_time;
+
+	squarings = 0;
+	multiplications = 0;
+}
+
+void pivacy_multiexp::set_constant_time(bool constant_time)
+{
+	assert(terms.empty() && fixed_terms.empty());
+
+	this->constant_time = constant_time;
+}
+
+pivacy_multiexp::~pivacy_multiexp()
+{
+	clear();
+}
+
+void pivacy_multiexp::add(const mpz_class& b, const mpz_class& e)
+{
+	assert(sgn(e) >= 0);
+
+	term t;
+
+	terms.push_back(t);
+
+	term& new_term = terms.back();
+
+	mpz_mod(new_term.b.get_mpz_t(), b.get_mpz_t(), n.get_mpz_t());
+	new_term.e = e;
+	new_term.bits = (sgn(e) == 0) ? 0 : mpz_sizeinbase(e.get_mpz_t(), 2);
+	new_term.w = window_size(new_term.bits);
+	new_term.index = 0;
+}
+
+void pivacy_multiexp::add_fixed(size_t index, const mpz_class& e)
+{
+	assert(fixed_base != NULL);
+	assert(sgn(e) >= 0);
+
+	size_t bits = (sgn(e) == 0) ? 0 : mpz_sizeinbase(e.get_mpz_t(), 2);
+
+	/* The bucket method for fixed bases is not constant-time */
+	if (constant_time || !fixed_base->covers(index, bits))
+	{
+		add(fixed_base->get_base(index), e);
+
+		return;
+	}
+
+	term t;
+
+	fixed_terms.push_back(t);
+
+	term& new_term = fixed_terms.back();
+
+	new_term.index = index;
+	new_term.e = e;
+	new_term.bits = bits;
+	new_term.w = fixed_base->get_window();
+}
+
+void pivacy_multiexp::clear()
+{
+	for (std::vector<term>::iterator i = terms.begin(); i != terms.end(); i++)
+	{
+		mpz_ptr e = i->e.get_mpz_t();
+
+		memset(e->_mp_d, 0, e->_mp_alloc * sizeof(mp_limb_t));
+	}
+
+	for (std::vector<term>::iterator i = fixed_terms.begin(); i != fixed_terms.end(); i++)
+	{
+		mpz_ptr e = i->e.get_mpz_t();
+
+		memset(e->_mp_d, 0, e->_mp_alloc * sizeof(mp_limb_t));
+	}
+
+	terms.clear();
+	fixed_terms.clear();
+}
+
+size_t pivacy_multiexp::get_squarings()
+{
+	return squarings;
+}
+
+size_t pivacy_multiexp::get_multiplications()
+{
+	return multiplications;
+}
+
+/*static*/ unsigned int pivacy_multiexp::window_size(size_t bits)
+{
+	/* Balances the table size (2^(w-1) entries) against the number of windows (~bits/(w+1)) */
+	if (bits <= 24)  return 2;
+	if (bits <= 80)  return 3;
+	if (bits <= 240) return 4;
+	if (bits <= 768) return 5;
+
+	return 6;
+}
+
+/*static*/ void pivacy_multiexp::split_windows(const term& t, std::vector<window>& windows)
+{
+	windows.clear();
+
+	size_t i = t.bits;
+
+	while (i > 0)
+	{
+		size_t top = i - 1;
+
+		if (mpz_tstbit(t.e.get_mpz_t(), top) == 0)
+		{
+			i--;
+
+			continue;
+		}
+
+		/* Take up to w bits and shrink the window so it ends in a 1 bit */
+		size_t bottom = (top + 1 >= t.w) ? (top + 1 - t.w) : 0;
+
+		while (mpz_tstbit(t.e.get_mpz_t(), bottom) == 0)
+		{
+			bottom++;
+		}
+
+		window win;
+
+		win.pos = bottom;
+		win.val = 0;
+
+		for (size_t j = top + 1; j > bottom; j--)
+		{
+			win.val = (win.val << 1) | mpz_tstbit(t.e.get_mpz_t(), j - 1);
+		}
+
+		windows.push_back(win);
+
+		i = bottom;
+	}
+}
+
+void pivacy_multiexp::mul_mod(mpz_class& r, const mpz_class& a, const mpz_class& b)
+{
+	mpz_mul(r.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+	mpz_tdiv_r(r.get_mpz_t(), r.get_mpz_t(), n.get_mpz_t());
+}
+
+void pivacy_multiexp::compute(mpz_class& result)
+{
+	/* Use fixed-width Montgomery arithmetic if there is an instantiation for the modulus size */
+	if (pivacy_montgomery_supported(n))
+	{
+		switch (mpz_size(n.get_mpz_t()))
+		{
+		case PIVACY_MONT_LIMBS(1024):
+			compute_montgomery<PIVACY_MONT_LIMBS(1024)>(result);
+			return;
+		case PIVACY_MONT_LIMBS(2048):
+			compute_montgomery<PIVACY_MONT_LIMBS(2048)>(result);
+			return;
+		case PIVACY_MONT_LIMBS(4096):
+			compute_montgomery<PIVACY_MONT_LIMBS(4096)>(result);
+			return;
+		default:
+			break;
+		}
+	}
+
+	compute_generic(result);
+}
+
+template <size_t N> void pivacy_multiexp::compute_montgomery(mpz_class& result)
+{
+	pivacy_montgomery<N> mont(n);
+
+	mp_limb_t acc[N];
+
+	if (constant_time)
+	{
+		compute_montgomery_sec(mont, acc);
+	}
+	else
+	{
+		bool acc_is_one = true;
+		size_t max_bits = 0;
+
+		std::vector<std::vector<window> > windows(terms.size());
+		std::vector<size_t> table_offset(terms.size(), 0);
+		std::vector<size_t> next_window(terms.size(), 0);
+
+		/* All window tables share one buffer */
+		size_t table_limbs = 0;
+
+		for (size_t k = 0; k < terms.size(); k++)
+		{
+			if (terms[k].bits == 0)
+			{
+				continue;
+			}
+
+			split_windows(terms[k], windows[k]);
+
+			if (terms[k].bits > max_bits)
+			{
+				max_bits = terms[k].bits;
+			}
+
+			table_offset[k] = table_limbs;
+			table_limbs += ((size_t) 1 << (terms[k].w - 1)) * N;
+		}
+
+		std::vector<mp_limb_t> tables(table_limbs);
+
+		/* Precompute the odd powers b, b^3, ..., b^(2^w - 1) of each base */
+		for (size_t k = 0; k < terms.size(); k++)
+		{
+			if (terms[k].bits == 0)
+			{
+				continue;
+			}
+
+			mp_limb_t* table = &tables[table_offset[k]];
+			size_t entries = (size_t) 1 << (terms[k].w - 1);
+
+			mont.to_mont(table, terms[k].b);
+
+			if (entries > 1)
+			{
+				mp_limb_t b_squared[N];
+
+				mont.sqr(b_squared, table);
+				multiplications++;
+
+				for (size_t j = 1; j < entries; j++)
+				{
+					mont.mul(&table[j * N], &table[(j - 1) * N], b_squared);
+					multiplications++;
+				}
+			}
+		}
+
+		/* Walk the shared squaring chain, multiplying in each window where it ends */
+		for (size_t pos = max_bits; pos > 0; pos--)
+		{
+			if (!acc_is_one)
+			{
+				mont.sqr(acc, acc);
+				squarings++;
+			}
+
+			for (size_t k = 0; k < terms.size(); k++)
+			{
+				if ((next_window[k] < windows[k].size()) && (windows[k][next_window[k]].pos == (pos - 1)))
+				{
+					const mp_limb_t* factor = &tables[table_offset[k] + (windows[k][next_window[k]].val >> 1) * N];
+
+					if (acc_is_one)
+					{
+						memcpy(acc, factor, N * sizeof(mp_limb_t));
+						acc_is_one = false;
+					}
+					else
+					{
+						mont.mul(acc, acc, factor);
+						multiplications++;
+					}
+
+					next_window[k]++;
+				}
+			}
+		}
+
+		/* The window decomposition reveals the exponents; wipe it */
+		for (size_t k = 0; k < windows.size(); k++)
+		{
+			if (!windows[k].empty())
+			{
+				memset(&windows[k][0], 0, windows[k].size() * sizeof(window));
+			}
+		}
+
+		/* Multiply in the fixed-base terms */
+		if (!fixed_terms.empty())
+		{
+			mp_limb_t fixed_result[N];
+
+			compute_montgomery_fixed(mont, fixed_result);
+
+			if (acc_is_one)
+			{
+				memcpy(acc, fixed_result, N * sizeof(mp_limb_t));
+				acc_is_one = false;
+			}
+			else
+			{
+				mont.mul(acc, acc, fixed_result);
+				multiplications++;
+			}
+		}
+
+		if (acc_is_one)
+		{
+			mont.one(acc);
+		}
+	}
+
+	mont.from_mont(result, acc);
+
+	memset(acc, 0, sizeof(acc));
+}
+
+template <size_t N> void pivacy_multiexp::compute_montgomery_fixed(const pivacy_montgomery<N>& mont, mp_limb_t* result)
+{
+	assert(fixed_base->is_montgomery());
+
+	/* See compute_fixed() */
+	unsigned int w = fixed_base->get_window();
+
+	std::vector<mp_limb_t> buckets(((size_t) 1 << w) * N);
+	std::vector<bool> bucket_used((size_t) 1 << w, false);
+
+	for (size_t k = 0; k < fixed_terms.size(); k++)
+	{
+		const term& t = fixed_terms[k];
+
+		for (size_t j = 0; (j * w) < t.bits; j++)
+		{
+			mp_limb_t d = pivacy_montgomery<N>::digit(t.e, j * w, w);
+
+			if (d == 0)
+			{
+				continue;
+			}
+
+			if (!bucket_used[d])
+			{
+				memcpy(&buckets[d * N], fixed_base->get_mont_power(t.index, j), N * sizeof(mp_limb_t));
+				bucket_used[d] = true;
+			}
+			else
+			{
+				mont.mul(&buckets[d * N], &buckets[d * N], fixed_base->get_mont_power(t.index, j));
+				multiplications++;
+			}
+		}
+	}
+
+	mp_limb_t running[N];
+	bool running_used = false;
+	bool result_used = false;
+
+	for (size_t d = bucket_used.size() - 1; d > 0; d--)
+	{
+		if (bucket_used[d])
+		{
+			if (!running_used)
+			{
+				memcpy(running, &buckets[d * N], N * sizeof(mp_limb_t));
+				running_used = true;
+			}
+			else
+			{
+				mont.mul(running, running, &buckets[d * N]);
+				multiplications++;
+			}
+		}
+
+		if (running_used)
+		{
+			if (!result_used)
+			{
+				memcpy(result, running, N * sizeof(mp_limb_t));
+				result_used = true;
+			}
+			else
+			{
+				mont.mul(result, result, running);
+				multiplications++;
+			}
+		}
+	}
+
+	/* The bucket occupation reveals the exponents; wipe it */
+	bucket_used.assign(bucket_used.size(), false);
+
+	if (!result_used)
+	{
+		mont.one(result);
+	}
+}
+
+template <size_t N> void pivacy_multiexp::compute_montgomery_sec(const pivacy_montgomery<N>& mont, mp_limb_t* result)
+{
+	/*
+	 * Interleaved fixed windows; every window of every term costs the
+	 * same number of operations and the table entries are selected by
+	 * scanning the whole table, so only the size of the largest
+	 * exponent affects the running time
+	 */
+	const size_t w = PIVACY_MONT_SEC_WINDOW;
+	const size_t entries = (size_t) 1 << w;
+
+	size_t max_bits = 0;
+
+	for (size_t k = 0; k < terms.size(); k++)
+	{
+		if (terms[k].bits > max_bits)
+		{
+			max_bits = terms[k].bits;
+		}
+	}
+
+	std::vector<mp_limb_t> tables(terms.size() * entries * N);
+
+	for (size_t k = 0; k < terms.size(); k++)
+	{
+		mp_limb_t* table = &tables[k * entries * N];
+
+		mont.one(table);
+		mont.to_mont(&table[N], terms[k].b);
+
+		for (size_t j = 2; j < entries; j++)
+		{
+			mont.mul(&table[j * N], &table[(j - 1) * N], &table[N]);
+			multiplications++;
+		}
+	}
+
+	mp_limb_t factor[N];
+
+	mont.one(result);
+
+	for (size_t pos = ((max_bits + w - 1) / w) * w; pos > 0; pos -= w)
+	{
+		for (size_t i = 0; i < w; i++)
+		{
+			mont.sqr(result, result);
+			squarings++;
+		}
+
+		for (size_t k = 0; k < terms.size(); k++)
+		{
+			mpn_sec_tabselect(factor, &tables[k * entries * N], N, entries, pivacy_montgomery<N>::digit(terms[k].e, pos - w, w));
+
+			mont.mul(result, result, factor);
+			multiplications++;
+		}
+	}
+
+	if (!tables.empty())
+	{
+		memset(&tables[0], 0, tables.size() * sizeof(mp_limb_t));
+	}
+
+	memset(factor, 0, sizeof(factor));
+}
+
+void pivacy_multiexp::compute_generic_sec(mpz_class& result)
+{
+	/* Without a Montgomery instantiation, fall back to GMP's side-channel silent exponentiation per term */
+	result = mpz_class(1) % n;
+
+	for (size_t k = 0; k < terms.size(); k++)
+	{
+		mpz_class r;
+
+		if (mpz_odd_p(n.get_mpz_t()))
+		{
+			mpz_powm_sec(r.get_mpz_t(), terms[k].b.get_mpz_t(), terms[k].e.get_mpz_t(), n.get_mpz_t());
+		}
+		else
+		{
+			mpz_powm(r.get_mpz_t(), terms[k].b.get_mpz_t(), terms[k].e.get_mpz_t(), n.get_mpz_t());
+		}
+
+		mul_mod(result, result, r);
+		multiplications++;
+	}
+}
+
+void pivacy_multiexp::compute_generic(mpz_class& result)
+{
+	if (constant_time)
+	{
+		compute_generic_sec(result);
+
+		return;
+	}
+
+	size_t max_bits = 0;
+
+	std::vector<std::vector<window> > windows(terms.size());
+	std::vector<std::vector<mpz_class> > tables(terms.size());
+	std::vector<size_t> next_window(terms.size(), 0);
+
+	/* Precompute the odd powers b, b^3, ..., b^(2^w - 1) of each base */
+	for (size_t k = 0; k < terms.size(); k++)
+	{
+		if (terms[k].bits == 0)
+		{
+			continue;
+		}
+
+		split_windows(terms[k], windows[k]);
+
+		if (terms[k].bits > max_bits)
+		{
+			max_bits = terms[k].bits;
+		}
+
+		std::vector<mpz_class>& table = tables[k];
+
+		table.resize((size_t) 1 << (terms[k].w - 1));
+		table[0] = terms[k].b;
+
+		if (table.size() > 1)
+		{
+			mpz_class b_squared;
+
+			mul_mod(b_squared, terms[k].b, terms[k].b);
+			multiplications++;
+
+			for (size_t j = 1; j < table.size(); j++)
+			{
+				mul_mod(table[j], table[j - 1], b_squared);
+				multiplications++;
+			}
+		}
+	}
+
+	/* Walk the shared squaring chain, multiplying in each window where it ends */
+	mpz_class acc = 1;
+	bool acc_is_one = true;
+
+	for (size_t pos = max_bits; pos > 0; pos--)
+	{
+		if (!acc_is_one)
+		{
+			mul_mod(acc, acc, acc);
+			squarings++;
+		}
+
+		for (size_t k = 0; k < terms.size(); k++)
+		{
+			if ((next_window[k] < windows[k].size()) && (windows[k][next_window[k]].pos == (pos - 1)))
+			{
+				const mpz_class& factor = tables[k][windows[k][next_window[k]].val >> 1];
+
+				if (acc_is_one)
+				{
+					acc = factor;
+					acc_is_one = false;
+				}
+				else
+				{
+					mul_mod(acc, acc, factor);
+					multiplications++;
+				}
+
+				next_window[k]++;
+			}
+		}
+	}
+
+	/* The window decomposition reveals the exponents; wipe it */
+	for (size_t k = 0; k < windows.size(); k++)
+	{
+		if (!windows[k].empty())
+		{
+			memset(&windows[k][0], 0, windows[k].size() * sizeof(window));
+		}
+	}
+
+	mpz_class fixed_result;
+
+	if (compute_fixed(fixed_result))
+	{
+		if (acc_is_one)
+		{
+			acc = fixed_result;
+			acc_is_one = false;
+		}
+		else
+		{
+			mul_mod(acc, acc, fixed_result);
+			multiplications++;
+		}
+	}
+
+	if (acc_is_one)
+	{
+		acc = mpz_class(1) % n;
+	}
+
+	result = acc;
+}
+
+bool pivacy_multiexp::compute_fixed(mpz_class& result)
+{
+	if (fixed_terms.empty())
+	{
+		return false;
+	}
+
+	/*
+	 * With e = sum(d_j * 2^(w*j)), g^e = prod_d (prod_{j: d_j = d} g^(2^(w*j)))^d;
+	 * the buckets for all terms are shared, and the final product over d
+	 * is computed with two running products
+	 */
+	unsigned int w = fixed_base->get_window();
+
+	std::vector<mpz_class> buckets((size_t) 1 << w);
+	std::vector<bool> bucket_used(buckets.size(), false);
+
+	for (size_t k = 0; k < fixed_terms.size(); k++)
+	{
+		const term& t = fixed_terms[k];
+		for (size_t j = 0; (j * w) < t.bits; j++)
+		{
+			unsigned int d = 0;
+
+			for (unsigned int bit = w; bit > 0; bit--)
+			{
+				d = (d << 1) | mpz_tstbit(t.e.get_mpz_t(), (j * w) + bit - 1);
+			}
+
+			if (d == 0)
+			{
+				continue;
+			}
+
+			if (!bucket_used[d])
+			{
+				buckets[d] = fixed_base->get_power(t.index, j);
+				bucket_used[d] = true;
+			}
+			else
+			{
+				mul_mod(buckets[d], buckets[d], fixed_base->get_power(t.index, j));
+				multiplications++;
+			}
+		}
+	}
+
+	mpz_class running;
+	bool running_used = false;
+	bool result_used = false;
+
+	for (size_t d = buckets.size() - 1; d > 0; d--)
+	{
+		if (bucket_used[d])
+		{
+			if (!running_used)
+			{
+				running = buckets[d];
+				running_used = true;
+			}
+			else
+			{
+				mul_mod(running, running, buckets[d]);
+				multiplications++;
+			}
+		}
+
+		if (running_used)
+		{
+			if (!result_used)
+			{
+				result = running;
+				result_used = true;
+			}
+			else
+			{
+				mul_mod(result, result, running);
+				multiplications++;
+			}
+		}
+	}
+
+	/* The bucket occupation reveals the exponents; wipe it */
+	bucket_used.assign(bucket_used.size(), false);
+
+	if (!result_used)
+	{
+		result = mpz_class(1) % n;
+	}
+
+	return true;
+}
+
@@ -0,0 +1,215 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_multiexp.h
+
+ Simultaneous multi-exponentiation (interleaved sliding windows over a
+ shared squaring chain); computes prod(b_i^e_i) mod n
+ *****************************************************************************/
+
+#ifndef _PIVACY_MULTIEXP_H
+#define _PIVACY_MULTIEXP_H
+
+#include <gmpxx.h>
+#include "pivacy_fixed_base.h"
+#include <vector>
+
+template <size_t N> class pivacy_montgomery;
+
+class pivacy_multiexp
+{
+public:
+	/**
+	 * Constructor
+	 * @param n the modulus
+	 * @param fixed_base fixed-base tables for the modulus (optional)
+	 */
+	pivacy_multiexp(const mpz_class& n, const pivacy_fixed_base* fixed_base = NULL);
+
+	/**
+	 * Destructor; wipes the exponents
+	 */
+	~pivacy_multiexp();
+
+	/**
+	 * Set whether new instances use constant-time arithmetic
+	 * @param constant_time true for constant-time arithmetic
+	 */
+	static void set_default_constant_time(bool constant_time);
+
+	/**
+	 * Check whether new instances use constant-time arithmetic
+	 * @return true for constant-time arithmetic
+	 */
+	static bool get_default_constant_time();
+
+	/**
+	 * Select constant-time arithmetic, in which the running time only
+	 * depends on the modulus size and the size of the largest exponent;
+	 * must be called before any terms are added
+	 * @param constant_time true for constant-time arithmetic
+	 */
+	void set_constant_time(bool constant_time);
+
+	/**
+	 * Add a term b^e to the product; the exponent must not be negative
+	 * @param b the base
+	 * @param e the exponent
+	 */
+	void add(const mpz_class& b, const mpz_class& e);
+
+	/**
+	 * Add a term g^e to the product for a base with a fixed-base table;
+	 * falls back to the generic path if the table does not cover the
+	 * exponent. Must only be used if fixed-base tables were specified
+	 * @param index the index of the base in the fixed-base tables
+	 * @param e the exponent
+	 */
+	void add_fixed(size_t index, const mpz_class& e);
+
+	/**
+	 * Compute the product of all terms that were added
+	 * @param result receives the product mod n
+	 */
+	void compute(mpz_class& result);
+
+	/**
+	 * Remove all terms and wipe the exponents
+	 */
+	void clear();
+
+	/**
+	 * Get the number of modular squarings performed so far
+	 * @return the number of squarings
+	 */
+	size_t get_squarings();
+
+	/**
+	 * Get the number of modular multiplications performed so far
+	 * (including the window table precomputation)
+	 * @return the number of multiplications
+	 */
+	size_t get_multiplications();
+
+private:
+	/* A window ending at bit position pos with odd value val */
+	struct window
+	{
+		size_t pos;
+		unsigned int val;
+	};
+
+	/* A term of the product */
+	struct term
+	{
+		mpz_class b;
+		mpz_class e;
+		size_t bits;
+		unsigned int w;
+		size_t index;
+	};
+
+	/**
+	 * Determine the window size for an exponent
+	 * @param bits the size of the exponent in bits
+	 * @return the window size
+	 */
+	static unsigned int window_size(size_t bits);
+
+	/**
+	 * Split an exponent into sliding windows, most significant first
+	 * @param t the term
+	 * @param windows receives the windows
+	 */
+	static void split_windows(const term& t, std::vector<window>& windows);
+
+	/**
+	 * Compute a * b mod n into r
+	 */
+	void mul_mod(mpz_class& r, const mpz_class& a, const mpz_class& b);
+
+	/**
+	 * Compute the product using mpz arithmetic
+	 * @param result receives the product mod n
+	 */
+	void compute_generic(mpz_class& result);
+
+	/**
+	 * Compute the product using constant-time mpz arithmetic
+	 * @param result receives the product mod n
+	 */
+	void compute_generic_sec(mpz_class& result);
+
+	/**
+	 * Compute the product using fixed-width Montgomery arithmetic
+	 * @param result receives the product mod n
+	 */
+	template <size_t N> void compute_montgomery(mpz_class& result);
+
+	/**
+	 * Compute the product of the fixed-base terms in Montgomery form
+	 * (see compute_fixed())
+	 * @param mont the Montgomery arithmetic for the modulus
+	 * @param result receives the product in Montgomery form
+	 */
+	template <size_t N> void compute_montgomery_fixed(const pivacy_montgomery<N>& mont, mp_limb_t* result);
+
+	/**
+	 * Compute the product in constant time in Montgomery form
+	 * @param mont the Montgomery arithmetic for the modulus
+	 * @param result receives the product in Montgomery form
+	 */
+	template <size_t N> void compute_montgomery_sec(const pivacy_montgomery<N>& mont, mp_limb_t* result);
+
+	/**
+	 * Compute the product of the fixed-base terms by accumulating the
+	 * precomputed powers in one bucket per window value
+	 * @param result receives the product mod n
+	 * @return false if there were no fixed-base terms
+	 */
+	bool compute_fixed(mpz_class& result);
+
+	mpz_class n;
+	std::vector<term> terms;
+
+	/* Terms for bases with a fixed-base table (b is unused) */
+	const pivacy_fixed_base* fixed_base;
+	std::vector<term> fixed_terms;
+
+	/* Use constant-time arithmetic? */
+	static bool default_constant_time;
+	bool constant_time;
+
+	/* Statistics */
+	size_t squarings;
+	size_t multiplications;
+};
+
+#endif // !_PIVACY_MULTIEXP_H
+
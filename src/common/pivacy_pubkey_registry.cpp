@@ -0,0 +1,313 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_pubkey_registry.cpp
+
+ Process-wide registry of issuer public keys; credentials from the same
+ issuer share a single parsed copy of the key
+ *****************************************************************************/
+
+#include "config.h"
+#include "pivacy_pubkey_registry.h"
+#include "pivacy_fixed_base.h"
+#include "silvia_idemix_xmlreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+/* FNV-1a 64-bit parameters */
+#define FNV_OFFSET_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME			0x100000001b3ULL
+
+/*static*/ std::auto_ptr<pivacy_pubkey_registry> pivacy_pubkey_registry::_i(NULL);
+/*static*/ pthread_once_t pivacy_pubkey_registry::_i_once = PTHREAD_ONCE_INIT;
+
+/*static*/ void pivacy_pubkey_registry::create_instance()
+{
+	_i = std::auto_ptr<pivacy_pubkey_registry>(new pivacy_pubkey_registry());
+}
+
+/*static*/ pivacy_pubkey_registry* pivacy_pubkey_registry::i()
+{
+	/* Keys may be loaded from several threads at once */
+	pthread_once(&_i_once, create_instance);
+
+	return _i.get();
+}
+
+pivacy_pubkey_registry::pivacy_pubkey_registry()
+{
+	pthread_mutex_init(&registry_mutex, NULL);
+	pthread_cond_init(&loaded_cond, NULL);
+
+	/* Make sure the key reader exists before keys are read concurrently */
+	silvia_idemix_xmlreader::i();
+}
+
+pivacy_pubkey_registry::~pivacy_pubkey_registry()
+{
+	for (std::map<key_id, entry>::iterator i = keys.begin(); i != keys.end(); i++)
+	{
+		delete i->second.pubkey;
+	}
+
+	pthread_cond_destroy(&loaded_cond);
+	pthread_mutex_destroy(&registry_mutex);
+}
+
+silvia_pub_key* pivacy_pubkey_registry::acquire(const std::string& file_name, const std::string& base_path /* = "" */)
+{
+	request_id id(file_name, base_path);
+
+	pthread_mutex_lock(&registry_mutex);
+
+	bool failed_before = (failures.find(id) != failures.end());
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	if (failed_before)
+	{
+		return NULL;
+	}
+
+	silvia_pub_key* pubkey = acquire_path(file_name);
+
+	if ((pubkey == NULL) && !base_path.empty())
+	{
+		pubkey = acquire_path(base_path + "/" + file_name);
+	}
+
+	if (pubkey == NULL)
+	{
+		pthread_mutex_lock(&registry_mutex);
+
+		failures.insert(id);
+
+		pthread_mutex_unlock(&registry_mutex);
+	}
+
+	return pubkey;
+}
+
+silvia_pub_key* pivacy_pubkey_registry::acquire_path(const std::string& path)
+{
+	char canonical[PATH_MAX];
+	unsigned long long hash;
+
+	if ((realpath(path.c_str(), canonical) == NULL) || !hash_file(canonical, hash))
+	{
+		return NULL;
+	}
+
+	key_id id(canonical, hash);
+
+	pthread_mutex_lock(&registry_mutex);
+
+	/* Wait if another thread is parsing the same key */
+	while (loading.find(id) != loading.end())
+	{
+		pthread_cond_wait(&loaded_cond, &registry_mutex);
+	}
+
+	std::map<key_id, entry>::iterator found = keys.find(id);
+
+	if (found != keys.end())
+	{
+		silvia_pub_key* pubkey = found->second.pubkey;
+
+		found->second.refcount++;
+
+		pthread_mutex_unlock(&registry_mutex);
+
+		return pubkey;
+	}
+
+	loading.insert(id);
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	silvia_pub_key* pubkey = silvia_idemix_xmlreader::i()->read_idemix_pubkey(canonical);
+
+	pthread_mutex_lock(&registry_mutex);
+
+	if (pubkey != NULL)
+	{
+		entry e;
+
+		e.pubkey = pubkey;
+		e.refcount = 1;
+		e.size = key_size(pubkey);
+
+		keys[id] = e;
+		key_ids[pubkey] = id;
+	}
+
+	loading.erase(id);
+
+	pthread_cond_broadcast(&loaded_cond);
+	pthread_mutex_unlock(&registry_mutex);
+
+	return pubkey;
+}
+
+void pivacy_pubkey_registry::release(silvia_pub_key* pubkey)
+{
+	pthread_mutex_lock(&registry_mutex);
+
+	std::map<silvia_pub_key*, key_id>::iterator found = key_ids.find(pubkey);
+
+	if (found != key_ids.end())
+	{
+		std::map<key_id, entry>::iterator key = keys.find(found->second);
+
+		if (--key->second.refcount == 0)
+		{
+			/* The tables for the key would otherwise use up the budget for good */
+			pivacy_fixed_base_cache::i()->release_tables(key->second.pubkey);
+
+			delete key->second.pubkey;
+
+			keys.erase(key);
+			key_ids.erase(found);
+		}
+	}
+
+	pthread_mutex_unlock(&registry_mutex);
+}
+
+void pivacy_pubkey_registry::forget_failures()
+{
+	pthread_mutex_lock(&registry_mutex);
+
+	failures.clear();
+
+	pthread_mutex_unlock(&registry_mutex);
+}
+
+size_t pivacy_pubkey_registry::num_keys()
+{
+	pthread_mutex_lock(&registry_mutex);
+
+	size_t rv = keys.size();
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	return rv;
+}
+
+size_t pivacy_pubkey_registry::num_references()
+{
+	size_t rv = 0;
+
+	pthread_mutex_lock(&registry_mutex);
+
+	for (std::map<key_id, entry>::iterator i = keys.begin(); i != keys.end(); i++)
+	{
+		rv += i->second.refcount;
+	}
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	return rv;
+}
+
+size_t pivacy_pubkey_registry::num_failures()
+{
+	pthread_mutex_lock(&registry_mutex);
+
+	size_t rv = failures.size();
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	return rv;
+}
+
+size_t pivacy_pubkey_registry::get_memory_saved()
+{
+	size_t rv = 0;
+
+	pthread_mutex_lock(&registry_mutex);
+
+	/* Without sharing, every reference would hold its own copy */
+	for (std::map<key_id, entry>::iterator i = keys.begin(); i != keys.end(); i++)
+	{
+		rv += (i->second.refcount - 1) * i->second.size;
+	}
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	return rv;
+}
+
+/*static*/ bool pivacy_pubkey_registry::hash_file(const std::string& path, unsigned long long& hash)
+{
+	FILE* f = fopen(path.c_str(), "r");
+
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	unsigned char buf[4096];
+	size_t read_len;
+
+	hash = FNV_OFFSET_BASIS;
+
+	while ((read_len = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		for (size_t i = 0; i < read_len; i++)
+		{
+			hash ^= buf[i];
+			hash *= FNV_PRIME;
+		}
+	}
+
+	bool rv = !ferror(f);
+
+	fclose(f);
+
+	return rv;
+}
+
+/*static*/ size_t pivacy_pubkey_registry::key_size(silvia_pub_key* pubkey)
+{
+	size_t size = sizeof(silvia_pub_key);
+
+	size += mpz_size(pubkey->get_n().get_mpz_t()) * sizeof(mp_limb_t);
+	size += mpz_size(pubkey->get_S().get_mpz_t()) * sizeof(mp_limb_t);
+	size += mpz_size(pubkey->get_Z().get_mpz_t()) * sizeof(mp_limb_t);
+
+	for (size_t i = 0; i < pubkey->get_R().size(); i++)
+	{
+		size += sizeof(mpz_class) + mpz_size(pubkey->get_R()[i].get_mpz_t()) * sizeof(mp_limb_t);
+	}
+
+	return size;
+}
+
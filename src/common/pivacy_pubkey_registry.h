@@ -0,0 +1,173 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2013 Roland van Rijswijk-Deij
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ pivacy_pubkey_registry.h
+
+ Process-wide registry of issuer public keys; credentials from the same
+ issuer share a single parsed copy of the key
+ *****************************************************************************/
+
+#ifndef _PIVACY_PUBKEY_REGISTRY_H
+#define _PIVACY_PUBKEY_REGISTRY_H
+
+#include "silvia_types.h"
+#include <pthread.h>
+#include <memory>
+#include <string>
+#include <map>
+#include <set>
+
+class pivacy_pubkey_registry
+{
+public:
+	/**
+	 * Get the one-and-only instance of the registry
+	 * @return the one-and-only instance of the registry
+	 */
+	static pivacy_pubkey_registry* i();
+
+	/**
+	 * Destructor
+	 */
+	~pivacy_pubkey_registry();
+
+	/**
+	 * Acquire a reference to an issuer public key, loading it if no
+	 * key with the same canonical path and content has been loaded yet.
+	 * The file name is tried as is first and then relative to the base
+	 * path; a key that failed to load before is not tried again
+	 * @param file_name the file name of the public key
+	 * @param base_path the directory to try if the file name is not found
+	 * @return the shared public key or NULL if it could not be loaded;
+	 *         the key must be returned using release()
+	 */
+	silvia_pub_key* acquire(const std::string& file_name, const std::string& base_path = "");
+
+	/**
+	 * Release a reference to an issuer public key; the key is deleted
+	 * once the last reference has been released
+	 * @param pubkey the public key
+	 */
+	void release(silvia_pub_key* pubkey);
+
+	/**
+	 * Forget all keys that failed to load so they will be tried again
+	 */
+	void forget_failures();
+
+	/**
+	 * Get the number of distinct public keys currently loaded
+	 * @return the number of public keys
+	 */
+	size_t num_keys();
+
+	/**
+	 * Get the number of outstanding references to public keys
+	 * @return the number of references
+	 */
+	size_t num_references();
+
+	/**
+	 * Get the number of keys that are known to fail to load
+	 * @return the number of failed keys
+	 */
+	size_t num_failures();
+
+	/**
+	 * Get the (approximate) amount of memory saved by sharing keys
+	 * instead of parsing a copy for every reference
+	 * @return the number of bytes saved
+	 */
+	size_t get_memory_saved();
+
+private:
+	/**
+	 * Constructor
+	 */
+	pivacy_pubkey_registry();
+
+	/**
+	 * Compute the FNV-1a hash of the contents of a file
+	 * @param path the path of the file
+	 * @param hash receives the hash
+	 * @return true if the file could be read
+	 */
+	static bool hash_file(const std::string& path, unsigned long long& hash);
+
+	/**
+	 * Determine the (approximate) amount of memory used by a public key
+	 * @param pubkey the public key
+	 * @return the size in bytes
+	 */
+	static size_t key_size(silvia_pub_key* pubkey);
+
+	/**
+	 * Try to acquire a key from a single path; the key is parsed without
+	 * holding the lock, so different keys can be loaded concurrently
+	 * @param path the path to the public key
+	 * @return the shared public key or NULL if it could not be loaded
+	 */
+	silvia_pub_key* acquire_path(const std::string& path);
+
+	/**
+	 * Create the one-and-only instance
+	 */
+	static void create_instance();
+
+	// The one-and-only instance
+	static std::auto_ptr<pivacy_pubkey_registry> _i;
+	static pthread_once_t _i_once;
+
+	/* A key is identified by its canonical path and the hash of its contents */
+	typedef std::pair<std::string, unsigned long long> key_id;
+
+	struct entry
+	{
+		silvia_pub_key* pubkey;
+		size_t refcount;
+		size_t size;
+	};
+
+	std::map<key_id, entry> keys;
+	std::map<silvia_pub_key*, key_id> key_ids;
+
+	/* Requests (file name, base path) that failed to load */
+	typedef std::pair<std::string, std::string> request_id;
+
+	std::set<request_id> failures;
+
+	/* Keys that are being parsed by another thread */
+	std::set<key_id> loading;
+
+	pthread_mutex_t registry_mutex;
+	pthread_cond_t loaded_cond;
+};
+
+#endif // !_PIVACY_PUBKEY_REGISTRY_H
+
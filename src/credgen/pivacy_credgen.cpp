@@ -38,8 +38,13 @@
 #include "silvia_issuer.h"
 #include "silvia_prover_credgen.h"
 #include "pivacy_cred_xml_rw.h"
+#include "pivacy_cred_bin_store.h"
+#include "pivacy_multiexp.h"
 #include <string>
+#include <set>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <time.h>
 #include <signal.h>
@@ -65,6 +70,145 @@ void set_parameters()
 	silvia_system_parameters::i()->set_hash_type("sha256");
 }
 
+bool verify_credential_file(const std::string& cred_file, silvia_pub_key* pubkey)
+{
+	pivacy_credential* pivacy_cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(cred_file);
+
+	if (pivacy_cred == NULL)
+	{
+		return false;
+	}
+
+	silvia_credential* cred = pivacy_cred->get_silvia_credential();
+	std::vector<silvia_attribute*> attributes = cred->get_attributes();
+
+	bool rv = (pubkey->get_R().size() >= (attributes.size() + 1));
+
+	if (rv)
+	{
+		// Check that Z = A^e * S^v * R_0^s * prod(R_i^m_i) mod n
+		pivacy_multiexp Z(pubkey->get_n());
+
+		Z.add(cred->get_A(), cred->get_e());
+		Z.add(pubkey->get_S(), cred->get_v());
+		Z.add(pubkey->get_R()[0], cred->get_secret().rep());
+
+		for (size_t i = 0; i < attributes.size(); i++)
+		{
+			Z.add(pubkey->get_R()[i + 1], attributes[i]->rep());
+		}
+
+		mpz_class Z_check;
+
+		Z.compute(Z_check);
+
+		rv = (Z_check == pubkey->get_Z());
+	}
+
+	for (std::vector<silvia_attribute*>::iterator i = attributes.begin(); i != attributes.end(); i++)
+	{
+		delete *i;
+	}
+
+	delete pivacy_cred;
+
+	return rv;
+}
+
+int compile_store(const std::string& cred_dir, const std::string& store_file)
+{
+	DIR* dir = opendir(cred_dir.c_str());
+
+	if (dir == NULL)
+	{
+		fprintf(stderr, "Failed to open credential directory %s\n", cred_dir.c_str());
+
+		return -1;
+	}
+
+	// Compile the credentials in the order of their file names
+	std::set<std::string> names;
+	struct dirent* entry = NULL;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		names.insert(std::string(entry->d_name));
+	}
+
+	closedir(dir);
+
+	std::vector<pivacy_credential*> creds;
+	std::set<unsigned short> cred_ids;
+	size_t skipped = 0;
+
+	for (std::set<std::string>::iterator i = names.begin(); i != names.end(); i++)
+	{
+		std::string full_path = cred_dir + "/" + *i;
+		struct stat entry_status;
+
+		if (lstat(full_path.c_str(), &entry_status) || !S_ISREG(entry_status.st_mode))
+		{
+			continue;
+		}
+
+		std::string error;
+		pivacy_credential* pivacy_cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(full_path, false, &error);
+
+		if (pivacy_cred == NULL)
+		{
+			if (!error.empty())
+			{
+				fprintf(stderr, "Skipping malformed credential %s\n", error.c_str());
+			}
+
+			skipped++;
+
+			continue;
+		}
+
+		if (!cred_ids.insert(pivacy_cred->get_credential_id()).second)
+		{
+			fprintf(stderr, "Skipping credential %s in %s, ID 0x%04X is already in use\n", pivacy_cred->get_name().c_str(), i->c_str(), pivacy_cred->get_credential_id());
+
+			delete pivacy_cred;
+
+			skipped++;
+
+			continue;
+		}
+
+		printf("Adding credential %s issued by %s (ID 0x%04X) from %s\n", pivacy_cred->get_name().c_str(), pivacy_cred->get_issuer().c_str(), pivacy_cred->get_credential_id(), i->c_str());
+
+		creds.push_back(pivacy_cred);
+	}
+
+	int rv = 0;
+
+	if (creds.empty())
+	{
+		fprintf(stderr, "No credentials found in %s\n", cred_dir.c_str());
+
+		rv = -1;
+	}
+	else if (!pivacy_cred_bin_store::write(store_file, creds))
+	{
+		fprintf(stderr, "Failed to write credential store to %s\n", store_file.c_str());
+
+		rv = -1;
+	}
+	else
+	{
+		printf("Successfully wrote %zu credential(s) to %s (%zu file(s) skipped)\n", creds.size(), store_file.c_str(), skipped);
+	}
+
+	for (std::vector<pivacy_credential*>::iterator i = creds.begin(); i != creds.end(); i++)
+	{
+		delete *i;
+	}
+
+	return rv;
+}
+
 void version(void)
 {
 	printf("Pivacy credential generator version %s\n", VERSION);
@@ -81,6 +225,7 @@ void usage(void)
 	printf("Usage:\n");
 	printf("\tpivacy_credgen -c <cred-spec> -o <cred-file> -p <issuer-pubkey> -s <issuer-privkey>");
 	printf("\n");
+	printf("\tpivacy_credgen -C <cred-dir> -o <store-file>\n");
 	printf("\tpivacy_credgen -h\n");
 	printf("\tpivacy_credgen -v\n");
 	printf("\n");
@@ -89,6 +234,9 @@ void usage(void)
 	printf("\t-p <issuer-pubkey>  Read issuer public key from <issuer-pubkey>\n");
 	printf("\t-s <issuer-privkey> Read issuer private key from <issuer-privkey>\n");
 	printf("\n");
+	printf("\t-C <cred-dir>       Compile the credentials in <cred-dir> into the binary\n");
+	printf("\t                    credential store <store-file>\n");
+	printf("\n");
 	printf("\t-h                  Print this help message\n");
 	printf("\n");
 	printf("\t-v                  Print the version number\n");
@@ -104,9 +252,10 @@ int main(int argc, char* argv[])
 	std::string cred_file;
 	std::string issuer_pubkey;
 	std::string issuer_privkey;
+	std::string compile_dir;
 	int c = 0;
 	
-	while ((c = getopt(argc, argv, "c:o:p:s:hv")) != -1)
+	while ((c = getopt(argc, argv, "c:o:p:s:C:hv")) != -1)
 	{
 		switch (c)
 		{
@@ -128,7 +277,22 @@ int main(int argc, char* argv[])
 		case 's':
 			issuer_privkey = std::string(optarg);
 			break;
+		case 'C':
+			compile_dir = std::string(optarg);
+			break;
+		}
+	}
+	
+	if (!compile_dir.empty())
+	{
+		if (cred_file.empty())
+		{
+			fprintf(stderr, "No credential store file specified on the command line!\n");
+			
+			return -1;
 		}
+		
+		return compile_store(compile_dir, cred_file);
 	}
 	
 	if (cred_spec.empty())
@@ -186,12 +350,18 @@ int main(int argc, char* argv[])
 	silvia_issuer issuer(issuer_public_key, issuer_private_key);
 	
 	// Read the credential specification
-	pivacy_credential* pivacy_cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(cred_spec);
+	std::string spec_error;
+	pivacy_credential* pivacy_cred = pivacy_credential_xml_rw::i()->read_pivacy_credential(cred_spec, false, &spec_error);
 	
 	if (pivacy_cred == NULL)
 	{
 		fprintf(stderr, "Failed to read credential specification from %s\n", cred_spec.c_str());
 		
+		if (!spec_error.empty())
+		{
+			fprintf(stderr, "%s\n", spec_error.c_str());
+		}
+		
 		delete issuer_public_key;
 		delete issuer_private_key;
 		
@@ -277,6 +447,18 @@ int main(int argc, char* argv[])
 	else
 	{
 		printf("Successfully wrote newly issued credential to %s\n", cred_file.c_str());
+		
+		// Check that the credential survived the round trip
+		printf("Verifying signature on stored credential... "); fflush(stdout);
+		
+		if (verify_credential_file(cred_file, issuer_public_key))
+		{
+			printf("OK\n");
+		}
+		else
+		{
+			printf("FAILED\n");
+		}
 	}
 	
 	// Clean up
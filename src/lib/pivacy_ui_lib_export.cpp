@@ -36,13 +36,49 @@
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
+#include <deque>
+#include <map>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/types.h>
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // !MSG_NOSIGNAL
+
+/* Maximum number of requests waiting for the UI */
+#define MAX_PENDING_REQUESTS		64
+
+/* Time to wait for queued requests to be sent when disconnecting */
+#define DISCONNECT_FLUSH_TIMEOUT	500 // ms
+
+/* Time to wait for the UI to answer the API version request */
+#define HANDSHAKE_TIMEOUT			1000 // ms
+
+/* Reconnect schedule; each delay is shortened by up to RECONNECT_JITTER percent */
+#define RECONNECT_INITIAL_DELAY		100 // ms
+#define RECONNECT_MAX_DELAY			5000 // ms
+#define RECONNECT_JITTER			20
+
+/* A request on its way to or from the UI */
+struct pivacy_ui_request
+{
+	pivacy_ui_ticket ticket;
+	unsigned char cmd;
+	std::vector<unsigned char> frame;	/* Length-prefixed command */
+	size_t sent;						/* Bytes of the frame sent so far */
+	bool want_result;					/* Keep the result until it is collected */
+	pivacy_ui_callback callback;
+	void* cb_data;
+};
+
 /* Library status */
 static bool 	pivacy_ui_lib_initialised	= false;
 
@@ -53,6 +89,43 @@ static bool		pivacy_ui_lib_must_cancel	= false;
 /* Connection socket */
 static int		pivacy_ui_socket			= -1;
 
+/* 
+ * Asynchronous request state; the queue holds requests in the order in
+ * which they are sent, the UI answers them in the same order
+ */
+static pthread_mutex_t							pivacy_ui_mutex		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t							pivacy_ui_cond		= PTHREAD_COND_INITIALIZER;
+static pthread_t								pivacy_ui_io_thread;
+static bool										pivacy_ui_io_running	= false;
+static int										pivacy_ui_wake_pipe[2]	= { -1, -1 };
+static int										pivacy_ui_done_pipe[2]	= { -1, -1 };
+static std::deque<pivacy_ui_request>			pivacy_ui_requests;
+static std::map<pivacy_ui_ticket, pivacy_ui_result>	pivacy_ui_results;		/* Completed, not yet collected */
+static std::map<pivacy_ui_ticket, bool>			pivacy_ui_outstanding;	/* Tickets of requests that will be collected */
+static pivacy_ui_ticket							pivacy_ui_next_ticket	= 1;
+static std::vector<unsigned char>				pivacy_ui_rx_buf;
+
+/* Serialises connecting and disconnecting */
+static pthread_mutex_t							pivacy_ui_connect_mutex	= PTHREAD_MUTEX_INITIALIZER;
+
+/* Connection state for cheap queries; only changed with the mutex held */
+static volatile int								pivacy_ui_connected_flag	= 0;
+
+/* Background reconnect state */
+static pthread_t								pivacy_ui_reconnect_thread;
+static bool										pivacy_ui_reconnect_running	= false;
+static bool										pivacy_ui_reconnect_stop	= false;
+static pivacy_ui_state_callback					pivacy_ui_state_cb			= NULL;
+static void*									pivacy_ui_state_cb_data		= NULL;
+
+static void pivacy_ui_close_pipe(int* p)
+{
+	if (p[0] >= 0) close(p[0]);
+	if (p[1] >= 0) close(p[1]);
+	
+	p[0] = p[1] = -1;
+}
+
 pivacy_rv pivacy_ui_lib_init(void)
 {
 	if (pivacy_ui_lib_initialised)
@@ -64,6 +137,19 @@ pivacy_rv pivacy_ui_lib_init(void)
 	pivacy_ui_lib_must_cancel = false;
 	pivacy_ui_socket = -1;
 	
+	/* Wakes up the I/O thread, and signals collectable results to the application */
+	if ((pipe(pivacy_ui_wake_pipe) != 0) || (pipe(pivacy_ui_done_pipe) != 0))
+	{
+		pivacy_ui_close_pipe(pivacy_ui_wake_pipe);
+		pivacy_ui_close_pipe(pivacy_ui_done_pipe);
+		
+		return PRV_GENERAL_ERROR;
+	}
+	
+	fcntl(pivacy_ui_wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(pivacy_ui_wake_pipe[1], F_SETFL, O_NONBLOCK);
+	fcntl(pivacy_ui_done_pipe[0], F_SETFL, O_NONBLOCK);
+	
 	pivacy_ui_lib_initialised = true;
 	
 	return PRV_OK;
@@ -76,23 +162,23 @@ pivacy_rv pivacy_ui_lib_uninit(void)
 		return PRV_NOT_INITIALISED;
 	}
 	
-	if (pivacy_ui_lib_connected)
-	{
-		pivacy_ui_disconnect();
-	}
+	/* Also stops reconnecting in the background */
+	pivacy_ui_disconnect();
+	
+	pivacy_ui_close_pipe(pivacy_ui_wake_pipe);
+	pivacy_ui_close_pipe(pivacy_ui_done_pipe);
+	
+	pivacy_ui_results.clear();
+	pivacy_ui_outstanding.clear();
 	
 	pivacy_ui_lib_initialised = false;
 	
 	return PRV_OK;
 }
 
-int pivacy_ui_send_to_daemon(const std::vector<unsigned char> tx)
+/* Send a command during the handshake */
+static int pivacy_ui_send_to_daemon(int fd, const std::vector<unsigned char>& tx)
 {
-	if (!pivacy_ui_lib_connected || (pivacy_ui_socket < 0))
-	{
-		return -1;
-	}
-	
 	if (tx.size() > 0xffff) return -1;
 	
 	/* 
@@ -109,220 +195,842 @@ int pivacy_ui_send_to_daemon(const std::vector<unsigned char> tx)
 	
 	memcpy(&tx_buf[2], &tx[0], tx.size());
 	
-	/* 
-	 * Transmit the command
-	 * 
-	 * FIXME: this will fail if the process receives a POSIX signal! 
-	 */
-	int tx_sent = 0;
-	 
-	if ((tx_sent = write(pivacy_ui_socket, &tx_buf[0], tx_buf.size())) != tx_buf.size())
+	/* Transmit the command */
+	if (send(fd, &tx_buf[0], tx_buf.size(), MSG_NOSIGNAL) != (ssize_t) tx_buf.size())
 	{
-		close(pivacy_ui_socket);
-		
-		pivacy_ui_lib_connected = false;
-		pivacy_ui_socket = -1;
-		
 		return -2;
 	}
 	
 	return 0;
 }
 
-int pivacy_ui_recv_from_daemon(std::vector<unsigned char>& rx)
+/* Receive an answer during the handshake */
+static int pivacy_ui_recv_from_daemon(int fd, std::vector<unsigned char>& rx)
 {
-	if (!pivacy_ui_lib_connected || (pivacy_ui_socket < 0))
+	unsigned char len[2];
+	
+	/* Read the length of the data to receive */
+	if (recv(fd, len, 2, MSG_WAITALL) != 2)
 	{
-		return -1;
+		return -2;
 	}
 	
-	unsigned short rx_size = 0;
+	rx.resize((len[0] << 8) + len[1]);
 	
-	size_t rx_index = 0;
+	/* Now receive the actual data */
+	if (!rx.empty() && (recv(fd, &rx[0], rx.size(), MSG_WAITALL) != (ssize_t) rx.size()))
+	{
+		return -2;
+	}
 	
-	unsigned char buf[512] = { 0 };
+	return 0;
+}
+
+/* Wake up the I/O thread */
+static void pivacy_ui_wake_io_thread(void)
+{
+	char c = 0;
 	
-	/*
-	 * Read the length of the data to receive
-	 * 
-	 * FIXME: this will fail if the process receives a signal!
-	 */
-	if ((read(pivacy_ui_socket, &buf[0], 1) != 1) ||
-	    (read(pivacy_ui_socket, &buf[1], 1) != 1))
+	/* If the pipe is full, the I/O thread is going to wake up anyway */
+	if (write(pivacy_ui_wake_pipe[1], &c, 1) != 1)
 	{
-		close(pivacy_ui_socket);
+		return;
+	}
+}
+
+/*
+ * Complete a request; must be called with the mutex held, which is
+ * released while the callback runs
+ */
+static void pivacy_ui_complete(pivacy_ui_request& req, const pivacy_ui_result& result)
+{
+	if (req.callback != NULL)
+	{
+		pthread_mutex_unlock(&pivacy_ui_mutex);
 		
-		pivacy_ui_lib_connected = false;
-		pivacy_ui_socket = -1;
+		req.callback(req.ticket, &result, req.cb_data);
 		
-		return -2;
+		pthread_mutex_lock(&pivacy_ui_mutex);
 	}
+	else if (req.want_result)
+	{
+		/* The completion descriptor is readable while there are results to collect */
+		if (pivacy_ui_results.empty())
+		{
+			char c = 0;
+			
+			if (write(pivacy_ui_done_pipe[1], &c, 1) != 1)
+			{
+				/* Cannot happen; the pipe holds at most one byte */
+			}
+		}
+		
+		pivacy_ui_results[req.ticket] = result;
+		
+		pthread_cond_broadcast(&pivacy_ui_cond);
+	}
+}
+
+/* Decode the answer of the UI to a request */
+static void pivacy_ui_decode_response(unsigned char cmd, const std::vector<unsigned char>& rsp, pivacy_ui_result& result)
+{
+	memset(&result, 0, sizeof(result));
+	
+	if ((rsp.size() < 1) || (rsp[0] != PIVACY_OK))
+	{
+		result.rv = PRV_PROTO_ERROR;
+	}
+	else if (cmd == REQUEST_PIN)
+	{
+		if ((rsp.size() - 1) > MAX_PIN_LEN)
+		{
+			result.rv = PRV_BUFFER_TOO_SMALL;
+		}
+		else
+		{
+			result.pin_len = rsp.size() - 1;
+			memcpy(result.pin, &rsp[1], rsp.size() - 1);
+			
+			result.rv = PRV_OK;
+		}
+	}
+	else if (cmd == REQUEST_CONSENT)
+	{
+		if (rsp.size() != 2)
+		{
+			result.rv = PRV_PROTO_ERROR;
+		}
+		else
+		{
+			result.consent_result = rsp[1];
+			
+			result.rv = PRV_OK;
+		}
+	}
+	else
+	{
+		result.rv = PRV_OK;
+	}
+}
+
+/*
+ * Fail all requests and drop the connection; must be called with the
+ * mutex held
+ */
+static void pivacy_ui_fail_all(void)
+{
+	pivacy_ui_result result;
+	
+	memset(&result, 0, sizeof(result));
+	result.rv = PRV_DISCONNECTED;
 	
-	rx_size = (buf[0] << 8) + buf[1];
+	while (!pivacy_ui_requests.empty())
+	{
+		pivacy_ui_request req = pivacy_ui_requests.front();
+		
+		pivacy_ui_requests.pop_front();
+		
+		pivacy_ui_complete(req, result);
+	}
 	
-	rx.resize(rx_size);
+	pivacy_ui_rx_buf.clear();
 	
-	/* 
-	 * Now receive the actual data 
-	 * 
-	 * FIXME: again, will not deal well with POSIX signals!
-	 */
-	while (rx_size > 0)
+	if (pivacy_ui_socket >= 0)
+	{
+		close(pivacy_ui_socket);
+	}
+	
+	pivacy_ui_socket = -1;
+	pivacy_ui_lib_connected = false;
+	pivacy_ui_connected_flag = 0;
+	
+	/* Also wakes up the reconnect thread */
+	pthread_cond_broadcast(&pivacy_ui_cond);
+}
+
+/*
+ * Send as much of the queued requests as the socket accepts; must be
+ * called with the mutex held
+ * @return false if the connection failed
+ */
+static bool pivacy_ui_flush(void)
+{
+	for (std::deque<pivacy_ui_request>::iterator i = pivacy_ui_requests.begin(); i != pivacy_ui_requests.end(); i++)
+	{
+		while (i->sent < i->frame.size())
+		{
+			ssize_t rv = send(pivacy_ui_socket, &i->frame[i->sent], i->frame.size() - i->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+			
+			if (rv < 0)
+			{
+				if (errno == EINTR) continue;
+				
+				return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+			}
+			
+			i->sent += rv;
+		}
+	}
+	
+	return true;
+}
+
+/*
+ * Read answers from the UI and complete the requests they belong to;
+ * must be called with the mutex held
+ * @return false if the connection failed
+ */
+static bool pivacy_ui_receive(void)
+{
+	unsigned char buf[512];
+	
+	while (true)
 	{
-		int received = read(pivacy_ui_socket, &buf[0], (rx_size < 512) ? rx_size : 512);
+		ssize_t received = recv(pivacy_ui_socket, buf, sizeof(buf), MSG_DONTWAIT);
 		
 		if (received < 0)
 		{
-			close(pivacy_ui_socket);
+			if (errno == EINTR) continue;
+			
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			
+			return false;
+		}
+		
+		if (received == 0)
+		{
+			return false;
+		}
+		
+		pivacy_ui_rx_buf.insert(pivacy_ui_rx_buf.end(), buf, buf + received);
+	}
+	
+	/* Process all complete answers */
+	size_t offset = 0;
+	
+	while ((pivacy_ui_rx_buf.size() - offset) >= 2)
+	{
+		size_t rsp_size = (pivacy_ui_rx_buf[offset] << 8) + pivacy_ui_rx_buf[offset + 1];
+		
+		if ((pivacy_ui_rx_buf.size() - offset - 2) < rsp_size)
+		{
+			break;
+		}
+		
+		/* An answer to a request that was not (completely) sent is a protocol violation */
+		if (pivacy_ui_requests.empty() || (pivacy_ui_requests.front().sent < pivacy_ui_requests.front().frame.size()))
+		{
+			return false;
+		}
+		
+		std::vector<unsigned char> rsp(pivacy_ui_rx_buf.begin() + offset + 2, pivacy_ui_rx_buf.begin() + offset + 2 + rsp_size);
+		
+		offset += 2 + rsp_size;
 		
-			pivacy_ui_lib_connected = false;
-			pivacy_ui_socket = -1;
+		pivacy_ui_request req = pivacy_ui_requests.front();
+		
+		pivacy_ui_requests.pop_front();
+		
+		pivacy_ui_result result;
+		
+		pivacy_ui_decode_response(req.cmd, rsp, result);
+		
+		pivacy_ui_complete(req, result);
+	}
+	
+	pivacy_ui_rx_buf.erase(pivacy_ui_rx_buf.begin(), pivacy_ui_rx_buf.begin() + offset);
+	
+	return true;
+}
+
+/* The I/O thread; sends requests and receives the answers of the UI */
+static void* pivacy_ui_io_thread_entry(void*)
+{
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	while (!pivacy_ui_lib_must_cancel && (pivacy_ui_socket >= 0))
+	{
+		struct pollfd fds[2];
+		
+		/* Make progress on everything that is queued before sleeping */
+		if (!pivacy_ui_flush())
+		{
+			pivacy_ui_fail_all();
 			
-			return -2;
+			break;
 		}
 		
-		memcpy(&rx[rx_index], buf, received);
+		bool want_write = false;
 		
-		rx_index += received;
-		rx_size -= received;
+		for (std::deque<pivacy_ui_request>::iterator i = pivacy_ui_requests.begin(); i != pivacy_ui_requests.end(); i++)
+		{
+			if (i->sent < i->frame.size())
+			{
+				want_write = true;
+				
+				break;
+			}
+		}
+		
+		fds[0].fd = pivacy_ui_socket;
+		fds[0].events = POLLIN | (want_write ? POLLOUT : 0);
+		fds[0].revents = 0;
+		fds[1].fd = pivacy_ui_wake_pipe[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		
+		pthread_mutex_unlock(&pivacy_ui_mutex);
+		
+		int rv = poll(fds, 2, -1);
+		
+		pthread_mutex_lock(&pivacy_ui_mutex);
+		
+		if (rv < 0)
+		{
+			if (errno == EINTR) continue;
+			
+			pivacy_ui_fail_all();
+			
+			break;
+		}
+		
+		if (fds[1].revents != 0)
+		{
+			char buf[64];
+			
+			while (read(pivacy_ui_wake_pipe[0], buf, sizeof(buf)) > 0);
+		}
+		
+		if ((fds[0].revents != 0) && !pivacy_ui_receive())
+		{
+			pivacy_ui_fail_all();
+			
+			break;
+		}
 	}
 	
-	return 0;
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	return NULL;
 }
 
-pivacy_rv pivacy_ui_connect(void)
+/*
+ * Queue a request for the UI
+ * @param cmd the command
+ * @param callback the completion callback (may be NULL)
+ * @param cb_data passed to the callback
+ * @param want_result true if the result is collected by the application
+ * @param ticket receives the ticket (may be NULL)
+ */
+static pivacy_rv pivacy_ui_submit(std::vector<unsigned char>& cmd, pivacy_ui_callback callback, void* cb_data, bool want_result, pivacy_ui_ticket* ticket)
 {
-	if (pivacy_ui_lib_connected)
+	if (!pivacy_ui_lib_initialised)
 	{
-		return PRV_ALREADY_CONNECTED;
+		return PRV_NOT_INITIALISED;
+	}
+	
+	if (cmd.size() > 0xffff)
+	{
+		return PRV_PARAM_INVALID;
+	}
+	
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	if (!pivacy_ui_lib_connected || (pivacy_ui_socket < 0))
+	{
+		pthread_mutex_unlock(&pivacy_ui_mutex);
+		
+		return PRV_NOT_CONNECTED;
+	}
+	
+	/* Replace a status update that is still waiting to be sent by the newer one */
+	if ((cmd[0] == SHOW_STATUS) && (callback == NULL) && !want_result && !pivacy_ui_requests.empty())
+	{
+		pivacy_ui_request& last = pivacy_ui_requests.back();
+		
+		if ((last.cmd == SHOW_STATUS) && (last.sent == 0) && (last.callback == NULL) && !last.want_result)
+		{
+			last.frame.resize(2);
+			last.frame.insert(last.frame.end(), cmd.begin(), cmd.end());
+			
+			pthread_mutex_unlock(&pivacy_ui_mutex);
+			
+			return PRV_OK;
+		}
+	}
+	
+	if (pivacy_ui_requests.size() >= MAX_PENDING_REQUESTS)
+	{
+		pthread_mutex_unlock(&pivacy_ui_mutex);
+		
+		return PRV_QUEUE_FULL;
+	}
+	
+	pivacy_ui_request req;
+	
+	req.ticket = pivacy_ui_next_ticket++;
+	req.cmd = cmd[0];
+	req.sent = 0;
+	req.want_result = want_result;
+	req.callback = callback;
+	req.cb_data = cb_data;
+	
+	req.frame.push_back(cmd.size() >> 8);
+	req.frame.push_back(cmd.size() & 0xff);
+	req.frame.insert(req.frame.end(), cmd.begin(), cmd.end());
+	
+	if (pivacy_ui_next_ticket == 0) pivacy_ui_next_ticket = 1;
+	
+	pivacy_ui_requests.push_back(req);
+	
+	if (want_result)
+	{
+		pivacy_ui_outstanding[req.ticket] = true;
 	}
 	
+	if (ticket != NULL)
+	{
+		*ticket = req.ticket;
+	}
+	
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	pivacy_ui_wake_io_thread();
+	
+	return PRV_OK;
+}
+
+/* Connect to the daemon and check the API version */
+static pivacy_rv pivacy_ui_open_connection(int& fd)
+{
 	/* Attempt to connect to the daemon */
 	struct sockaddr_un addr = { 0 };
 	
-	pivacy_ui_socket = socket(PF_UNIX, SOCK_STREAM, 0);
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
 	
-	if (pivacy_ui_socket < 0)
+	if (fd < 0)
 	{
-		pivacy_ui_socket = -1;
-		
 		return PRV_CONNECT_FAILED;
 	}
 	
 	addr.sun_family = AF_UNIX;
 	snprintf(addr.sun_path, UNIX_PATH_MAX, PIVACY_UI_SOCKET);
 	
-	if (connect(pivacy_ui_socket, (struct sockaddr*) &addr, sizeof(struct sockaddr_un)) != 0)
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(struct sockaddr_un)) != 0)
 	{
-		close(pivacy_ui_socket);
-		
-		pivacy_ui_socket = -1;
+		close(fd);
 		
 		return PRV_CONNECT_FAILED;
 	}
 	
-	pivacy_ui_lib_connected = true;
+	/* A UI that hangs must not block the caller forever */
+	struct timeval timeout = { HANDSHAKE_TIMEOUT / 1000, (HANDSHAKE_TIMEOUT % 1000) * 1000 };
+	
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 	
 	/* Request the API version from the daemon */
 	std::vector<unsigned char> get_api_version;
 	get_api_version.push_back(GET_API_VERSION);
 	
-	if (pivacy_ui_send_to_daemon(get_api_version) != 0)
+	std::vector<unsigned char> api_version_info;
+	
+	if ((pivacy_ui_send_to_daemon(fd, get_api_version) != 0) ||
+	    (pivacy_ui_recv_from_daemon(fd, api_version_info) != 0))
 	{
-		close(pivacy_ui_socket);
-		
-		pivacy_ui_socket = -1;
-		pivacy_ui_lib_connected = false;
+		close(fd);
 		
 		return PRV_DISCONNECTED;
 	}
 	
-	std::vector<unsigned char> api_version_info;
+	if ((api_version_info.size() != 1) || (api_version_info[0] != API_VERSION))
+	{
+		close(fd);
+		
+		return PRV_VERSION_MISMATCH;
+	}
 	
-	if (pivacy_ui_recv_from_daemon(api_version_info) != 0)
+	return PRV_OK;
+}
+
+pivacy_rv pivacy_ui_connect(void)
+{
+	if (!pivacy_ui_lib_initialised)
 	{
-		close(pivacy_ui_socket);
+		return PRV_NOT_INITIALISED;
+	}
+	
+	pthread_mutex_lock(&pivacy_ui_connect_mutex);
+	
+	if (pivacy_ui_connected_flag)
+	{
+		pthread_mutex_unlock(&pivacy_ui_connect_mutex);
 		
-		pivacy_ui_socket = -1;
-		pivacy_ui_lib_connected = false;
+		return PRV_ALREADY_CONNECTED;
+	}
+	
+	/* The I/O thread exits by itself when the connection is lost */
+	if (pivacy_ui_io_running)
+	{
+		pthread_join(pivacy_ui_io_thread, NULL);
 		
-		return PRV_DISCONNECTED;
+		pivacy_ui_io_running = false;
 	}
 	
-	if ((api_version_info.size() != 1) || (api_version_info[0] != API_VERSION))
+	int fd = -1;
+	pivacy_rv rv = pivacy_ui_open_connection(fd);
+	
+	if (rv != PRV_OK)
 	{
-		close(pivacy_ui_socket);
+		pthread_mutex_unlock(&pivacy_ui_connect_mutex);
 		
-		pivacy_ui_socket = -1;
-		pivacy_ui_lib_connected = false;
+		return rv;
+	}
+	
+	/* From here on, all traffic goes through the I/O thread */
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	pivacy_ui_socket = fd;
+	pivacy_ui_lib_connected = true;
+	pivacy_ui_lib_must_cancel = false;
+	pivacy_ui_rx_buf.clear();
+	
+	if (pthread_create(&pivacy_ui_io_thread, NULL, pivacy_ui_io_thread_entry, NULL) != 0)
+	{
+		pivacy_ui_fail_all();
 		
-		return PRV_VERSION_MISMATCH;
+		rv = PRV_GENERAL_ERROR;
+	}
+	else
+	{
+		pivacy_ui_io_running = true;
+		pivacy_ui_connected_flag = 1;
+		
+		pthread_cond_broadcast(&pivacy_ui_cond);
 	}
 	
-	return PRV_OK;
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	pthread_mutex_unlock(&pivacy_ui_connect_mutex);
+	
+	return rv;
 }
 
-pivacy_rv pivacy_ui_disconnect(void)
+int pivacy_ui_is_connected(void)
 {
-	if (!pivacy_ui_lib_connected || (pivacy_ui_socket < 0))
+	/* An aligned int is read atomically; no lock or system call needed */
+	return pivacy_ui_connected_flag;
+}
+
+/* Keeps the connection to the UI up */
+static void* pivacy_ui_reconnect_thread_entry(void*)
+{
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	
+	unsigned int seed = (unsigned int) (tv.tv_sec ^ tv.tv_usec ^ getpid());
+	unsigned int delay = RECONNECT_INITIAL_DELAY;
+	bool reported_connected = false;
+	
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	while (!pivacy_ui_reconnect_stop)
 	{
-		return PRV_NOT_CONNECTED;
+		bool connected = pivacy_ui_lib_connected;
+		
+		/* Report changes of the connection state */
+		if (connected != reported_connected)
+		{
+			reported_connected = connected;
+			
+			if (connected)
+			{
+				delay = RECONNECT_INITIAL_DELAY;
+			}
+			
+			if (pivacy_ui_state_cb != NULL)
+			{
+				pivacy_ui_state_callback callback = pivacy_ui_state_cb;
+				void* cb_data = pivacy_ui_state_cb_data;
+				
+				pthread_mutex_unlock(&pivacy_ui_mutex);
+				
+				callback(connected ? 1 : 0, cb_data);
+				
+				pthread_mutex_lock(&pivacy_ui_mutex);
+			}
+			
+			continue;
+		}
+		
+		/* Sleep until the connection is lost */
+		if (connected)
+		{
+			pthread_cond_wait(&pivacy_ui_cond, &pivacy_ui_mutex);
+			
+			continue;
+		}
+		
+		pthread_mutex_unlock(&pivacy_ui_mutex);
+		
+		pivacy_rv rv = pivacy_ui_connect();
+		
+		pthread_mutex_lock(&pivacy_ui_mutex);
+		
+		if ((rv == PRV_OK) || (rv == PRV_ALREADY_CONNECTED))
+		{
+			continue;
+		}
+		
+		/* Wait before the next attempt; shorten the delay randomly so restarts do not synchronise */
+		unsigned int jittered = delay - (unsigned int) (((unsigned long long) delay * RECONNECT_JITTER * (rand_r(&seed) % 1000)) / 100000);
+		
+		gettimeofday(&tv, NULL);
+		
+		unsigned long long deadline_usec = ((unsigned long long) tv.tv_sec * 1000000ULL) + tv.tv_usec + (jittered * 1000ULL);
+		struct timespec deadline;
+		
+		deadline.tv_sec = deadline_usec / 1000000ULL;
+		deadline.tv_nsec = (deadline_usec % 1000000ULL) * 1000;
+		
+		while (!pivacy_ui_reconnect_stop && !pivacy_ui_lib_connected)
+		{
+			if (pthread_cond_timedwait(&pivacy_ui_cond, &pivacy_ui_mutex, &deadline) == ETIMEDOUT)
+			{
+				break;
+			}
+		}
+		
+		delay = ((delay * 2) < RECONNECT_MAX_DELAY) ? (delay * 2) : RECONNECT_MAX_DELAY;
 	}
 	
-	/* Send disconnect command */
-	std::vector<unsigned char> disconnect_cmd;
-	disconnect_cmd.push_back(DISCONNECT);
+	pthread_mutex_unlock(&pivacy_ui_mutex);
 	
-	pivacy_ui_send_to_daemon(disconnect_cmd);
+	return NULL;
+}
+
+pivacy_rv pivacy_ui_auto_connect(pivacy_ui_state_callback callback, void* cb_data)
+{
+	if (!pivacy_ui_lib_initialised)
+	{
+		return PRV_NOT_INITIALISED;
+	}
 	
-	close(pivacy_ui_socket);
-	pivacy_ui_lib_connected = false;
+	if (pivacy_ui_reconnect_running)
+	{
+		return PRV_OK;
+	}
+	
+	pivacy_ui_state_cb = callback;
+	pivacy_ui_state_cb_data = cb_data;
+	pivacy_ui_reconnect_stop = false;
+	
+	if (pthread_create(&pivacy_ui_reconnect_thread, NULL, pivacy_ui_reconnect_thread_entry, NULL) != 0)
+	{
+		return PRV_GENERAL_ERROR;
+	}
+	
+	pivacy_ui_reconnect_running = true;
 	
 	return PRV_OK;
 }
 
-pivacy_rv pivacy_ui_transceive(std::vector<unsigned char>& cmd, std::vector<unsigned char>& resp, bool expectOK = true)
+/* Stop keeping the connection up */
+static void pivacy_ui_stop_reconnect(void)
 {
-	if (!pivacy_ui_lib_connected || (pivacy_ui_socket < 0))
+	if (!pivacy_ui_reconnect_running)
 	{
+		return;
+	}
+	
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	pivacy_ui_reconnect_stop = true;
+	
+	pthread_cond_broadcast(&pivacy_ui_cond);
+	
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	pthread_join(pivacy_ui_reconnect_thread, NULL);
+	
+	pivacy_ui_reconnect_running = false;
+	pivacy_ui_state_cb = NULL;
+	pivacy_ui_state_cb_data = NULL;
+}
+
+pivacy_rv pivacy_ui_disconnect(void)
+{
+	/* Nobody is going to reconnect anymore */
+	pivacy_ui_stop_reconnect();
+	
+	pthread_mutex_lock(&pivacy_ui_connect_mutex);
+	
+	if (!pivacy_ui_io_running)
+	{
+		pthread_mutex_unlock(&pivacy_ui_connect_mutex);
+		
 		return PRV_NOT_CONNECTED;
 	}
 	
-	if (pivacy_ui_send_to_daemon(cmd) != 0)
+	/* Give the I/O thread a chance to send what is queued, then stop it */
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	bool connected = pivacy_ui_lib_connected;
+	
+	pivacy_ui_lib_must_cancel = true;
+	
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	pivacy_ui_wake_io_thread();
+	
+	pthread_join(pivacy_ui_io_thread, NULL);
+	
+	pivacy_ui_io_running = false;
+	
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	if (pivacy_ui_socket >= 0)
 	{
-		close(pivacy_ui_socket);
-		pivacy_ui_socket = -1;
-		pivacy_ui_lib_connected = false;
+		struct timeval timeout = { DISCONNECT_FLUSH_TIMEOUT / 1000, (DISCONNECT_FLUSH_TIMEOUT % 1000) * 1000 };
 		
-		return PRV_DISCONNECTED;
+		setsockopt(pivacy_ui_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		
+		for (std::deque<pivacy_ui_request>::iterator i = pivacy_ui_requests.begin(); i != pivacy_ui_requests.end(); i++)
+		{
+			size_t remaining = i->frame.size() - i->sent;
+			
+			if ((remaining > 0) && (send(pivacy_ui_socket, &i->frame[i->sent], remaining, MSG_NOSIGNAL) != (ssize_t) remaining))
+			{
+				break;
+			}
+		}
+		
+		/* Send disconnect command */
+		unsigned char disconnect_cmd[] = { 0x00, 0x01, DISCONNECT };
+		
+		if (send(pivacy_ui_socket, disconnect_cmd, sizeof(disconnect_cmd), MSG_NOSIGNAL) != sizeof(disconnect_cmd))
+		{
+			/* The UI is gone already */
+		}
 	}
 	
-	if (pivacy_ui_recv_from_daemon(resp) != 0)
+	/* Nobody is going to receive the answers anymore */
+	pivacy_ui_fail_all();
+	
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	pthread_mutex_unlock(&pivacy_ui_connect_mutex);
+	
+	return connected ? PRV_OK : PRV_NOT_CONNECTED;
+}
+
+pivacy_rv pivacy_ui_get_result(pivacy_ui_ticket ticket, pivacy_ui_result* result)
+{
+	if (result == NULL)
 	{
-		close(pivacy_ui_socket);
-		pivacy_ui_socket = -1;
-		pivacy_ui_lib_connected = false;
+		return PRV_PARAM_INVALID;
+	}
+	
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	pivacy_rv rv = PRV_PARAM_INVALID;
+	
+	if (pivacy_ui_outstanding.find(ticket) != pivacy_ui_outstanding.end())
+	{
+		std::map<pivacy_ui_ticket, pivacy_ui_result>::iterator i = pivacy_ui_results.find(ticket);
 		
-		return PRV_DISCONNECTED;
+		if (i == pivacy_ui_results.end())
+		{
+			rv = PRV_PENDING;
+		}
+		else
+		{
+			*result = i->second;
+			
+			pivacy_ui_results.erase(i);
+			pivacy_ui_outstanding.erase(ticket);
+			
+			/* Nothing left to collect */
+			if (pivacy_ui_results.empty())
+			{
+				char c;
+				
+				while (read(pivacy_ui_done_pipe[0], &c, 1) > 0);
+			}
+			
+			rv = PRV_OK;
+		}
 	}
 	
-	if ((resp.size() < 1) || (resp[0] != PIVACY_OK))
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	return rv;
+}
+
+pivacy_rv pivacy_ui_wait(pivacy_ui_ticket ticket, pivacy_ui_result* result)
+{
+	if (result == NULL)
 	{
-		return PRV_PROTO_ERROR;
+		return PRV_PARAM_INVALID;
 	}
 	
-	return PRV_OK;
+	pthread_mutex_lock(&pivacy_ui_mutex);
+	
+	while ((pivacy_ui_outstanding.find(ticket) != pivacy_ui_outstanding.end()) &&
+	       (pivacy_ui_results.find(ticket) == pivacy_ui_results.end()))
+	{
+		pthread_cond_wait(&pivacy_ui_cond, &pivacy_ui_mutex);
+	}
+	
+	pthread_mutex_unlock(&pivacy_ui_mutex);
+	
+	return pivacy_ui_get_result(ticket, result);
+}
+
+int pivacy_ui_completion_fd(void)
+{
+	return pivacy_ui_lib_initialised ? pivacy_ui_done_pipe[0] : -1;
+}
+
+/* Queue a request and wait for the answer */
+static pivacy_rv pivacy_ui_transceive(std::vector<unsigned char>& cmd, pivacy_ui_result& result)
+{
+	pivacy_ui_ticket ticket;
+	pivacy_rv rv = pivacy_ui_submit(cmd, NULL, NULL, true, &ticket);
+	
+	if (rv != PRV_OK)
+	{
+		return rv;
+	}
+	
+	if ((rv = pivacy_ui_wait(ticket, &result)) != PRV_OK)
+	{
+		return rv;
+	}
+	
+	return result.rv;
 }
 
 pivacy_rv pivacy_ui_show_status(unsigned char status)
 {
 	std::vector<unsigned char> show_status_cmd;
-	std::vector<unsigned char> show_status_resp;
+	pivacy_ui_result show_status_result;
+	
+	show_status_cmd.push_back(SHOW_STATUS);
+	show_status_cmd.push_back(status);
+	
+	return pivacy_ui_transceive(show_status_cmd, show_status_result);
+}
+
+pivacy_rv pivacy_ui_show_status_async(unsigned char status)
+{
+	std::vector<unsigned char> show_status_cmd;
 	
 	show_status_cmd.push_back(SHOW_STATUS);
 	show_status_cmd.push_back(status);
 	
-	return pivacy_ui_transceive(show_status_cmd, show_status_resp);
+	return pivacy_ui_submit(show_status_cmd, NULL, NULL, false, NULL);
 }
 
 pivacy_rv pivacy_ui_request_pin(char* pin_buffer, size_t* pin_len)
@@ -333,28 +1041,42 @@ pivacy_rv pivacy_ui_request_pin(char* pin_buffer, size_t* pin_len)
 	}
 	
 	std::vector<unsigned char> request_pin_cmd;
-	std::vector<unsigned char> request_pin_rsp;
+	pivacy_ui_result request_pin_result;
 	
 	request_pin_cmd.push_back(REQUEST_PIN);
 	
 	pivacy_rv rv;
 	
-	if ((rv = pivacy_ui_transceive(request_pin_cmd, request_pin_rsp)) != PRV_OK)
+	if ((rv = pivacy_ui_transceive(request_pin_cmd, request_pin_result)) != PRV_OK)
 	{
 		return rv;
 	}
 	
-	if (*pin_len < (request_pin_rsp.size() - 1))
+	if (*pin_len < request_pin_result.pin_len)
 	{
 		return PRV_BUFFER_TOO_SMALL;
 	}
 	
-	*pin_len = request_pin_rsp.size() - 1;
-	memcpy(pin_buffer, &request_pin_rsp[1], request_pin_rsp.size() - 1);
+	*pin_len = request_pin_result.pin_len;
+	memcpy(pin_buffer, request_pin_result.pin, request_pin_result.pin_len);
 	
 	return PRV_OK;
 }
 
+pivacy_rv pivacy_ui_request_pin_async(pivacy_ui_callback callback, void* cb_data, pivacy_ui_ticket* ticket)
+{
+	if ((callback == NULL) && (ticket == NULL))
+	{
+		return PRV_PARAM_INVALID;
+	}
+	
+	std::vector<unsigned char> request_pin_cmd;
+	
+	request_pin_cmd.push_back(REQUEST_PIN);
+	
+	return pivacy_ui_submit(request_pin_cmd, callback, cb_data, (callback == NULL), ticket);
+}
+
 // WARNING: strlen(str) must be less than 256
 void append_string_to_vector(std::vector<unsigned char>& vec, const char* str)
 {
@@ -364,9 +1086,10 @@ void append_string_to_vector(std::vector<unsigned char>& vec, const char* str)
 	memcpy(&vec[pos], str, strlen(str));
 }
 
-pivacy_rv pivacy_ui_consent(const char* rp_name, const char** attributes, size_t num_attrs, int show_always, int* consent_result)
+/* Build a consent request */
+static pivacy_rv pivacy_ui_build_consent(const char* rp_name, const char** attributes, size_t num_attrs, int show_always, std::vector<unsigned char>& consent_cmd)
 {
-	if ((rp_name == NULL) || ((attributes == NULL) && (num_attrs != 0)) || (consent_result == NULL) || (strlen(rp_name) > 255))
+	if ((rp_name == NULL) || ((attributes == NULL) && (num_attrs != 0)) || (strlen(rp_name) > 255))
 	{
 		return PRV_PARAM_INVALID;
 	}
@@ -380,9 +1103,6 @@ pivacy_rv pivacy_ui_consent(const char* rp_name, const char** attributes, size_t
 		}
 	}
 	
-	std::vector<unsigned char> consent_cmd;
-	std::vector<unsigned char> consent_rsp;
-	
 	consent_cmd.push_back(REQUEST_CONSENT);
 	
 	if (show_always)
@@ -401,23 +1121,55 @@ pivacy_rv pivacy_ui_consent(const char* rp_name, const char** attributes, size_t
 		append_string_to_vector(consent_cmd, attributes[i]);
 	}
 	
+	return PRV_OK;
+}
+
+pivacy_rv pivacy_ui_consent(const char* rp_name, const char** attributes, size_t num_attrs, int show_always, int* consent_result)
+{
+	if (consent_result == NULL)
+	{
+		return PRV_PARAM_INVALID;
+	}
+	
+	std::vector<unsigned char> consent_cmd;
+	pivacy_ui_result consent_rsp;
+	
 	pivacy_rv rv;
 	
-	if ((rv = pivacy_ui_transceive(consent_cmd, consent_rsp)) != PRV_OK)
+	if ((rv = pivacy_ui_build_consent(rp_name, attributes, num_attrs, show_always, consent_cmd)) != PRV_OK)
 	{
 		return rv;
 	}
 	
-	if (consent_rsp.size() != 2)
+	if ((rv = pivacy_ui_transceive(consent_cmd, consent_rsp)) != PRV_OK)
 	{
-		return PRV_PROTO_ERROR;
+		return rv;
 	}
 	
-	*consent_result = consent_rsp[1];
+	*consent_result = consent_rsp.consent_result;
 	
 	return PRV_OK;
 }
 
+pivacy_rv pivacy_ui_consent_async(const char* rp_name, const char** attributes, size_t num_attrs, int show_always, pivacy_ui_callback callback, void* cb_data, pivacy_ui_ticket* ticket)
+{
+	if ((callback == NULL) && (ticket == NULL))
+	{
+		return PRV_PARAM_INVALID;
+	}
+	
+	std::vector<unsigned char> consent_cmd;
+	
+	pivacy_rv rv;
+	
+	if ((rv = pivacy_ui_build_consent(rp_name, attributes, num_attrs, show_always, consent_cmd)) != PRV_OK)
+	{
+		return rv;
+	}
+	
+	return pivacy_ui_submit(consent_cmd, callback, cb_data, (callback == NULL), ticket);
+}
+
 pivacy_rv pivacy_ui_message(const char* msg)
 {
 	if (msg == NULL)
@@ -426,12 +1178,29 @@ pivacy_rv pivacy_ui_message(const char* msg)
 	}
 	
 	std::vector<unsigned char> show_msg_cmd;
-	std::vector<unsigned char> show_msg_rsp;
+	pivacy_ui_result show_msg_result;
+	
+	show_msg_cmd.resize(strlen(msg) + 1);
+	
+	show_msg_cmd[0] = SHOW_MESSAGE;
+	memcpy(&show_msg_cmd[1], msg, strlen(msg));
+	
+	return pivacy_ui_transceive(show_msg_cmd, show_msg_result);
+}
+
+pivacy_rv pivacy_ui_message_async(const char* msg)
+{
+	if (msg == NULL)
+	{
+		return PRV_PARAM_INVALID;
+	}
+	
+	std::vector<unsigned char> show_msg_cmd;
 	
 	show_msg_cmd.resize(strlen(msg) + 1);
 	
 	show_msg_cmd[0] = SHOW_MESSAGE;
 	memcpy(&show_msg_cmd[1], msg, strlen(msg));
 	
-	return pivacy_ui_transceive(show_msg_cmd, show_msg_rsp);
+	return pivacy_ui_submit(show_msg_cmd, NULL, NULL, false, NULL);
 }
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
 
 int main(int argc, char* argv[])
 {
@@ -150,6 +151,38 @@ int main(int argc, char* argv[])
 		break;
 	}
 	
+	/* Try the asynchronous interface; the status update does not wait for the UI */
+	pivacy_ui_ticket ticket;
+	pivacy_ui_result result;
+	
+	if (((rv = pivacy_ui_show_status_async(PIVACY_STATE_PRESENT)) != PRV_OK) ||
+	    ((rv = pivacy_ui_consent_async("Coffeeshop Weedrook", attrs, 1, 0, NULL, NULL, &ticket)) != PRV_OK))
+	{
+		fprintf(stderr, "Failed to queue asynchronous requests (0x%08X)\n", (unsigned int) rv);
+		
+		return -1;
+	}
+	
+	printf("Waiting for asynchronous consent (ticket %lu)... ", ticket);
+	fflush(stdout);
+	
+	/* A real client would poll the completion descriptor in its event loop */
+	struct pollfd completion = { pivacy_ui_completion_fd(), POLLIN, 0 };
+	
+	while ((rv = pivacy_ui_get_result(ticket, &result)) == PRV_PENDING)
+	{
+		poll(&completion, 1, -1);
+	}
+	
+	if ((rv != PRV_OK) || (result.rv != PRV_OK))
+	{
+		fprintf(stderr, "Asynchronous consent failed (0x%08X)\n", (unsigned int) ((rv != PRV_OK) ? rv : result.rv));
+		
+		return -1;
+	}
+	
+	printf("%s\n", (result.consent_result == PIVACY_CONSENT_NO) ? "REFUSE" : "OK");
+	
 	/* Disconnect from the daemon */
 	pivacy_ui_disconnect();
 	